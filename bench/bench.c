@@ -0,0 +1,105 @@
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// glibc's allocator entry points, used by the counting replacements below
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void __libc_free(void* pointer);
+
+static BenchAllocs alloc_counters;
+
+void* malloc(size_t size) {
+    __atomic_fetch_add(&alloc_counters.calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_counters.bytes, size, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&alloc_counters.calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_counters.bytes, count * size, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    __atomic_fetch_add(&alloc_counters.calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_counters.bytes, size, __ATOMIC_RELAXED);
+    return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer) {
+    if (pointer) {
+        __atomic_fetch_add(&alloc_counters.frees, 1, __ATOMIC_RELAXED);
+    }
+    __libc_free(pointer);
+}
+
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void bench_allocs(BenchAllocs* allocs) {
+    allocs->calls = __atomic_load_n(&alloc_counters.calls, __ATOMIC_RELAXED);
+    allocs->frees = __atomic_load_n(&alloc_counters.frees, __ATOMIC_RELAXED);
+    allocs->bytes = __atomic_load_n(&alloc_counters.bytes, __ATOMIC_RELAXED);
+}
+
+uint64_t bench_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+void bench_phase_begin(BenchPhase* phase, const char* name, size_t capacity) {
+    memset(phase, 0, sizeof(*phase));
+    phase->name = name;
+    phase->samples = malloc((capacity > 0 ? capacity : 1) * sizeof(uint64_t));
+    phase->capacity = phase->samples ? capacity : 0;
+    bench_allocs(&phase->allocs);
+    phase->begin_ns = bench_now_ns();
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t left = *(const uint64_t*)a;
+    uint64_t right = *(const uint64_t*)b;
+    return left < right ? -1 : left > right;
+}
+
+// Nearest-rank percentile of sorted samples, in microseconds
+static double percentile_us(const uint64_t* sorted, size_t count, double p) {
+    if (count == 0) {
+        return 0.0;
+    }
+    size_t rank = (size_t)(p / 100.0 * (double)count + 0.5);
+    rank = rank > 0 ? rank - 1 : 0;
+    return sorted[rank < count ? rank : count - 1] / 1e3;
+}
+
+void bench_phase_end(BenchPhase* phase) {
+    uint64_t wall_ns = bench_now_ns() - phase->begin_ns;
+    BenchAllocs now;
+    bench_allocs(&now);
+
+    qsort(phase->samples, phase->count, sizeof(uint64_t), compare_u64);
+    printf("%-20s %7zu ops %9.1f ms  p50 %9.2f  p90 %9.2f  p99 %9.2f  max %9.2f us"
+           "  %8llu allocs %8llu frees %10.1f KB\n",
+           phase->name, phase->count, wall_ns / 1e6,
+           percentile_us(phase->samples, phase->count, 50.0),
+           percentile_us(phase->samples, phase->count, 90.0),
+           percentile_us(phase->samples, phase->count, 99.0),
+           percentile_us(phase->samples, phase->count, 100.0),
+           (unsigned long long)(now.calls - phase->allocs.calls),
+           (unsigned long long)(now.frees - phase->allocs.frees),
+           (now.bytes - phase->allocs.bytes) / 1024.0);
+    fflush(stdout);
+
+    free(phase->samples);
+    phase->samples = NULL;
+}
@@ -0,0 +1,46 @@
+#ifndef PROMPTOS_BENCH_H
+#define PROMPTOS_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared helpers for the host benchmarks (bench.c)
+//
+// A phase times a batch of operations one by one and prints latency
+// percentiles together with the heap allocations made while it ran.
+// bench.c replaces malloc, calloc and realloc to count allocations, so
+// every benchmark linked with it is counted, libc-internal calls included.
+
+typedef struct {
+    uint64_t calls;             // malloc, calloc and realloc
+    uint64_t frees;
+    uint64_t bytes;             // Requested, not resident
+} BenchAllocs;
+
+typedef struct {
+    const char* name;
+    uint64_t* samples;          // Nanoseconds per operation
+    size_t count;
+    size_t capacity;
+    uint64_t begin_ns;
+    BenchAllocs allocs;         // Counters when the phase began
+} BenchPhase;
+
+uint64_t bench_now_ns(void);
+void bench_allocs(BenchAllocs* allocs);
+
+// Deterministic xorshift generator so runs are comparable
+uint64_t bench_random(uint64_t* state);
+
+// Sample storage is allocated before the allocation counters are read
+void bench_phase_begin(BenchPhase* phase, const char* name, size_t capacity);
+void bench_phase_end(BenchPhase* phase);
+
+// Record one operation that started at `begin_ns`
+static inline void bench_phase_sample(BenchPhase* phase, uint64_t begin_ns) {
+    if (phase->count < phase->capacity) {
+        phase->samples[phase->count++] = bench_now_ns() - begin_ns;
+    }
+}
+
+#endif // PROMPTOS_BENCH_H
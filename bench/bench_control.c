@@ -0,0 +1,346 @@
+// Control socket load generator
+//
+// Forks a supervisor that registers BENCH_SERVICES services, starts
+// BENCH_RUNNING of them and serves the control socket from init.c's event
+// loop. The parent first checks the protocol: status of every service,
+// unknown names, stop and start, a malformed request, replies to
+// pipelined requests coming back in order, and more replies than the
+// socket buffers hold. It then measures requests per
+// second one round trip at a time, pipelined BENCH_DEPTH deep, as
+// whole-table status batches and from BENCH_CLIENTS connections at once.
+// Exits non-zero if a check fails or pipelined status requests stay
+// under BENCH_MIN_RPS.
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "../system/libs/control.h"
+
+#define BENCH_SERVICES 200
+#define BENCH_RUNNING 4
+#define BENCH_ROUND_TRIPS 20000
+#define BENCH_PIPELINED 400000
+#define BENCH_DEPTH 64
+#define BENCH_BATCHES 5000
+#define BENCH_CLIENTS 4
+#define BENCH_MIN_RPS 10000
+
+// init.c has no header
+bool clear_services(void);
+bool supervisor_init(void);
+bool register_service(const char* name, const char* exec_path, bool autostart, int priority);
+bool start_service(const char* name);
+bool control_open(const char* path);
+bool supervise(void);
+
+static char root[] = "/tmp/promptos-control-XXXXXX";
+static char socket_path[256];
+static char names[BENCH_SERVICES][32];
+
+// The supervisor: returns once SIGUSR1 has stopped everything
+static int serve(const char* script) {
+    if (!clear_services() || !supervisor_init()) {
+        return 1;
+    }
+    for (int i = 0; i < BENCH_SERVICES; i++) {
+        if (!register_service(names[i], script, false, 50) || (i < BENCH_RUNNING && !start_service(names[i]))) {
+            return 1;
+        }
+    }
+    if (!control_open(socket_path)) {
+        perror(socket_path);
+        return 1;
+    }
+    return supervise() ? 0 : 1;
+}
+
+static bool connect_retry(ControlClient* client) {
+    for (int attempt = 0; attempt < 200; attempt++) {
+        if (control_client_open(client, socket_path)) {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+// One request and its reply
+static bool call(ControlClient* client, ControlOp op, const char* const* request_names, uint32_t count,
+                 ControlHeader* reply, const uint8_t** body) {
+    static uint8_t request[CONTROL_MAX_REQUEST];
+    size_t size = control_encode_request(request, sizeof(request), 7, op, request_names, count);
+    return size > 0 && control_send(client, request, size) && control_receive(client, reply, body) &&
+           reply->tag == 7 && reply->op == op;
+}
+
+static bool record_at(const ControlHeader* reply, const uint8_t* body, uint32_t index, ControlRecord* record,
+                      char* name) {
+    size_t offset = 0;
+    const char* text = NULL;
+    for (uint32_t i = 0; i <= index; i++) {
+        if (!control_next_record(body, reply->length, &offset, record, &text)) {
+            return false;
+        }
+    }
+    memcpy(name, text, record->name_length);
+    name[record->name_length] = '\0';
+    return true;
+}
+
+static bool service_state(ControlClient* client, const char* service, ControlRecord* record) {
+    ControlHeader reply;
+    const uint8_t* body;
+    char name[CONTROL_MAX_NAME + 1];
+    return call(client, CONTROL_OP_STATUS, &service, 1, &reply, &body) && reply.count == 1 &&
+           record_at(&reply, body, 0, record, name);
+}
+
+static bool check_protocol(ControlClient* client) {
+    ControlHeader reply;
+    const uint8_t* body;
+    ControlRecord record;
+    char name[CONTROL_MAX_NAME + 1];
+
+    // The whole table, in registration order
+    bool ok = call(client, CONTROL_OP_STATUS, NULL, 0, &reply, &body) && reply.count == BENCH_SERVICES;
+    int running = 0;
+    for (uint32_t i = 0; ok && i < reply.count; i++) {
+        ok = record_at(&reply, body, i, &record, name) && strcmp(name, names[i]) == 0 &&
+             record.result == CONTROL_OK;
+        running += record.state == CONTROL_STATE_RUNNING && record.pid > 0;
+    }
+    ok = ok && running == BENCH_RUNNING;
+    if (!ok) {
+        printf("status of all services: WRONG\n");
+        return false;
+    }
+
+    const char* lookups[] = { names[7], "no-such-service" };
+    ok = call(client, CONTROL_OP_STATUS, lookups, 2, &reply, &body) && reply.count == 2 &&
+         record_at(&reply, body, 0, &record, name) && record.state == CONTROL_STATE_STOPPED &&
+         record.result == CONTROL_OK && record_at(&reply, body, 1, &record, name) &&
+         record.result == CONTROL_UNKNOWN_SERVICE && strcmp(name, "no-such-service") == 0;
+    if (!ok) {
+        printf("status by name: WRONG\n");
+        return false;
+    }
+
+    // Stop a running service; it cannot start again until its exit is reaped
+    const char* target = names[0];
+    int old_pid = 0;
+    ok = service_state(client, target, &record) && (old_pid = record.pid) > 0 &&
+         call(client, CONTROL_OP_STOP, &target, 1, &reply, &body) && record_at(&reply, body, 0, &record, name) &&
+         record.result == CONTROL_OK;
+    for (int wait = 0; ok && record.state != CONTROL_STATE_STOPPED && wait < 500; wait++) {
+        usleep(2000);
+        ok = service_state(client, target, &record);
+    }
+    ok = ok && record.state == CONTROL_STATE_STOPPED && call(client, CONTROL_OP_START, &target, 1, &reply, &body) &&
+         record_at(&reply, body, 0, &record, name) && record.result == CONTROL_OK &&
+         record.state == CONTROL_STATE_RUNNING && record.pid > 0 && record.pid != old_pid &&
+         call(client, CONTROL_OP_START, &target, 1, &reply, &body) && record_at(&reply, body, 0, &record, name) &&
+         record.result == CONTROL_REFUSED;
+    if (!ok) {
+        printf("stop and start: WRONG\n");
+        return false;
+    }
+
+    // An unknown op is refused as a whole; the connection stays usable
+    ok = call(client, (ControlOp)99, NULL, 0, &reply, &body) && reply.result == CONTROL_BAD_REQUEST &&
+         reply.count == 0 && service_state(client, names[1], &record);
+    if (!ok) {
+        printf("bad request: WRONG\n");
+        return false;
+    }
+
+    // Pipelined replies come back in request order
+    static uint8_t requests[1000 * 64];
+    size_t size = 0;
+    for (uint32_t i = 0; i < 1000; i++) {
+        const char* name_i = names[i % BENCH_SERVICES];
+        size += control_encode_request(requests + size, sizeof(requests) - size, i, CONTROL_OP_STATUS, &name_i, 1);
+    }
+    ok = control_send(client, requests, size);
+    for (uint32_t i = 0; ok && i < 1000; i++) {
+        ok = control_receive(client, &reply, &body) && reply.tag == i && reply.count == 1 &&
+             record_at(&reply, body, 0, &record, name) && strcmp(name, names[i % BENCH_SERVICES]) == 0;
+    }
+    if (!ok) {
+        printf("pipelined order: WRONG\n");
+        return false;
+    }
+
+    // More whole-table replies than the socket buffers: init keeps what
+    // the socket does not take and stops reading until it is taken
+    size = 0;
+    for (uint32_t i = 0; i < 1000; i++) {
+        size += control_encode_request(requests + size, sizeof(requests) - size, i, CONTROL_OP_STATUS, NULL, 0);
+    }
+    ok = control_send(client, requests, size);
+    for (uint32_t i = 0; ok && i < 1000; i++) {
+        ok = control_receive(client, &reply, &body) && reply.tag == i && reply.count == BENCH_SERVICES &&
+             record_at(&reply, body, BENCH_SERVICES - 1, &record, name) &&
+             strcmp(name, names[BENCH_SERVICES - 1]) == 0;
+    }
+    if (!ok) {
+        printf("backpressure: WRONG\n");
+    }
+    return ok;
+}
+
+// BENCH_DEPTH single-service status requests, encoded once
+static size_t encode_window(uint8_t* out, size_t size, int first) {
+    size_t used = 0;
+    for (int i = 0; i < BENCH_DEPTH; i++) {
+        const char* name = names[(first + i) % BENCH_SERVICES];
+        used += control_encode_request(out + used, size - used, (uint32_t)i, CONTROL_OP_STATUS, &name, 1);
+    }
+    return used;
+}
+
+// Send `total` requests BENCH_DEPTH at a time; each window is written
+// before any of its replies is read
+static bool run_pipelined(ControlClient* client, int total, int first) {
+    uint8_t window[BENCH_DEPTH * 64];
+    size_t size = encode_window(window, sizeof(window), first);
+    ControlHeader reply;
+    const uint8_t* body;
+    bool ok = true;
+    for (int sent = 0; ok && sent < total; sent += BENCH_DEPTH) {
+        ok = control_send(client, window, size);
+        for (int i = 0; ok && i < BENCH_DEPTH; i++) {
+            ok = control_receive(client, &reply, &body) && reply.count == 1 && reply.tag == (uint32_t)i;
+        }
+    }
+    return ok;
+}
+
+typedef struct {
+    int index;
+    bool ok;
+} ClientThread;
+
+static void* client_thread(void* arg) {
+    ClientThread* thread = arg;
+    ControlClient client;
+    thread->ok = connect_retry(&client) &&
+                 run_pipelined(&client, BENCH_PIPELINED / BENCH_CLIENTS, thread->index * 17);
+    control_client_close(&client);
+    return NULL;
+}
+
+static void report_rate(const char* label, int requests, uint64_t elapsed_ns) {
+    printf("%-34s %8d requests in %7.1f ms: %9.0f requests/s\n", label, requests, elapsed_ns / 1e6,
+           requests / (elapsed_ns / 1e9));
+}
+
+int main(void) {
+    if (!mkdtemp(root)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char script[256];
+    snprintf(script, sizeof(script), "%s/service.sh", root);
+    snprintf(socket_path, sizeof(socket_path), "%s/control.sock", root);
+    FILE* file = fopen(script, "w");
+    if (!file) {
+        perror(script);
+        return 1;
+    }
+    fprintf(file, "#!/bin/sh\nexec sleep 1000\n");
+    fclose(file);
+    chmod(script, 0755);
+    for (int i = 0; i < BENCH_SERVICES; i++) {
+        snprintf(names[i], sizeof(names[i]), "svc-%03d", i);
+    }
+
+    pid_t server = fork();
+    if (server == 0) {
+        _exit(serve(script));
+    }
+    ControlClient client;
+    if (server < 0 || !connect_retry(&client)) {
+        fprintf(stderr, "bench: no control socket at %s\n", socket_path);
+        return 1;
+    }
+    printf("%d services, %d running\n", BENCH_SERVICES, BENCH_RUNNING);
+    bool protocol_ok = check_protocol(&client);
+
+    // One request per round trip
+    ControlHeader reply;
+    const uint8_t* body;
+    bool ok = protocol_ok;
+    BenchPhase phase;
+    bench_phase_begin(&phase, "status, one round trip each", BENCH_ROUND_TRIPS);
+    uint64_t begin = bench_now_ns();
+    for (int i = 0; ok && i < BENCH_ROUND_TRIPS; i++) {
+        const char* name = names[i % BENCH_SERVICES];
+        uint64_t sample = bench_now_ns();
+        ok = call(&client, CONTROL_OP_STATUS, &name, 1, &reply, &body);
+        bench_phase_sample(&phase, sample);
+    }
+    uint64_t round_trip_ns = bench_now_ns() - begin;
+    bench_phase_end(&phase);
+    report_rate("status, one round trip each", BENCH_ROUND_TRIPS, round_trip_ns);
+
+    begin = bench_now_ns();
+    ok = ok && run_pipelined(&client, BENCH_PIPELINED, 0);
+    uint64_t pipelined_ns = bench_now_ns() - begin;
+    char label[64];
+    snprintf(label, sizeof(label), "status, pipelined %d deep", BENCH_DEPTH);
+    report_rate(label, BENCH_PIPELINED, pipelined_ns);
+
+    begin = bench_now_ns();
+    for (int i = 0; ok && i < BENCH_BATCHES; i++) {
+        ok = call(&client, CONTROL_OP_STATUS, NULL, 0, &reply, &body) && reply.count == BENCH_SERVICES;
+    }
+    uint64_t batch_ns = bench_now_ns() - begin;
+    report_rate("status of all services", BENCH_BATCHES, batch_ns);
+    printf("  %.0f service states/s, %u bytes per reply\n",
+           (double)BENCH_BATCHES * BENCH_SERVICES / (batch_ns / 1e9), (unsigned)(sizeof(reply) + reply.length));
+
+    // Several connections served by the one event loop
+    pthread_t threads[BENCH_CLIENTS];
+    ClientThread state[BENCH_CLIENTS];
+    bool started[BENCH_CLIENTS];
+    begin = bench_now_ns();
+    for (int i = 0; i < BENCH_CLIENTS; i++) {
+        state[i].index = i;
+        state[i].ok = false;
+        started[i] = pthread_create(&threads[i], NULL, client_thread, &state[i]) == 0;
+        if (!started[i]) {
+            client_thread(&state[i]);
+        }
+    }
+    for (int i = 0; i < BENCH_CLIENTS; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        ok &= state[i].ok;
+    }
+    snprintf(label, sizeof(label), "status, %d clients pipelined", BENCH_CLIENTS);
+    report_rate(label, BENCH_PIPELINED / BENCH_CLIENTS * BENCH_CLIENTS, bench_now_ns() - begin);
+    control_client_close(&client);
+
+    // SIGUSR1 makes the supervisor stop its services and return
+    int status = 0;
+    kill(server, SIGUSR1);
+    bool stopped = waitpid(server, &status, 0) == server && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    double pipelined_rps = BENCH_PIPELINED / (pipelined_ns / 1e9);
+    bool fast = pipelined_rps >= BENCH_MIN_RPS;
+
+    printf("protocol: %s, load: %s, pipelined over %d requests/s: %s, clean shutdown: %s\n",
+           protocol_ok ? "ok" : "WRONG", ok ? "ok" : "WRONG", BENCH_MIN_RPS, fast ? "ok" : "WRONG",
+           stopped ? "ok" : "WRONG");
+    unlink(script);
+    rmdir(root);
+    return protocol_ok && ok && fast && stopped ? 0 : 1;
+}
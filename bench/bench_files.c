@@ -0,0 +1,192 @@
+// File-ownership index benchmark
+//
+// Commits BENCH_PACKAGES packages of BENCH_FILES files each to a fresh
+// index, one package at a time as installs do, then merges the log into
+// the table. It times commits, owner lookups (hits, misses and paths that
+// only the log knows) and conflict checks, and prints the table size
+// against the raw path bytes. The owners are checked after reopening the
+// index from disk, after removing a package and after a second merge, and
+// a package that reuses another's file must be caught. Exits non-zero if
+// any check fails.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bench.h"
+#include "../packages/package_files.h"
+
+#define BENCH_PACKAGES 500
+#define BENCH_FILES 200
+#define BENCH_LOOKUPS 200000
+#define BENCH_DIR "/tmp/promptos-bench-files"
+
+static PackageManifest manifests[BENCH_PACKAGES];
+
+static void package_name(int package, char* name, size_t size) {
+    snprintf(name, size, "pkg-%03d", package);
+}
+
+// A package spreads its files over a few directories other packages use too
+static bool build_manifest(int package, PackageManifest* manifest) {
+    char name[32], path[256];
+    package_name(package, name, sizeof(name));
+    package_manifest_init(manifest, name, "1.0");
+    bool ok = true;
+    for (int f = 0; ok && f < BENCH_FILES; f++) {
+        switch (f % 4) {
+        case 0:
+            snprintf(path, sizeof(path), "bin/%s-tool-%03d", name, f);
+            break;
+        case 1:
+            snprintf(path, sizeof(path), "lib/%s/plugins/module-%03d.so", name, f);
+            break;
+        case 2:
+            snprintf(path, sizeof(path), "share/doc/%s/chapter-%03d.html", name, f);
+            break;
+        default:
+            snprintf(path, sizeof(path), "share/locale/lang-%02d/LC_MESSAGES/%s.mo", f / 4, name);
+            break;
+        }
+        ok = package_manifest_add(manifest, STORE_FILE_REGULAR, path, NULL, 0644);
+    }
+    return ok && package_manifest_add(manifest, STORE_FILE_DIRECTORY, "share/doc", NULL, 0755);
+}
+
+// Every file of every package resolves to its owner; `removed` to nobody
+static bool check_owners(const PackageFiles* files, int removed) {
+    char key[PATH_MAX];
+    for (int p = 0; p < BENCH_PACKAGES; p++) {
+        for (uint32_t i = 0; i < manifests[p].file_count; i++) {
+            if (manifests[p].files[i].type == STORE_FILE_DIRECTORY) {
+                continue;
+            }
+            package_files_key("/usr", manifests[p].files[i].path, key, sizeof(key));
+            const char* owner = package_files_owner(files, key);
+            if (p == removed ? owner != NULL : !owner || strcmp(owner, manifests[p].name) != 0) {
+                printf("wrong owner for %s: %s\n", key, owner ? owner : "(none)");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void random_key(uint64_t* random_state, char* key, size_t size) {
+    int package = (int)(bench_random(random_state) % BENCH_PACKAGES);
+    int file = (int)(bench_random(random_state) % BENCH_FILES);
+    package_files_key("/usr", manifests[package].files[file].path, key, size);
+}
+
+static void time_lookups(const PackageFiles* files, const char* label, bool miss) {
+    uint64_t random_state = 0x9e3779b97f4a7c15ULL;
+    char key[PATH_MAX];
+    int found = 0;
+    BenchPhase phase;
+    bench_phase_begin(&phase, label, BENCH_LOOKUPS);
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        random_key(&random_state, key, sizeof(key));
+        if (miss) {
+            strcat(key, ".orig");
+        }
+        uint64_t begin = bench_now_ns();
+        found += package_files_owner(files, key) != NULL;
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+    printf("  %d of %d found\n", found, BENCH_LOOKUPS);
+}
+
+int main(void) {
+    if (system("rm -rf " BENCH_DIR) != 0 || mkdir(BENCH_DIR, 0755) < 0) {
+        perror(BENCH_DIR);
+        return 1;
+    }
+    size_t path_bytes = 0;
+    for (int p = 0; p < BENCH_PACKAGES; p++) {
+        if (!build_manifest(p, &manifests[p])) {
+            return 1;
+        }
+        for (uint32_t i = 0; i < manifests[p].file_count; i++) {
+            path_bytes += strlen("/usr/") + strlen(manifests[p].files[i].path) + 1;
+        }
+    }
+    printf("%d packages of %d files\n", BENCH_PACKAGES, BENCH_FILES);
+
+    PackageFiles files;
+    if (!package_files_open(&files, BENCH_DIR "/files")) {
+        fprintf(stderr, "bench: cannot open index\n");
+        return 1;
+    }
+
+    // Installs: check, then commit, one package at a time
+    BenchPhase phase;
+    char conflict[PATH_MAX];
+    const char* owner = NULL;
+    bool ok = true;
+    bench_phase_begin(&phase, "check + commit (per package)", BENCH_PACKAGES);
+    for (int p = 0; p < BENCH_PACKAGES; p++) {
+        uint64_t begin = bench_now_ns();
+        ok &= package_files_check(&files, manifests[p].name, "/usr", &manifests[p], conflict, sizeof(conflict), &owner) &&
+              package_files_commit(&files, manifests[p].name, "usr", NULL, &manifests[p]);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+
+    uint64_t begin = bench_now_ns();
+    ok &= package_files_compact(&files);
+    printf("merge: %.1f ms, %u paths in %zu bytes of table (%zu bytes of paths)\n",
+           (bench_now_ns() - begin) / 1e6, package_files_count(&files), files.size, path_bytes);
+
+    time_lookups(&files, "lookup (table hit)", false);
+    time_lookups(&files, "lookup (miss)", true);
+
+    bench_phase_begin(&phase, "conflict check (per package)", BENCH_PACKAGES);
+    for (int p = 0; p < BENCH_PACKAGES; p++) {
+        begin = bench_now_ns();
+        ok &= package_files_check(&files, manifests[p].name, "usr", &manifests[p], conflict, sizeof(conflict), &owner);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+
+    // A newcomer shipping one of pkg-123's plugins must be refused
+    PackageManifest intruder;
+    package_manifest_init(&intruder, "intruder", "1.0");
+    package_manifest_add(&intruder, STORE_FILE_REGULAR, "bin/intruder", NULL, 0755);
+    package_manifest_add(&intruder, STORE_FILE_REGULAR, "lib/pkg-123/plugins/module-005.so", NULL, 0644);
+    bool conflict_ok = !package_files_check(&files, "intruder", "usr/", &intruder, conflict, sizeof(conflict), &owner) &&
+                       strcmp(conflict, "/usr/lib/pkg-123/plugins/module-005.so") == 0 &&
+                       strcmp(owner, "pkg-123") == 0;
+    package_manifest_free(&intruder);
+
+    // Remove one package and upgrade another to a renamed file; both only
+    // in the log until the index is reopened and merged again
+    ok &= package_files_commit(&files, "pkg-042", "usr", &manifests[42], NULL);
+    PackageManifest renamed;
+    package_manifest_init(&renamed, "pkg-007", "2.0");
+    package_manifest_add(&renamed, STORE_FILE_REGULAR, "bin/pkg-007-renamed", NULL, 0755);
+    ok &= package_files_commit(&files, "pkg-007", "usr", &manifests[7], &renamed);
+    time_lookups(&files, "lookup (table and log)", false);
+    const char* renamed_owner = package_files_owner(&files, "/usr/bin/pkg-007-renamed");
+    bool log_ok = renamed_owner && strcmp(renamed_owner, "pkg-007") == 0 &&
+                  !package_files_owner(&files, "/usr/bin/pkg-007-tool-000");
+    package_files_close(&files);
+
+    // Reopen: the log is replayed over the table, then merged into it
+    package_manifest_free(&manifests[7]);
+    manifests[7] = renamed;
+    bool reopen_ok = package_files_open(&files, BENCH_DIR "/files") && check_owners(&files, 42);
+    reopen_ok &= package_files_compact(&files) && check_owners(&files, 42) &&
+                 package_files_count(&files) == (BENCH_PACKAGES - 2) * BENCH_FILES + 1;
+    package_files_close(&files);
+
+    printf("owners after reopen and merge: %s, conflict caught: %s, log overlay: %s\n",
+           reopen_ok ? "ok" : "WRONG", conflict_ok ? "ok" : "WRONG", log_ok ? "ok" : "WRONG");
+    for (int p = 0; p < BENCH_PACKAGES; p++) {
+        package_manifest_free(&manifests[p]);
+    }
+    system("rm -rf " BENCH_DIR);
+    return ok && reopen_ok && conflict_ok && log_ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+// Kernel init table benchmark
+//
+// Runs init tables of mock phases that sleep for a configurable time, as
+// device probing or a mount waiting on I/O would. It compares one worker
+// with the kernel's worker count on the kernel's own phase layout and on
+// a wide random table. It also checks that failures skip exactly the
+// dependent phases and that cyclic tables are rejected without running.
+// Exits non-zero if the framework misbehaves.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+#include "../kernel/config.h"
+#include "../kernel/init_table.h"
+
+#define BENCH_RUNS 10
+#define BENCH_WIDE_PHASES 32
+#define BENCH_WIDE_LATENCY_US 1000
+
+bool kernel_init(void);
+void kernel_init_report(char* buffer, size_t size);
+
+typedef struct {
+    int latency_us;
+    bool fail;
+    int runs;
+} MockPhase;
+
+static bool mock_run(void* context) {
+    MockPhase* mock = context;
+    struct timespec delay = { mock->latency_us / 1000000, (mock->latency_us % 1000000) * 1000L };
+    nanosleep(&delay, NULL);
+    __atomic_fetch_add(&mock->runs, 1, __ATOMIC_RELAXED);
+    return !mock->fail;
+}
+
+enum { MEMORY, SCHEDULER, DRIVERS, FILESYSTEM, SYSCALLS, NETWORK, KERNEL_PHASES };
+
+// The kernel's layout plus a phase that needs the drivers
+static MockPhase kernel_mocks[KERNEL_PHASES] = {
+    [MEMORY] = { 5000, false, 0 },
+    [SCHEDULER] = { 2000, false, 0 },
+    [DRIVERS] = { 40000, false, 0 },
+    [FILESYSTEM] = { 30000, false, 0 },
+    [SYSCALLS] = { 3000, false, 0 },
+    [NETWORK] = { 10000, false, 0 }
+};
+
+#define AFTER_CORE (INIT_PHASE_NEEDS(MEMORY) | INIT_PHASE_NEEDS(SCHEDULER))
+static const InitPhase kernel_table[KERNEL_PHASES] = {
+    [MEMORY] = { "memory", mock_run, &kernel_mocks[MEMORY], 0 },
+    [SCHEDULER] = { "scheduler", mock_run, &kernel_mocks[SCHEDULER], INIT_PHASE_NEEDS(MEMORY) },
+    [DRIVERS] = { "drivers", mock_run, &kernel_mocks[DRIVERS], AFTER_CORE },
+    [FILESYSTEM] = { "filesystem", mock_run, &kernel_mocks[FILESYSTEM], AFTER_CORE },
+    [SYSCALLS] = { "syscalls", mock_run, &kernel_mocks[SYSCALLS], AFTER_CORE },
+    [NETWORK] = { "network", mock_run, &kernel_mocks[NETWORK], INIT_PHASE_NEEDS(DRIVERS) }
+};
+
+static void time_table(const char* name, const InitPhase* table, int count, int workers) {
+    InitPhaseResult results[INIT_TABLE_MAX_PHASES];
+    BenchPhase phase;
+    bench_phase_begin(&phase, name, BENCH_RUNS);
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        uint64_t begin = bench_now_ns();
+        init_table_run(table, count, workers, results);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+}
+
+static bool check_failure(void) {
+    InitPhaseResult results[KERNEL_PHASES];
+    char report[2048];
+    for (int i = 0; i < KERNEL_PHASES; i++) {
+        kernel_mocks[i].runs = 0;
+    }
+    kernel_mocks[DRIVERS].fail = true;
+    bool ok = init_table_run(kernel_table, KERNEL_PHASES, KERNEL_INIT_WORKERS, results);
+    kernel_mocks[DRIVERS].fail = false;
+
+    init_table_report(kernel_table, results, KERNEL_PHASES, report, sizeof(report));
+    printf("with failing drivers:\n%s", report);
+    return !ok && results[DRIVERS].state == INIT_PHASE_FAILED &&
+           results[NETWORK].state == INIT_PHASE_SKIPPED && results[NETWORK].blocked_by == DRIVERS &&
+           kernel_mocks[NETWORK].runs == 0 &&
+           results[FILESYSTEM].state == INIT_PHASE_DONE && results[SYSCALLS].state == INIT_PHASE_DONE;
+}
+
+static bool check_cycle(void) {
+    MockPhase mock = { 0, false, 0 };
+    InitPhase table[3] = {
+        { "a", mock_run, &mock, 0 },
+        { "b", mock_run, &mock, INIT_PHASE_NEEDS(0) | INIT_PHASE_NEEDS(2) },
+        { "c", mock_run, &mock, INIT_PHASE_NEEDS(1) }
+    };
+    InitPhaseResult results[3];
+    bool rejected = !init_table_run(table, 3, KERNEL_INIT_WORKERS, results) && mock.runs == 0;
+    table[0].requires = INIT_PHASE_NEEDS(5);    // Outside the table
+    return rejected && !init_table_run(table, 1, KERNEL_INIT_WORKERS, results) && mock.runs == 0;
+}
+
+int main(void) {
+    char report[4096];
+    bool ok = true;
+
+    int serial_us = 0;
+    for (int i = 0; i < KERNEL_PHASES; i++) {
+        serial_us += kernel_mocks[i].latency_us;
+    }
+    printf("kernel layout: %d mock phases, %.1f ms of work\n", KERNEL_PHASES, serial_us / 1e3);
+    time_table("kernel 1 worker", kernel_table, KERNEL_PHASES, 1);
+    time_table("kernel workers", kernel_table, KERNEL_PHASES, KERNEL_INIT_WORKERS);
+
+    InitPhaseResult results[INIT_TABLE_MAX_PHASES];
+    ok &= init_table_run(kernel_table, KERNEL_PHASES, KERNEL_INIT_WORKERS, results);
+    init_table_report(kernel_table, results, KERNEL_PHASES, report, sizeof(report));
+    printf("%s", report);
+
+    // Wide random DAG: each phase needs up to two earlier ones
+    static MockPhase wide_mocks[BENCH_WIDE_PHASES];
+    static InitPhase wide_table[BENCH_WIDE_PHASES];
+    static char names[BENCH_WIDE_PHASES][16];
+    uint64_t random_state = 0x2545f4914f6cdd1dULL;
+    for (int i = 0; i < BENCH_WIDE_PHASES; i++) {
+        snprintf(names[i], sizeof(names[i]), "phase-%02d", i);
+        wide_mocks[i] = (MockPhase){ BENCH_WIDE_LATENCY_US, false, 0 };
+        wide_table[i] = (InitPhase){ names[i], mock_run, &wide_mocks[i], 0 };
+        for (int d = 0; d < 2 && i > 0; d++) {
+            if (bench_random(&random_state) % 3 == 0) {
+                wide_table[i].requires |= INIT_PHASE_NEEDS(bench_random(&random_state) % (uint64_t)i);
+            }
+        }
+    }
+    printf("wide table: %d phases of %.1f ms\n", BENCH_WIDE_PHASES, BENCH_WIDE_LATENCY_US / 1e3);
+    time_table("wide 1 worker", wide_table, BENCH_WIDE_PHASES, 1);
+    time_table("wide workers", wide_table, BENCH_WIDE_PHASES, KERNEL_INIT_WORKERS);
+    time_table("wide 32 workers", wide_table, BENCH_WIDE_PHASES, BENCH_WIDE_PHASES);
+
+    bool failure_ok = check_failure();
+    bool cycle_ok = check_cycle();
+    printf("failure propagation: %s, invalid tables rejected: %s\n",
+           failure_ok ? "ok" : "WRONG", cycle_ok ? "ok" : "WRONG");
+
+    // The real table, with its stub phases
+    ok &= kernel_init();
+    kernel_init_report(report, sizeof(report));
+    printf("kernel_init:\n%s", report);
+
+    return ok && failure_ok && cycle_ok ? 0 : 1;
+}
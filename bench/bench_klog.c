@@ -0,0 +1,212 @@
+// System log ring benchmark and stress test
+//
+// Measures single-writer latency and drain throughput, then runs many
+// writers against one log while a reader drains it. Every stress record
+// carries its writer, sequence number and a check value, plus a string
+// whose length varies with the sequence so records wrap the ring at
+// every offset. The reader verifies each one. Writers retry a record the
+// ring refused, so every record must arrive exactly once and intact;
+// the run fails otherwise.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "bench.h"
+#include "../system/libs/klog.h"
+
+#define BENCH_LOG_NAME "/promptos-klog-bench"
+#define BENCH_WRITES 200000
+#define BENCH_DRAIN_EVERY 512           // Single-writer phase: drain before the ring fills
+#define BENCH_STRESS_WRITERS 8
+#define BENCH_STRESS_RECORDS 250000     // Per writer
+#define BENCH_BATCH 512
+
+static const char text_pattern[] = "abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+static Klog log_ring;
+
+static uint64_t check_value(uint64_t writer, uint64_t sequence) {
+    uint64_t x = (writer << 32 | sequence) * 0x9e3779b97f4a7c15ULL;
+    return x ^ (x >> 29);
+}
+
+static void discard(const KlogRecord* record, void* context) {
+    (void)record;
+    (void)context;
+}
+
+static void format_line(const KlogRecord* record, void* context) {
+    char line[256];
+    *(size_t*)context += klog_format(record, line, sizeof(line));
+}
+
+// ---- Stress ----
+
+typedef struct {
+    uint8_t* seen[BENCH_STRESS_WRITERS];    // Per writer, per sequence
+    uint64_t received;
+    uint64_t duplicates;
+    uint64_t torn;
+} StressReader;
+
+static StressReader stress;
+static uint64_t writer_retries[BENCH_STRESS_WRITERS];
+static bool writers_done = false;
+
+static void verify_record(const KlogRecord* record, void* context) {
+    StressReader* reader = context;
+    reader->received++;
+    if (record->message != KLOG_MSG_STRESS || record->arg_count != 3 ||
+        record->args[0] >= BENCH_STRESS_WRITERS || record->args[1] >= BENCH_STRESS_RECORDS) {
+        reader->torn++;
+        return;
+    }
+    uint64_t writer = record->args[0];
+    uint64_t sequence = record->args[1];
+    size_t text_length = sequence % (sizeof(text_pattern) - 1);
+    if (record->args[2] != check_value(writer, sequence) || record->text_length != text_length ||
+        memcmp(klog_record_text(record), text_pattern, text_length) != 0) {
+        reader->torn++;
+        return;
+    }
+    if (reader->seen[writer][sequence]++) {
+        reader->duplicates++;
+    }
+}
+
+static void* stress_writer(void* arg) {
+    uint64_t writer = (uint64_t)(uintptr_t)arg;
+    char text[sizeof(text_pattern)];
+    for (uint64_t sequence = 0; sequence < BENCH_STRESS_RECORDS; sequence++) {
+        size_t text_length = sequence % (sizeof(text_pattern) - 1);
+        memcpy(text, text_pattern, text_length);
+        text[text_length] = '\0';
+        uint64_t args[3] = { writer, sequence, check_value(writer, sequence) };
+        while (!klog_write(&log_ring, KLOG_INFO, KLOG_SUBSYSTEM_KERNEL, KLOG_MSG_STRESS,
+                           text, 3, args)) {
+            writer_retries[writer]++;   // Ring full: let the reader catch up
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void* stress_reader(void* arg) {
+    (void)arg;
+    for (;;) {
+        bool done = __atomic_load_n(&writers_done, __ATOMIC_ACQUIRE);
+        if (klog_drain(&log_ring, verify_record, &stress, BENCH_BATCH) == 0) {
+            if (done) {
+                return NULL;    // Writers finished before this empty drain
+            }
+            sched_yield();
+        }
+    }
+}
+
+static bool run_stress(void) {
+    pthread_t writers[BENCH_STRESS_WRITERS];
+    pthread_t reader;
+    for (int i = 0; i < BENCH_STRESS_WRITERS; i++) {
+        stress.seen[i] = calloc(BENCH_STRESS_RECORDS, 1);
+        if (!stress.seen[i]) {
+            fprintf(stderr, "bench: out of memory\n");
+            return false;
+        }
+    }
+
+    uint64_t begin = bench_now_ns();
+    pthread_create(&reader, NULL, stress_reader, NULL);
+    for (int i = 0; i < BENCH_STRESS_WRITERS; i++) {
+        pthread_create(&writers[i], NULL, stress_writer, (void*)(uintptr_t)i);
+    }
+    for (int i = 0; i < BENCH_STRESS_WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    __atomic_store_n(&writers_done, true, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+    uint64_t wall_ns = bench_now_ns() - begin;
+
+    uint64_t expected = (uint64_t)BENCH_STRESS_WRITERS * BENCH_STRESS_RECORDS;
+    uint64_t missing = 0, retries = 0;
+    for (int i = 0; i < BENCH_STRESS_WRITERS; i++) {
+        for (int sequence = 0; sequence < BENCH_STRESS_RECORDS; sequence++) {
+            missing += stress.seen[i][sequence] == 0;
+        }
+        retries += writer_retries[i];
+        free(stress.seen[i]);
+    }
+
+    printf("stress: %d writers x %d records in %.1f ms, %.2f M records/s\n",
+           BENCH_STRESS_WRITERS, BENCH_STRESS_RECORDS, wall_ns / 1e6, expected * 1e3 / wall_ns);
+    printf("stress: %llu received, %llu missing, %llu duplicated, %llu torn, "
+           "%llu writes retried on a full ring\n",
+           (unsigned long long)stress.received, (unsigned long long)missing,
+           (unsigned long long)stress.duplicates, (unsigned long long)stress.torn,
+           (unsigned long long)retries);
+    return stress.received == expected && missing == 0 && stress.duplicates == 0 &&
+           stress.torn == 0 && klog_dropped(&log_ring) == retries;
+}
+
+int main(void) {
+    BenchPhase phase;
+    if (!klog_create(&log_ring, BENCH_LOG_NAME)) {
+        fprintf(stderr, "bench: cannot create %s\n", BENCH_LOG_NAME);
+        return 1;
+    }
+    printf("%u rings of %d KB, %zu-byte record header\n",
+           log_ring.page->ring_count, KLOG_RING_SIZE / 1024, sizeof(KlogRecord));
+
+    // One writer, no contention: the cost of a record on the hot path
+    uint64_t args[3] = { 1, 2, 3 };
+    bench_phase_begin(&phase, "write", BENCH_WRITES);
+    for (int i = 0; i < BENCH_WRITES; i++) {
+        if (i % BENCH_DRAIN_EVERY == 0) {
+            klog_drain(&log_ring, discard, NULL, BENCH_DRAIN_EVERY * 2);
+        }
+        uint64_t begin = bench_now_ns();
+        klog_write(&log_ring, KLOG_INFO, KLOG_SUBSYSTEM_SERVICE, KLOG_MSG_SERVICE_STARTED,
+                   "network", 1, args);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+    klog_drain(&log_ring, discard, NULL, BENCH_DRAIN_EVERY * 2);
+
+    // Drain and format full batches, as the syslog service does
+    size_t formatted = 0, bytes = 0;
+    bench_phase_begin(&phase, "drain+format", BENCH_WRITES / BENCH_DRAIN_EVERY);
+    for (int i = 0; i < BENCH_WRITES / BENCH_DRAIN_EVERY; i++) {
+        for (int j = 0; j < BENCH_DRAIN_EVERY; j++) {
+            klog_write(&log_ring, KLOG_INFO, KLOG_SUBSYSTEM_SERVICE, KLOG_MSG_SERVICE_STARTED,
+                       "network", 1, args);
+        }
+        uint64_t begin = bench_now_ns();
+        size_t drained = 0;
+        for (;;) {
+            size_t batch = klog_drain(&log_ring, format_line, &bytes, BENCH_DRAIN_EVERY);
+            if (batch == 0) {
+                break;
+            }
+            drained += batch;
+        }
+        bench_phase_sample(&phase, begin);
+        formatted += drained;
+    }
+    bench_phase_end(&phase);
+    printf("drained %zu records in batches of %d, %zu bytes of text\n",
+           formatted, BENCH_DRAIN_EVERY, bytes);
+
+    bool ok = run_stress();
+    klog_close(&log_ring);
+    shm_unlink(BENCH_LOG_NAME);
+    if (!ok) {
+        fprintf(stderr, "bench: stress test FAILED\n");
+        return 1;
+    }
+    printf("stress: passed\n");
+    return 0;
+}
@@ -0,0 +1,150 @@
+// Package manager benchmark
+//
+// Registers 100k packages arranged as long dependency chains with random
+// cross-chain edges, then measures registration, lookup, install planning
+// and many installs and removals. Installs run without a repository, so
+// only planning, the pipeline's bookkeeping and the hooks are timed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "../packages/package_manager.h"
+
+#define BENCH_PACKAGES 100000
+#define BENCH_CHAIN_LENGTH 1000     // Each package depends on the previous one in its chain
+#define BENCH_CROSS_PERCENT 20      // Chance of an extra edge into an earlier chain
+#define BENCH_LOOKUPS 100000
+#define BENCH_PLANS 500
+#define BENCH_INSTALLS 2000
+#define BENCH_REMOVES 5000
+
+static Package* definitions;
+static uint64_t random_state = 0x2545f4914f6cdd1dULL;
+
+static void build_packages(void) {
+    definitions = calloc(BENCH_PACKAGES, sizeof(Package));
+    if (!definitions) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+
+    int edges = 0;
+    for (int i = 0; i < BENCH_PACKAGES; i++) {
+        Package* package = &definitions[i];
+        snprintf(package->name, sizeof(package->name), "pkg-%06d", i);
+        snprintf(package->version, sizeof(package->version), "1.%d", i % 7);
+        snprintf(package->install_path, sizeof(package->install_path), "/usr/lib/pkg-%06d", i);
+        package->state = PACKAGE_STATE_NOT_INSTALLED;
+
+        // Dependencies only point at lower numbers, so there are no cycles
+        int chain_start = i - i % BENCH_CHAIN_LENGTH;
+        if (i > chain_start) {
+            PackageDependency* dep = &package->dependencies[package->dependency_count++];
+            snprintf(dep->name, sizeof(dep->name), "pkg-%06d", i - 1);
+            snprintf(dep->version, sizeof(dep->version), ">= 1.0");
+        }
+        if (chain_start > 0 && (int)(bench_random(&random_state) % 100) < BENCH_CROSS_PERCENT) {
+            PackageDependency* dep = &package->dependencies[package->dependency_count++];
+            snprintf(dep->name, sizeof(dep->name), "pkg-%06d",
+                     (int)(bench_random(&random_state) % (uint64_t)chain_start));
+            dep->optional = bench_random(&random_state) % 2 == 0;
+        }
+        edges += package->dependency_count;
+    }
+    printf("%d packages in chains of %d, %d dependency edges\n",
+           BENCH_PACKAGES, BENCH_CHAIN_LENGTH, edges);
+}
+
+static const char* random_name(void) {
+    return definitions[bench_random(&random_state) % BENCH_PACKAGES].name;
+}
+
+static int compare_desc(const void* a, const void* b) {
+    return *(const int*)b - *(const int*)a;
+}
+
+int main(void) {
+    BenchPhase phase;
+    PackagePlan plan;
+
+    build_packages();
+
+    // No repository: installs only plan, order and run hooks
+    PackagePipelineConfig config = { NULL, "/tmp", "/tmp", "/", NULL, 0, 0, 0, 0 };
+    if (!package_manager_init()) {
+        fprintf(stderr, "bench: package_manager_init failed\n");
+        return 1;
+    }
+    package_manager_configure(&config);
+
+    bench_phase_begin(&phase, "register", BENCH_PACKAGES);
+    for (int i = 0; i < BENCH_PACKAGES; i++) {
+        uint64_t begin = bench_now_ns();
+        bool ok = package_register(&definitions[i]);
+        bench_phase_sample(&phase, begin);
+        if (!ok) {
+            fprintf(stderr, "bench: cannot register %s\n", definitions[i].name);
+            return 1;
+        }
+    }
+    bench_phase_end(&phase);
+
+    bench_phase_begin(&phase, "lookup", BENCH_LOOKUPS);
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        const char* name = random_name();
+        uint64_t begin = bench_now_ns();
+        package_index(name);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+
+    // Resolution only; nothing is installed yet, so plans cover whole chains
+    long long planned = 0;
+    bench_phase_begin(&phase, "plan", BENCH_PLANS);
+    for (int i = 0; i < BENCH_PLANS; i++) {
+        const char* name = random_name();
+        uint64_t begin = bench_now_ns();
+        bool ok = package_plan_install(&name, 1, &plan);
+        bench_phase_sample(&phase, begin);
+        planned += ok ? plan.count : 0;
+        package_plan_free(&plan);
+    }
+    bench_phase_end(&phase);
+    printf("average plan: %.0f packages\n", (double)planned / BENCH_PLANS);
+
+    // Installs get cheaper as more of each closure is already installed
+    bench_phase_begin(&phase, "install", BENCH_INSTALLS);
+    for (int i = 0; i < BENCH_INSTALLS; i++) {
+        const char* name = random_name();
+        uint64_t begin = bench_now_ns();
+        package_install(name);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+
+    // Remove dependents before their dependencies: higher numbers first
+    int* installed = malloc(BENCH_PACKAGES * sizeof(int));
+    int installed_count = 0;
+    for (int i = 0; installed && i < package_entry_count(); i++) {
+        if (package_entry(i)->state == PACKAGE_STATE_INSTALLED) {
+            installed[installed_count++] = atoi(package_entry(i)->name + 4);
+        }
+    }
+    printf("%d packages installed\n", installed_count);
+    qsort(installed, (size_t)installed_count, sizeof(int), compare_desc);
+
+    int removed = 0;
+    int removals = installed_count < BENCH_REMOVES ? installed_count : BENCH_REMOVES;
+    bench_phase_begin(&phase, "remove", (size_t)removals);
+    for (int i = 0; i < removals; i++) {
+        uint64_t begin = bench_now_ns();
+        removed += package_remove(definitions[installed[i]].name);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+    printf("%d of %d removals succeeded\n", removed, removals);
+
+    free(installed);
+    return 0;
+}
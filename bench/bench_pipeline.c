@@ -0,0 +1,152 @@
+// Install pipeline benchmark
+//
+// Builds a local repository of gzip tar archives with sha256 sidecars,
+// registers a package graph over them and installs it twice: once with
+// a single worker per stage and a queue depth of one, and once with the
+// default pipeline sizing. Reports per-stage throughput for both runs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../packages/package_manager.h"
+#include "../system/libs/sha256.h"
+
+#define BENCH_PACKAGES 256
+#define BENCH_FILES 8
+#define BENCH_FILE_SIZE (96 * 1024)
+#define BENCH_ROOT "0256"   // Named after BENCH_PACKAGES
+#define BENCH_DIR "/tmp/promptos-bench-pipeline"
+
+static bool write_file(const char* path, const void* data, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write(fd, data, size) == (ssize_t)size;
+    return close(fd) == 0 && ok;
+}
+
+// Create <repo>/pkg-N-1.0.pkg and its checksum from generated files
+static bool build_archive(int index, int files, char* data) {
+    char dir[256], path[512], command[1024];
+    snprintf(dir, sizeof(dir), BENCH_DIR "/src/pkg-%04d", index);
+    snprintf(path, sizeof(path), "%s/share/pkg-%04d", dir, index);
+    snprintf(command, sizeof(command), "mkdir -p %s", path);
+    if (system(command) != 0) {
+        return false;
+    }
+
+    for (int f = 0; f < files; f++) {
+        // Half random, half text, so gzip has something to do
+        for (int i = 0; i < BENCH_FILE_SIZE; i++) {
+            data[i] = i % 2 ? (char)rand() : (char)('a' + i % 26);
+        }
+        snprintf(path, sizeof(path), "%s/share/pkg-%04d/data-%d", dir, index, f);
+        if (!write_file(path, data, BENCH_FILE_SIZE)) {
+            return false;
+        }
+    }
+
+    snprintf(command, sizeof(command), "tar -czf " BENCH_DIR "/repo/pkg-%04d-1.0.pkg -C %s .", index, dir);
+    if (system(command) != 0) {
+        return false;
+    }
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    snprintf(path, sizeof(path), BENCH_DIR "/repo/pkg-%04d-1.0.pkg", index);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || !sha256_file(fd, digest, NULL)) {
+        return false;
+    }
+    close(fd);
+    sha256_to_hex(digest, hex);
+    snprintf(path, sizeof(path), BENCH_DIR "/repo/pkg-%04d-1.0.pkg.sha256", index);
+    return write_file(path, hex, SHA256_HEX_SIZE - 1);
+}
+
+// Register the packages; each depends on up to three earlier ones
+static bool register_packages(void) {
+    if (!package_manager_init()) {
+        return false;
+    }
+    srand(7);
+    for (int i = 0; i < BENCH_PACKAGES; i++) {
+        Package package;
+        memset(&package, 0, sizeof(package));
+        snprintf(package.name, sizeof(package.name), "pkg-%04d", i);
+        snprintf(package.version, sizeof(package.version), "1.0");
+        snprintf(package.install_path, sizeof(package.install_path), "usr");
+        package.dependency_count = i == 0 ? 0 : 1 + rand() % 3;
+        for (int d = 0; d < package.dependency_count; d++) {
+            snprintf(package.dependencies[d].name, MAX_PACKAGE_NAME_LEN, "pkg-%04d", rand() % i);
+        }
+        if (!package_register(&package)) {
+            return false;
+        }
+    }
+
+    // One empty root package pulls in everything
+    Package root;
+    memset(&root, 0, sizeof(root));
+    snprintf(root.name, sizeof(root.name), "pkg-%04d", BENCH_PACKAGES);
+    snprintf(root.version, sizeof(root.version), "1.0");
+    root.dependency_count = MAX_DEPENDENCIES;
+    for (int d = 0; d < MAX_DEPENDENCIES; d++) {
+        snprintf(root.dependencies[d].name, MAX_PACKAGE_NAME_LEN, "pkg-%04d", BENCH_PACKAGES - 1 - d);
+    }
+    return package_register(&root);
+}
+
+static bool run(const char* label, int workers, int depth) {
+    if (system("rm -rf " BENCH_DIR "/cache " BENCH_DIR "/manifests " BENCH_DIR "/root " BENCH_DIR "/files*") != 0 || !register_packages()) {
+        return false;
+    }
+    mkdir(BENCH_DIR "/root", 0755);
+
+    PackagePipelineConfig config = {
+        "file://" BENCH_DIR "/repo", BENCH_DIR "/cache", BENCH_DIR "/manifests", BENCH_DIR "/root", BENCH_DIR "/files",
+        workers, workers, workers, depth
+    };
+    package_manager_configure(&config);
+
+    bool ok = package_install("pkg-" BENCH_ROOT);
+    char report[1024];
+    package_pipeline_report(package_manager_last_install(), report, sizeof(report));
+    printf("%s\n%s\n", label, report);
+    return ok;
+}
+
+int main(void) {
+    char* data = malloc(BENCH_FILE_SIZE);
+    if (!data || system("rm -rf " BENCH_DIR " && mkdir -p " BENCH_DIR "/repo") != 0) {
+        return 1;
+    }
+
+    printf("building %d archives...\n", BENCH_PACKAGES);
+    srand(42);
+    for (int i = 0; i <= BENCH_PACKAGES; i++) {
+        if (!build_archive(i, i < BENCH_PACKAGES ? BENCH_FILES : 0, data)) {
+            fprintf(stderr, "cannot build archive %d\n", i);
+            return 1;
+        }
+    }
+    free(data);
+
+    if (!run("serial (1 worker per stage, depth 1)", 1, 1) ||
+        !run("pipelined (default sizing)", 0, 0)) {
+        fprintf(stderr, "install failed\n");
+        return 1;
+    }
+
+    // Spot-check the extracted tree
+    struct stat st;
+    if (stat(BENCH_DIR "/root/usr/share/pkg-0000/data-0", &st) != 0 || st.st_size != BENCH_FILE_SIZE) {
+        fprintf(stderr, "extracted files missing\n");
+        return 1;
+    }
+    return 0;
+}
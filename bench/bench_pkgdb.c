@@ -0,0 +1,127 @@
+// Package database benchmark
+//
+// Builds a synthetic 100k-package database, evicts it from the page cache,
+// then measures how long it takes to open it and to answer lookups, and
+// how many page faults those lookups cost.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "../packages/package_db.h"
+
+#define BENCH_PACKAGES 100000
+#define BENCH_LOOKUPS 100000
+#define BENCH_DB_PATH "/tmp/promptos-bench-pkgdb"
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void faults(long* minor, long* major) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    *minor = usage.ru_minflt;
+    *major = usage.ru_majflt;
+}
+
+static bool build_database(const char* path, int count) {
+    PackageDbBuilder builder;
+    if (!package_db_builder_init(&builder, (uint32_t)count)) {
+        return false;
+    }
+
+    char name[64], version[32], description[128], dep_names[4][64];
+    PackageDbDependencyInput deps[4];
+    bool ok = true;
+
+    srand(42);
+    for (int i = 0; ok && i < count; i++) {
+        snprintf(name, sizeof(name), "pkg-%06d", i);
+        snprintf(version, sizeof(version), "%d.%d.%d", rand() % 10, rand() % 20, rand() % 50);
+        snprintf(description, sizeof(description), "Synthetic package number %d", i);
+
+        int dep_count = i == 0 ? 0 : rand() % 5;
+        for (int d = 0; d < dep_count; d++) {
+            snprintf(dep_names[d], sizeof(dep_names[d]), "pkg-%06d", rand() % i);
+            deps[d].name = dep_names[d];
+            deps[d].constraint = ">= 1.0";
+            deps[d].flags = d == 3 ? PACKAGE_DB_DEP_OPTIONAL : 0;
+        }
+
+        ok = package_db_builder_add(&builder, name, version, description, "/usr",
+                                    (uint64_t)(rand() % 100000), i % 50 == 0 ? 1 : 0,
+                                    deps, (uint32_t)(dep_count < 4 ? dep_count : 3));
+    }
+
+    ok = ok && package_db_write(&builder, path);
+    package_db_builder_free(&builder);
+    return ok;
+}
+
+static void evict(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+int main(void) {
+    double start = now_ms();
+    if (!build_database(BENCH_DB_PATH, BENCH_PACKAGES)) {
+        fprintf(stderr, "bench_pkgdb: failed to build %s\n", BENCH_DB_PATH);
+        return 1;
+    }
+    printf("build+write %d packages: %.1f ms\n", BENCH_PACKAGES, now_ms() - start);
+
+    evict(BENCH_DB_PATH);
+
+    long minor0, major0, minor1, major1;
+    PackageDb db;
+
+    faults(&minor0, &major0);
+    start = now_ms();
+    if (!package_db_open(&db, BENCH_DB_PATH)) {
+        fprintf(stderr, "bench_pkgdb: failed to open %s\n", BENCH_DB_PATH);
+        return 1;
+    }
+    double open_ms = now_ms() - start;
+    faults(&minor1, &major1);
+    printf("open (%zu bytes): %.3f ms, %ld faults\n", db.size, open_ms,
+           (minor1 - minor0) + (major1 - major0));
+
+    char name[64];
+    faults(&minor0, &major0);
+    start = now_ms();
+    snprintf(name, sizeof(name), "pkg-%06d", BENCH_PACKAGES / 2);
+    int32_t first = package_db_find(&db, name);
+    double first_ms = now_ms() - start;
+    faults(&minor1, &major1);
+    printf("first lookup: %.3f ms, %ld faults (found=%d)\n", first_ms,
+           (minor1 - minor0) + (major1 - major0), first >= 0);
+
+    int found = 0;
+    srand(7);
+    faults(&minor0, &major0);
+    start = now_ms();
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        snprintf(name, sizeof(name), "pkg-%06d", rand() % (BENCH_PACKAGES * 2));
+        found += package_db_find(&db, name) >= 0;
+    }
+    double lookup_ms = now_ms() - start;
+    faults(&minor1, &major1);
+    printf("%d random lookups (%d hits): %.1f ms, %.0f ns/lookup, %ld faults\n",
+           BENCH_LOOKUPS, found, lookup_ms, lookup_ms * 1e6 / BENCH_LOOKUPS,
+           (minor1 - minor0) + (major1 - major0));
+
+    package_db_close(&db);
+    unlink(BENCH_DB_PATH);
+    return 0;
+}
@@ -0,0 +1,190 @@
+// Package removal benchmark
+//
+// Registers BENCH_CHAINS installed chains of BENCH_CHAIN_LENGTH packages,
+// each depending on the previous one in its chain, with optional edges
+// into earlier chains. Only the last package of a chain was installed by
+// the user; the rest came in as dependencies. The dependents check of
+// package_remove() is timed against the full scan it replaced, then half
+// of the chains lose their last package and package_autoremove() must
+// remove exactly the packages nothing kept still reaches. A small graph
+// with a dependency cycle checks refusals and autoremove order. Exits
+// non-zero if any check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "../packages/package_manager.h"
+
+#define BENCH_CHAINS 1000
+#define BENCH_CHAIN_LENGTH 100
+#define BENCH_PACKAGES (BENCH_CHAINS * BENCH_CHAIN_LENGTH)
+#define BENCH_CROSS_PERCENT 10      // Chance of an optional edge into an earlier chain
+
+static Package* definitions;
+static int cross[BENCH_PACKAGES];   // Optional dependency, or -1
+
+static bool chain_tail(int index) {
+    return index % BENCH_CHAIN_LENGTH == BENCH_CHAIN_LENGTH - 1;
+}
+
+static bool build_packages(void) {
+    definitions = calloc(BENCH_PACKAGES, sizeof(Package));
+    if (!definitions) {
+        return false;
+    }
+    uint64_t random_state = 0x2545f4914f6cdd1dULL;
+    for (int i = 0; i < BENCH_PACKAGES; i++) {
+        Package* package = &definitions[i];
+        snprintf(package->name, sizeof(package->name), "pkg-%06d", i);
+        snprintf(package->version, sizeof(package->version), "1.0");
+        snprintf(package->install_path, sizeof(package->install_path), "usr");
+        package->state = PACKAGE_STATE_INSTALLED;
+        package->automatic = !chain_tail(i);
+
+        int chain_start = i - i % BENCH_CHAIN_LENGTH;
+        if (i > chain_start) {
+            snprintf(package->dependencies[package->dependency_count++].name, MAX_PACKAGE_NAME_LEN,
+                     "pkg-%06d", i - 1);
+        }
+        cross[i] = -1;
+        if (chain_start > 0 && (int)(bench_random(&random_state) % 100) < BENCH_CROSS_PERCENT) {
+            cross[i] = (int)(bench_random(&random_state) % (uint64_t)chain_start);
+            PackageDependency* dep = &package->dependencies[package->dependency_count++];
+            snprintf(dep->name, sizeof(dep->name), "pkg-%06d", cross[i]);
+            dep->optional = true;
+        }
+        if (!package_register(package)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The check package_remove() made before the reverse index
+static int scan_dependent(int target) {
+    for (int i = 0; i < package_entry_count(); i++) {
+        const PackageEntry* entry = package_entry(i);
+        if (entry->state != PACKAGE_STATE_INSTALLED) {
+            continue;
+        }
+        for (int d = 0; d < entry->dependency_count; d++) {
+            if (package_dep_index(&entry->dependencies[d]) == target && !entry->dependencies[d].optional) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+// A package survives if its chain keeps its tail, or if a survivor reaches
+// it through an optional edge; removed tails stay removed. Walk from the
+// highest number down, since every edge points at a lower one.
+static bool check_survivors(void) {
+    bool* keep = calloc(BENCH_PACKAGES, sizeof(bool));
+    if (!keep) {
+        return false;
+    }
+    for (int i = BENCH_PACKAGES - 1; i >= 0; i--) {
+        if (chain_tail(i)) {
+            keep[i] = (i / BENCH_CHAIN_LENGTH) % 2 == 0;
+        }
+        if (keep[i] && i % BENCH_CHAIN_LENGTH > 0) {
+            keep[i - 1] = true;
+        }
+        if (keep[i] && cross[i] >= 0) {
+            keep[cross[i]] = true;
+        }
+    }
+    bool ok = true;
+    for (int i = 0; ok && i < BENCH_PACKAGES; i++) {
+        ok = (package_entry(package_index(definitions[i].name))->state == PACKAGE_STATE_INSTALLED) == keep[i];
+        if (!ok) {
+            printf("%s: %s\n", definitions[i].name, keep[i] ? "removed but needed" : "orphan left installed");
+        }
+    }
+    free(keep);
+    return ok;
+}
+
+static bool register_small(const char* name, bool automatic, const char* dependency, const char* optional) {
+    Package package;
+    memset(&package, 0, sizeof(package));
+    snprintf(package.name, sizeof(package.name), "%s", name);
+    snprintf(package.version, sizeof(package.version), "1.0");
+    snprintf(package.install_path, sizeof(package.install_path), "usr");
+    package.state = PACKAGE_STATE_INSTALLED;
+    package.automatic = automatic;
+    if (dependency) {
+        snprintf(package.dependencies[package.dependency_count++].name, MAX_PACKAGE_NAME_LEN, "%s", dependency);
+    }
+    if (optional) {
+        PackageDependency* dep = &package.dependencies[package.dependency_count++];
+        snprintf(dep->name, sizeof(dep->name), "%s", optional);
+        dep->optional = true;
+    }
+    return package_register(&package);
+}
+
+static bool installed(const char* name) {
+    return package_entry(package_index(name))->state == PACKAGE_STATE_INSTALLED;
+}
+
+// app -> lib-a -> lib-b <- tool, and app needs lib-e optionally; lib-c
+// and lib-d need each other and nothing else; lib-f is alone
+static bool check_small(void) {
+    int removed = 0;
+    bool ok = package_manager_init() && register_small("app", false, "lib-a", "lib-e") &&
+              register_small("lib-a", true, "lib-b", NULL) && register_small("lib-b", true, NULL, NULL) &&
+              register_small("tool", false, "lib-b", NULL) && register_small("lib-c", true, "lib-d", NULL) &&
+              register_small("lib-d", true, "lib-c", NULL) && register_small("lib-e", true, NULL, NULL) &&
+              register_small("lib-f", true, NULL, NULL);
+    ok = ok && !package_remove("lib-a") && package_autoremove(&removed) && removed == 3 &&
+         !installed("lib-c") && !installed("lib-d") && !installed("lib-f") && installed("lib-a") &&
+         installed("lib-e");
+    ok = ok && package_remove("app") && package_autoremove(&removed) && removed == 2 &&
+         !installed("lib-a") && !installed("lib-e") && installed("lib-b") && installed("tool");
+    return ok;
+}
+
+int main(void) {
+    if (!package_manager_init() || !build_packages()) {
+        fprintf(stderr, "bench: cannot register packages\n");
+        return 1;
+    }
+    printf("%d installed packages in %d chains\n", BENCH_PACKAGES, BENCH_CHAINS);
+
+    // The same chain tails both ways; before the reverse index, even a
+    // package nothing depends on cost a walk over every installed one
+    BenchPhase phase;
+    bool ok = true;
+    bench_phase_begin(&phase, "dependents check (full scan)", BENCH_CHAINS / 2);
+    for (int chain = 1; chain < BENCH_CHAINS; chain += 2) {
+        uint64_t begin = bench_now_ns();
+        int dependent = scan_dependent(chain * BENCH_CHAIN_LENGTH + BENCH_CHAIN_LENGTH - 1);
+        bench_phase_sample(&phase, begin);
+        ok &= dependent < 0;
+    }
+    bench_phase_end(&phase);
+
+    // Remove the tails of the odd chains through the reverse index
+    bench_phase_begin(&phase, "remove (reverse index)", BENCH_CHAINS / 2);
+    for (int chain = 1; chain < BENCH_CHAINS; chain += 2) {
+        const char* name = definitions[chain * BENCH_CHAIN_LENGTH + BENCH_CHAIN_LENGTH - 1].name;
+        uint64_t begin = bench_now_ns();
+        ok &= package_remove(name);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+
+    int removed = 0;
+    uint64_t begin = bench_now_ns();
+    ok &= package_autoremove(&removed);
+    printf("autoremove: %d orphans in %.1f ms\n", removed, (bench_now_ns() - begin) / 1e6);
+    bool survivors_ok = ok && check_survivors();
+    bool small_ok = check_small();
+
+    printf("survivors: %s, refusals and cycles: %s\n", survivors_ok ? "ok" : "WRONG", small_ok ? "ok" : "WRONG");
+    free(definitions);
+    return survivors_ok && small_ok ? 0 : 1;
+}
@@ -0,0 +1,223 @@
+// Service manager and init benchmark
+//
+// Registers 10k services wired into a random dependency DAG, then measures
+// registration, lookup, dependency-ordered starts (recursive and through
+// the wavefront) and stops (one at a time and all in reverse order). A
+// smaller run through init.c measures its table and how long spawning a
+// supervised process takes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "../system/service_manager.h"
+
+#define BENCH_SERVICES 10000
+#define BENCH_MAX_DEPS 4            // Dependencies per service, 0 to this many
+#define BENCH_WAVEFRONT_RUNS 20
+#define BENCH_INIT_SPAWNS 200
+#define BENCH_INIT_EXEC "/bin/true"
+
+// init.c has no header
+bool clear_services(void);
+bool register_service(const char* name, const char* exec_path, bool autostart, int priority);
+bool start_service(const char* name);
+
+static Service* definitions;
+static int* order;                  // Registration order, shuffled
+static uint64_t random_state = 0x9e3779b97f4a7c15ULL;
+
+static bool bench_start(void) {
+    return true;
+}
+
+static bool bench_stop(void) {
+    return true;
+}
+
+// Each service depends on a few services with lower numbers, so the graph
+// is acyclic; registration order is shuffled so most dependencies are
+// registered after their dependents
+static void build_graph(void) {
+    definitions = calloc(BENCH_SERVICES, sizeof(Service));
+    order = malloc(BENCH_SERVICES * sizeof(int));
+    if (!definitions || !order) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+
+    int edges = 0;
+    for (int i = 0; i < BENCH_SERVICES; i++) {
+        Service* service = &definitions[i];
+        snprintf(service->name, sizeof(service->name), "svc-%05d", i);
+        service->type = (ServiceType)(i % 3);
+        service->priority = (int)(bench_random(&random_state) % 10);
+        service->enabled = true;
+        service->start = bench_start;
+        service->stop = bench_stop;
+
+        int wanted = i > 0 ? (int)(bench_random(&random_state) % (BENCH_MAX_DEPS + 1)) : 0;
+        for (int d = 0; d < wanted; d++) {
+            int dep = (int)(bench_random(&random_state) % (uint64_t)i);
+            snprintf(service->dependencies[d].name, MAX_SERVICE_NAME_LEN, "svc-%05d", dep);
+            service->dependencies[d].required = bench_random(&random_state) % 4 != 0;
+        }
+        service->dependency_count = wanted;
+        edges += wanted;
+        order[i] = i;
+    }
+    for (int i = BENCH_SERVICES - 1; i > 0; i--) {
+        int j = (int)(bench_random(&random_state) % (uint64_t)(i + 1));
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    printf("%d services, %d dependency edges\n", BENCH_SERVICES, edges);
+}
+
+static void register_all(BenchPhase* phase) {
+    if (!service_manager_init()) {
+        fprintf(stderr, "bench: service_manager_init failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < BENCH_SERVICES; i++) {
+        uint64_t begin = bench_now_ns();
+        bool ok = service_register(&definitions[order[i]]);
+        if (phase) {
+            bench_phase_sample(phase, begin);
+        }
+        if (!ok) {
+            fprintf(stderr, "bench: cannot register %s\n", definitions[order[i]].name);
+            exit(1);
+        }
+    }
+}
+
+static void bench_service_manager(void) {
+    BenchPhase phase;
+    char report[512];
+
+    bench_phase_begin(&phase, "register", BENCH_SERVICES);
+    register_all(&phase);
+    bench_phase_end(&phase);
+
+    // Recursive starts in random order: each call starts whatever its
+    // dependencies still need, then the service itself
+    bench_phase_begin(&phase, "start (recursive)", BENCH_SERVICES);
+    for (int i = 0; i < BENCH_SERVICES; i++) {
+        uint64_t begin = bench_now_ns();
+        service_start(definitions[order[i]].name);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+
+    // Starting an active service is a name lookup and a state check
+    bench_phase_begin(&phase, "lookup", BENCH_SERVICES);
+    for (int i = 0; i < BENCH_SERVICES; i++) {
+        const char* name = definitions[bench_random(&random_state) % BENCH_SERVICES].name;
+        uint64_t begin = bench_now_ns();
+        service_start(name);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+
+    bench_phase_begin(&phase, "stop", BENCH_SERVICES);
+    for (int i = 0; i < BENCH_SERVICES; i++) {
+        uint64_t begin = bench_now_ns();
+        service_stop(definitions[order[i]].name);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+
+    // Whole-graph ordering and start through the wavefront; registration
+    // is repeated between runs outside the timed region
+    bench_phase_begin(&phase, "start_enabled", BENCH_WAVEFRONT_RUNS);
+    for (int run = 0; run < BENCH_WAVEFRONT_RUNS; run++) {
+        BenchAllocs before, after;
+        bench_allocs(&before);
+        uint64_t paused = bench_now_ns();
+        register_all(NULL);
+        phase.begin_ns += bench_now_ns() - paused;
+        bench_allocs(&after);
+        phase.allocs.calls += after.calls - before.calls;
+        phase.allocs.frees += after.frees - before.frees;
+        phase.allocs.bytes += after.bytes - before.bytes;
+
+        uint64_t begin = bench_now_ns();
+        service_start_enabled();
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+
+    service_start_report(report, sizeof(report));
+    report[strcspn(report, ":")] = '\0';    // The critical path itself is long
+    printf("last wavefront: %s\n", report);
+
+    // Reverse-order stop of the whole graph; the graph is started again
+    // between runs outside the timed region
+    bench_phase_begin(&phase, "stop_all", BENCH_WAVEFRONT_RUNS);
+    for (int run = 0; run < BENCH_WAVEFRONT_RUNS; run++) {
+        if (run > 0) {
+            BenchAllocs before, after;
+            bench_allocs(&before);
+            uint64_t paused = bench_now_ns();
+            service_start_enabled();
+            phase.begin_ns += bench_now_ns() - paused;
+            bench_allocs(&after);
+            phase.allocs.calls += after.calls - before.calls;
+            phase.allocs.frees += after.frees - before.frees;
+            phase.allocs.bytes += after.bytes - before.bytes;
+        }
+
+        uint64_t begin = bench_now_ns();
+        if (!service_stop_all()) {
+            fprintf(stderr, "bench: service_stop_all failed\n");
+            exit(1);
+        }
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+}
+
+static void bench_init(void) {
+    BenchPhase phase;
+    char name[32];
+
+    if (!clear_services()) {
+        fprintf(stderr, "bench: clear_services failed\n");
+        exit(1);
+    }
+    bench_phase_begin(&phase, "init register", BENCH_SERVICES);
+    for (int i = 0; i < BENCH_SERVICES; i++) {
+        snprintf(name, sizeof(name), "svc-%05d", order[i]);
+        uint64_t begin = bench_now_ns();
+        bool ok = register_service(name, BENCH_INIT_EXEC, false, (int)(order[i] % 10));
+        bench_phase_sample(&phase, begin);
+        if (!ok) {
+            fprintf(stderr, "bench: init cannot register %s (is MAX_SERVICES large enough?)\n", name);
+            exit(1);
+        }
+    }
+    bench_phase_end(&phase);
+
+    // fork and exec of a trivial service; children are reaped afterwards
+    bench_phase_begin(&phase, "init spawn", BENCH_INIT_SPAWNS);
+    for (int i = 0; i < BENCH_INIT_SPAWNS; i++) {
+        snprintf(name, sizeof(name), "svc-%05d", i);
+        uint64_t begin = bench_now_ns();
+        start_service(name);
+        bench_phase_sample(&phase, begin);
+    }
+    bench_phase_end(&phase);
+    while (wait(NULL) > 0) {
+    }
+}
+
+int main(void) {
+    build_graph();
+    bench_service_manager();
+    bench_init();
+    return 0;
+}
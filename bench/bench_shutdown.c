@@ -0,0 +1,171 @@
+// Shutdown benchmark
+//
+// Starts a layered graph of real supervised processes through init.c.
+// Each one takes BENCH_STOP_MS to exit after SIGTERM, and one ignores
+// SIGTERM entirely. stop_all_services() must stop the graph in reverse
+// dependency order and kill the stubborn one once its timeout passes. Its
+// wall time is compared with stopping the same services one at a time.
+// Every service appends its name to a log as it exits, and the run fails
+// if a service exited before something that depends on it.
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bench.h"
+
+#define BENCH_LAYERS 4
+#define BENCH_WIDTH 12
+#define BENCH_SERVICES (BENCH_LAYERS * BENCH_WIDTH)
+#define BENCH_STOP_MS 100
+#define BENCH_STOP_SECONDS "0.1"          // BENCH_STOP_MS, for sleep(1)
+#define BENCH_STUBBORN_TIMEOUT_MS 300
+
+// init.c has no header
+bool clear_services(void);
+bool supervisor_init(void);
+bool register_service(const char* name, const char* exec_path, bool autostart, int priority);
+bool add_dependency(const char* name, const char* dependency);
+bool set_stop_timeout(const char* name, int timeout_ms);
+bool start_service(const char* name);
+bool stop_all_services(void);
+void shutdown_report_text(char* buffer, size_t size);
+
+static char root[] = "/tmp/promptos-shutdown-XXXXXX";
+static char log_path[256];
+
+// Services are symlinks to one script, which logs its own name ($0)
+static bool write_script(const char* path, bool stubborn) {
+    FILE* script = fopen(path, "w");
+    if (!script) {
+        return false;
+    }
+    fprintf(script,
+            "#!/bin/sh\n"
+            "trap %s TERM\n"
+            "while :; do sleep 1 & wait $!; done\n",
+            stubborn ? "''" : "'sleep " BENCH_STOP_SECONDS "; echo \"${0##*/}\" >> \"$LOG\"; exit 0'");
+    fclose(script);
+    return chmod(path, 0755) == 0;
+}
+
+static void service_name(int layer, int index, char* name, size_t size) {
+    snprintf(name, size, "l%d-s%02d", layer, index);
+}
+
+// Position of each service in the exit log, or -1 if it never logged
+static int exit_order(const char* name) {
+    FILE* log = fopen(log_path, "r");
+    char line[64];
+    int position = 0;
+    int found = -1;
+    while (log && found < 0 && fgets(line, sizeof(line), log)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strcmp(line, name) == 0) {
+            found = position;
+        }
+        position++;
+    }
+    if (log) {
+        fclose(log);
+    }
+    return found;
+}
+
+int main(void) {
+    if (!mkdtemp(root)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char script[256], stubborn[256], path[256], name[32], dependency[32];
+    snprintf(script, sizeof(script), "%s/service.sh", root);
+    snprintf(stubborn, sizeof(stubborn), "%s/stubborn.sh", root);
+    snprintf(log_path, sizeof(log_path), "%s/exits.log", root);
+    setenv("LOG", log_path, 1);
+    if (!write_script(script, false) || !write_script(stubborn, true) ||
+        !clear_services() || !supervisor_init()) {
+        fprintf(stderr, "bench: setup failed\n");
+        return 1;
+    }
+
+    // Layer 0 is the bottom; each service in layer n needs two in layer n - 1
+    uint64_t random_state = 0x2545f4914f6cdd1dULL;
+    int dependencies[BENCH_LAYERS][BENCH_WIDTH][2];
+    for (int layer = 0; layer < BENCH_LAYERS; layer++) {
+        for (int i = 0; i < BENCH_WIDTH; i++) {
+            service_name(layer, i, name, sizeof(name));
+            snprintf(path, sizeof(path), "%s/%s", root, name);
+            bool is_stubborn = layer == BENCH_LAYERS - 1 && i == 0;
+            symlink(is_stubborn ? stubborn : script, path);
+            register_service(name, path, false, layer);
+            for (int d = 0; d < 2 && layer > 0; d++) {
+                dependencies[layer][i][d] = (int)(bench_random(&random_state) % BENCH_WIDTH);
+                service_name(layer - 1, dependencies[layer][i][d], dependency, sizeof(dependency));
+                add_dependency(name, dependency);
+            }
+            if (is_stubborn) {
+                set_stop_timeout(name, BENCH_STUBBORN_TIMEOUT_MS);
+            }
+        }
+    }
+    for (int layer = 0; layer < BENCH_LAYERS; layer++) {
+        for (int i = 0; i < BENCH_WIDTH; i++) {
+            service_name(layer, i, name, sizeof(name));
+            if (!start_service(name)) {
+                fprintf(stderr, "bench: cannot start %s\n", name);
+                return 1;
+            }
+        }
+    }
+    usleep(200000);     // Let the shells install their traps
+
+    printf("%d services in %d layers, %d ms to stop each, one ignores SIGTERM (%d ms timeout)\n",
+           BENCH_SERVICES, BENCH_LAYERS, BENCH_STOP_MS, BENCH_STUBBORN_TIMEOUT_MS);
+    BenchPhase phase;
+    bench_phase_begin(&phase, "stop_all_services", 1);
+    uint64_t begin = bench_now_ns();
+    bool clean = stop_all_services();
+    bench_phase_sample(&phase, begin);
+    bench_phase_end(&phase);
+
+    char report[256];
+    shutdown_report_text(report, sizeof(report));
+    printf("%s\n", report);
+
+    // Every service but the stubborn one logged its exit after its dependents
+    bool ordered = true;
+    for (int layer = 1; layer < BENCH_LAYERS; layer++) {
+        for (int i = 0; i < BENCH_WIDTH; i++) {
+            service_name(layer, i, name, sizeof(name));
+            int mine = exit_order(name);
+            if (mine < 0 && !(layer == BENCH_LAYERS - 1 && i == 0)) {
+                ordered = false;
+            }
+            for (int d = 0; d < 2; d++) {
+                service_name(layer - 1, dependencies[layer][i][d], dependency, sizeof(dependency));
+                if (exit_order(dependency) < mine) {
+                    ordered = false;
+                }
+            }
+        }
+    }
+    printf("reverse dependency order: %s, stubborn service killed: %s\n",
+           ordered ? "ok" : "WRONG", !clean ? "ok" : "WRONG");
+
+    for (int layer = 0; layer < BENCH_LAYERS; layer++) {
+        for (int i = 0; i < BENCH_WIDTH; i++) {
+            service_name(layer, i, name, sizeof(name));
+            snprintf(path, sizeof(path), "%s/%s", root, name);
+            unlink(path);
+        }
+    }
+    unlink(script);
+    unlink(stubborn);
+    unlink(log_path);
+    rmdir(root);
+    return ordered && !clean ? 0 : 1;
+}
@@ -0,0 +1,234 @@
+// Repository index sync benchmark
+//
+// Publishes a BENCH_PACKAGES-package catalog into a repository directory,
+// syncs a fresh client from the snapshot and marks some of its packages
+// installed, then publishes BENCH_ROUNDS changes of BENCH_CHANGES version
+// bumps, additions and removals each. The client syncs after every
+// round, from one delta. Two more clients that stopped syncing after the
+// first round catch up at the end: one from BENCH_BEHIND deltas, one from
+// the snapshot because it is too far behind. A last one finds its deltas
+// pruned and falls back to the snapshot too. Every client must end up with
+// the catalog's versions, and its installed packages must keep their
+// state and install path, even when the repository dropped them. Exits
+// non-zero if any check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bench.h"
+#include "../packages/package_manager.h"
+#include "../packages/package_db.h"
+
+#define BENCH_PACKAGES 100000
+#define BENCH_EXTRA 4096            // Room for packages added by the rounds
+#define BENCH_ROUNDS 80
+#define BENCH_CHANGES 50
+#define BENCH_BEHIND 20
+#define BENCH_INSTALLED_EVERY 100
+#define BENCH_INSTALL_PATH "/opt/installed"
+#define BENCH_DIR "/tmp/promptos-bench-sync"
+#define BENCH_REPO BENCH_DIR "/repo"
+#define BENCH_CATALOG BENCH_DIR "/catalog"
+
+typedef struct {
+    int version;
+    bool alive;
+} CatalogEntry;
+
+static CatalogEntry catalog[BENCH_PACKAGES + BENCH_EXTRA];
+static int catalog_count;
+
+static void package_name(int index, char* name, size_t size) {
+    snprintf(name, size, "pkg-%06d", index);
+}
+
+// Only among the packages of the first sync
+static bool installed(int index) {
+    return index < BENCH_PACKAGES && index % BENCH_INSTALLED_EVERY == 0;
+}
+
+// The catalog as the repository publishes it or, given the database of a
+// synced client, as that client holds it once some packages are installed
+static bool write_database(const char* path, const PackageDb* synced) {
+    PackageDbBuilder builder;
+    if (!package_db_builder_init(&builder, (uint32_t)catalog_count)) {
+        return false;
+    }
+    char name[32], version[32], description[64], dependency[32];
+    bool ok = true;
+    for (int i = 0; ok && i < catalog_count; i++) {
+        if (!catalog[i].alive) {
+            continue;
+        }
+        bool local = synced && installed(i);
+        package_name(i, name, sizeof(name));
+        package_name(i / 2, dependency, sizeof(dependency));
+        snprintf(version, sizeof(version), "1.%d", catalog[i].version);
+        snprintf(description, sizeof(description), "Synthetic package number %d", i);
+        PackageDbDependencyInput dep = { dependency, ">= 1.0", 0 };
+        ok = package_db_builder_add(&builder, name, version, description, local ? BENCH_INSTALL_PATH : "/usr",
+                                    4096 + (uint64_t)i,
+                                    local ? PACKAGE_STATE_INSTALLED : PACKAGE_STATE_NOT_INSTALLED,
+                                    &dep, i > 0 ? 1 : 0);
+    }
+    if (synced) {
+        builder.sequence = synced->sequence;
+        builder.origin = synced->origin;
+    }
+    ok = ok && package_db_write(&builder, path);
+    package_db_builder_free(&builder);
+    return ok;
+}
+
+// One round of repository changes: version bumps, one new package and
+// one removal, which every few rounds hits an installed package
+static void change_catalog(uint64_t* random_state, int round) {
+    for (int c = 0; c < BENCH_CHANGES - 2; c++) {
+        catalog[bench_random(random_state) % (uint64_t)catalog_count].version++;
+    }
+    catalog[catalog_count].alive = true;
+    catalog[catalog_count++].version = 0;
+    int removed = round % 4 == 0 ? round * BENCH_INSTALLED_EVERY
+                                 : (int)(bench_random(random_state) % (uint64_t)catalog_count);
+    catalog[removed].alive = false;
+}
+
+// Mark every BENCH_INSTALLED_EVERY-th package installed under its own path
+static bool install_some(const char* db_path) {
+    PackageDb db;
+    if (!package_db_open(&db, db_path)) {
+        return false;
+    }
+    bool ok = write_database(db_path, &db);
+    package_db_close(&db);
+    return ok;
+}
+
+// The client has every live package at its current version, and every
+// installed one in place whether or not the repository still has it
+static bool check_client(const char* db_path, bool has_installed) {
+    PackageDb db;
+    if (!package_db_open(&db, db_path)) {
+        return false;
+    }
+    char name[32], version[32];
+    uint32_t expected = 0;
+    bool ok = true;
+    for (int i = 0; ok && i < catalog_count; i++) {
+        package_name(i, name, sizeof(name));
+        int32_t index = package_db_find(&db, name);
+        bool local = has_installed && installed(i);
+        bool present = catalog[i].alive || local;
+        expected += present;
+        if (index < 0) {
+            ok = !present;
+            continue;
+        }
+        const PackageDbRecord* record = package_db_record(&db, (uint32_t)index);
+        snprintf(version, sizeof(version), "1.%d", catalog[i].version);
+        ok = present && (!catalog[i].alive || strcmp(package_db_string(&db, record->version), version) == 0) &&
+             (record->state == PACKAGE_STATE_INSTALLED) == local &&
+             (!local || strcmp(package_db_string(&db, record->install_path), BENCH_INSTALL_PATH) == 0);
+        if (!ok) {
+            printf("client %s: wrong record for %s\n", db_path, name);
+        }
+    }
+    ok = ok && package_db_count(&db) == expected;
+    package_db_close(&db);
+    return ok;
+}
+
+static int compare_ns(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static bool copy_file(const char* from, const char* to) {
+    char command[512];
+    snprintf(command, sizeof(command), "cp %s %s", from, to);
+    return system(command) == 0;
+}
+
+static bool sync_client(const char* db_path, const char* label, bool want_snapshot, uint32_t want_deltas,
+                        bool has_installed) {
+    PackageSyncStats stats;
+    char report[256];
+    bool ok = package_sync_run(BENCH_REPO, db_path, &stats);
+    package_sync_report(&stats, report, sizeof(report));
+    printf("%s: %s", label, report);
+    return ok && stats.snapshot == want_snapshot && stats.deltas == want_deltas &&
+           check_client(db_path, has_installed);
+}
+
+int main(void) {
+    if (system("rm -rf " BENCH_DIR) != 0 || mkdir(BENCH_DIR, 0755) < 0 || mkdir(BENCH_REPO, 0755) < 0) {
+        perror(BENCH_DIR);
+        return 1;
+    }
+    catalog_count = BENCH_PACKAGES;
+    for (int i = 0; i < catalog_count; i++) {
+        catalog[i].alive = true;
+    }
+
+    PackageSyncStats stats;
+    char report[256];
+    bool ok = write_database(BENCH_CATALOG, NULL) && package_index_publish(BENCH_REPO, BENCH_CATALOG, PACKAGE_INDEX_KEEP, &stats);
+    package_sync_report(&stats, report, sizeof(report));
+    printf("%d packages; publish: %s", BENCH_PACKAGES, report);
+    ok = ok && sync_client(BENCH_DIR "/client", "first sync", true, 0, false) && install_some(BENCH_DIR "/client");
+
+    // Publish a round, sync from its delta, then check
+    uint64_t random_state = 0x853c49e6748fea9bULL;
+    PackageSyncStats round_stats[BENCH_ROUNDS];
+    uint64_t publish_ns[BENCH_ROUNDS], sync_ns[BENCH_ROUNDS];
+    uint64_t delta_bytes = 0;
+    for (int round = 1; ok && round <= BENCH_ROUNDS; round++) {
+        if (round == 2) {
+            ok = copy_file(BENCH_DIR "/client", BENCH_DIR "/behind") &&
+                 copy_file(BENCH_DIR "/client", BENCH_DIR "/far-behind");
+        }
+        change_catalog(&random_state, round);
+        ok = ok && write_database(BENCH_CATALOG, NULL);
+        uint64_t begin = bench_now_ns();
+        ok = ok && package_index_publish(BENCH_REPO, BENCH_CATALOG, PACKAGE_INDEX_KEEP, &stats);
+        publish_ns[round - 1] = bench_now_ns() - begin;
+
+        begin = bench_now_ns();
+        ok = ok && package_sync_run(BENCH_REPO, BENCH_DIR "/client", &round_stats[round - 1]);
+        sync_ns[round - 1] = bench_now_ns() - begin;
+        ok = ok && round_stats[round - 1].deltas == 1 && check_client(BENCH_DIR "/client", true);
+        delta_bytes += round_stats[round - 1].bytes_read;
+
+        if (ok && round == 1 + BENCH_BEHIND) {
+            ok = sync_client(BENCH_DIR "/behind", "catch up", false, BENCH_BEHIND, true);
+        }
+        if (ok && round == BENCH_ROUNDS - 12) {
+            ok = copy_file(BENCH_DIR "/client", BENCH_DIR "/pruned");
+        }
+    }
+    if (ok) {
+        qsort(publish_ns, BENCH_ROUNDS, sizeof(uint64_t), compare_ns);
+        qsort(sync_ns, BENCH_ROUNDS, sizeof(uint64_t), compare_ns);
+        printf("%d rounds of %d changes: publish p50 %.2f ms, sync p50 %.2f ms p90 %.2f ms max %.2f ms, "
+               "%.1f KB of deltas read per round\n", BENCH_ROUNDS, BENCH_CHANGES,
+               publish_ns[BENCH_ROUNDS / 2] / 1e6, sync_ns[BENCH_ROUNDS / 2] / 1e6,
+               sync_ns[BENCH_ROUNDS * 9 / 10] / 1e6, sync_ns[BENCH_ROUNDS - 1] / 1e6,
+               delta_bytes / 1e3 / BENCH_ROUNDS);
+    }
+
+    ok = ok && sync_client(BENCH_DIR "/far-behind", "too far behind", true, 0, true);
+
+    // Keep only the last 5 deltas; the client 12 behind cannot use them
+    change_catalog(&random_state, BENCH_ROUNDS + 1);
+    ok = ok && write_database(BENCH_CATALOG, NULL) && package_index_publish(BENCH_REPO, BENCH_CATALOG, 5, &stats) &&
+         sync_client(BENCH_DIR "/pruned", "deltas pruned", true, 0, true);
+
+    // For comparison: a client without a database takes the whole snapshot
+    ok = ok && sync_client(BENCH_DIR "/fresh", "fresh client", true, 0, false);
+
+    printf("clients match the catalog: %s\n", ok ? "ok" : "WRONG");
+    system("rm -rf " BENCH_DIR);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,328 @@
+// Delta upgrade benchmark
+//
+// Publishes two versions of a package whose trees differ by a few small
+// edits, installs the first from its archive, then upgrades to the second
+// through the chunk store. It also assembles the whole of the second
+// version from the local store into an empty directory, which is where
+// copying in the kernel (or reflinking) pays off, and checks that an
+// upgrade whose chunks cannot be fetched leaves the installed tree alone,
+// that a manifest naming paths outside the install path is refused, that
+// removing a package clears its files from the file index and that a
+// full-archive upgrade deletes dropped files and installs new
+// dependencies. A second package ships a copy of one of the first
+// package's files to show cross-package deduplication. Prints the
+// bytes fetched and written against a full-archive upgrade, and the I/O
+// each step cost: wall time, CPU time, read and write system calls and the
+// bytes the process sent to the block layer (/proc/self/io).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "../packages/package_manager.h"
+#include "../packages/package_store.h"
+
+#define BENCH_FILES 32
+#define BENCH_FILE_SIZE (256 * 1024)
+#define BENCH_DIR "/tmp/promptos-bench-upgrade"
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+typedef struct {
+    double wall_ms;
+    double user_ms;
+    double system_ms;
+    long long read_calls;       // syscr
+    long long write_calls;      // syscw
+    long long write_bytes;      // To storage, after the page cache
+} IoCost;
+
+static void io_sample(IoCost* cost) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    cost->wall_ms = now_ms();
+    cost->user_ms = usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3;
+    cost->system_ms = usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+    cost->read_calls = cost->write_calls = cost->write_bytes = 0;
+
+    FILE* io = fopen("/proc/self/io", "r");
+    char key[32];
+    long long value;
+    while (io && fscanf(io, "%31[^:]: %lld\n", key, &value) == 2) {
+        if (strcmp(key, "syscr") == 0) {
+            cost->read_calls = value;
+        } else if (strcmp(key, "syscw") == 0) {
+            cost->write_calls = value;
+        } else if (strcmp(key, "write_bytes") == 0) {
+            cost->write_bytes = value;
+        }
+    }
+    if (io) {
+        fclose(io);
+    }
+}
+
+static void io_report(const char* step, const IoCost* begin) {
+    IoCost end;
+    io_sample(&end);
+    printf("%s: %.1f ms wall, %.1f ms user, %.1f ms system, %lld reads, %lld writes, %lld bytes written\n",
+           step, end.wall_ms - begin->wall_ms, end.user_ms - begin->user_ms, end.system_ms - begin->system_ms,
+           end.read_calls - begin->read_calls, end.write_calls - begin->write_calls,
+           end.write_bytes - begin->write_bytes);
+}
+
+static bool write_file(const char* path, const void* data, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write(fd, data, size) == (ssize_t)size;
+    return close(fd) == 0 && ok;
+}
+
+// Generate the version 1.0 tree, then derive 2.0 with three small edits
+static bool build_trees(void) {
+    char* data = malloc(BENCH_FILE_SIZE);
+    char path[256];
+    if (!data || system("mkdir -p " BENCH_DIR "/app-1.0/lib/app " BENCH_DIR "/lib-1.0/lib/shared " BENCH_DIR "/repo") != 0) {
+        free(data);
+        return false;
+    }
+
+    srand(1);
+    bool ok = true;
+    for (int f = 0; ok && f < BENCH_FILES; f++) {
+        for (int i = 0; i < BENCH_FILE_SIZE; i++) {
+            data[i] = (char)(rand() % 96 + 32);
+        }
+        snprintf(path, sizeof(path), BENCH_DIR "/app-1.0/lib/app/module-%02d.so", f);
+        ok = write_file(path, data, BENCH_FILE_SIZE);
+    }
+    free(data);
+
+    ok = ok && system("cp " BENCH_DIR "/app-1.0/lib/app/module-00.so " BENCH_DIR "/lib-1.0/lib/shared/") == 0 &&
+         system("cp -a " BENCH_DIR "/app-1.0 " BENCH_DIR "/app-2.0") == 0;
+
+    // One-line change, an insertion that shifts the rest of a file, a new file
+    ok = ok && system("printf 'patched' | dd of=" BENCH_DIR "/app-2.0/lib/app/module-03.so bs=1 seek=1000 conv=notrunc status=none") == 0 &&
+         system("(head -c 50000 " BENCH_DIR "/app-1.0/lib/app/module-07.so; echo inserted;"
+                " tail -c +50001 " BENCH_DIR "/app-1.0/lib/app/module-07.so) > " BENCH_DIR "/app-2.0/lib/app/module-07.so") == 0 &&
+         system("echo 2.0 > " BENCH_DIR "/app-2.0/lib/app/VERSION") == 0;
+    return ok;
+}
+
+// Archive for the initial install, manifest and chunks for upgrades
+static bool publish(const char* name, const char* version, bool archive) {
+    char command[512], path[256], tree[256];
+    snprintf(tree, sizeof(tree), BENCH_DIR "/%s-%s", name, version);
+
+    if (archive) {
+        snprintf(command, sizeof(command), "tar -czf " BENCH_DIR "/repo/%s-%s.pkg -C %s . && "
+                 "sha256sum " BENCH_DIR "/repo/%s-%s.pkg | cut -c1-64 > " BENCH_DIR "/repo/%s-%s.pkg.sha256",
+                 name, version, tree, name, version, name, version);
+        if (system(command) != 0) {
+            return false;
+        }
+    }
+
+    PackageManifest manifest;
+    PackageStoreWriter* writer = malloc(sizeof(PackageStoreWriter));
+    package_manifest_init(&manifest, name, version);
+    snprintf(path, sizeof(path), BENCH_DIR "/repo/%s-%s" PACKAGE_MANIFEST_SUFFIX, name, version);
+    package_store_writer_init(writer, BENCH_DIR "/repo/chunks", &manifest);
+    bool ok = package_store_add_tree(writer, tree) && !writer->failed &&
+              package_manifest_save(&manifest, path);
+    free(writer);
+    package_manifest_free(&manifest);
+    return ok;
+}
+
+static bool register_package_on(const char* name, const char* version, PackageState state, const char* dependency) {
+    Package package;
+    memset(&package, 0, sizeof(package));
+    snprintf(package.name, sizeof(package.name), "%s", name);
+    snprintf(package.version, sizeof(package.version), "%s", version);
+    snprintf(package.install_path, sizeof(package.install_path), "usr");
+    package.state = state;
+    if (dependency) {
+        snprintf(package.dependencies[0].name, sizeof(package.dependencies[0].name), "%s", dependency);
+        package.dependency_count = 1;
+    }
+    return package_register(&package);
+}
+
+static bool register_package(const char* name, const char* version, PackageState state) {
+    return register_package_on(name, version, state, NULL);
+}
+
+int main(void) {
+    PackagePipelineConfig config = {
+        "file://" BENCH_DIR "/repo", BENCH_DIR "/cache", BENCH_DIR "/manifests", BENCH_DIR "/root",
+        BENCH_DIR "/files", 0, 0, 0, 0
+    };
+
+    if (system("rm -rf " BENCH_DIR) != 0 || !build_trees() ||
+        !publish("app", "1.0", true) || !publish("lib", "1.0", true) || !publish("app", "2.0", false)) {
+        fprintf(stderr, "cannot build repository\n");
+        return 1;
+    }
+    mkdir(BENCH_DIR "/root", 0755);
+
+    // Install 1.0 of both packages from their archives
+    char report[1024];
+    if (!package_manager_init() || !register_package("app", "1.0", PACKAGE_STATE_NOT_INSTALLED) ||
+        !register_package("lib", "1.0", PACKAGE_STATE_NOT_INSTALLED)) {
+        return 1;
+    }
+    package_manager_configure(&config);
+    IoCost cost;
+    io_sample(&cost);
+    if (!package_install("app")) {
+        fprintf(stderr, "install failed\n");
+        return 1;
+    }
+    io_report("install app 1.0", &cost);
+    if (!package_install("lib")) {
+        fprintf(stderr, "install failed\n");
+        return 1;
+    }
+    package_pipeline_report(package_manager_last_install(), report, sizeof(report));
+    printf("install lib 1.0 (shares one file with app)\n%s\n", report);
+
+    // The catalog now offers app 2.0
+    struct stat archive;
+    stat(BENCH_DIR "/repo/app-1.0.pkg", &archive);
+    if (!package_manager_init() || !register_package("app", "2.0", PACKAGE_STATE_INSTALLED) ||
+        !register_package("lib", "1.0", PACKAGE_STATE_INSTALLED)) {
+        return 1;
+    }
+    package_manager_configure(&config);
+
+    io_sample(&cost);
+    bool ok = package_upgrade_all();
+    io_report("upgrade app to 2.0", &cost);
+    printf("a full-archive upgrade fetches %lld bytes and writes %d\n",
+           (long long)archive.st_size, BENCH_FILES * BENCH_FILE_SIZE);
+
+    if (!ok || system("diff -r " BENCH_DIR "/app-2.0/lib/app " BENCH_DIR "/root/usr/lib/app") != 0) {
+        fprintf(stderr, "upgraded tree does not match 2.0\n");
+        return 1;
+    }
+
+    // The manifest was committed with the files
+    PackageManifest empty, target;
+    struct stat staging;
+    ok = package_manifest_load(&target, BENCH_DIR "/manifests/app" PACKAGE_MANIFEST_SUFFIX) &&
+         strcmp(target.version, "2.0") == 0 &&
+         stat(BENCH_DIR "/manifests/app" PACKAGE_MANIFEST_SUFFIX ".tmp", &staging) < 0;
+    package_manifest_free(&target);
+    if (!ok) {
+        fprintf(stderr, "installed manifest is not 2.0\n");
+        return 1;
+    }
+
+    // Every file of 2.0 from the local store, as for a reinstall
+    PackageUpgradeStats stats;
+    package_manifest_init(&empty, "app", "0");
+    if (!package_manifest_load(&target, BENCH_DIR "/repo/app-2.0" PACKAGE_MANIFEST_SUFFIX)) {
+        return 1;
+    }
+    mkdir(BENCH_DIR "/restore", 0755);
+    io_sample(&cost);
+    PackageStage stage;
+    ok = package_stage_begin(&stage, BENCH_DIR "/restore", "app") &&
+         package_store_upgrade(BENCH_DIR "/repo/chunks", BENCH_DIR "/cache/chunks", &empty, &target,
+                               &stage, &stats) &&
+         package_stage_commit(&stage);
+    io_report("assemble app 2.0 from the store", &cost);
+    printf("%llu bytes written, %llu of them reflinked\n",
+           (unsigned long long)stats.written_bytes, (unsigned long long)stats.cloned_bytes);
+    package_manifest_free(&target);
+    if (!ok || system("diff -r " BENCH_DIR "/app-2.0 " BENCH_DIR "/restore") != 0) {
+        fprintf(stderr, "assembled tree does not match 2.0\n");
+        return 1;
+    }
+
+    // 3.0 edits two files, but the repository lost a chunk of the second
+    ok = system("cp -a " BENCH_DIR "/app-2.0 " BENCH_DIR "/app-3.0 && echo 3.0 > " BENCH_DIR "/app-3.0/lib/app/VERSION && "
+                "printf 'broken' | dd of=" BENCH_DIR "/app-3.0/lib/app/module-05.so bs=1 seek=9000 conv=notrunc status=none") == 0 &&
+         publish("app", "3.0", false) &&
+         package_manifest_load(&target, BENCH_DIR "/repo/app-3.0" PACKAGE_MANIFEST_SUFFIX);
+    for (uint32_t i = 0; ok && i < target.file_count; i++) {
+        const StoreFile* file = &target.files[i];
+        for (uint32_t c = file->first_chunk; strcmp(file->path, "lib/app/module-05.so") == 0 &&
+                                             c < file->first_chunk + file->chunk_count; c++) {
+            char hex[SHA256_DIGEST_SIZE * 2 + 1], path[512];
+            for (int b = 0; b < SHA256_DIGEST_SIZE; b++) {
+                snprintf(hex + b * 2, 3, "%02x", target.chunks[c].digest[b]);
+            }
+            if (!package_store_has_chunk(BENCH_DIR "/cache/chunks", &target.chunks[c])) {
+                snprintf(path, sizeof(path), BENCH_DIR "/repo/chunks/%.2s/%s", hex, hex);
+                unlink(path);
+            }
+        }
+    }
+    package_manifest_free(&target);
+    if (!ok || !package_manager_init() || !register_package("app", "3.0", PACKAGE_STATE_INSTALLED) ||
+        !register_package("lib", "1.0", PACKAGE_STATE_INSTALLED)) {
+        return 1;
+    }
+    package_manager_configure(&config);
+    bool failed = !package_upgrade_all();
+    bool intact = failed && system("diff -r " BENCH_DIR "/app-2.0/lib/app " BENCH_DIR "/root/usr/lib/app") == 0 &&
+                  stat(BENCH_DIR "/root/usr/" PACKAGE_STAGE_PREFIX "app", &staging) < 0 &&
+                  package_entry(package_index("app"))->state == PACKAGE_STATE_INSTALLED;
+    printf("failed upgrade left 2.0 installed: %s\n", intact ? "ok" : "WRONG");
+
+    // A manifest may not name anything outside the install path
+    const char* escapes[] = {
+        "promptos-manifest 1\npackage app 9.0\nfile 0644 lib/../../../etc/x\n",
+        "promptos-manifest 1\npackage app 9.0\nsymlink lib/x\t/etc/shadow\n",
+    };
+    bool confined = true;
+    for (int i = 0; i < 2; i++) {
+        confined &= write_file(BENCH_DIR "/escape" PACKAGE_MANIFEST_SUFFIX, escapes[i], strlen(escapes[i])) &&
+                    !package_manifest_load(&target, BENCH_DIR "/escape" PACKAGE_MANIFEST_SUFFIX);
+    }
+    printf("escaping manifest rejected: %s\n", confined ? "ok" : "WRONG");
+
+    // Removing lib deletes its file, its manifest and its entry in the
+    // file index
+    const char* owner = package_file_owner("/usr/lib/shared/module-00.so");
+    bool removed = owner && strcmp(owner, "lib") == 0 && package_remove("lib") &&
+                   stat(BENCH_DIR "/root/usr/lib/shared/module-00.so", &staging) < 0 &&
+                   stat(BENCH_DIR "/manifests/lib" PACKAGE_MANIFEST_SUFFIX, &staging) < 0 &&
+                   stat(BENCH_DIR "/root/usr/" PACKAGE_STAGE_PREFIX "lib", &staging) < 0 &&
+                   !package_file_owner("/usr/lib/shared/module-00.so") &&
+                   strcmp(package_file_owner("/usr/lib/app/VERSION"), "app") == 0;
+    printf("remove lib: %s\n", removed ? "ok" : "WRONG");
+
+    // 4.0 drops a module and needs lib again, and only its archive is
+    // published, so the upgrade goes through the pipeline
+    ok = system("cp -a " BENCH_DIR "/app-2.0 " BENCH_DIR "/app-4.0 && rm " BENCH_DIR "/app-4.0/lib/app/module-31.so") == 0 &&
+         publish("app", "4.0", true) && unlink(BENCH_DIR "/repo/app-4.0" PACKAGE_MANIFEST_SUFFIX) == 0 &&
+         package_manager_init() && register_package_on("app", "4.0", PACKAGE_STATE_INSTALLED, "lib") &&
+         register_package("lib", "1.0", PACKAGE_STATE_NOT_INSTALLED);
+    package_manager_configure(&config);
+    bool archived = ok && package_upgrade_all() &&
+                    system("diff -r " BENCH_DIR "/app-4.0/lib/app " BENCH_DIR "/root/usr/lib/app") == 0 &&
+                    !package_file_owner("/usr/lib/app/module-31.so") &&
+                    package_manifest_load(&target, BENCH_DIR "/manifests/app" PACKAGE_MANIFEST_SUFFIX);
+    if (archived) {
+        archived = strcmp(target.version, "4.0") == 0 &&
+                   package_entry(package_index("lib"))->state == PACKAGE_STATE_INSTALLED &&
+                   package_entry(package_index("lib"))->automatic &&
+                   strcmp(package_file_owner("/usr/lib/shared/module-00.so"), "lib") == 0;
+        package_manifest_free(&target);
+    }
+    printf("full-archive upgrade: %s\n", archived ? "ok" : "WRONG");
+    return intact && confined && removed && archived ? 0 : 1;
+}
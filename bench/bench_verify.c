@@ -0,0 +1,237 @@
+// Integrity verification benchmark
+//
+// Measures the SHA-256 kernels this CPU supports, one stream at a time and
+// through sha256_many() on chunk-sized messages, and checks every kernel
+// against the scalar one on messages of random lengths. It then installs
+// BENCH_PACKAGES generated packages, records their manifests as the
+// install pipeline would, and verifies them all with the page cache warm
+// and evicted. Finally a few files are edited, deleted or repointed and
+// each change must be reported. Exits non-zero if any check fails.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bench.h"
+#include "../packages/package_manager.h"
+#include "../packages/package_store.h"
+
+#define BENCH_PACKAGES 24
+#define BENCH_FILES 40
+#define BENCH_MAX_FILE (2 * 1024 * 1024)
+#define BENCH_KERNEL_BYTES (64 * 1024 * 1024)
+#define BENCH_CHUNK 8192
+#define BENCH_MESSAGES 4000
+#define BENCH_DIR "/tmp/promptos-bench-verify"
+
+static const Sha256Kernel kernels[] = { SHA256_KERNEL_SCALAR, SHA256_KERNEL_AVX2, SHA256_KERNEL_SHANI };
+
+static uint8_t* random_bytes(size_t size, uint64_t seed) {
+    uint8_t* data = malloc(size);
+    for (size_t i = 0; data && i < size; i += 8) {
+        uint64_t value = bench_random(&seed);
+        memcpy(data + i, &value, size - i < 8 ? size - i : 8);
+    }
+    return data;
+}
+
+// MB/s of one stream and of chunk-sized messages hashed together
+static void time_kernel(Sha256Kernel kernel, const uint8_t* data) {
+    static const void* messages[BENCH_KERNEL_BYTES / BENCH_CHUNK];
+    static size_t sizes[BENCH_KERNEL_BYTES / BENCH_CHUNK];
+    static uint8_t digests[BENCH_KERNEL_BYTES / BENCH_CHUNK][SHA256_DIGEST_SIZE];
+    size_t count = BENCH_KERNEL_BYTES / BENCH_CHUNK;
+    for (size_t i = 0; i < count; i++) {
+        messages[i] = data + i * BENCH_CHUNK;
+        sizes[i] = BENCH_CHUNK;
+    }
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint64_t begin = bench_now_ns();
+    sha256(data, BENCH_KERNEL_BYTES, digest);
+    double stream_s = (bench_now_ns() - begin) / 1e9;
+    begin = bench_now_ns();
+    sha256_many(messages, sizes, count, digests);
+    double many_s = (bench_now_ns() - begin) / 1e9;
+    printf("  %-7s %7.0f MB/s one stream, %7.0f MB/s in %d-byte messages\n", sha256_kernel_name(kernel),
+           BENCH_KERNEL_BYTES / 1e6 / stream_s, BENCH_KERNEL_BYTES / 1e6 / many_s, BENCH_CHUNK);
+}
+
+// Every kernel must agree with the scalar one, across padding boundaries
+static bool check_kernels(const uint8_t* data) {
+    static const void* messages[BENCH_MESSAGES];
+    static size_t sizes[BENCH_MESSAGES];
+    static uint8_t expected[BENCH_MESSAGES][SHA256_DIGEST_SIZE], actual[BENCH_MESSAGES][SHA256_DIGEST_SIZE];
+    uint64_t random_state = 0x2545f4914f6cdd1dULL;
+    for (int i = 0; i < BENCH_MESSAGES; i++) {
+        sizes[i] = i < 200 ? (size_t)i : bench_random(&random_state) % (3 * BENCH_CHUNK);
+        messages[i] = data + bench_random(&random_state) % 4096;
+    }
+    sha256_use_kernel(SHA256_KERNEL_SCALAR);
+    for (int i = 0; i < BENCH_MESSAGES; i++) {
+        sha256(messages[i], sizes[i], expected[i]);
+    }
+
+    bool ok = true;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!sha256_use_kernel(kernels[k])) {
+            continue;
+        }
+        memset(actual, 0, sizeof(actual));
+        sha256_many(messages, sizes, BENCH_MESSAGES, actual);
+        if (memcmp(actual, expected, sizeof(expected)) != 0) {
+            printf("kernel %s disagrees with scalar\n", sha256_kernel_name(kernels[k]));
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static bool write_file(const char* path, const uint8_t* data, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && write(fd, data, size) == (ssize_t)size;
+    if (fd >= 0) {
+        close(fd);
+    }
+    return ok;
+}
+
+// A package tree of files from a few bytes up to BENCH_MAX_FILE, plus a
+// symlink, recorded into the chunk store and a manifest
+static bool install_package(int package, const uint8_t* pool, uint64_t* bytes) {
+    char name[32], dir[PATH_MAX], path[PATH_MAX * 2];
+    snprintf(name, sizeof(name), "pkg-%02d", package);
+    snprintf(dir, sizeof(dir), BENCH_DIR "/root/%s", name);
+    snprintf(path, sizeof(path), "%s/lib", dir);
+    if (mkdir(dir, 0755) < 0 || mkdir(path, 0755) < 0) {
+        return false;
+    }
+
+    uint64_t random_state = 0x9e3779b97f4a7c15ULL + (uint64_t)package;
+    for (int f = 0; f < BENCH_FILES; f++) {
+        size_t size = f % 8 == 0 ? BENCH_MAX_FILE - bench_random(&random_state) % 4096
+                                 : bench_random(&random_state) % (BENCH_MAX_FILE / 8);
+        size_t offset = bench_random(&random_state) % (BENCH_KERNEL_BYTES - BENCH_MAX_FILE);
+        snprintf(path, sizeof(path), "%s/lib/file-%02d.bin", dir, f);
+        if (!write_file(path, pool + offset, size)) {
+            return false;
+        }
+        *bytes += size;
+    }
+    snprintf(path, sizeof(path), "%s/current", dir);
+    if (symlink("lib/file-00.bin", path) < 0) {
+        return false;
+    }
+
+    PackageManifest manifest;
+    PackageStoreWriter* writer = malloc(sizeof(PackageStoreWriter));
+    package_manifest_init(&manifest, name, "1.0");
+    bool ok = writer != NULL;
+    if (ok) {
+        package_store_writer_init(writer, BENCH_DIR "/chunks", &manifest);
+        ok = package_store_add_tree(writer, dir) && !writer->failed;
+    }
+    snprintf(path, sizeof(path), BENCH_DIR "/manifests/%s" PACKAGE_MANIFEST_SUFFIX, name);
+    ok = ok && package_manifest_save(&manifest, path);
+    free(writer);
+    package_manifest_free(&manifest);
+    return ok;
+}
+
+static void evict_tree(void) {
+    char path[PATH_MAX];
+    sync();
+    for (int p = 0; p < BENCH_PACKAGES; p++) {
+        for (int f = 0; f < BENCH_FILES; f++) {
+            snprintf(path, sizeof(path), BENCH_DIR "/root/pkg-%02d/lib/file-%02d.bin", p, f);
+            int fd = open(path, O_RDONLY | O_CLOEXEC);
+            if (fd >= 0) {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                close(fd);
+            }
+        }
+    }
+}
+
+static bool run_verify(const PackagePipelineConfig* config, const PackageVerifyTarget* targets,
+                       const char* label, PackageVerifyStats* stats) {
+    char report[512];
+    bool ok = package_verify_run(config, targets, BENCH_PACKAGES, stats);
+    package_verify_report(stats, report, sizeof(report));
+    printf("%s: %s", label, report);
+    return ok;
+}
+
+int main(void) {
+    uint8_t* pool = random_bytes(BENCH_KERNEL_BYTES, 0x853c49e6748fea9bULL);
+    if (!pool) {
+        return 1;
+    }
+
+    printf("SHA-256 kernels, %d MB (selected: %s)\n", BENCH_KERNEL_BYTES / 1000000,
+           sha256_kernel_name(sha256_kernel()));
+    Sha256Kernel selected = sha256_kernel();
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (sha256_use_kernel(kernels[k])) {
+            time_kernel(kernels[k], pool);
+        } else {
+            printf("  %-7s not supported\n", sha256_kernel_name(kernels[k]));
+        }
+    }
+    bool kernels_ok = check_kernels(pool);
+    sha256_use_kernel(selected);
+
+    if (system("rm -rf " BENCH_DIR) != 0 || mkdir(BENCH_DIR, 0755) < 0 ||
+        mkdir(BENCH_DIR "/root", 0755) < 0 || mkdir(BENCH_DIR "/manifests", 0755) < 0) {
+        perror(BENCH_DIR);
+        return 1;
+    }
+    uint64_t bytes = 0;
+    PackageVerifyTarget targets[BENCH_PACKAGES];
+    static char names[BENCH_PACKAGES][32];
+    for (int p = 0; p < BENCH_PACKAGES; p++) {
+        if (!install_package(p, pool, &bytes)) {
+            fprintf(stderr, "bench: cannot install package %d\n", p);
+            return 1;
+        }
+        snprintf(names[p], sizeof(names[p]), "pkg-%02d", p);
+        targets[p].name = names[p];
+        targets[p].install_path = names[p];
+    }
+    printf("%d packages, %d files, %.1f MB installed\n", BENCH_PACKAGES, BENCH_PACKAGES * (BENCH_FILES + 1),
+           bytes / 1e6);
+
+    PackagePipelineConfig config;
+    memset(&config, 0, sizeof(config));
+    config.manifest_dir = BENCH_DIR "/manifests";
+    config.root = BENCH_DIR "/root";
+    PackageVerifyStats stats;
+    bool ok = run_verify(&config, targets, "verify --all (warm)", &stats);
+    evict_tree();
+    ok &= run_verify(&config, targets, "verify --all (evicted)", &stats);
+    config.verify_workers = 1;
+    ok &= run_verify(&config, targets, "verify --all (warm, 1 worker)", &stats);
+    ok &= stats.files == (uint64_t)BENCH_PACKAGES * (BENCH_FILES + 1) && stats.bytes == bytes;
+    config.verify_workers = 0;
+
+    // Same-size edit, deletion and a repointed symlink must all be caught
+    int fd = open(BENCH_DIR "/root/pkg-03/lib/file-08.bin", O_WRONLY | O_CLOEXEC);
+    bool damaged = fd >= 0 && pwrite(fd, "x", 1, 1234567) == 1;
+    if (fd >= 0) {
+        close(fd);
+    }
+    damaged &= unlink(BENCH_DIR "/root/pkg-11/lib/file-05.bin") == 0 &&
+               unlink(BENCH_DIR "/root/pkg-20/current") == 0 &&
+               symlink("lib/file-01.bin", BENCH_DIR "/root/pkg-20/current") == 0;
+    bool detected = damaged && !run_verify(&config, targets, "verify --all (damaged)", &stats) &&
+                    stats.missing == 1 && stats.modified == 2;
+
+    printf("kernels agree: %s, clean tree passes: %s, damage caught: %s\n",
+           kernels_ok ? "ok" : "WRONG", ok ? "ok" : "WRONG", detected ? "ok" : "WRONG");
+    free(pool);
+    system("rm -rf " BENCH_DIR);
+    return kernels_ok && ok && detected ? 0 : 1;
+}
@@ -1,26 +1,48 @@
 ; PromptOS Stage 2 Bootloader
 ; Handles Linux kernel loading and boot protocol
 
-[BITS 16]                       ; Start in 16-bit real mode
+[BITS 16]                       ; Runs in real mode (unreal for copies above 1MB)
 [ORG 0x0000]                    ; We are loaded at segment 0x2000 by stage 1
 
-; Linux boot protocol constants
-BOOT_SIGNATURE     EQU 0xAA55   ; Boot signature
-SETUP_SECTS        EQU 4        ; Number of setup sectors
-SYSSIZE            EQU 0x8000   ; Size of protected-mode code in paragraphs
-BOOTPARAM_ADDR     EQU 0x90000  ; Boot parameter block address
-KERNEL_LOAD_ADDR   EQU 0x100000 ; Where to load the kernel (1MB)
-INITRD_LOAD_ADDR   EQU 0x800000 ; Where to load the initrd (8MB)
-STACK_SEGMENT      EQU 0x9000   ; Stack segment
-KERNEL_CMDLINE_ADDR EQU 0x92000 ; Kernel command line address
-
-; Boot parameters structure offsets
-BP_SETUP_SECTS     EQU 0x1F1    ; Offset of setup_sects in boot params
-BP_SYSSIZE         EQU 0x1F4    ; Offset of syssize in boot params
-BP_BOOTFLAG        EQU 0x1FE    ; Offset of boot_flag in boot params
-BP_TYPE_OF_LOADER  EQU 0x210    ; Offset of type_of_loader in boot params
-BP_LOADFLAGS       EQU 0x211    ; Offset of loadflags in boot params
-BP_CODE32_START    EQU 0x214    ; Offset of code32_start in boot params
+; Memory layout
+STAGE2_BASE        EQU 0x20000  ; Linear address of this code (segment 0x2000)
+STACK_SEGMENT      EQU 0x1000   ; Stack below stage 2
+LOAD_BUFFER_SEGMENT EQU 0x3000  ; Bounce buffer for reads above 1MB
+LOAD_CHUNK         EQU 127      ; Sectors per read; the most every BIOS accepts
+SETUP_SEGMENT      EQU 0x9000   ; Real-mode kernel (boot sector + setup)
+SETUP_ENTRY_SEGMENT EQU 0x9020  ; Setup code starts after the boot sector
+HEAP_END           EQU 0xDE00   ; End of the setup heap, below the command line
+CMDLINE_OFFSET     EQU 0xE000   ; Command line at 0x9E000
+KERNEL_LOAD_ADDR   EQU 0x100000 ; Protected-mode kernel (1MB)
+DEFAULT_MEMORY_TOP EQU 0x1000000 ; Used when INT 15h E801 is unavailable
+
+; Disk layout: stage 1 in LBA 0, stage 2 in LBA 1-8, then the bzImage.
+; The initrd follows the kernel; the image builder stores its size in
+; the kernel's ramdisk_size field.
+KERNEL_LBA         EQU 9
+
+; Setup header offsets (Linux boot protocol)
+BP_SETUP_SECTS     EQU 0x1F1    ; Setup sectors after the boot sector (0 means 4)
+BP_SYSSIZE         EQU 0x1F4    ; Protected-mode code size in 16-byte paragraphs
+BP_BOOT_FLAG       EQU 0x1FE    ; 0xAA55, the last field in the boot sector
+BP_HEADER          EQU 0x202    ; "HdrS"
+BP_VERSION         EQU 0x206    ; Boot protocol version
+BP_TYPE_OF_LOADER  EQU 0x210
+BP_LOADFLAGS       EQU 0x211
+BP_RAMDISK_IMAGE   EQU 0x218
+BP_RAMDISK_SIZE    EQU 0x21C
+BP_HEAP_END_PTR    EQU 0x224
+BP_CMD_LINE_PTR    EQU 0x228
+BP_INITRD_ADDR_MAX EQU 0x22C
+BP_INIT_SIZE       EQU 0x260    ; Memory the kernel needs from its load address
+
+HEADER_MAGIC       EQU 0x53726448 ; "HdrS"
+BOOT_FLAG          EQU 0xAA55
+MIN_PROTOCOL       EQU 0x0203   ; First version with initrd_addr_max
+INIT_SIZE_PROTOCOL EQU 0x020A   ; First version with init_size
+LOADED_HIGH        EQU 0x01
+CAN_USE_HEAP       EQU 0x80
+MAX_SETUP_SECTS    EQU 63       ; Setup must fit below HEAP_END
 
 start:
     ; Set up segments and stack
@@ -29,30 +51,8 @@ start:
     mov es, ax
     mov ax, STACK_SEGMENT
     mov ss, ax
-    mov sp, 0xFFFF             ; Set up stack pointer
-
-    ; Initialize boot parameters
-    mov ax, BOOTPARAM_ADDR >> 4
-    mov es, ax
-    xor di, di
-    mov cx, 4096
-    xor al, al
-    rep stosb                  ; Clear boot parameter block
-
-    ; Set up boot parameters
-    mov byte [es:BP_SETUP_SECTS], SETUP_SECTS
-    mov dword [es:BP_SYSSIZE], SYSSIZE
-    mov word [es:BP_BOOTFLAG], BOOT_SIGNATURE
-    mov byte [es:BP_TYPE_OF_LOADER], 0xFF  ; Custom bootloader
-    mov byte [es:BP_LOADFLAGS], 0x01      ; LOADED_HIGH flag
-    mov dword [es:BP_CODE32_START], KERNEL_LOAD_ADDR
-
-    ; Copy kernel command line
-    mov ax, KERNEL_CMDLINE_ADDR >> 4
-    mov es, ax
-    xor di, di
-    mov si, kernel_cmdline
-    call copy_string
+    mov sp, 0xFFFE             ; Set up stack pointer
+    mov [boot_drive], dl       ; Stage 1 leaves the BIOS drive in DL
 
     ; Print stage 2 message
     mov si, stage2_msg
@@ -62,46 +62,297 @@ start:
     call enable_a20
     jc a20_error
 
-    ; Load GDT
-    cli                         ; Disable interrupts
-    lgdt [gdt_descriptor]       ; Load GDT descriptor
+    ; Extended reads (AH=42h) take a 64-bit LBA instead of CHS numbers
+    mov ah, 0x41
+    mov bx, 0x55AA
+    mov dl, [boot_drive]
+    int 0x13
+    jc lba_error
+    cmp bx, 0xAA55
+    jne lba_error
+    test cx, 1                 ; Packet interface supported
+    jz lba_error
 
-    ; Switch to protected mode
-    mov eax, cr0
-    or eax, 1                   ; Set protected mode bit
-    mov cr0, eax
+    call enter_unreal
+    call detect_memory
 
-    ; Load the kernel
-    mov ax, 0x1000
+    call read_ticks
+    mov [load_start_ticks], eax
+
+    ; Boot sector first: it holds setup_sects, and the rest of the setup
+    ; header is in the sectors after it
+    mov ax, SETUP_SEGMENT
     mov es, ax
     xor bx, bx
+    mov eax, KERNEL_LBA
+    mov cx, 1
+    call read_sectors
+    jc kernel_load_error
+
+    cmp word [es:BP_BOOT_FLAG], BOOT_FLAG
+    jne kernel_format_error
+    movzx cx, byte [es:BP_SETUP_SECTS]
+    test cx, cx
+    jnz .setup_sects
+    mov cx, 4
+.setup_sects:
+    cmp cx, MAX_SETUP_SECTS
+    ja kernel_format_error
+    mov [setup_sects], cx
+
+    ; Rest of the setup code, right after the boot sector
+    mov eax, KERNEL_LBA + 1
+    mov bx, 0x200
+    call read_sectors
+    jc kernel_load_error
+
+    ; Only now is the whole setup header in memory
+    cmp dword [es:BP_HEADER], HEADER_MAGIC
+    jne kernel_format_error
+    cmp word [es:BP_VERSION], MIN_PROTOCOL
+    jb kernel_format_error
+    test byte [es:BP_LOADFLAGS], LOADED_HIGH
+    jz kernel_format_error     ; zImage kernels are not supported
+
+    ; Protected-mode kernel: syssize paragraphs, rounded up to sectors
+    mov ecx, [es:BP_SYSSIZE]
+    shl ecx, 4
+    lea edx, [ecx + KERNEL_LOAD_ADDR]
+    mov [kernel_end], edx
+    ; The kernel decompresses in place and needs init_size bytes from its
+    ; load address, which is usually well past the end of the image
+    cmp word [es:BP_VERSION], INIT_SIZE_PROTOCOL
+    jb .kernel_end_set
+    mov edx, [es:BP_INIT_SIZE]
+    add edx, KERNEL_LOAD_ADDR
+    jc kernel_format_error
+    cmp edx, [kernel_end]
+    jbe .kernel_end_set
+    mov [kernel_end], edx
+.kernel_end_set:
+    add ecx, 511
+    shr ecx, 9
+    movzx eax, word [setup_sects]
+    add eax, KERNEL_LBA + 1
+    mov edi, KERNEL_LOAD_ADDR
+    call load_high
+    jc kernel_load_error
+    add eax, ecx               ; The initrd starts where the kernel ends
+    mov [initrd_lba], eax
+
+    ; Initrd: as high as the kernel allows, clear of the area it
+    ; decompresses into
+    mov ecx, [es:BP_RAMDISK_SIZE]
+    test ecx, ecx
+    jz .loaded
+    mov edi, [es:BP_INITRD_ADDR_MAX]
+    inc edi
+    jz .initrd_clamp           ; No limit below 4GB
+    cmp edi, [memory_top]
+    jbe .initrd_top
+.initrd_clamp:
+    mov edi, [memory_top]
+.initrd_top:
+    sub edi, ecx
+    jb initrd_load_error
+    and edi, 0xFFFFF000
+    cmp edi, [kernel_end]
+    jb initrd_load_error
+    mov [es:BP_RAMDISK_IMAGE], edi
+    add ecx, 511
+    shr ecx, 9
+    mov eax, [initrd_lba]
+    call load_high
+    jc initrd_load_error
+
+.loaded:
+    call read_ticks
+    sub eax, [load_start_ticks]
+    mov edx, 55                ; One BIOS tick is about 55 ms
+    mul edx
+    mov si, load_time_msg
+    call print_string
+    call print_dec
+    mov si, ms_msg
+    call print_string
 
-    ; Read kernel setup sectors
-    mov ah, 0x02
-    mov al, SETUP_SECTS
-    mov ch, 0
-    mov cl, 10          ; Start after bootloader and stage2
-    mov dh, 0
-    mov dl, [boot_drive]
-    int 0x13
-    jc disk_error
+    ; Tell the kernel who loaded it and where everything is
+    mov byte [es:BP_TYPE_OF_LOADER], 0xFF  ; Undefined loader
+    or byte [es:BP_LOADFLAGS], CAN_USE_HEAP
+    mov word [es:BP_HEAP_END_PTR], HEAP_END
+    mov dword [es:BP_CMD_LINE_PTR], (SETUP_SEGMENT << 4) + CMDLINE_OFFSET
+
+    ; Copy kernel command line
+    mov di, CMDLINE_OFFSET
+    mov si, kernel_cmdline
+    call copy_string
 
-    ; Read kernel protected mode code
-    mov ax, KERNEL_LOAD_ADDR >> 4
+    ; Enter the setup code as the 16-bit boot protocol describes
+    cli
+    mov ax, SETUP_SEGMENT
+    mov ds, ax
     mov es, ax
-    xor bx, bx
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov sp, CMDLINE_OFFSET
+    jmp SETUP_ENTRY_SEGMENT:0x0000
+
+; Function: read_sectors
+; Reads sectors with the INT 13h extensions, retrying after a disk reset
+; Input: EAX = first LBA, CX = sector count (1-127), ES:BX = buffer
+; Output: CF set on error
+read_sectors:
+    pushad
+    mov bp, cx
+    mov di, 3                  ; Retry counter
+.retry:
+    mov [disk_packet.count], bp  ; The BIOS overwrites it on failure
+    mov [disk_packet.offset], bx
+    mov [disk_packet.segment], es
+    mov [disk_packet.lba], eax
+    mov dword [disk_packet.lba + 4], 0
+    mov si, disk_packet
+    mov ah, 0x42
+    mov dl, [boot_drive]
+    int 0x13
+    jnc .done
 
-    mov ah, 0x02
-    mov al, 127         ; Read remaining sectors
-    mov ch, 0
-    mov cl, 14          ; Start after setup sectors
-    mov dh, 0
+    ; On error, reset disk and retry
+    mov ah, 0x00
     mov dl, [boot_drive]
     int 0x13
-    jc disk_error
+    mov eax, [disk_packet.lba]
+    dec di
+    jnz .retry
+    stc
+.done:
+    popad
+    ret
+
+; Function: load_high
+; Streams sectors to memory above 1MB, LOAD_CHUNK sectors per read,
+; through the bounce buffer with dword copies
+; Input: EAX = first LBA, ECX = sector count, EDI = linear destination
+; Output: CF set on error
+load_high:
+    pushad
+.next:
+    test ecx, ecx
+    jz .done
+    mov edx, ecx
+    cmp edx, LOAD_CHUNK
+    jbe .read
+    mov edx, LOAD_CHUNK
+.read:
+    push ecx
+    push es
+    push word LOAD_BUFFER_SEGMENT
+    pop es
+    xor bx, bx
+    mov cx, dx
+    call read_sectors
+    pop es
+    jc .fail
+
+    call enter_unreal          ; The BIOS may have reset the segment limits
+    push ds
+    push es
+    xor cx, cx
+    mov ds, cx
+    mov es, cx
+    mov esi, LOAD_BUFFER_SEGMENT << 4
+    mov ecx, edx
+    shl ecx, 7                 ; 128 dwords per sector
+    cld
+    a32 rep movsd              ; Advances EDI to the next chunk
+    pop es
+    pop ds
+    pop ecx
+
+    add eax, edx
+    sub ecx, edx
+    jmp .next
+
+.fail:
+    pop ecx
+    popad
+    stc
+    ret
+.done:
+    popad
+    clc
+    ret
+
+; Function: enter_unreal
+; Gives DS and ES a 4GB limit, then returns to real mode with their
+; values unchanged, so 32-bit offsets reach all of memory
+enter_unreal:
+    push eax
+    push bx
+    push ds
+    push es
+    cli
+    lgdt [gdt_descriptor]
+    mov eax, cr0
+    or al, 1                   ; Set protected mode bit
+    mov cr0, eax
+    jmp $+2
+    mov bx, 0x10               ; Flat data segment
+    mov ds, bx
+    mov es, bx
+    and al, 0xFE               ; Back to real mode; the limits stay
+    mov cr0, eax
+    pop es
+    pop ds
+    sti
+    pop bx
+    pop eax
+    ret
+
+; Function: detect_memory
+; Sets memory_top to the end of contiguous memory above 1MB
+detect_memory:
+    pushad
+    mov dword [memory_top], DEFAULT_MEMORY_TOP
+    xor cx, cx
+    xor dx, dx
+    mov ax, 0xE801
+    int 0x15
+    jc .done
+    jcxz .use_ax               ; Some BIOSes only report in AX/BX
+    mov ax, cx
+    mov bx, dx
+.use_ax:
+    test bx, bx
+    jz .below_16mb
+    movzx eax, bx              ; 64KB blocks above 16MB
+    shl eax, 16
+    add eax, 0x1000000
+    mov [memory_top], eax
+    jmp .done
+.below_16mb:
+    movzx eax, ax              ; KB between 1MB and 16MB
+    shl eax, 10
+    add eax, 0x100000
+    mov [memory_top], eax
+.done:
+    popad
+    ret
 
-    ; Jump to 32-bit code
-    jmp 0x08:protected_mode     ; Far jump to code segment
+; Function: read_ticks
+; Output: EAX = BIOS ticks since midnight
+read_ticks:
+    push cx
+    push dx
+    xor ah, ah
+    int 0x1A
+    mov ax, cx
+    shl eax, 16
+    mov ax, dx
+    pop dx
+    pop cx
+    ret
 
 ; Function: enable_a20
 ; Enables A20 line using BIOS
@@ -172,114 +423,55 @@ print_string:
     popa
     ret
 
+; Function: print_dec
+; Input: EAX = unsigned number to print
+print_dec:
+    pushad
+    mov ebx, 10
+    xor cx, cx
+.divide:
+    xor edx, edx
+    div ebx
+    push dx                    ; Digits come out lowest first
+    inc cx
+    test eax, eax
+    jnz .divide
+.print:
+    pop ax
+    add al, '0'
+    mov ah, 0x0E
+    xor bx, bx
+    int 0x10
+    loop .print
+    popad
+    ret
+
 a20_error:
     mov si, a20_error_msg
-    call print_string
-    jmp $                      ; Infinite loop
+    jmp fatal
 
-[BITS 32]                       ; 32-bit protected mode code
-protected_mode:
-    ; Set up segment registers
-    mov ax, 0x10               ; Data segment selector
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
-    mov ss, ax
+lba_error:
+    mov si, lba_error_msg
+    jmp fatal
 
-    ; Set up stack
-    mov esp, 0x90000
-
-    ; Set up boot parameters
-    mov eax, BOOTPARAM_ADDR
-    mov dword [eax], 0x53726448 ; Header signature (HdrS)
-    mov word [eax+0x1F1], 0x207 ; Boot protocol version 2.07
-    mov byte [eax+0x210], 0x80  ; Type of loader: boot protocol 2.00+
-    mov byte [eax+0x211], 0x01  ; Loader flags: LOADED_HIGH
-    mov dword [eax+0x214], 0    ; kernel_start
-    mov dword [eax+0x218], INITRD_LOAD_ADDR  ; ramdisk_image
-    mov dword [eax+0x21C], 0    ; ramdisk_size (to be filled)
-    mov dword [eax+0x228], KERNEL_CMDLINE_ADDR ; cmd_line_ptr
-    mov dword [eax+0x22C], 0    ; initrd_size_max
-
-    ; Load kernel setup sectors
-    mov eax, 0x02                ; BIOS read sectors function
-    mov cx, SETUP_SECTS          ; Number of sectors to read
-    mov bx, 0x1000              ; Temporary buffer for setup sectors
-    mov dl, [boot_drive]         ; Drive number
-    mov dh, 0                    ; Head 0
-    mov ch, 0                    ; Cylinder 0
-    mov cl, 2                    ; Start from sector 2
-    int 0x13                     ; BIOS disk interrupt
-    jc kernel_load_error         ; If carry flag set, error occurred
-
-    ; Load protected-mode kernel
-    mov eax, 0x02                ; BIOS read sectors function
-    mov cx, [0x1000 + 0x1F4]    ; Read protected-mode kernel size
-    mov bx, 0x10000             ; Temporary buffer
-    mov dl, [boot_drive]         ; Drive number
-    mov dh, 0                    ; Head 0
-    mov ch, 0                    ; Cylinder 0
-    mov cl, 6                    ; Start from sector 6
-    int 0x13                     ; BIOS disk interrupt
-    jc kernel_load_error         ; If carry flag set, error occurred
-
-    ; Copy kernel to high memory
-    mov esi, 0x10000            ; Source: temporary buffer
-    mov edi, KERNEL_LOAD_ADDR    ; Destination: final kernel location
-    mov ecx, [0x1000 + 0x1F4]   ; Size of protected-mode kernel
-    shl ecx, 4                  ; Convert to bytes (multiply by 16)
-    rep movsb                    ; Copy kernel
-
-    ; Copy setup sectors to high memory
-    mov esi, 0x1000             ; Source: temporary buffer
-    mov edi, KERNEL_LOAD_ADDR    ; Destination: final kernel location
-    mov ecx, SETUP_SECTS * 512   ; Number of bytes to copy
-    rep movsb                    ; Copy setup sectors
-
-    ; Load initrd
-    mov eax, 0x02                ; BIOS read sectors function
-    mov cx, 32                   ; Number of sectors for initrd (adjust as needed)
-    mov bx, INITRD_LOAD_ADDR     ; Buffer to load into
-    mov dl, [boot_drive]         ; Drive number
-    mov dh, 0                    ; Head 0
-    mov ch, 0                    ; Cylinder 0
-    mov cl, 6                    ; Start from sector 6 (after kernel)
-    int 0x13                     ; BIOS disk interrupt
-    jc initrd_load_error         ; If carry flag set, error occurred
-
-    ; Set up command line
-    mov esi, kernel_cmdline      ; Source: command line string
-    mov edi, KERNEL_CMDLINE_ADDR ; Destination: command line buffer
-    mov ecx, cmdline_len         ; Length of command line
-    rep movsb                    ; Copy command line
-    mov byte [edi], 0           ; Null terminate
-
-    ; Update boot parameters
-    mov eax, BOOTPARAM_ADDR
-    mov dword [eax+0x228], 0x92000  ; Set command line pointer
-    mov dword [eax+0x21C], 0x100000 ; Set initrd size (adjust as needed)
-
-    ; Jump to kernel entry point
-    mov eax, KERNEL_LOAD_ADDR
-    add eax, 0x1000              ; Kernel entry point offset
-    jmp eax
-
-    ; Should never reach here
-    cli
-    hlt
+kernel_format_error:
+    mov si, kernel_format_msg
+    jmp fatal
 
 kernel_load_error:
     mov si, kernel_error_msg
-    call print_string
-    jmp $
+    jmp fatal
 
 initrd_load_error:
     mov si, initrd_error_msg
+
+fatal:
+    mov ax, cs
+    mov ds, ax
     call print_string
-    jmp $
+    jmp $                      ; Infinite loop
 
-; Global Descriptor Table
+; Global Descriptor Table, only used to enter unreal mode
 gdt_start:
     ; Null descriptor
     dd 0x0
@@ -304,16 +496,34 @@ gdt_end:
 
 gdt_descriptor:
     dw gdt_end - gdt_start - 1  ; GDT size
-    dd gdt_start                ; GDT address
+    dd gdt_start + STAGE2_BASE  ; GDT linear address
+
+; Disk address packet for INT 13h AH=42h
+align 4
+disk_packet:
+    db 0x10                     ; Packet size
+    db 0
+.count:   dw 0                  ; Sectors to transfer
+.offset:  dw 0                  ; Buffer offset
+.segment: dw 0                  ; Buffer segment
+.lba:     dq 0                  ; First sector
 
 ; Data
 stage2_msg db 'PromptOS Stage 2 Bootloader...', 13, 10, 0
 a20_error_msg db 'A20 Line Enable Failed!', 13, 10, 0
+lba_error_msg db 'BIOS LBA Extensions Not Supported!', 13, 10, 0
+kernel_format_msg db 'Unsupported Kernel Image!', 13, 10, 0
 kernel_error_msg db 'Kernel Load Failed!', 13, 10, 0
 initrd_error_msg db 'InitRD Load Failed!', 13, 10, 0
+load_time_msg db 'Kernel and InitRD loaded in ', 0
+ms_msg db ' ms', 13, 10, 0
 kernel_cmdline db 'root=/dev/ram0 init=/sbin/init console=tty0', 0
-cmdline_len equ $ - kernel_cmdline
 boot_drive db 0
+setup_sects dw 0
+kernel_end dd 0
+initrd_lba dd 0
+memory_top dd 0
+load_start_ticks dd 0
 
 ; Function: copy_string
 ; Input: DS:SI = source string, ES:DI = destination
@@ -325,4 +535,4 @@ copy_string:
     test al, al
     jnz .loop
     pop ax
-    ret
\ No newline at end of file
+    ret
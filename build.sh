@@ -100,6 +100,49 @@ build_bootloader() {
     nasm -f bin bootloader/stage2.asm -o "$BUILD_DIR/boot/stage2.bin"
 }
 
+# Build the host benchmarks: the service manager, package manager and init
+# compiled into a host library and linked into each bench/bench_*.c program.
+# init.c keeps a fixed service table, sized up here for the workloads.
+build_bench() {
+    echo "Building host benchmarks..."
+    local out="$BUILD_DIR/bench"
+    local cflags="-O2 -g -Wall -Wextra -Wno-format-truncation -pthread -DMAX_SERVICES=16384"
+    local sources="system/service_manager.c init/init.c
+        packages/package_manager.c packages/package_db.c packages/package_solver.c
+        packages/package_pipeline.c packages/package_store.c packages/package_files.c
+        packages/package_verify.c packages/package_sync.c
+        system/libs/name_registry.c system/libs/arena.c system/libs/sha256.c
+        system/libs/boot_trace.c system/libs/metrics.c system/libs/readahead.c
+        system/libs/klog.c system/libs/cgroup.c system/libs/unit_file.c system/libs/control.c
+        system/syslog_service.c kernel/init.c kernel/init_table.c"
+    mkdir -p "$out/obj"
+
+    local objects=""
+    for source in $sources; do
+        # Named after the path: init/init.c and kernel/init.c both exist
+        local object="$out/obj/$(echo "${source%.c}" | tr / _).o"
+        gcc $cflags -c "$source" -o "$object"
+        objects="$objects $object"
+    done
+    rm -f "$out/libpromptos-host.a"
+    ar rcs "$out/libpromptos-host.a" $objects
+
+    for bench in bench/bench_*.c; do
+        gcc $cflags "$bench" bench/bench.c "$out/libpromptos-host.a" -lz -lrt \
+            -o "$out/$(basename "$bench" .c)"
+    done
+    echo "Benchmarks built in $out; run them with ./build.sh bench run"
+}
+
+# Run every benchmark in turn
+run_bench() {
+    for bench in "$BUILD_DIR"/bench/bench_*; do
+        echo ""
+        echo "== $(basename "$bench")"
+        "$bench"
+    done
+}
+
 # Create ISO
 create_iso() {
     echo "Creating ISO image..."
@@ -122,7 +165,15 @@ main() {
     echo "Build complete! ISO image created as $ISO_FILE"
 }
 
-# Run the build
+# Run the build; "./build.sh bench" builds only the host benchmarks and
+# "./build.sh bench run" also runs them
+if [ "$1" = "bench" ]; then
+    build_bench
+    if [ "$2" = "run" ]; then
+        run_bench
+    fi
+    exit 0
+fi
 main
 echo ""
 echo "To run in VMware:"
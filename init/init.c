@@ -1,40 +1,207 @@
+#define _GNU_SOURCE
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/mount.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/reboot.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include "../system/libs/name_registry.h"
+#include "../system/libs/boot_trace.h"
+#include "../system/libs/readahead.h"
+#include "../system/libs/klog.h"
+#include "../system/libs/cgroup.h"
+#include "../system/libs/unit_file.h"
+#include "../system/libs/control.h"
 
 // Maximum number of services that can be managed
+#ifndef MAX_SERVICES
 #define MAX_SERVICES 64
+#endif
 #define SHELL_PATH "/bin/bash"
 #define DEFAULT_PATH "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin"
 
+// Supervisor configuration
+#define MAX_EVENTS 64
+#define PID_TABLE_SIZE (MAX_SERVICES * 2)   // Power of two
+#define RESPAWN_WINDOW_SEC 10
+#define RESPAWN_LIMIT 5
+
+// Socket activation
+#define MAX_LISTENERS 4            // Pre-bound fds per service
+#define LISTEN_FDS_START 3         // First fd a service receives (sd_listen_fds)
+#define ACTIVATION_LIMIT 20        // Activations per RESPAWN_WINDOW_SEC
+
+// Control socket
+#define MAX_CONTROL_CLIENTS 64
+#define CONTROL_INPUT_SIZE (sizeof(ControlHeader) + CONTROL_MAX_REQUEST)
+#define CONTROL_BATCH 256          // Replies per write, two iovecs each
+#define CONTROL_BATCH_BYTES (1024 * 1024)   // Reply bodies per write, before the last one
+
+// Boot readahead recording stops once boot has settled
+#define BOOT_SETTLE_MS 5000        // Without a service start for this long
+#define BOOT_SETTLE_MAX_MS 60000   // Or this long after it began, whichever is first
+
+// Shutdown
+#define STOP_TIMEOUT_MS 5000       // SIGTERM to SIGKILL, unless the service sets its own
+#define KILL_WAIT_MS 2000          // After SIGKILL, before giving up on a process
+#define ORPHAN_TIMEOUT_MS 2000     // For processes no service owns, per signal
+#define MAX_MOUNTS 256
+
 // Service states
 typedef enum {
     SERVICE_STOPPED,
     SERVICE_STARTING,
     SERVICE_RUNNING,
     SERVICE_STOPPING,
-    SERVICE_FAILED
+    SERVICE_FAILED,
+    SERVICE_LISTENING          // Sockets bound; started on first use
 } service_state_t;
 
+// Kinds of pre-bound activation endpoints
+typedef enum {
+    LISTEN_STREAM,             // Unix stream socket, listening
+    LISTEN_DATAGRAM,           // Unix datagram socket
+    LISTEN_FIFO                // Named pipe, held open read-write by init
+} listen_kind_t;
+
+// What to do once everything is stopped
+typedef enum {
+    SHUTDOWN_NONE,
+    SHUTDOWN_REBOOT,           // SIGINT (Ctrl-Alt-Del)
+    SHUTDOWN_HALT,             // SIGUSR1
+    SHUTDOWN_POWEROFF          // SIGUSR2 or SIGPWR
+} shutdown_t;
+
 // Service structure
 typedef struct {
     char name[32];
     char exec_path[256];
     service_state_t state;
     int pid;
+    int pidfd;                 // Process handle watched by the event loop
+    int exit_status;           // Last wait status
     bool autostart;
+    bool respawn;              // Restart when the process exits
     int priority;
-    char dependencies[8][32];  // Up to 8 dependencies
+    int32_t dependencies[8];   // Up to 8 dependencies, as interned name ids
     int dep_count;
+    time_t respawn_window;     // Start of the current respawn window
+    int respawn_count;
+    int listen_fds[MAX_LISTENERS];  // Handed to the service from fd 3 up
+    int listen_count;
+    bool parked;               // Listening, fds out of epoll until a dependency starts
+    ServiceType type;          // Picks the cgroup slice
+    uint64_t memory_max;       // Declared limits, 0 for none
+    uint32_t cpu_max_percent;
+    int stop_timeout_ms;       // SIGTERM to SIGKILL
+    int dependents;            // Shutdown: running services that need this one
+    bool killed;               // Shutdown: SIGKILL sent
+    uint64_t stop_begin_ns;
+    uint64_t stop_deadline_ns;
 } service_t;
 
+// Event loop sources, encoded in the upper half of epoll_data.u64
+typedef enum {
+    EVENT_SIGNAL,
+    EVENT_PIDFD,
+    EVENT_LISTEN,              // Activity on a listening service's fd
+    EVENT_CONTROL,             // Connection on the control socket
+    EVENT_CONTROL_CLIENT,      // Requests from a control connection
+    EVENT_SETTLE               // Boot settle timer expired
+} event_kind_t;
+
+// Control socket connection
+typedef struct {
+    int fd;
+    uint8_t* input;            // CONTROL_INPUT_SIZE bytes; NULL when the slot is free
+    size_t input_used;
+    uint8_t* output;           // Replies the client has not taken yet
+    size_t output_size;
+    size_t output_sent;
+} control_client_t;
+
 // Global service table
 static service_t services[MAX_SERVICES];
 static int service_count = 0;
+static NameRegistry service_names;
+
+// Supervisor state
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static int running_count = 0;
+static int listening_count = 0;
+static int parked_services[MAX_SERVICES];   // Indices of parked listeners
+static int parked_count = 0;
+static Klog system_log;        // Service events, drained by the syslog service
+static bool cgroups_enabled = false;
+static bool shutting_down = false;
+static shutdown_t shutdown_requested = SHUTDOWN_NONE;
+static UnitRecord unit_storage[MAX_SERVICES];  // Parsed units when the cache is stale
+static int settle_fd = -1;     // Boot settle timer while readahead records
+static uint64_t settle_limit_ns;
+static struct {
+    pid_t pid;
+    int index;
+} pid_table[PID_TABLE_SIZE];
+
+// Control socket state; reply bodies are built in one buffer shared by
+// all connections, since the event loop serves them one at a time
+static int control_fd = -1;
+static char control_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static control_client_t control_clients[MAX_CONTROL_CLIENTS];
+static uint8_t* control_reply;
+static size_t control_reply_capacity;
+
+// Timing of the last stop_all_services() run
+static struct {
+    uint64_t wall_ns;          // First SIGTERM to last exit
+    uint64_t serial_ns;        // Sum of every service's SIGTERM-to-exit time
+    int stopped;
+    int killed;                // Needed SIGKILL
+    int abandoned;             // Survived SIGKILL; stopped waiting for them
+} shutdown_report;
+
+bool clear_services(void);
+bool supervisor_init(void);
+bool register_service(const char* name, const char* exec_path, bool autostart, int priority);
+bool add_listener(const char* name, listen_kind_t kind, const char* path);
+bool add_dependency(const char* name, const char* dependency);
+bool set_stop_timeout(const char* name, int timeout_ms);
+bool start_service(const char* name);
+bool stop_service(const char* name);
+bool stop_all_services(void);
+void shutdown_report_text(char* buffer, size_t size);
+bool system_shutdown(shutdown_t action);
+bool set_service_resources(const char* name, ServiceType type, uint64_t memory_max,
+                           uint32_t cpu_max_percent);
+bool read_service_pressure(const char* name, CgroupPressure* pressure);
+bool control_open(const char* path);
+void control_close(void);
+bool supervise(void);
+static service_t* find_service(const char* name);
+static void control_accept(void);
+static void control_client_event(int slot);
+static void boot_settle_arm(void);
+static void boot_settled(void);
+static bool start_autostart_services(void);
+static int register_units(void);
+static void register_builtin_services(void);
 
 // Set up basic environment
 void setup_environment(void) {
@@ -44,57 +211,605 @@ void setup_environment(void) {
     setenv("SHELL", SHELL_PATH, 1);
 }
 
-// Launch interactive shell
-void launch_shell(void) {
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t event_key(event_kind_t kind, int index) {
+    return ((uint64_t)kind << 32) | (uint32_t)index;
+}
+
+// Map a child pid to its service index in O(1)
+static void pid_table_insert(pid_t pid, int index) {
+    unsigned slot = (unsigned)pid & (PID_TABLE_SIZE - 1);
+    while (pid_table[slot].pid != 0) {
+        slot = (slot + 1) & (PID_TABLE_SIZE - 1);
+    }
+    pid_table[slot].pid = pid;
+    pid_table[slot].index = index;
+}
+
+static int pid_table_remove(pid_t pid) {
+    unsigned slot = (unsigned)pid & (PID_TABLE_SIZE - 1);
+    while (pid_table[slot].pid != pid) {
+        if (pid_table[slot].pid == 0) {
+            return -1;
+        }
+        slot = (slot + 1) & (PID_TABLE_SIZE - 1);
+    }
+    int index = pid_table[slot].index;
+
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    unsigned hole = slot;
+    for (;;) {
+        slot = (slot + 1) & (PID_TABLE_SIZE - 1);
+        if (pid_table[slot].pid == 0) {
+            break;
+        }
+        unsigned home = (unsigned)pid_table[slot].pid & (PID_TABLE_SIZE - 1);
+        if (((slot - home) & (PID_TABLE_SIZE - 1)) >= ((slot - hole) & (PID_TABLE_SIZE - 1))) {
+            pid_table[hole] = pid_table[slot];
+            hole = slot;
+        }
+    }
+    pid_table[hole].pid = 0;
+    return index;
+}
+
+// Set up the event loop: SIGCHLD and the shutdown requests are blocked
+// and delivered through a signalfd
+bool supervisor_init(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    sigaddset(&mask, SIGPWR);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        perror("sigprocmask");
+        return false;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        return false;
+    }
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        perror("signalfd");
+        return false;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = event_key(EVENT_SIGNAL, 0) };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        return false;
+    }
+
+    memset(pid_table, 0, sizeof(pid_table));
+    return true;
+}
+
+// Take a listening service's fds out of epoll until one of the services
+// it depends on starts. Left armed, a connection it cannot be started for
+// would fire on every pass of the loop.
+static void park_listeners(service_t* service) {
+    for (int i = 0; i < service->listen_count; i++) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, service->listen_fds[i], NULL);
+    }
+    if (!service->parked) {
+        service->parked = true;
+        parked_services[parked_count++] = (int)(service - services);
+    }
+}
+
+// A service started or began listening: watch the parked listeners again,
+// so one whose dependencies are now up is activated by its queued clients
+static void unpark_listeners(void) {
+    int count = parked_count;
+    parked_count = 0;
+    for (int p = 0; p < count; p++) {
+        service_t* service = &services[parked_services[p]];
+        if (service->parked && service->state == SERVICE_LISTENING) {
+            int index = (int)(service - services);
+            for (int i = 0; i < service->listen_count; i++) {
+                struct epoll_event ev = { .events = EPOLLIN, .data.u64 = event_key(EVENT_LISTEN, index) };
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, service->listen_fds[i], &ev);
+            }
+        }
+        service->parked = false;
+    }
+}
+
+// Watch a service's listening fds; the first activity starts it
+static void arm_listeners(service_t* service) {
+    int index = (int)(service - services);
+    for (int i = 0; i < service->listen_count; i++) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = event_key(EVENT_LISTEN, index) };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, service->listen_fds[i], &ev);
+    }
+    if (service->state != SERVICE_LISTENING) {
+        service->state = SERVICE_LISTENING;
+        listening_count++;
+        unpark_listeners();
+    }
+}
+
+// Stop watching while the service itself owns the fds
+static void disarm_listeners(service_t* service) {
+    for (int i = 0; i < service->listen_count; i++) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, service->listen_fds[i], NULL);
+    }
+    if (service->state == SERVICE_LISTENING) {
+        listening_count--;
+    }
+}
+
+// In the child: move the listening fds to 3, 4, ... and describe them
+// in LISTEN_FDS/LISTEN_PID, as sd_listen_fds() expects
+static void pass_listeners(const service_t* service) {
+    int count = service->listen_count;
+    int moved[MAX_LISTENERS];
+    char value[16];
+
+    // Copy above the target range first so no fd is overwritten early
+    for (int i = 0; i < count; i++) {
+        moved[i] = fcntl(service->listen_fds[i], F_DUPFD_CLOEXEC, LISTEN_FDS_START + count);
+    }
+    for (int i = 0; i < count; i++) {
+        dup2(moved[i], LISTEN_FDS_START + i);   // The copy at 3 + i is inheritable
+        close(moved[i]);
+    }
+
+    snprintf(value, sizeof(value), "%d", count);
+    setenv("LISTEN_FDS", value, 1);
+    snprintf(value, sizeof(value), "%d", (int)getpid());
+    setenv("LISTEN_PID", value, 1);
+}
+
+// Fork and exec a service in its own cgroup, and watch its pidfd from the
+// event loop
+static bool spawn_service(service_t* service) {
+    char cgroup[CGROUP_MAX_PATH];
+    bool grouped = false;
+    if (cgroups_enabled && cgroup_service_path(service->type, service->name, cgroup, sizeof(cgroup))) {
+        CgroupLimits limits;
+        cgroup_limits_for(service->type, service->priority, service->memory_max,
+                          service->cpu_max_percent, &limits);
+        grouped = cgroup_create(cgroup, &limits);
+    }
+
     pid_t pid = fork();
     
     if (pid < 0) {
         perror("fork");
-        return;
+        return false;
     }
     
     if (pid == 0) {
         // Child process
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        if (service->listen_count > 0) {
+            pass_listeners(service);
+        }
+        // Joined before exec, so everything the service forks stays in the group
+        if (grouped) {
+            cgroup_attach(cgroup, 0);
+        }
 
-        execl(SHELL_PATH, "bash", NULL);
+        const char* argv0 = strrchr(service->exec_path, '/');
+        argv0 = argv0 ? argv0 + 1 : service->exec_path;
+        execl(service->exec_path, argv0, (char*)NULL);
         perror("execl");
-        exit(1);
+        _exit(127);
     }
     
-    // Parent process
+    int index = (int)(service - services);
+    service->pid = pid;
+    service->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    pid_table_insert(pid, index);
+    running_count++;
+    klog_write(&system_log, KLOG_INFO, KLOG_SUBSYSTEM_INIT, KLOG_MSG_SERVICE_STARTED,
+               service->name, 1, (uint64_t[]){ (uint64_t)pid });
+
+    // Without pidfds (pre-5.3 kernels) the SIGCHLD sweep still reaps the child
+    if (service->pidfd >= 0) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = event_key(EVENT_PIDFD, index) };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, service->pidfd, &ev) < 0) {
+            close(service->pidfd);
+            service->pidfd = -1;
+        }
+    }
+
+    return true;
+}
+
+// Count a (re)start in the current window; true once `limit` is exceeded
+static bool start_rate_exceeded(service_t* service, int limit) {
+    time_t now = time(NULL);
+    if (now - service->respawn_window >= RESPAWN_WINDOW_SEC) {
+        service->respawn_window = now;
+        service->respawn_count = 0;
+    }
+    return ++service->respawn_count > limit;
+}
+
+// Restart a respawnable service unless it is crash-looping
+static void respawn_service(service_t* service) {
+    if (start_rate_exceeded(service, RESPAWN_LIMIT)) {
+        fprintf(stderr, "init: %s respawning too fast, giving up\n", service->name);
+        klog_write(&system_log, KLOG_ERROR, KLOG_SUBSYSTEM_INIT, KLOG_MSG_SERVICE_RESPAWN_LIMIT,
+                   service->name, 0, NULL);
+        service->state = SERVICE_FAILED;
+        return;
+    }
+
+    service->state = SERVICE_STARTING;
+    service->state = spawn_service(service) ? SERVICE_RUNNING : SERVICE_FAILED;
+    if (service->state == SERVICE_RUNNING) {
+        unpark_listeners();
+    }
+}
+
+// Signal a service through its pidfd, so a recycled pid is never hit
+static int signal_service(const service_t* service, int signal) {
+    if (service->pidfd >= 0) {
+        return (int)syscall(SYS_pidfd_send_signal, service->pidfd, signal, NULL, 0);
+    }
+    return kill(service->pid, signal);
+}
+
+// Shutdown: send SIGTERM and start the service's kill timer
+static void begin_stop(service_t* service) {
+    if (service->state != SERVICE_STOPPING) {
+        service->state = SERVICE_STOPPING;
+        signal_service(service, SIGTERM);
+    }
+    service->killed = false;
+    service->stop_begin_ns = monotonic_ns();
+    service->stop_deadline_ns = service->stop_begin_ns + (uint64_t)service->stop_timeout_ms * 1000000ULL;
+}
+
+// Shutdown: a service is gone, so dependencies nothing else running
+// needs can be stopped now
+static void release_dependencies(const service_t* service) {
+    for (int i = 0; i < service->dep_count; i++) {
+        int dep = name_registry_value(&service_names, service->dependencies[i]);
+        if (dep >= 0 && --services[dep].dependents == 0 && services[dep].state == SERVICE_RUNNING) {
+            begin_stop(&services[dep]);
+        }
+    }
+}
+
+// Record the exit of a supervised child
+static void service_exited(int index, int status) {
+    service_t* service = &services[index];
+
+    if (service->pidfd >= 0) {
+        close(service->pidfd);   // Also removes it from the epoll set
+        service->pidfd = -1;
+    }
+    service->pid = -1;
+    service->exit_status = status;
+    running_count--;
+    if (cgroups_enabled) {
+        // Fails while processes the service left behind are still in it
+        char cgroup[CGROUP_MAX_PATH];
+        if (cgroup_service_path(service->type, service->name, cgroup, sizeof(cgroup))) {
+            cgroup_remove(cgroup);
+        }
+    }
+    if (WIFSIGNALED(status)) {
+        klog_write(&system_log, KLOG_WARN, KLOG_SUBSYSTEM_INIT, KLOG_MSG_SERVICE_KILLED,
+                   service->name, 1, (uint64_t[]){ (uint64_t)WTERMSIG(status) });
+    } else {
+        klog_write(&system_log, WEXITSTATUS(status) ? KLOG_WARN : KLOG_INFO, KLOG_SUBSYSTEM_INIT,
+                   KLOG_MSG_SERVICE_EXITED, service->name, 1,
+                   (uint64_t[]){ (uint64_t)WEXITSTATUS(status) });
+    }
+
+    // During shutdown nothing restarts, and the dependencies may go next
+    if (shutting_down) {
+        if (service->state == SERVICE_STOPPING) {
+            shutdown_report.serial_ns += monotonic_ns() - service->stop_begin_ns;
+        }
+        shutdown_report.stopped++;
+        service->state = SERVICE_STOPPED;
+        release_dependencies(service);
+        return;
+    }
+
+    bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (service->listen_count > 0 && (service->state == SERVICE_STOPPING || clean)) {
+        // Socket-activated: idle until the next connection
+        arm_listeners(service);
+    } else if (service->state == SERVICE_STOPPING) {
+        service->state = SERVICE_STOPPED;
+    } else if (service->respawn) {
+        respawn_service(service);
+    } else if (clean) {
+        service->state = SERVICE_STOPPED;
+    } else {
+        service->state = SERVICE_FAILED;
+    }
+}
+
+// Reap one supervised child whose pidfd became readable
+static void reap_service(int index) {
     int status;
-    waitpid(pid, &status, 0);
+    pid_t pid = services[index].pid;
+    if (pid > 0 && waitpid(pid, &status, WNOHANG) == pid) {
+        pid_table_remove(pid);
+        service_exited(index, status);
+    }
+}
+
+// Reap everything that exited, including orphans reparented to init, and
+// note shutdown requests
+static void reap_children(void) {
+    struct signalfd_siginfo info;
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        // SIGCHLD coalesces, so one sweep below covers every instance
+        switch (info.ssi_signo) {
+        case SIGINT:
+            shutdown_requested = SHUTDOWN_REBOOT;
+            break;
+        case SIGUSR1:
+            shutdown_requested = SHUTDOWN_HALT;
+            break;
+        case SIGUSR2:
+        case SIGPWR:
+            shutdown_requested = SHUTDOWN_POWEROFF;
+            break;
+        }
+    }
+
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        int index = pid_table_remove(pid);
+        if (index >= 0) {
+            service_exited(index, status);
+        }
+    }
+}
+
+// First activity on a listening service: start it and hand over its fds.
+// Pending connections or data stay queued for the service to pick up.
+static void activate_service(int index) {
+    service_t* service = &services[index];
+    if (service->state != SERVICE_LISTENING) {
+        return;     // Already started by an earlier event in the batch
+    }
+    // A service that exits without draining its fds would be re-triggered
+    // immediately, forever
+    if (start_rate_exceeded(service, ACTIVATION_LIMIT)) {
+        fprintf(stderr, "init: %s activated too often, giving up\n", service->name);
+        disarm_listeners(service);
+        service->state = SERVICE_FAILED;
+        return;
+    }
+    klog_write(&system_log, KLOG_INFO, KLOG_SUBSYSTEM_INIT, KLOG_MSG_SERVICE_ACTIVATED,
+               service->name, 0, NULL);
+    BootSpanId span = BOOT_TRACE_BEGIN("activate", service->name);
+    if (!start_service(service->name)) {
+        fprintf(stderr, "init: cannot activate %s\n", service->name);
+        if (service->state == SERVICE_LISTENING) {
+            // A dependency is down. Wait for a start instead of retrying on
+            // every pass; the refused start is not an activation.
+            service->respawn_count--;
+            park_listeners(service);
+        }
+    }
+    BOOT_TRACE_END(span);
+}
+
+// Push the settle deadline BOOT_SETTLE_MS past now, but never past the
+// limit. Every service start calls this while the timer exists.
+static void boot_settle_arm(void) {
+    if (settle_fd < 0) {
+        return;
+    }
+    uint64_t due = monotonic_ns() + (uint64_t)BOOT_SETTLE_MS * 1000000ULL;
+    if (due > settle_limit_ns) {
+        due = settle_limit_ns;
+    }
+    struct itimerspec spec = {
+        .it_value = { (time_t)(due / 1000000000ULL), (long)(due % 1000000000ULL) }
+    };
+    timerfd_settime(settle_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+// Start the boot settle timer; boot_settled() runs from the event loop
+// when it expires
+static bool boot_settle_begin(void) {
+    settle_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (settle_fd < 0) {
+        return false;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = event_key(EVENT_SETTLE, 0) };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, settle_fd, &ev) < 0) {
+        close(settle_fd);
+        settle_fd = -1;
+        return false;
+    }
+    settle_limit_ns = monotonic_ns() + (uint64_t)BOOT_SETTLE_MAX_MS * 1000000ULL;
+    boot_settle_arm();
+    return true;
+}
+
+// Services have stopped starting, so what they read is in the recording.
+// Probing the files and writing the pack happens on a background thread
+// to keep the event loop responsive.
+static void boot_settled(void) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, settle_fd, NULL);
+    close(settle_fd);
+    settle_fd = -1;
+    if (!readahead_record_finish(READAHEAD_PACK_PATH)) {
+        fprintf(stderr, "init: cannot save readahead pack\n");
+    }
+}
+
+// Run the supervisor until no supervised process, listener or control
+// socket is left
+bool supervise(void) {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (running_count > 0 || listening_count > 0 || control_fd >= 0) {
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return false;
+        }
+
+        for (int i = 0; i < count; i++) {
+            uint64_t key = events[i].data.u64;
+            int index = (int)(uint32_t)key;
+            switch ((event_kind_t)(key >> 32)) {
+            case EVENT_SIGNAL:
+                reap_children();
+                break;
+            case EVENT_PIDFD:
+                reap_service(index);
+                break;
+            case EVENT_LISTEN:
+                activate_service(index);
+                break;
+            case EVENT_CONTROL:
+                control_accept();
+                break;
+            case EVENT_CONTROL_CLIENT:
+                control_client_event(index);
+                break;
+            case EVENT_SETTLE:
+                boot_settled();
+                break;
+            }
+        }
+
+        // Returns only if the system could not be taken down
+        if (shutdown_requested != SHUTDOWN_NONE) {
+            return system_shutdown(shutdown_requested);
+        }
+    }
+
+    return true;
+}
+
+// Launch interactive shell as a supervised, respawning child
+void launch_shell(void) {
+    if (!register_service("shell", SHELL_PATH, false, 100)) {
+        return;
+    }
+    find_service("shell")->respawn = true;
+    start_service("shell");
+}
+
+// Mount an essential filesystem inside a boot timeline span
+static void mount_essential(const char* source, const char* target, const char* type) {
+    BootSpanId span = BOOT_TRACE_BEGIN("mount", target);
+    mount(source, target, type, 0, NULL);
+    BOOT_TRACE_END(span);
 }
 
 // Initialize the init system
 bool init_system_start(void) {
     // Mount essential filesystems
-    mount("proc", "/proc", "proc", 0, NULL);
-    mount("sysfs", "/sys", "sysfs", 0, NULL);
-    mount("devtmpfs", "/dev", "devtmpfs", 0, NULL);
+    mount_essential("proc", "/proc", "proc");
+    mount_essential("sysfs", "/sys", "sysfs");
+    mount_essential("devtmpfs", "/dev", "devtmpfs");
+    mount_essential("tmpfs", "/run", "tmpfs");
+    mkdir("/dev/shm", 01777);
+    mount_essential("tmpfs", "/dev/shm", "tmpfs");
+    
+    // Ctrl-Alt-Del becomes SIGINT to init, which reboots cleanly
+    if (getpid() == 1) {
+        reboot(RB_DISABLE_CAD);
+    }
+    
+    // One cgroup per service; without cgroup v2 services share init's
+    cgroups_enabled = cgroup_setup(CGROUP_ROOT);
+    
+    // Log ring for service events; without it init only logs to the console
+    if (!klog_create(&system_log, KLOG_SHM_NAME)) {
+        fprintf(stderr, "init: cannot create system log\n");
+    }
+    
+    // Warm the page cache with what the last recorded boot read, in disk
+    // order, while services start. Without a pack (or when asked on the
+    // kernel command line) record this boot's file accesses instead.
+    bool recording = readahead_record_requested() || !readahead_replay_start(READAHEAD_PACK_PATH);
+    if (recording) {
+        recording = readahead_record_start();
+    }
     
     // Clear service table
-    memset(services, 0, sizeof(services));
+    if (!clear_services()) {
+        return false;
+    }
+
+    if (!supervisor_init()) {
+        return false;
+    }
     
-    // Register essential system services
-    register_service("syslog", "/sbin/syslogd", true, 1);
-    register_service("devd", "/sbin/devd", true, 2);
-    register_service("network", "/sbin/networkd", true, 3);
-    register_service("storage", "/sbin/storaged", true, 3);
-    register_service("neofetch", "/sbin/neofetch", true, 10);
+    // Recording runs until services stop starting; without the timer it
+    // stops right away rather than never
+    if (recording && !boot_settle_begin() && !readahead_record_finish(READAHEAD_PACK_PATH)) {
+        fprintf(stderr, "init: cannot save readahead pack\n");
+    }
+    
+    // Status, start and stop for tools outside init
+    if (!control_open(CONTROL_SOCKET_PATH)) {
+        fprintf(stderr, "init: cannot open control socket %s: %s\n", CONTROL_SOCKET_PATH, strerror(errno));
+    }
+    
+    // Register services from the unit files, or the built-in set when
+    // there are none
+    if (register_units() == 0) {
+        register_builtin_services();
+    }
     
     // Set up environment
     setup_environment();
     
     // Start all autostart services
-    if (!start_autostart_services()) {
+    BootSpanId span = BOOT_TRACE_BEGIN("init", "autostart");
+    bool started = start_autostart_services();
+    BOOT_TRACE_END(span);
+    if (!started) {
         return false;
     }
     
     // Launch shell
     launch_shell();
     
-    return true;
+    // Boot is done; save the timeline (no-op unless tracing is built in)
+    if (!BOOT_TRACE_EXPORT()) {
+        fprintf(stderr, "init: cannot save boot trace\n");
+    }
+    
+    // Supervise children for the lifetime of the system
+    return supervise();
+}
+
+// Empty the service table and its name registry
+bool clear_services(void) {
+    memset(services, 0, sizeof(services));
+    service_count = 0;
+    listening_count = 0;
+    parked_count = 0;
+    name_registry_free(&service_names);
+    return name_registry_init(&service_names, MAX_SERVICES);
 }
 
 // Register a new service
@@ -103,6 +818,12 @@ bool register_service(const char* name, const char* exec_path, bool autostart, i
         return false;
     }
     
+    int32_t id = name_registry_intern(&service_names, name);
+    if (id < 0 || name_registry_value(&service_names, id) != NAME_REGISTRY_UNBOUND) {
+        return false;
+    }
+    name_registry_bind(&service_names, id, service_count);
+    
     service_t* service = &services[service_count++];
     strncpy(service->name, name, sizeof(service->name) - 1);
     strncpy(service->exec_path, exec_path, sizeof(service->exec_path) - 1);
@@ -110,30 +831,519 @@ bool register_service(const char* name, const char* exec_path, bool autostart, i
     service->priority = priority;
     service->state = SERVICE_STOPPED;
     service->pid = -1;
+    service->pidfd = -1;
     service->dep_count = 0;
+    service->listen_count = 0;
+    service->type = SERVICE_TYPE_SYSTEM;
+    service->memory_max = 0;
+    service->cpu_max_percent = 0;
+    service->stop_timeout_ms = STOP_TIMEOUT_MS;
+    
+    return true;
+}
+
+// Make `name` wait for `dependency` to run before it starts, and stop
+// before it at shutdown
+bool add_dependency(const char* name, const char* dependency) {
+    service_t* service = find_service(name);
+    if (!service || service->dep_count >= (int)(sizeof(service->dependencies) / sizeof(int32_t))) {
+        return false;
+    }
+    int32_t id = name_registry_intern(&service_names, dependency);
+    if (id < 0) {
+        return false;
+    }
+    service->dependencies[service->dep_count++] = id;
+    return true;
+}
+
+// How long a service may take to exit after SIGTERM before it is killed
+bool set_stop_timeout(const char* name, int timeout_ms) {
+    service_t* service = find_service(name);
+    if (!service || timeout_ms <= 0) {
+        return false;
+    }
+    service->stop_timeout_ms = timeout_ms;
+    return true;
+}
+
+// Register every unit in the unit directories. The compiled cache is
+// mapped when it is current, so a normal boot parses no unit files.
+static int register_units(void) {
+    static const char* const dirs[] = UNIT_DIRS;
+    static const listen_kind_t listen_kinds[] = {
+        [UNIT_LISTEN_STREAM] = LISTEN_STREAM,
+        [UNIT_LISTEN_DATAGRAM] = LISTEN_DATAGRAM,
+        [UNIT_LISTEN_FIFO] = LISTEN_FIFO
+    };
+    UnitTable table;
+    BootSpanId span = BOOT_TRACE_BEGIN("init", "units");
+    unit_load(dirs, (int)(sizeof(dirs) / sizeof(dirs[0])), UNIT_CACHE_PATH,
+              unit_storage, MAX_SERVICES, &table);
+    BOOT_TRACE_END(span);
+    if (table.rejected > 0) {
+        fprintf(stderr, "init: %u unit files could not be loaded\n", table.rejected);
+    }
+
+    // Name ids of the registered units, so the cached dependency indices
+    // turn into ids without any lookups by name
+    static int32_t unit_ids[MAX_SERVICES];
+    int registered = 0;
+    for (uint32_t i = 0; i < table.count; i++) {
+        const UnitRecord* unit = &table.units[i];
+        unit_ids[i] = -1;
+        if (!register_service(unit->name, unit->exec_path, unit->autostart, unit->priority)) {
+            fprintf(stderr, "init: cannot register unit %s\n", unit->name);
+            continue;
+        }
+        registered++;
+        unit_ids[i] = name_registry_lookup(&service_names, unit->name);
+        service_t* service = &services[service_count - 1];
+        service->respawn = unit->respawn;
+        service->type = (ServiceType)unit->type;
+        service->memory_max = unit->memory_max;
+        service->cpu_max_percent = unit->cpu_max_percent;
+        if (unit->stop_timeout_sec > 0) {
+            service->stop_timeout_ms = (int)unit->stop_timeout_sec * 1000;
+        }
+    }
+
+    for (uint32_t i = 0; i < table.count; i++) {
+        const UnitRecord* unit = &table.units[i];
+        if (unit_ids[i] < 0) {
+            continue;
+        }
+        service_t* service = &services[name_registry_value(&service_names, unit_ids[i])];
+        for (int d = 0; d < unit->dependency_count; d++) {
+            int32_t dep = unit->dependencies[d];
+            if (dep < 0) {
+                fprintf(stderr, "init: %s needs missing unit %s\n", unit->name,
+                        unit->dependency_names[d]);
+            }
+            // An unbound id keeps the service from starting, as it should
+            int32_t id = dep >= 0 && unit_ids[dep] >= 0 ?
+                unit_ids[dep] : name_registry_intern(&service_names, unit->dependency_names[d]);
+            if (id < 0) {
+                service->state = SERVICE_FAILED;
+                continue;
+            }
+            service->dependencies[service->dep_count++] = id;
+        }
+        for (int l = 0; l < unit->listen_count; l++) {
+            add_listener(unit->name, listen_kinds[unit->listen_kinds[l]], unit->listen_paths[l]);
+        }
+    }
+
+    unit_table_close(&table);
+    return registered;
+}
+
+// Services of a system without unit files
+static void register_builtin_services(void) {
+    register_service("syslog", "/sbin/syslogd", true, 1);
+    register_service("devd", "/sbin/devd", true, 2);
+    register_service("network", "/sbin/networkd", true, 3);
+    register_service("storage", "/sbin/storaged", true, 3);
+    register_service("neofetch", "/sbin/neofetch", true, 10);
+    set_service_resources("network", SERVICE_TYPE_NETWORK, 0, 0);
+    set_service_resources("neofetch", SERVICE_TYPE_USER, 0, 0);
     
+    // Daemons nobody talks to during boot start on first use instead:
+    // init binds their sockets now and forks them when a client arrives.
+    // If binding fails they are started eagerly as before.
+    add_listener("syslog", LISTEN_DATAGRAM, "/dev/log");
+    add_listener("network", LISTEN_STREAM, "/run/networkd.sock");
+    add_listener("storage", LISTEN_STREAM, "/run/storaged.sock");
+}
+
+// Set a service's cgroup slice and hard limits; applied at its next start
+bool set_service_resources(const char* name, ServiceType type, uint64_t memory_max,
+                           uint32_t cpu_max_percent) {
+    service_t* service = find_service(name);
+    if (!service) {
+        return false;
+    }
+    service->type = type;
+    service->memory_max = memory_max;
+    service->cpu_max_percent = cpu_max_percent;
+    return true;
+}
+
+// CPU, memory and I/O pressure of a running service's cgroup
+bool read_service_pressure(const char* name, CgroupPressure* pressure) {
+    service_t* service = find_service(name);
+    char cgroup[CGROUP_MAX_PATH];
+    if (!service || service->pid <= 0 ||
+        !cgroup_path_of_pid(service->pid, cgroup, sizeof(cgroup))) {
+        return false;
+    }
+    return cgroup_read_pressure(cgroup, pressure);
+}
+
+// Create a socket or FIFO at `path` for a service to inherit; sockets
+// get `mode`
+static int open_listener(listen_kind_t kind, const char* path, mode_t mode) {
+    if (kind == LISTEN_FIFO) {
+        if (mkfifo(path, 0620) < 0 && errno != EEXIST) {
+            return -1;
+        }
+        // Read-write, so the FIFO never reports hangup when writers close
+        return open(path, O_RDWR | O_CLOEXEC);
+    }
+    
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    
+    int fd = socket(AF_UNIX, (kind == LISTEN_STREAM ? SOCK_STREAM : SOCK_DGRAM) | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);   // Left over from a previous boot
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || chmod(path, mode) < 0 ||
+        (kind == LISTEN_STREAM && listen(fd, SOMAXCONN) < 0)) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+// Pre-bind an activation endpoint for a registered service. From then on
+// the service starts on first activity instead of at boot.
+bool add_listener(const char* name, listen_kind_t kind, const char* path) {
+    service_t* service = find_service(name);
+    if (!service || service->listen_count >= MAX_LISTENERS ||
+        (service->state != SERVICE_STOPPED && service->state != SERVICE_LISTENING)) {
+        return false;
+    }
+    
+    int fd = open_listener(kind, path, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "init: cannot listen on %s for %s: %s\n", path, name, strerror(errno));
+        return false;
+    }
+    service->listen_fds[service->listen_count++] = fd;
+    arm_listeners(service);
+    return true;
+}
+
+// Serve the control protocol (system/libs/control.h) on `path`. The
+// socket is for root only, since it starts and stops services.
+bool control_open(const char* path) {
+    int fd = open_listener(LISTEN_STREAM, path, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = event_key(EVENT_CONTROL, 0) };
+    if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        int saved = errno;
+        close(fd);
+        unlink(path);
+        errno = saved;
+        return false;
+    }
+    control_fd = fd;
+    snprintf(control_path, sizeof(control_path), "%s", path);
+    return true;
+}
+
+static void control_drop(control_client_t* client) {
+    close(client->fd);      // Also removes it from the epoll set
+    free(client->input);
+    free(client->output);
+    memset(client, 0, sizeof(*client));
+}
+
+// Close the control socket and every connection
+void control_close(void) {
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+        if (control_clients[i].input) {
+            control_drop(&control_clients[i]);
+        }
+    }
+    if (control_fd >= 0) {
+        close(control_fd);
+        unlink(control_path);
+        control_fd = -1;
+    }
+    free(control_reply);
+    control_reply = NULL;
+    control_reply_capacity = 0;
+}
+
+// Accept every pending connection; beyond MAX_CONTROL_CLIENTS they are
+// closed at once
+static void control_accept(void) {
+    int fd;
+    while ((fd = accept4(control_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int slot = 0;
+        while (slot < MAX_CONTROL_CLIENTS && control_clients[slot].input) {
+            slot++;
+        }
+        uint8_t* input = slot < MAX_CONTROL_CLIENTS ? malloc(CONTROL_INPUT_SIZE) : NULL;
+        struct epoll_event ev = { .events = EPOLLIN, .data.u64 = event_key(EVENT_CONTROL_CLIENT, slot) };
+        if (!input || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            free(input);
+            close(fd);
+            continue;
+        }
+        control_clients[slot].fd = fd;
+        control_clients[slot].input = input;
+    }
+}
+
+static bool control_reserve(size_t size) {
+    if (size <= control_reply_capacity) {
+        return true;
+    }
+    size_t capacity = control_reply_capacity ? control_reply_capacity : CONTROL_BATCH_BYTES;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+    uint8_t* reply = realloc(control_reply, capacity);
+    if (!reply) {
+        return false;
+    }
+    control_reply = reply;
+    control_reply_capacity = capacity;
+    return true;
+}
+
+static size_t control_put_service(uint8_t* out, const service_t* service, ControlResult result) {
+    ControlRecord record = { (uint8_t)service->state, (uint8_t)result, 0, 0, service->pid, service->exit_status };
+    return control_put_record(out, &record, service->name);
+}
+
+// Answer one request into the reply buffer at `offset`. Every name gets a
+// record, with the service's state after the request.
+static bool control_handle(const ControlHeader* request, const uint8_t* body, size_t offset,
+                           ControlHeader* reply) {
+    memset(reply, 0, sizeof(*reply));
+    reply->tag = request->tag;
+    reply->op = request->op;
+    bool known_op = request->op == CONTROL_OP_STATUS || request->op == CONTROL_OP_START ||
+                    request->op == CONTROL_OP_STOP;
+    if (!known_op || request->count > request->length ||
+        (request->count == 0 && request->op != CONTROL_OP_STATUS)) {
+        reply->result = CONTROL_BAD_REQUEST;
+        return true;
+    }
+
+    uint32_t records = request->count > 0 ? request->count : (uint32_t)service_count;
+    if (!control_reserve(offset + (size_t)records * CONTROL_RECORD_MAX)) {
+        return false;
+    }
+    uint8_t* out = control_reply + offset;
+    size_t used = 0;
+    if (request->count == 0) {
+        for (int i = 0; i < service_count; i++) {
+            used += control_put_service(out + used, &services[i], CONTROL_OK);
+        }
+    }
+
+    char name[CONTROL_MAX_NAME + 1];
+    size_t position = 0;
+    for (uint32_t i = 0; i < request->count; i++) {
+        if (!control_next_name(body, request->length, &position, name)) {
+            reply->result = CONTROL_BAD_REQUEST;
+            return true;
+        }
+        service_t* service = find_service(name);
+        if (!service) {
+            ControlRecord record = { CONTROL_STATE_STOPPED, CONTROL_UNKNOWN_SERVICE, 0, 0, -1, 0 };
+            used += control_put_record(out + used, &record, name);
+            continue;
+        }
+        bool done = true;
+        if (request->op == CONTROL_OP_START) {
+            done = start_service(service->name);
+        } else if (request->op == CONTROL_OP_STOP) {
+            done = stop_service(service->name);
+        }
+        used += control_put_service(out + used, service, done ? CONTROL_OK : CONTROL_REFUSED);
+    }
+    reply->count = records;
+    reply->length = (uint32_t)used;
+    return true;
+}
+
+// Send a batch of replies, each a header and its body from the reply
+// buffer, with one vectored write. What the socket does not take is kept
+// and the connection waits for EPOLLOUT. sendmsg() is writev() with
+// MSG_NOSIGNAL: a client that went away must not raise SIGPIPE in init.
+static bool control_send_batch(int slot, const ControlHeader* headers, int count) {
+    control_client_t* client = &control_clients[slot];
+    struct iovec iov[CONTROL_BATCH * 2];
+    int iov_count = 0;
+    size_t total = 0, body = 0;
+    for (int i = 0; i < count; i++) {
+        iov[iov_count++] = (struct iovec){ (void*)&headers[i], sizeof(ControlHeader) };
+        if (headers[i].length > 0) {
+            iov[iov_count++] = (struct iovec){ control_reply + body, headers[i].length };
+        }
+        body += headers[i].length;
+        total += sizeof(ControlHeader) + headers[i].length;
+    }
+
+    struct msghdr message = { .msg_iov = iov, .msg_iovlen = (size_t)iov_count };
+    ssize_t written;
+    do {
+        written = sendmsg(client->fd, &message, MSG_NOSIGNAL);
+    } while (written < 0 && errno == EINTR);
+    if (written < 0 && errno != EAGAIN) {
+        return false;
+    }
+    size_t sent = written > 0 ? (size_t)written : 0;
+    if (sent == total) {
+        return true;
+    }
+
+    client->output = malloc(total - sent);
+    if (!client->output) {
+        return false;
+    }
+    client->output_size = total - sent;
+    client->output_sent = 0;
+    size_t copied = 0, skip = sent;
+    for (int i = 0; i < iov_count; i++) {
+        size_t from = skip < iov[i].iov_len ? skip : iov[i].iov_len;
+        skip -= from;
+        memcpy(client->output + copied, (uint8_t*)iov[i].iov_base + from, iov[i].iov_len - from);
+        copied += iov[i].iov_len - from;
+    }
+    struct epoll_event ev = { .events = EPOLLOUT, .data.u64 = event_key(EVENT_CONTROL_CLIENT, slot) };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) == 0;
+}
+
+// Answer every complete request in the input, in batches, until the
+// input runs out or the client stops taking replies
+static bool control_serve(int slot) {
+    control_client_t* client = &control_clients[slot];
+    ControlHeader headers[CONTROL_BATCH];
+    size_t offset = 0;
+    while (!client->output) {
+        int count = 0;
+        size_t body = 0;
+        while (count < CONTROL_BATCH && body < CONTROL_BATCH_BYTES &&
+               client->input_used - offset >= sizeof(ControlHeader)) {
+            ControlHeader request;
+            memcpy(&request, client->input + offset, sizeof(request));
+            if (request.length > CONTROL_MAX_REQUEST) {
+                return false;   // No way to find the next frame
+            }
+            if (client->input_used - offset < sizeof(request) + request.length) {
+                break;
+            }
+            if (!control_handle(&request, client->input + offset + sizeof(request), body, &headers[count])) {
+                return false;
+            }
+            body += headers[count++].length;
+            offset += sizeof(request) + request.length;
+        }
+        if (count == 0) {
+            break;
+        }
+        if (!control_send_batch(slot, headers, count)) {
+            return false;
+        }
+    }
+    memmove(client->input, client->input + offset, client->input_used - offset);
+    client->input_used -= offset;
     return true;
 }
 
+// Hand the client the replies it did not take; then read on
+static bool control_flush(int slot) {
+    control_client_t* client = &control_clients[slot];
+    while (client->output_sent < client->output_size) {
+        ssize_t written = send(client->fd, client->output + client->output_sent,
+                               client->output_size - client->output_sent, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            return errno == EAGAIN;
+        }
+        client->output_sent += (size_t)written;
+    }
+    free(client->output);
+    client->output = NULL;
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = event_key(EVENT_CONTROL_CLIENT, slot) };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) == 0 && control_serve(slot);
+}
+
+// Requests arrived or the client made room for its replies. Each read is
+// answered before the next, so a client that reads nothing back stops
+// being read.
+static void control_client_event(int slot) {
+    control_client_t* client = &control_clients[slot];
+    if (!client->input) {
+        return;     // Closed by an earlier event in the batch
+    }
+    if (client->output) {
+        if (!control_flush(slot)) {
+            control_drop(client);
+        }
+        if (!client->input || client->output) {
+            return;     // Closed, or the replies are still not taken
+        }
+    }
+    while (!client->output) {
+        ssize_t got = read(client->fd, client->input + client->input_used,
+                           CONTROL_INPUT_SIZE - client->input_used);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0 && errno == EAGAIN) {
+            return;
+        }
+        if (got <= 0) {
+            control_drop(client);
+            return;
+        }
+        client->input_used += (size_t)got;
+        if (!control_serve(slot)) {
+            control_drop(client);
+            return;
+        }
+    }
+}
+
 // Start a service
 bool start_service(const char* name) {
     service_t* service = find_service(name);
-    if (!service || service->state != SERVICE_STOPPED) {
+    if (!service || (service->state != SERVICE_STOPPED && service->state != SERVICE_LISTENING)) {
         return false;
     }
     
-    // Check dependencies
+    // Check dependencies; a listening dependency already accepts clients
     for (int i = 0; i < service->dep_count; i++) {
-        service_t* dep = find_service(service->dependencies[i]);
-        if (!dep || dep->state != SERVICE_RUNNING) {
+        int dep = name_registry_value(&service_names, service->dependencies[i]);
+        if (dep < 0 || (services[dep].state != SERVICE_RUNNING &&
+                        services[dep].state != SERVICE_LISTENING)) {
             return false;
         }
     }
     
-    // Start the service process
+    // Start the service process; it takes over any listening fds
+    disarm_listeners(service);
+    service->parked = false;
     service->state = SERVICE_STARTING;
-    // TODO: Implement process creation and management
+    BootSpanId span = BOOT_TRACE_BEGIN("service", service->name);
+    bool spawned = spawn_service(service);
+    BOOT_TRACE_END(span);
+    if (!spawned) {
+        service->state = SERVICE_FAILED;
+        return false;
+    }
     service->state = SERVICE_RUNNING;
+    boot_settle_arm();
+    unpark_listeners();
     
     return true;
 }
@@ -141,48 +1351,58 @@ bool start_service(const char* name) {
 // Stop a service
 bool stop_service(const char* name) {
     service_t* service = find_service(name);
+    if (service && service->state == SERVICE_LISTENING) {
+        disarm_listeners(service);
+        service->state = SERVICE_STOPPED;
+        return true;
+    }
     if (!service || service->state != SERVICE_RUNNING) {
         return false;
     }
     
+    // The event loop completes the transition to SERVICE_STOPPED on exit.
+    // ESRCH means the process already exited and its pidfd or SIGCHLD is
+    // still pending: the reap path clears the pid, pidfd, pid table entry
+    // and running count, and must find STOPPING so it does not respawn.
     service->state = SERVICE_STOPPING;
-    // TODO: Implement process termination
-    service->state = SERVICE_STOPPED;
-    service->pid = -1;
+    signal_service(service, SIGTERM);
     
     return true;
 }
 
 // Find a service by name
 static service_t* find_service(const char* name) {
-    for (int i = 0; i < service_count; i++) {
-        if (strcmp(services[i].name, name) == 0) {
-            return &services[i];
-        }
+    int index = name_registry_find(&service_names, name);
+    return index >= 0 ? &services[index] : NULL;
+}
+
+// Order service indices by priority, keeping registration order for ties
+static int compare_priority(const void* a, const void* b) {
+    int left = *(const int*)a;
+    int right = *(const int*)b;
+    if (services[left].priority != services[right].priority) {
+        return services[left].priority < services[right].priority ? -1 : 1;
     }
-    return NULL;
+    return left - right;
 }
 
 // Start all autostart services
 static bool start_autostart_services(void) {
     bool success = true;
     
-    // Sort services by priority
-    // Simple bubble sort
-    for (int i = 0; i < service_count - 1; i++) {
-        for (int j = 0; j < service_count - i - 1; j++) {
-            if (services[j].priority > services[j + 1].priority) {
-                service_t temp = services[j];
-                services[j] = services[j + 1];
-                services[j + 1] = temp;
-            }
-        }
+    // Sort by priority through an index array; the table itself stays put
+    // so registry bindings and pids keep pointing at the right entries
+    int order[MAX_SERVICES];
+    for (int i = 0; i < service_count; i++) {
+        order[i] = i;
     }
+    qsort(order, (size_t)service_count, sizeof(order[0]), compare_priority);
     
-    // Start services in priority order
+    // Start services in priority order; socket-activated ones wait
     for (int i = 0; i < service_count; i++) {
-        if (services[i].autostart) {
-            if (!start_service(services[i].name)) {
+        service_t* service = &services[order[i]];
+        if (service->autostart && service->state == SERVICE_STOPPED) {
+            if (!start_service(service->name)) {
                 success = false;
             }
         }
@@ -190,3 +1410,233 @@ static bool start_autostart_services(void) {
     
     return success;
 }
+
+// Shutdown: past its deadline, a service is killed. One that survives
+// SIGKILL too (stuck in the kernel) is given up on.
+static void expire_stop(service_t* service, uint64_t now) {
+    if (!service->killed) {
+        fprintf(stderr, "init: %s did not stop within %d ms, killing\n",
+                service->name, service->stop_timeout_ms);
+        klog_write(&system_log, KLOG_WARN, KLOG_SUBSYSTEM_INIT, KLOG_MSG_SERVICE_STOP_TIMEOUT,
+                   service->name, 1, (uint64_t[]){ (uint64_t)service->stop_timeout_ms });
+        signal_service(service, SIGKILL);
+        service->killed = true;
+        service->stop_deadline_ns = now + KILL_WAIT_MS * 1000000ULL;
+        shutdown_report.killed++;
+        return;
+    }
+
+    fprintf(stderr, "init: %s (pid %d) survived SIGKILL\n", service->name, service->pid);
+    pid_table_remove(service->pid);
+    if (service->pidfd >= 0) {
+        close(service->pidfd);
+        service->pidfd = -1;
+    }
+    service->pid = -1;
+    service->state = SERVICE_FAILED;
+    running_count--;
+    shutdown_report.abandoned++;
+    release_dependencies(service);
+}
+
+// Stop every running service in reverse dependency order: a service gets
+// SIGTERM once no running service depends on it, so independent services
+// stop concurrently. Past its stop timeout it gets SIGKILL. Exits arrive
+// through the pidfds, and the only wait is epoll until the next exit or
+// deadline. True when nothing had to be killed.
+bool stop_all_services(void) {
+    struct epoll_event events[MAX_EVENTS];
+    memset(&shutdown_report, 0, sizeof(shutdown_report));
+    uint64_t begin = monotonic_ns();
+    shutting_down = true;
+
+    // Nothing is started or stopped on request from here on
+    control_close();
+
+    // The loop below reads only exits, so the settle timer must not stay
+    // armed in epoll. A boot cut short still saves what it recorded; the
+    // pack is written while the services stop.
+    if (settle_fd >= 0) {
+        boot_settled();
+    }
+
+    // Listening services have no process; closing their fds is enough
+    for (int i = 0; i < service_count; i++) {
+        services[i].dependents = 0;
+        if (services[i].state == SERVICE_LISTENING) {
+            disarm_listeners(&services[i]);
+            services[i].state = SERVICE_STOPPED;
+        }
+    }
+    for (int i = 0; i < service_count; i++) {
+        if (services[i].pid <= 0) {
+            continue;
+        }
+        for (int d = 0; d < services[i].dep_count; d++) {
+            int dep = name_registry_value(&service_names, services[i].dependencies[d]);
+            if (dep >= 0) {
+                services[dep].dependents++;
+            }
+        }
+    }
+    for (int i = 0; i < service_count; i++) {
+        if (services[i].pid > 0 && services[i].dependents == 0) {
+            begin_stop(&services[i]);
+        }
+    }
+
+    while (running_count > 0) {
+        uint64_t now = monotonic_ns();
+        uint64_t next = UINT64_MAX;
+        for (int i = 0; i < service_count; i++) {
+            service_t* service = &services[i];
+            if (service->pid <= 0 || service->state != SERVICE_STOPPING) {
+                continue;
+            }
+            if (now >= service->stop_deadline_ns) {
+                expire_stop(service, now);
+            }
+            if (service->pid > 0 && service->stop_deadline_ns < next) {
+                next = service->stop_deadline_ns;
+            }
+        }
+        if (next == UINT64_MAX) {
+            // Nothing is stopping but services still run: they depend on
+            // each other in a cycle. Stop them all at once.
+            for (int i = 0; i < service_count; i++) {
+                if (services[i].pid > 0) {
+                    begin_stop(&services[i]);
+                }
+            }
+            continue;
+        }
+
+        int timeout_ms = (int)((next - now + 999999) / 1000000);
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+        for (int i = 0; i < count; i++) {
+            uint64_t key = events[i].data.u64;
+            if ((event_kind_t)(key >> 32) == EVENT_PIDFD) {
+                reap_service((int)(uint32_t)key);
+            } else if ((event_kind_t)(key >> 32) == EVENT_SIGNAL) {
+                reap_children();
+            }
+        }
+    }
+
+    shutdown_report.wall_ns = monotonic_ns() - begin;
+    return shutdown_report.killed == 0 && shutdown_report.abandoned == 0;
+}
+
+// Describe the last stop_all_services() run
+void shutdown_report_text(char* buffer, size_t size) {
+    snprintf(buffer, size,
+             "stopped %d, killed %d, abandoned %d\n"
+             "wall %.3f ms, one at a time %.3f ms",
+             shutdown_report.stopped, shutdown_report.killed, shutdown_report.abandoned,
+             shutdown_report.wall_ns / 1e6, shutdown_report.serial_ns / 1e6);
+}
+
+// Send `signal` to every process but init and wait until they are gone or
+// `timeout_ms` passes, woken by SIGCHLD through the signalfd
+static bool signal_orphans(int signal, int timeout_ms) {
+    if (kill(-1, signal) < 0 && errno == ESRCH) {
+        return true;
+    }
+    uint64_t deadline = monotonic_ns() + (uint64_t)timeout_ms * 1000000ULL;
+    struct epoll_event events[MAX_EVENTS];
+    struct signalfd_siginfo info;
+    for (;;) {
+        pid_t pid;
+        while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        }
+        if (pid < 0 && errno == ECHILD) {
+            return true;
+        }
+        uint64_t now = monotonic_ns();
+        if (now >= deadline) {
+            return false;
+        }
+        epoll_wait(epoll_fd, events, MAX_EVENTS, (int)((deadline - now + 999999) / 1000000));
+        while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        }
+    }
+}
+
+// Turn the octal escapes of /proc/self/mounts (\040 for a space) back
+// into characters
+static void unescape_mount_path(char* path) {
+    char* out = path;
+    for (char* in = path; *in; ) {
+        if (in[0] == '\\' && in[1] >= '0' && in[1] <= '3' && in[2] >= '0' && in[2] <= '7' &&
+            in[3] >= '0' && in[3] <= '7') {
+            *out++ = (char)((in[1] - '0') * 64 + (in[2] - '0') * 8 + (in[3] - '0'));
+            in += 4;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+}
+
+// Unmount everything but the root, newest mount first, so nothing is
+// unmounted from under a mount stacked on it. What cannot be unmounted
+// (still busy) is made read-only instead, and so is the root.
+static void unmount_all(void) {
+    static char targets[MAX_MOUNTS][256];
+    char line[1024];
+    int count = 0;
+    FILE* mounts = fopen("/proc/self/mounts", "re");
+    while (mounts && count < MAX_MOUNTS && fgets(line, sizeof(line), mounts)) {
+        if (sscanf(line, "%*s %255s", targets[count]) == 1) {
+            unescape_mount_path(targets[count]);
+            count++;
+        }
+    }
+    if (mounts) {
+        fclose(mounts);
+    }
+
+    for (int i = count - 1; i >= 0; i--) {
+        if (strcmp(targets[i], "/") != 0 && umount2(targets[i], 0) < 0) {
+            mount(NULL, targets[i], NULL, MS_REMOUNT | MS_RDONLY, NULL);
+        }
+    }
+    mount(NULL, "/", NULL, MS_REMOUNT | MS_RDONLY, NULL);
+}
+
+// Stop all services, then every other process, flush and unmount the
+// filesystems and reboot, halt or power off. Only init (pid 1) goes past
+// stopping the services. Returns only if the system is still up.
+bool system_shutdown(shutdown_t action) {
+    char report[256];
+    bool clean = stop_all_services();
+    shutdown_report_text(report, sizeof(report));
+    fprintf(stderr, "init: shutdown: %s\n", report);
+    klog_write(&system_log, KLOG_INFO, KLOG_SUBSYSTEM_INIT, KLOG_MSG_SHUTDOWN, NULL, 3,
+               (uint64_t[]){ (uint64_t)shutdown_report.stopped,
+                             shutdown_report.wall_ns / 1000000, (uint64_t)shutdown_report.killed });
+    if (getpid() != 1) {
+        return clean;
+    }
+
+    if (!signal_orphans(SIGTERM, ORPHAN_TIMEOUT_MS)) {
+        signal_orphans(SIGKILL, ORPHAN_TIMEOUT_MS);
+    }
+    sync();
+    unmount_all();
+    sync();
+
+    switch (action) {
+    case SHUTDOWN_HALT:
+        reboot(RB_HALT_SYSTEM);
+        break;
+    case SHUTDOWN_POWEROFF:
+        reboot(RB_POWER_OFF);
+        break;
+    default:
+        reboot(RB_AUTOBOOT);
+        break;
+    }
+    perror("reboot");
+    return false;
+}
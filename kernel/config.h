@@ -22,6 +22,7 @@
 // Scheduling configuration
 #define SCHEDULER_TIMESLICE_MS 10
 #define PRIORITY_LEVELS        32
+#define KERNEL_INIT_WORKERS    4    // Threads running independent init phases
 
 // File system
 #define MAX_OPEN_FILES         4096
@@ -42,5 +43,7 @@
 // Debugging
 #define DEBUG_LEVEL           3  // 0=off, 1=error, 2=warn, 3=info, 4=debug
 #define KERNEL_LOG_BUFFER_SIZE (64 * 1024)
+#define BOOT_TRACE_LEVEL      3  // Record boot timeline spans at this DEBUG_LEVEL
+#define BOOT_TRACE_SPANS      4096
 
 #endif // PROMPTOS_KERNEL_CONFIG_H
\ No newline at end of file
@@ -8,60 +8,55 @@
 #include "config.h"
 #include <stddef.h>
 #include <stdbool.h>
+#include "init_table.h"
 
 // Forward declarations
-static bool init_memory_management(void);
-static bool init_process_scheduler(void);
-static bool init_device_drivers(void);
-static bool init_filesystem(void);
-static bool init_syscall_table(void);
+static bool init_memory_management(void* context);
+static bool init_process_scheduler(void* context);
+static bool init_device_drivers(void* context);
+static bool init_filesystem(void* context);
+static bool init_syscall_table(void* context);
 
-// Kernel initialization status
-static struct {
-    bool memory_initialized;
-    bool scheduler_initialized;
-    bool drivers_initialized;
-    bool filesystem_initialized;
-    bool syscalls_initialized;
-} kernel_status = {0};
+// Initialization phases, in table order
+enum {
+    PHASE_MEMORY,
+    PHASE_SCHEDULER,
+    PHASE_DRIVERS,
+    PHASE_FILESYSTEM,
+    PHASE_SYSCALLS,
+    PHASE_COUNT
+};
 
-// Main kernel initialization function
-bool kernel_init(void) {
-    // Initialize memory management subsystem
-    if (!init_memory_management()) {
-        return false;
-    }
-    kernel_status.memory_initialized = true;
-
-    // Initialize process scheduler
-    if (!init_process_scheduler()) {
-        return false;
-    }
-    kernel_status.scheduler_initialized = true;
-
-    // Initialize device drivers
-    if (!init_device_drivers()) {
-        return false;
-    }
-    kernel_status.drivers_initialized = true;
+// Once memory and the scheduler are up, device probing, filesystem setup
+// and the syscall table run side by side
+static const InitPhase kernel_phases[PHASE_COUNT] = {
+    [PHASE_MEMORY] = { "memory", init_memory_management, NULL, 0 },
+    [PHASE_SCHEDULER] = { "scheduler", init_process_scheduler, NULL,
+                          INIT_PHASE_NEEDS(PHASE_MEMORY) },
+    [PHASE_DRIVERS] = { "drivers", init_device_drivers, NULL,
+                        INIT_PHASE_NEEDS(PHASE_MEMORY) | INIT_PHASE_NEEDS(PHASE_SCHEDULER) },
+    [PHASE_FILESYSTEM] = { "filesystem", init_filesystem, NULL,
+                           INIT_PHASE_NEEDS(PHASE_MEMORY) | INIT_PHASE_NEEDS(PHASE_SCHEDULER) },
+    [PHASE_SYSCALLS] = { "syscalls", init_syscall_table, NULL,
+                         INIT_PHASE_NEEDS(PHASE_MEMORY) | INIT_PHASE_NEEDS(PHASE_SCHEDULER) }
+};
 
-    // Initialize filesystem
-    if (!init_filesystem()) {
-        return false;
-    }
-    kernel_status.filesystem_initialized = true;
+// Outcome and timing of each phase in the last kernel_init()
+static InitPhaseResult phase_results[PHASE_COUNT];
 
-    // Initialize system call table
-    if (!init_syscall_table()) {
-        return false;
-    }
-    kernel_status.syscalls_initialized = true;
+// Main kernel initialization function
+bool kernel_init(void) {
+    return init_table_run(kernel_phases, PHASE_COUNT, KERNEL_INIT_WORKERS, phase_results);
+}
 
-    return true;
+// Per-phase state and timing of the last kernel_init()
+void kernel_init_report(char* buffer, size_t size) {
+    init_table_report(kernel_phases, phase_results, PHASE_COUNT, buffer, size);
 }
 
 // Memory management initialization
-static bool init_memory_management(void) {
+static bool init_memory_management(void* context) {
+    (void)context;
     // Set up page tables
     // Initialize kernel heap
     // Configure virtual memory mapping
@@ -69,7 +64,8 @@ static bool init_memory_management(void) {
 }
 
 // Process scheduler initialization
-static bool init_process_scheduler(void) {
+static bool init_process_scheduler(void* context) {
+    (void)context;
     // Initialize process table
     // Set up scheduling queues
     // Configure timer interrupt
@@ -77,7 +73,8 @@ static bool init_process_scheduler(void) {
 }
 
 // Device driver initialization
-static bool init_device_drivers(void) {
+static bool init_device_drivers(void* context) {
+    (void)context;
     // Initialize device management subsystem
     // Load essential drivers (keyboard, display, disk)
     // Set up interrupt handlers
@@ -85,7 +82,8 @@ static bool init_device_drivers(void) {
 }
 
 // Filesystem initialization
-static bool init_filesystem(void) {
+static bool init_filesystem(void* context) {
+    (void)context;
     // Initialize root filesystem
     // Mount system partitions
     // Set up file descriptors
@@ -93,7 +91,8 @@ static bool init_filesystem(void) {
 }
 
 // System call table initialization
-static bool init_syscall_table(void) {
+static bool init_syscall_table(void* context) {
+    (void)context;
     // Register system calls
     // Set up syscall handlers
     // Initialize syscall parameters
@@ -101,8 +100,9 @@ static bool init_syscall_table(void) {
 }
 
 // Kernel status query functions
-bool is_memory_initialized(void) { return kernel_status.memory_initialized; }
-bool is_scheduler_initialized(void) { return kernel_status.scheduler_initialized; }
-bool is_drivers_initialized(void) { return kernel_status.drivers_initialized; }
-bool is_filesystem_initialized(void) { return kernel_status.filesystem_initialized; }
-bool is_syscalls_initialized(void) { return kernel_status.syscalls_initialized; }
\ No newline at end of file
+static bool phase_done(int phase) { return phase_results[phase].state == INIT_PHASE_DONE; }
+bool is_memory_initialized(void) { return phase_done(PHASE_MEMORY); }
+bool is_scheduler_initialized(void) { return phase_done(PHASE_SCHEDULER); }
+bool is_drivers_initialized(void) { return phase_done(PHASE_DRIVERS); }
+bool is_filesystem_initialized(void) { return phase_done(PHASE_FILESYSTEM); }
+bool is_syscalls_initialized(void) { return phase_done(PHASE_SYSCALLS); }
@@ -0,0 +1,202 @@
+#include "init_table.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../system/libs/boot_trace.h"
+
+// Shared state of one run
+typedef struct {
+    const InitPhase* phases;
+    InitPhaseResult* results;
+    int count;
+    uint32_t claimed;           // Running or settled
+    uint32_t settled;
+    uint32_t done;              // Succeeded
+    uint64_t begin_ns;
+    BootSpanId spans[INIT_TABLE_MAX_PHASES];
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} InitRun;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Prerequisites must be in the table and acyclic
+static bool table_valid(const InitPhase* phases, int count) {
+    if (count < 0 || count > INIT_TABLE_MAX_PHASES) {
+        return false;
+    }
+    uint32_t all = count == 32 ? UINT32_MAX : (1u << count) - 1;
+    uint32_t ordered = 0;
+    for (int i = 0; i < count; i++) {
+        if (phases[i].requires & ~all) {
+            return false;
+        }
+    }
+    // Peel off phases whose prerequisites are already ordered
+    for (bool progress = true; progress && ordered != all; ) {
+        progress = false;
+        for (int i = 0; i < count; i++) {
+            if (!(ordered & INIT_PHASE_NEEDS(i)) && (phases[i].requires & ~ordered) == 0) {
+                ordered |= INIT_PHASE_NEEDS(i);
+                progress = true;
+            }
+        }
+    }
+    return ordered == all;
+}
+
+// Next runnable phase, or -1. Skips phases whose prerequisites can no
+// longer succeed on the way (lock held).
+static int claim_next(InitRun* run) {
+    uint32_t unsuccessful = run->settled & ~run->done;
+    for (int i = 0; i < run->count; i++) {
+        uint32_t bit = INIT_PHASE_NEEDS(i);
+        uint32_t requires = run->phases[i].requires;
+        if (run->claimed & bit) {
+            continue;
+        }
+        if (requires & unsuccessful) {
+            InitPhaseResult* result = &run->results[i];
+            result->state = INIT_PHASE_SKIPPED;
+            result->blocked_by = __builtin_ctz(requires & unsuccessful);
+            result->begin_ns = result->end_ns = monotonic_ns() - run->begin_ns;
+            run->claimed |= bit;
+            run->settled |= bit;
+            unsuccessful |= bit;
+            pthread_cond_broadcast(&run->wake);     // May have been the last phase
+            i = -1;     // Rescan: phases earlier in the table may need this one
+            continue;
+        }
+        if ((requires & ~run->done) == 0) {
+            run->claimed |= bit;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void* init_worker(void* arg) {
+    InitRun* run = arg;
+    uint32_t all = run->count == 32 ? UINT32_MAX : (1u << run->count) - 1;
+
+    pthread_mutex_lock(&run->lock);
+    for (;;) {
+        int index;
+        while ((index = claim_next(run)) < 0 && run->settled != all) {
+            pthread_cond_wait(&run->wake, &run->lock);
+        }
+        if (index < 0) {
+            break;
+        }
+
+        // Critical path: the prerequisite that finished last
+        const InitPhase* phase = &run->phases[index];
+        InitPhaseResult* result = &run->results[index];
+        for (uint32_t requires = phase->requires; requires; requires &= requires - 1) {
+            int prerequisite = __builtin_ctz(requires);
+            if (result->waited_on < 0 ||
+                run->results[prerequisite].end_ns > run->results[result->waited_on].end_ns) {
+                result->waited_on = prerequisite;
+            }
+        }
+        BootSpanId after = result->waited_on >= 0 ? run->spans[result->waited_on] : BOOT_SPAN_NONE;
+        result->state = INIT_PHASE_RUNNING;
+        pthread_mutex_unlock(&run->lock);
+
+        BootSpanId span = BOOT_TRACE_BEGIN_AFTER("kernel", phase->name, after);
+        uint64_t begin = monotonic_ns();
+        bool ok = phase->run(phase->context);
+        uint64_t end = monotonic_ns();
+        BOOT_TRACE_END(span);
+
+        pthread_mutex_lock(&run->lock);
+        run->spans[index] = span;
+        result->begin_ns = begin - run->begin_ns;
+        result->end_ns = end - run->begin_ns;
+        result->state = ok ? INIT_PHASE_DONE : INIT_PHASE_FAILED;
+        run->settled |= INIT_PHASE_NEEDS(index);
+        if (ok) {
+            run->done |= INIT_PHASE_NEEDS(index);
+        }
+        pthread_cond_broadcast(&run->wake);
+    }
+    pthread_mutex_unlock(&run->lock);
+    return NULL;
+}
+
+bool init_table_run(const InitPhase* phases, int count, int workers, InitPhaseResult* results) {
+    if (!table_valid(phases, count)) {
+        return false;
+    }
+
+    static InitRun run;
+    memset(&run, 0, sizeof(run));
+    run.phases = phases;
+    run.results = results;
+    run.count = count;
+    for (int i = 0; i < count; i++) {
+        results[i] = (InitPhaseResult){ INIT_PHASE_PENDING, 0, 0, -1, -1 };
+        run.spans[i] = BOOT_SPAN_NONE;
+    }
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.wake, NULL);
+    run.begin_ns = monotonic_ns();
+
+    // The calling thread is one of the workers
+    pthread_t threads[INIT_TABLE_MAX_PHASES];
+    int thread_count = 0;
+    int wanted = workers < count ? workers : count;
+    for (int i = 1; i < wanted; i++) {
+        if (pthread_create(&threads[thread_count], NULL, init_worker, &run) == 0) {
+            thread_count++;
+        }
+    }
+    init_worker(&run);
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&run.wake);
+    pthread_mutex_destroy(&run.lock);
+    return count == 32 ? run.done == UINT32_MAX : run.done == (1u << count) - 1;
+}
+
+void init_table_report(const InitPhase* phases, const InitPhaseResult* results, int count,
+                       char* buffer, size_t size) {
+    static const char* const state_names[] = { "pending", "running", "ok", "FAILED", "skipped" };
+    size_t used = 0;
+    if (size > 0) {
+        buffer[0] = '\0';
+    }
+
+    for (int i = 0; i < count && used < size; i++) {
+        const InitPhaseResult* result = &results[i];
+        int written = snprintf(buffer + used, size - used, "%-12s %-7s %8.3f - %8.3f ms",
+                               phases[i].name, state_names[result->state],
+                               result->begin_ns / 1e6, result->end_ns / 1e6);
+        if (written > 0 && (size_t)written < size - used) {
+            used += (size_t)written;
+        }
+        if (result->state == INIT_PHASE_SKIPPED && result->blocked_by >= 0) {
+            written = snprintf(buffer + used, size - used, "  (needs %s)",
+                               phases[result->blocked_by].name);
+        } else if (result->waited_on >= 0) {
+            written = snprintf(buffer + used, size - used, "  (after %s)",
+                               phases[result->waited_on].name);
+        } else {
+            written = 0;
+        }
+        if (written > 0 && (size_t)written < size - used) {
+            used += (size_t)written;
+        }
+        if (used + 1 < size) {
+            buffer[used++] = '\n';
+            buffer[used] = '\0';
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef PROMPTOS_INIT_TABLE_H
+#define PROMPTOS_INIT_TABLE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Dependency-ordered initialization tables
+//
+// A table lists phases and, for each, the phases that must have succeeded
+// before it may run, as a bitmask of table indices. init_table_run()
+// dispatches every phase whose prerequisites are done to a small worker
+// pool, so independent phases overlap. A phase whose prerequisite failed
+// is skipped rather than run. Each phase is timed and traced.
+
+#define INIT_TABLE_MAX_PHASES 32
+#define INIT_PHASE_NEEDS(index) (1u << (index))
+
+typedef struct {
+    const char* name;
+    bool (*run)(void* context);
+    void* context;
+    uint32_t requires;          // INIT_PHASE_NEEDS() of each prerequisite
+} InitPhase;
+
+typedef enum {
+    INIT_PHASE_PENDING,
+    INIT_PHASE_RUNNING,
+    INIT_PHASE_DONE,
+    INIT_PHASE_FAILED,          // run() returned false
+    INIT_PHASE_SKIPPED          // A prerequisite failed or was skipped
+} InitPhaseState;
+
+typedef struct {
+    InitPhaseState state;
+    uint64_t begin_ns;          // Relative to the start of the run
+    uint64_t end_ns;
+    int waited_on;              // Prerequisite that finished last, or -1
+    int blocked_by;             // Skipped: the prerequisite that did not succeed
+} InitPhaseResult;
+
+// Run a table with up to `workers` threads. `results` has one entry per
+// phase. Returns true when every phase succeeded; false without running
+// anything if the table is invalid (too long, unknown or cyclic
+// prerequisites).
+bool init_table_run(const InitPhase* phases, int count, int workers, InitPhaseResult* results);
+
+// One line per phase: state, start and end time, and why it was skipped
+void init_table_report(const InitPhase* phases, const InitPhaseResult* results, int count,
+                       char* buffer, size_t size);
+
+#endif // PROMPTOS_INIT_TABLE_H
@@ -0,0 +1,430 @@
+#include "package_db.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+// Check that a section lies inside the mapping
+static bool section_fits(const PackageDb* db, uint64_t offset, uint64_t count, uint64_t stride) {
+    return offset % 8 == 0 && offset <= db->size &&
+           (stride == 0 || count <= (db->size - offset) / stride);
+}
+
+bool package_db_open(PackageDb* db, const char* path) {
+    memset(db, 0, sizeof(*db));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < PACKAGE_DB_V1_HEADER_SIZE) {
+        close(fd);
+        return false;
+    }
+
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    // Lookups hop between hash slots, records and strings
+    madvise(base, (size_t)st.st_size, MADV_RANDOM);
+
+    db->base = base;
+    db->size = (size_t)st.st_size;
+    db->header = base;
+
+    // Validate the header only; records are checked as they are touched
+    const PackageDbHeader* header = db->header;
+    bool current = header->version == PACKAGE_DB_VERSION && header->header_size == sizeof(PackageDbHeader);
+    bool valid =
+        header->magic == PACKAGE_DB_MAGIC &&
+        (current || (header->version == 1 && header->header_size == PACKAGE_DB_V1_HEADER_SIZE)) &&
+        header->record_size == sizeof(PackageDbRecord) &&
+        header->file_size == db->size &&
+        header->slot_count != 0 &&
+        (header->slot_count & (header->slot_count - 1)) == 0 &&
+        header->slot_count > header->record_count &&
+        section_fits(db, header->records_offset, header->record_count, sizeof(PackageDbRecord)) &&
+        section_fits(db, header->dependencies_offset, header->dependency_count, sizeof(PackageDbDependency)) &&
+        section_fits(db, header->installed_offset, header->installed_count, sizeof(uint32_t)) &&
+        section_fits(db, header->slots_offset, header->slot_count, sizeof(uint32_t)) &&
+        section_fits(db, header->strings_offset, header->strings_size, 1) &&
+        header->strings_size > 0 &&
+        db->base[header->strings_offset + header->strings_size - 1] == '\0';
+
+    if (!valid) {
+        package_db_close(db);
+        return false;
+    }
+
+    db->records = (const PackageDbRecord*)(db->base + header->records_offset);
+    db->dependencies = (const PackageDbDependency*)(db->base + header->dependencies_offset);
+    db->installed = (const uint32_t*)(db->base + header->installed_offset);
+    db->slots = (const uint32_t*)(db->base + header->slots_offset);
+    db->strings = (const char*)(db->base + header->strings_offset);
+    if (current) {
+        db->sequence = header->sequence;
+        db->origin = header->origin;
+    }
+    return true;
+}
+
+void package_db_close(PackageDb* db) {
+    if (db->base) {
+        munmap((void*)db->base, db->size);
+    }
+    memset(db, 0, sizeof(*db));
+}
+
+int32_t package_db_find_hashed(const PackageDb* db, const char* name, uint64_t hash) {
+    if (!db->header) {
+        return -1;
+    }
+
+    uint32_t mask = db->header->slot_count - 1;
+    uint32_t slot = (uint32_t)hash & mask;
+
+    // The table is never full, so an empty slot always ends the probe
+    for (uint32_t probes = 0; probes <= mask; probes++) {
+        uint32_t entry = db->slots[slot];
+        if (entry == 0 || entry > db->header->record_count) {
+            return -1;
+        }
+        const PackageDbRecord* record = &db->records[entry - 1];
+        if (record->name_hash == hash && strcmp(package_db_string(db, record->name), name) == 0) {
+            return (int32_t)(entry - 1);
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+int32_t package_db_find(const PackageDb* db, const char* name) {
+    return package_db_find_hashed(db, name, name_hash(name));
+}
+
+bool package_db_builder_init(PackageDbBuilder* builder, uint32_t expected) {
+    memset(builder, 0, sizeof(*builder));
+    if (!name_registry_init(&builder->strings, expected * 2)) {
+        return false;
+    }
+
+    // Offset 0 is the empty string, so zeroed fields read as ""
+    int32_t empty = name_registry_intern(&builder->strings, "");
+    if (empty < 0) {
+        return false;
+    }
+    name_registry_bind(&builder->strings, empty, 0);
+    builder->strings_size = 1;
+    return true;
+}
+
+bool package_db_builder_init_from(PackageDbBuilder* builder, const PackageDb* db, uint32_t extra) {
+    if (!package_db_builder_init(builder, extra + 16)) {
+        return false;
+    }
+    uint32_t count = package_db_count(db);
+    if (count > 0 && db->strings[0] != '\0') {
+        package_db_builder_free(builder);
+        return false;
+    }
+    builder->record_capacity = count + extra + 1;
+    builder->dependency_capacity = (db->header ? db->header->dependency_count : 0) + extra * 4 + 1;
+    builder->records = malloc(builder->record_capacity * sizeof(PackageDbRecord));
+    builder->dependencies = malloc(builder->dependency_capacity * sizeof(PackageDbDependency));
+    if (!builder->records || !builder->dependencies) {
+        package_db_builder_free(builder);
+        return false;
+    }
+    if (count > 0) {
+        builder->record_count = count;
+        builder->dependency_count = db->header->dependency_count;
+        memcpy(builder->records, db->records, count * sizeof(PackageDbRecord));
+        memcpy(builder->dependencies, db->dependencies, builder->dependency_count * sizeof(PackageDbDependency));
+
+        // Offset 0 is the empty string in both tables
+        builder->base_strings = db->strings;
+        builder->base_strings_size = db->header->strings_size;
+        builder->strings_size = db->header->strings_size;
+    }
+    return true;
+}
+
+void package_db_builder_remove(PackageDbBuilder* builder, uint32_t index) {
+    builder->records[index] = builder->records[--builder->record_count];
+}
+
+void package_db_builder_free(PackageDbBuilder* builder) {
+    free(builder->records);
+    free(builder->dependencies);
+    name_registry_free(&builder->strings);
+    memset(builder, 0, sizeof(*builder));
+}
+
+// Intern a string and return its string table offset
+static bool builder_string(PackageDbBuilder* builder, const char* text, uint32_t* offset) {
+    if (!text) {
+        text = "";
+    }
+
+    int32_t id = name_registry_intern(&builder->strings, text);
+    if (id < 0) {
+        return false;
+    }
+
+    int32_t value = name_registry_value(&builder->strings, id);
+    if (value == NAME_REGISTRY_UNBOUND) {
+        if (builder->strings_size + strlen(text) + 1 > INT32_MAX) {
+            return false;
+        }
+        value = (int32_t)builder->strings_size;
+        name_registry_bind(&builder->strings, id, value);
+        builder->strings_size += strlen(text) + 1;
+    }
+
+    *offset = (uint32_t)value;
+    return true;
+}
+
+static bool builder_reserve(PackageDbBuilder* builder, uint32_t dependencies) {
+    if (builder->record_count == builder->record_capacity) {
+        uint32_t capacity = builder->record_capacity ? builder->record_capacity * 2 : 1024;
+        PackageDbRecord* records = realloc(builder->records, capacity * sizeof(*records));
+        if (!records) {
+            return false;
+        }
+        builder->records = records;
+        builder->record_capacity = capacity;
+    }
+
+    if (builder->dependency_count + dependencies > builder->dependency_capacity) {
+        uint32_t capacity = builder->dependency_capacity ? builder->dependency_capacity : 4096;
+        while (capacity < builder->dependency_count + dependencies) {
+            capacity *= 2;
+        }
+        PackageDbDependency* deps = realloc(builder->dependencies, capacity * sizeof(*deps));
+        if (!deps) {
+            return false;
+        }
+        builder->dependencies = deps;
+        builder->dependency_capacity = capacity;
+    }
+    return true;
+}
+
+bool package_db_builder_add(PackageDbBuilder* builder,
+                            const char* name, const char* version,
+                            const char* description, const char* install_path,
+                            uint64_t installed_size, uint8_t state,
+                            const PackageDbDependencyInput* dependencies,
+                            uint32_t dependency_count) {
+    if (dependency_count > UINT16_MAX || !builder_reserve(builder, dependency_count)) {
+        return false;
+    }
+
+    PackageDbRecord* record = &builder->records[builder->record_count];
+    memset(record, 0, sizeof(*record));
+    if (!builder_string(builder, name, &record->name) ||
+        !builder_string(builder, version, &record->version) ||
+        !builder_string(builder, description, &record->description) ||
+        !builder_string(builder, install_path, &record->install_path)) {
+        return false;
+    }
+    record->name_hash = name_hash(name);
+    record->installed_size = installed_size;
+    record->state = state;
+    record->dependency_start = builder->dependency_count;
+    record->dependency_count = (uint16_t)dependency_count;
+
+    for (uint32_t i = 0; i < dependency_count; i++) {
+        PackageDbDependency* dep = &builder->dependencies[builder->dependency_count + i];
+        memset(dep, 0, sizeof(*dep));
+        if (!builder_string(builder, dependencies[i].name, &dep->name) ||
+            !builder_string(builder, dependencies[i].constraint, &dep->constraint)) {
+            return false;
+        }
+        dep->flags = dependencies[i].flags;
+    }
+
+    builder->dependency_count += dependency_count;
+    builder->record_count++;
+    return true;
+}
+
+bool package_db_builder_copy(PackageDbBuilder* builder, const PackageDb* db,
+                             uint32_t index, uint8_t state) {
+    const PackageDbRecord* record = package_db_record(db, index);
+    PackageDbDependencyInput* deps = malloc((record->dependency_count + 1) * sizeof(*deps));
+    uint32_t count = 0;
+    if (!deps) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < record->dependency_count; i++) {
+        const PackageDbDependency* dep = package_db_dependency(db, record, i);
+        if (!dep) {
+            break;
+        }
+        deps[count].name = package_db_string(db, dep->name);
+        deps[count].constraint = package_db_string(db, dep->constraint);
+        deps[count].flags = dep->flags;
+        count++;
+    }
+
+    bool ok = package_db_builder_add(builder,
+        package_db_string(db, record->name), package_db_string(db, record->version),
+        package_db_string(db, record->description), package_db_string(db, record->install_path),
+        record->installed_size, state, deps, count);
+    if (ok && state != 0) {
+        // Only local state carries over; catalog flags such as tombstones do not
+        builder->records[builder->record_count - 1].flags = record->flags & PACKAGE_DB_RECORD_AUTOMATIC;
+    }
+    free(deps);
+    return ok;
+}
+
+bool package_db_builder_update(PackageDbBuilder* builder, const PackageDb* db, uint32_t index,
+                               const PackageDb* local, uint32_t local_index) {
+    const PackageDbRecord* installed = package_db_record(local, local_index);
+    if (!package_db_builder_copy(builder, db, index, installed->state)) {
+        return false;
+    }
+    if (installed->state == 0) {
+        return true;    // Not installed: the catalog's install path applies
+    }
+    PackageDbRecord* record = &builder->records[builder->record_count - 1];
+    record->flags = installed->flags & PACKAGE_DB_RECORD_AUTOMATIC;
+    return builder_string(builder, package_db_string(local, installed->install_path), &record->install_path);
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+    const uint8_t* p = data;
+    while (size > 0) {
+        ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            return false;
+        }
+        p += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+static bool write_padding(int fd, uint64_t from, uint64_t to) {
+    static const uint8_t zeros[8];
+    return write_all(fd, zeros, (size_t)(to - from));
+}
+
+bool package_db_write(const PackageDbBuilder* builder, const char* path) {
+    PackageDbHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = PACKAGE_DB_MAGIC;
+    header.version = PACKAGE_DB_VERSION;
+    header.header_size = sizeof(PackageDbHeader);
+    header.record_size = sizeof(PackageDbRecord);
+    header.record_count = builder->record_count;
+    header.dependency_count = builder->dependency_count;
+    header.sequence = builder->sequence;
+    header.origin = builder->origin;
+
+    header.slot_count = 16;
+    while (header.slot_count < builder->record_count * 2) {
+        header.slot_count *= 2;
+    }
+
+    // Build the hash slots and the installed index
+    uint32_t* slots = calloc(header.slot_count, sizeof(uint32_t));
+    uint32_t* installed = malloc((builder->record_count + 1) * sizeof(uint32_t));
+    char* strings = malloc(builder->strings_size);
+    if (!slots || !installed || !strings) {
+        free(slots);
+        free(installed);
+        free(strings);
+        return false;
+    }
+
+    uint32_t mask = header.slot_count - 1;
+    for (uint32_t i = 0; i < builder->record_count; i++) {
+        uint32_t slot = (uint32_t)builder->records[i].name_hash & mask;
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = i + 1;
+        if (builder->records[i].state == PACKAGE_DB_STATE_INSTALLED) {
+            installed[header.installed_count++] = i;
+        }
+    }
+
+    if (builder->base_strings) {
+        memcpy(strings, builder->base_strings, builder->base_strings_size);
+    }
+    for (uint32_t id = 0; id < builder->strings.count; id++) {
+        const char* text = name_registry_name(&builder->strings, (int32_t)id);
+        memcpy(strings + name_registry_value(&builder->strings, (int32_t)id), text, strlen(text) + 1);
+    }
+
+    header.records_offset = ALIGN8(sizeof(header));
+    header.dependencies_offset = ALIGN8(header.records_offset + (uint64_t)builder->record_count * sizeof(PackageDbRecord));
+    header.installed_offset = ALIGN8(header.dependencies_offset + (uint64_t)builder->dependency_count * sizeof(PackageDbDependency));
+    header.slots_offset = ALIGN8(header.installed_offset + (uint64_t)header.installed_count * sizeof(uint32_t));
+    header.strings_offset = ALIGN8(header.slots_offset + (uint64_t)header.slot_count * sizeof(uint32_t));
+    header.strings_size = builder->strings_size;
+    header.file_size = header.strings_offset + header.strings_size;
+
+    // Write under a temporary name, then atomically replace the old file
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path, (int)getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0;
+
+    ok = ok && write_all(fd, &header, sizeof(header)) &&
+         write_padding(fd, sizeof(header), header.records_offset) &&
+         write_all(fd, builder->records, (size_t)builder->record_count * sizeof(PackageDbRecord)) &&
+         write_padding(fd, header.records_offset + (uint64_t)builder->record_count * sizeof(PackageDbRecord),
+                       header.dependencies_offset) &&
+         write_all(fd, builder->dependencies, (size_t)builder->dependency_count * sizeof(PackageDbDependency)) &&
+         write_padding(fd, header.dependencies_offset + (uint64_t)builder->dependency_count * sizeof(PackageDbDependency),
+                       header.installed_offset) &&
+         write_all(fd, installed, (size_t)header.installed_count * sizeof(uint32_t)) &&
+         write_padding(fd, header.installed_offset + (uint64_t)header.installed_count * sizeof(uint32_t),
+                       header.slots_offset) &&
+         write_all(fd, slots, (size_t)header.slot_count * sizeof(uint32_t)) &&
+         write_padding(fd, header.slots_offset + (uint64_t)header.slot_count * sizeof(uint32_t),
+                       header.strings_offset) &&
+         write_all(fd, strings, builder->strings_size) &&
+         fsync(fd) == 0;
+
+    if (fd >= 0 && close(fd) < 0) {
+        ok = false;
+    }
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) {
+        unlink(tmp_path);
+    }
+
+    // Make the rename itself durable
+    if (ok) {
+        char dir_path[4096];
+        snprintf(dir_path, sizeof(dir_path), "%s", path);
+        int dir_fd = open(dirname(dir_path), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    }
+
+    free(slots);
+    free(installed);
+    free(strings);
+    return ok;
+}
@@ -0,0 +1,183 @@
+#ifndef PROMPTOS_PACKAGE_DB_H
+#define PROMPTOS_PACKAGE_DB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "../system/libs/name_registry.h"
+
+// Binary package database (PACKAGE_DB_PATH)
+//
+// The file is mapped read-only and queried in place; opening it validates
+// the header and nothing else, so startup cost is one page fault per
+// record actually touched. All integers are little-endian and every
+// section starts on an 8-byte boundary:
+//
+//   header | records | dependencies | installed | hash slots | strings
+//
+// Records have a fixed stride and refer to the string table by offset.
+// The hash slots hold record index + 1 (0 = empty) and are probed
+// linearly from name_hash & (slot_count - 1). The installed section lists
+// the indices of installed records so they can be loaded without scanning
+// the catalog.
+//
+// Version 2 appends the repository sync position to the header (see
+// package_sync.c); version 1 files still open, as never synced.
+
+#define PACKAGE_DB_MAGIC   0x42444b50u  // "PKDB"
+#define PACKAGE_DB_VERSION 2
+
+// Dependency flags
+#define PACKAGE_DB_DEP_OPTIONAL 0x01
+#define PACKAGE_DB_DEP_CONFLICT 0x02  // Entry names a conflicting package
+
+// Record state listed in the installed section (PACKAGE_STATE_INSTALLED)
+#define PACKAGE_DB_STATE_INSTALLED 1
+
+// Record flags
+#define PACKAGE_DB_RECORD_REMOVED 0x01  // In a repository delta: the package was dropped
+#define PACKAGE_DB_RECORD_AUTOMATIC 0x02    // Installed only as a dependency
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t record_size;
+    uint32_t record_count;
+    uint32_t dependency_count;
+    uint32_t installed_count;
+    uint32_t slot_count;            // Power of two
+    uint32_t reserved;
+    uint64_t records_offset;
+    uint64_t dependencies_offset;
+    uint64_t installed_offset;
+    uint64_t slots_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t file_size;
+    uint64_t sequence;              // Repository index sequence this catalog matches
+    uint64_t origin;                // Repository the sequence belongs to; 0 = never synced
+} PackageDbHeader;
+
+#define PACKAGE_DB_V1_HEADER_SIZE offsetof(PackageDbHeader, sequence)
+
+typedef struct {
+    uint64_t name_hash;             // name_hash() of the package name
+    uint64_t installed_size;
+    uint32_t name;                  // String table offsets
+    uint32_t version;
+    uint32_t description;
+    uint32_t install_path;
+    uint32_t dependency_start;      // Index into the dependency section
+    uint16_t dependency_count;
+    uint8_t state;                  // PackageState
+    uint8_t flags;
+    uint32_t reserved[2];
+} PackageDbRecord;
+
+typedef struct {
+    uint32_t name;
+    uint32_t constraint;            // Version constraint text, e.g. ">= 2.0"
+    uint8_t flags;
+    uint8_t reserved[3];
+} PackageDbDependency;
+
+// Read-only view of a mapped database
+typedef struct {
+    const uint8_t* base;
+    size_t size;
+    const PackageDbHeader* header;
+    const PackageDbRecord* records;
+    const PackageDbDependency* dependencies;
+    const uint32_t* installed;
+    const uint32_t* slots;
+    const char* strings;
+    uint64_t sequence;              // From the header; 0 for version 1 files
+    uint64_t origin;
+} PackageDb;
+
+bool package_db_open(PackageDb* db, const char* path);
+void package_db_close(PackageDb* db);
+
+// Return the record index for a package name, or -1
+int32_t package_db_find(const PackageDb* db, const char* name);
+int32_t package_db_find_hashed(const PackageDb* db, const char* name, uint64_t hash);
+
+static inline uint32_t package_db_count(const PackageDb* db) {
+    return db->header ? db->header->record_count : 0;
+}
+
+static inline const PackageDbRecord* package_db_record(const PackageDb* db, uint32_t index) {
+    return &db->records[index];
+}
+
+// Strings outside the table read as empty rather than faulting
+static inline const char* package_db_string(const PackageDb* db, uint32_t offset) {
+    return offset < db->header->strings_size ? db->strings + offset : "";
+}
+
+// Dependencies of a record; bounds are checked against the section
+static inline const PackageDbDependency* package_db_dependency(const PackageDb* db,
+                                                               const PackageDbRecord* record,
+                                                               uint32_t i) {
+    uint32_t index = record->dependency_start + i;
+    return index < db->header->dependency_count ? &db->dependencies[index] : NULL;
+}
+
+// Database writer. Strings are deduplicated through a name registry.
+typedef struct {
+    PackageDbRecord* records;
+    uint32_t record_count;
+    uint32_t record_capacity;
+    PackageDbDependency* dependencies;
+    uint32_t dependency_count;
+    uint32_t dependency_capacity;
+    NameRegistry strings;           // Value = offset in the string table
+    uint64_t strings_size;
+    const char* base_strings;       // String table of the seed database, if any
+    uint64_t base_strings_size;
+    uint64_t sequence;              // Written to the header
+    uint64_t origin;
+} PackageDbBuilder;
+
+// Input for one dependency or conflict entry
+typedef struct {
+    const char* name;
+    const char* constraint;
+    uint8_t flags;
+} PackageDbDependencyInput;
+
+bool package_db_builder_init(PackageDbBuilder* builder, uint32_t expected);
+void package_db_builder_free(PackageDbBuilder* builder);
+
+// Start from every record of `db`, to change a few of them without
+// re-adding the rest. The string table is reused as it is and new strings
+// go after it, so `db` must stay open until the builder is written.
+// Strings no record uses any more stay until a full rewrite.
+bool package_db_builder_init_from(PackageDbBuilder* builder, const PackageDb* db, uint32_t extra);
+
+// Drop a record by moving the last one into its place
+void package_db_builder_remove(PackageDbBuilder* builder, uint32_t index);
+
+bool package_db_builder_add(PackageDbBuilder* builder,
+                            const char* name, const char* version,
+                            const char* description, const char* install_path,
+                            uint64_t installed_size, uint8_t state,
+                            const PackageDbDependencyInput* dependencies,
+                            uint32_t dependency_count);
+
+// Copy a record (and its dependencies) from another database, optionally
+// overriding its state
+bool package_db_builder_copy(PackageDbBuilder* builder, const PackageDb* db,
+                             uint32_t index, uint8_t state);
+
+// Copy a catalog record from `db`, keeping the state and install path of
+// record `local_index` in `local`: the package's files are already there
+bool package_db_builder_update(PackageDbBuilder* builder, const PackageDb* db, uint32_t index,
+                               const PackageDb* local, uint32_t local_index);
+
+// Write the database to `path` crash-safely: the new file is written and
+// fsynced under a temporary name, then renamed over the old one
+bool package_db_write(const PackageDbBuilder* builder, const char* path);
+
+#endif // PROMPTOS_PACKAGE_DB_H
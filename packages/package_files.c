@@ -0,0 +1,551 @@
+#include "package_files.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+// Growable byte buffer for the log and the table sections
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+static bool buffer_append(Buffer* buffer, const void* data, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->size + size) {
+            capacity *= 2;
+        }
+        uint8_t* grown = realloc(buffer->data, capacity);
+        if (!grown) {
+            return false;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+    return true;
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+    const uint8_t* p = data;
+    while (size > 0) {
+        ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            return false;
+        }
+        p += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+static bool write_padding(int fd, uint64_t from, uint64_t to) {
+    static const uint8_t zeros[8];
+    return write_all(fd, zeros, (size_t)(to - from));
+}
+
+// Check that a section lies inside the mapping
+static bool section_fits(const PackageFiles* files, uint64_t offset, uint64_t count, uint64_t stride) {
+    return offset % 8 == 0 && offset <= files->size &&
+           (stride == 0 || count <= (files->size - offset) / stride);
+}
+
+static void table_unmap(PackageFiles* files) {
+    if (files->base) {
+        munmap((void*)files->base, files->size);
+    }
+    files->base = NULL;
+    files->size = 0;
+    files->header = NULL;
+}
+
+// Map the table; a missing one is an empty index
+static bool table_map(PackageFiles* files) {
+    int fd = open(files->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(PackageFilesHeader)) {
+        close(fd);
+        return false;
+    }
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    madvise(base, (size_t)st.st_size, MADV_RANDOM);
+    files->base = base;
+    files->size = (size_t)st.st_size;
+
+    // Entries are bounds-checked as they are decoded
+    const PackageFilesHeader* header = base;
+    bool valid =
+        header->magic == PACKAGE_FILES_MAGIC &&
+        header->version == PACKAGE_FILES_VERSION &&
+        header->header_size == sizeof(PackageFilesHeader) &&
+        header->file_size == files->size &&
+        header->block_count == (header->entry_count + PACKAGE_FILES_BLOCK - 1) / PACKAGE_FILES_BLOCK &&
+        section_fits(files, header->owners_offset, header->owner_count, sizeof(uint32_t)) &&
+        section_fits(files, header->blocks_offset, header->block_count, sizeof(uint64_t)) &&
+        section_fits(files, header->data_offset, header->data_size, 1) &&
+        section_fits(files, header->strings_offset, header->strings_size, 1) &&
+        (header->owner_count == 0 ||
+         (header->strings_size > 0 && files->base[header->strings_offset + header->strings_size - 1] == '\0'));
+    if (!valid) {
+        table_unmap(files);
+        return false;
+    }
+
+    files->header = header;
+    files->owners = (const uint32_t*)(files->base + header->owners_offset);
+    files->blocks = (const uint64_t*)(files->base + header->blocks_offset);
+    files->data = files->base + header->data_offset;
+    files->strings = (const char*)(files->base + header->strings_offset);
+    return true;
+}
+
+static const char* table_owner(const PackageFiles* files, uint32_t owner) {
+    uint32_t offset = files->owners[owner];
+    return offset < files->header->strings_size ? files->strings + offset : "";
+}
+
+// Decode the entry at `*offset` over the previous path in `path`
+static bool entry_next(const PackageFiles* files, uint64_t* offset, char* path, size_t* len, uint32_t* owner) {
+    PackageFilesEntry entry;
+    uint64_t size = files->header->data_size;
+    if (*offset > size || size - *offset < sizeof(entry)) {
+        return false;
+    }
+    memcpy(&entry, files->data + *offset, sizeof(entry));
+    if (entry.shared > *len || (size_t)entry.shared + entry.suffix >= PATH_MAX ||
+        size - *offset - sizeof(entry) < entry.suffix || entry.owner >= files->header->owner_count) {
+        return false;
+    }
+    memcpy(path + entry.shared, files->data + *offset + sizeof(entry), entry.suffix);
+    *len = (size_t)entry.shared + entry.suffix;
+    path[*len] = '\0';
+    *offset += sizeof(entry) + entry.suffix;
+    *owner = entry.owner;
+    return true;
+}
+
+// Owner index of `path` in the table, or -1
+static int32_t table_find(const PackageFiles* files, const char* path) {
+    if (!files->header || files->header->block_count == 0) {
+        return -1;
+    }
+
+    // Last block whose first path sorts at or before `path`
+    char key[PATH_MAX];
+    size_t len;
+    uint32_t owner;
+    uint32_t low = 0, high = files->header->block_count;
+    while (high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+        uint64_t offset = files->blocks[mid];
+        len = 0;
+        if (!entry_next(files, &offset, key, &len, &owner)) {
+            return -1;
+        }
+        if (strcmp(key, path) <= 0) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    uint64_t offset = files->blocks[low];
+    uint32_t count = files->header->entry_count - low * PACKAGE_FILES_BLOCK;
+    len = 0;
+    for (uint32_t i = 0; i < count && i < PACKAGE_FILES_BLOCK; i++) {
+        if (!entry_next(files, &offset, key, &len, &owner)) {
+            return -1;
+        }
+        int order = strcmp(key, path);
+        if (order == 0) {
+            return (int32_t)owner;
+        }
+        if (order > 0) {
+            break;
+        }
+    }
+    return -1;
+}
+
+// Apply complete log lines to the overlay; returns the bytes consumed
+static size_t replay(PackageFiles* files, char* text, size_t size) {
+    size_t used = 0;
+    char* end;
+    while (used < size && (end = memchr(text + used, '\n', size - used)) != NULL) {
+        char* line = text + used;
+        *end = '\0';
+        used = (size_t)(end - text) + 1;
+        files->log_lines++;
+
+        int32_t value = PACKAGE_FILES_REMOVED;
+        char* path = line + 1;
+        if (line[0] == '+') {
+            char* tab = strchr(path, '\t');
+            if (!tab) {
+                continue;
+            }
+            *tab = '\0';
+            value = name_registry_intern(&files->owner_names, path);
+            path = tab + 1;
+        } else if (line[0] != '-') {
+            continue;
+        }
+        int32_t id = name_registry_intern(&files->changes, path);
+        if (id >= 0 && value != NAME_REGISTRY_UNBOUND) {
+            name_registry_bind(&files->changes, id, value);
+        }
+    }
+    return used;
+}
+
+static bool overlay_reset(PackageFiles* files) {
+    name_registry_free(&files->changes);
+    name_registry_free(&files->owner_names);
+    files->log_lines = 0;
+    return name_registry_init(&files->changes, 1024) && name_registry_init(&files->owner_names, 64);
+}
+
+bool package_files_open(PackageFiles* files, const char* path) {
+    memset(files, 0, sizeof(*files));
+    files->log_fd = -1;
+    char log_path[PATH_MAX + 8];
+    if (snprintf(files->path, sizeof(files->path), "%s", path) >= (int)sizeof(files->path) ||
+        !overlay_reset(files)) {
+        package_files_close(files);
+        return false;
+    }
+    snprintf(log_path, sizeof(log_path), "%s" PACKAGE_FILES_LOG_SUFFIX, path);
+    if (!package_make_parents(log_path, 0755) || !table_map(files)) {
+        package_files_close(files);
+        return false;
+    }
+
+    files->log_fd = open(log_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    if (files->log_fd < 0 || fstat(files->log_fd, &st) < 0) {
+        package_files_close(files);
+        return false;
+    }
+
+    // A torn last line (a crash mid-append) is cut off, so the next commit
+    // starts on a line of its own
+    bool ok = true;
+    if (st.st_size > 0) {
+        char* text = malloc((size_t)st.st_size);
+        ok = text && pread(files->log_fd, text, (size_t)st.st_size, 0) == st.st_size;
+        size_t used = ok ? replay(files, text, (size_t)st.st_size) : 0;
+        ok = ok && (used == (size_t)st.st_size || ftruncate(files->log_fd, (off_t)used) == 0);
+        free(text);
+    }
+    if (!ok) {
+        package_files_close(files);
+    }
+    return ok;
+}
+
+void package_files_close(PackageFiles* files) {
+    table_unmap(files);
+    name_registry_free(&files->changes);
+    name_registry_free(&files->owner_names);
+    if (files->log_fd >= 0) {
+        close(files->log_fd);
+    }
+    files->log_fd = -1;
+}
+
+const char* package_files_owner(const PackageFiles* files, const char* path) {
+    int32_t id = name_registry_lookup(&files->changes, path);
+    int32_t value = id >= 0 ? name_registry_value(&files->changes, id) : NAME_REGISTRY_UNBOUND;
+    if (value == PACKAGE_FILES_REMOVED) {
+        return NULL;
+    }
+    if (value >= 0) {
+        return name_registry_name(&files->owner_names, value);
+    }
+    int32_t owner = table_find(files, path);
+    return owner >= 0 ? table_owner(files, (uint32_t)owner) : NULL;
+}
+
+// "usr", "/usr/" and "/" all give one leading slash and no trailing one
+bool package_files_key(const char* install_path, const char* relative, char* key, size_t size) {
+    while (*install_path == '/') {
+        install_path++;
+    }
+    size_t len = strlen(install_path);
+    while (len > 0 && install_path[len - 1] == '/') {
+        len--;
+    }
+    int written = len > 0 ? snprintf(key, size, "/%.*s/%s", (int)len, install_path, relative)
+                          : snprintf(key, size, "/%s", relative);
+    return written > 0 && (size_t)written < size;
+}
+
+bool package_files_check(const PackageFiles* files, const char* owner, const char* install_path,
+                         const PackageManifest* manifest, char* conflict, size_t size,
+                         const char** conflict_owner) {
+    char key[PATH_MAX];
+    for (uint32_t i = 0; i < manifest->file_count; i++) {
+        const StoreFile* file = &manifest->files[i];
+        if (file->type == STORE_FILE_DIRECTORY ||
+            !package_files_key(install_path, file->path, key, sizeof(key))) {
+            continue;
+        }
+        const char* current = package_files_owner(files, key);
+        if (current && strcmp(current, owner) != 0) {
+            snprintf(conflict, size, "%s", key);
+            *conflict_owner = current;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Log lines for one manifest; removals only for paths `owner` still owns
+static bool log_manifest(const PackageFiles* files, Buffer* log, const char* owner, const char* install_path,
+                         const PackageManifest* manifest, bool add) {
+    char key[PATH_MAX];
+    for (uint32_t i = 0; manifest && i < manifest->file_count; i++) {
+        const StoreFile* file = &manifest->files[i];
+        if (file->type == STORE_FILE_DIRECTORY) {
+            continue;
+        }
+        if (!package_files_key(install_path, file->path, key, sizeof(key))) {
+            return false;
+        }
+        if (add) {
+            if (!buffer_append(log, "+", 1) || !buffer_append(log, owner, strlen(owner)) ||
+                !buffer_append(log, "\t", 1)) {
+                return false;
+            }
+        } else {
+            const char* current = package_files_owner(files, key);
+            if (!current || strcmp(current, owner) != 0) {
+                continue;
+            }
+            if (!buffer_append(log, "-", 1)) {
+                return false;
+            }
+        }
+        if (!buffer_append(log, key, strlen(key)) || !buffer_append(log, "\n", 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool package_files_commit(PackageFiles* files, const char* owner, const char* install_path,
+                          const PackageManifest* removed, const PackageManifest* added) {
+    if (owner[0] == '\0' || strpbrk(owner, "\t\n")) {
+        return false;
+    }
+
+    // The overlay changes only once the log holds the lines on disk
+    Buffer log = { NULL, 0, 0 };
+    bool ok = log_manifest(files, &log, owner, install_path, removed, false) &&
+              log_manifest(files, &log, owner, install_path, added, true) &&
+              write_all(files->log_fd, log.data, log.size) && fdatasync(files->log_fd) == 0;
+    if (ok) {
+        replay(files, (char*)log.data, log.size);
+    }
+    free(log.data);
+
+    // A failed merge leaves a valid table and log; it is retried next time
+    uint32_t limit = package_files_count(files) / 4;
+    if (ok && files->log_lines > (limit > PACKAGE_FILES_LOG_MIN ? limit : PACKAGE_FILES_LOG_MIN)) {
+        package_files_compact(files);
+    }
+    return ok;
+}
+
+// Writes the merged table
+typedef struct {
+    Buffer blocks;
+    Buffer data;
+    Buffer owners;
+    Buffer strings;
+    NameRegistry owner_ids;         // Owner name -> index in the new table
+    char previous[PATH_MAX];
+    size_t previous_len;
+    uint32_t count;
+} TableWriter;
+
+static bool writer_add(TableWriter* writer, const char* path, const char* owner) {
+    int32_t id = name_registry_intern(&writer->owner_ids, owner);
+    if (id < 0) {
+        return false;
+    }
+    if (name_registry_value(&writer->owner_ids, id) == NAME_REGISTRY_UNBOUND) {
+        uint32_t offset = (uint32_t)writer->strings.size;
+        if (!buffer_append(&writer->owners, &offset, sizeof(offset)) ||
+            !buffer_append(&writer->strings, owner, strlen(owner) + 1)) {
+            return false;
+        }
+        name_registry_bind(&writer->owner_ids, id, (int32_t)(writer->owners.size / sizeof(uint32_t) - 1));
+    }
+
+    size_t len = strlen(path);
+    size_t shared = 0;
+    if (writer->count % PACKAGE_FILES_BLOCK == 0) {
+        uint64_t offset = writer->data.size;
+        if (!buffer_append(&writer->blocks, &offset, sizeof(offset))) {
+            return false;
+        }
+    } else {
+        while (shared < len && shared < writer->previous_len && path[shared] == writer->previous[shared]) {
+            shared++;
+        }
+    }
+    if (len >= PATH_MAX) {
+        return false;
+    }
+
+    PackageFilesEntry entry = { (uint16_t)shared, (uint16_t)(len - shared),
+                                (uint32_t)name_registry_value(&writer->owner_ids, id) };
+    if (!buffer_append(&writer->data, &entry, sizeof(entry)) ||
+        !buffer_append(&writer->data, path + shared, len - shared)) {
+        return false;
+    }
+    memcpy(writer->previous, path, len);
+    writer->previous_len = len;
+    writer->count++;
+    return true;
+}
+
+static bool writer_save(const TableWriter* writer, const char* path) {
+    PackageFilesHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = PACKAGE_FILES_MAGIC;
+    header.version = PACKAGE_FILES_VERSION;
+    header.header_size = sizeof(header);
+    header.entry_count = writer->count;
+    header.block_count = (uint32_t)(writer->blocks.size / sizeof(uint64_t));
+    header.owner_count = (uint32_t)(writer->owners.size / sizeof(uint32_t));
+    header.owners_offset = ALIGN8(sizeof(header));
+    header.blocks_offset = ALIGN8(header.owners_offset + writer->owners.size);
+    header.data_offset = ALIGN8(header.blocks_offset + writer->blocks.size);
+    header.data_size = writer->data.size;
+    header.strings_offset = ALIGN8(header.data_offset + header.data_size);
+    header.strings_size = writer->strings.size;
+    header.file_size = header.strings_offset + header.strings_size;
+
+    // Write under a temporary name, then atomically replace the old table
+    char tmp_path[PATH_MAX + 32];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path, (int)getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 &&
+              write_all(fd, &header, sizeof(header)) &&
+              write_padding(fd, sizeof(header), header.owners_offset) &&
+              write_all(fd, writer->owners.data, writer->owners.size) &&
+              write_padding(fd, header.owners_offset + writer->owners.size, header.blocks_offset) &&
+              write_all(fd, writer->blocks.data, writer->blocks.size) &&
+              write_padding(fd, header.blocks_offset + writer->blocks.size, header.data_offset) &&
+              write_all(fd, writer->data.data, writer->data.size) &&
+              write_padding(fd, header.data_offset + header.data_size, header.strings_offset) &&
+              write_all(fd, writer->strings.data, writer->strings.size) &&
+              fsync(fd) == 0;
+    if (fd >= 0 && close(fd) < 0) {
+        ok = false;
+    }
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) {
+        unlink(tmp_path);
+        return false;
+    }
+
+    // Make the rename durable before the log is emptied
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s", path);
+    int dir_fd = open(dirname(dir_path), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    return true;
+}
+
+typedef struct {
+    const char* path;
+    int32_t value;
+} OverlayPath;
+
+static int overlay_compare(const void* a, const void* b) {
+    return strcmp(((const OverlayPath*)a)->path, ((const OverlayPath*)b)->path);
+}
+
+bool package_files_compact(PackageFiles* files) {
+    uint32_t overlay_count = 0;
+    OverlayPath* overlay = malloc((files->changes.count + 1) * sizeof(OverlayPath));
+    TableWriter* writer = calloc(1, sizeof(TableWriter));
+    bool ok = overlay && writer && name_registry_init(&writer->owner_ids, 64);
+    for (uint32_t id = 0; ok && id < files->changes.count; id++) {
+        int32_t value = name_registry_value(&files->changes, (int32_t)id);
+        if (value != NAME_REGISTRY_UNBOUND) {
+            overlay[overlay_count].path = name_registry_name(&files->changes, (int32_t)id);
+            overlay[overlay_count++].value = value;
+        }
+    }
+    if (ok) {
+        qsort(overlay, overlay_count, sizeof(OverlayPath), overlay_compare);
+    }
+
+    // Merge two sorted runs; the overlay wins on equal paths
+    char key[PATH_MAX];
+    size_t len = 0;
+    uint32_t owner = 0;
+    uint64_t offset = 0;
+    uint32_t table_left = package_files_count(files);
+    bool have_key = ok && table_left > 0 && entry_next(files, &offset, key, &len, &owner);
+    ok = ok && (table_left == 0 || have_key);
+    uint32_t next = 0;
+    while (ok && (have_key || next < overlay_count)) {
+        int order = !have_key ? 1 : next == overlay_count ? -1 : strcmp(key, overlay[next].path);
+        if (order < 0) {
+            ok = writer_add(writer, key, table_owner(files, owner));
+        } else {
+            int32_t value = overlay[next++].value;
+            if (value >= 0) {
+                ok = writer_add(writer, overlay[next - 1].path, name_registry_name(&files->owner_names, value));
+            }
+        }
+        if (ok && order <= 0) {
+            have_key = --table_left > 0;
+            ok = !have_key || entry_next(files, &offset, key, &len, &owner);
+        }
+    }
+
+    ok = ok && writer_save(writer, files->path);
+    if (ok) {
+        table_unmap(files);
+        ok = table_map(files) && overlay_reset(files) && ftruncate(files->log_fd, 0) == 0 &&
+             fdatasync(files->log_fd) == 0;
+    }
+
+    if (writer) {
+        free(writer->blocks.data);
+        free(writer->data.data);
+        free(writer->owners.data);
+        free(writer->strings.data);
+        name_registry_free(&writer->owner_ids);
+    }
+    free(writer);
+    free(overlay);
+    return ok;
+}
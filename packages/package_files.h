@@ -0,0 +1,121 @@
+#ifndef PROMPTOS_PACKAGE_FILES_H
+#define PROMPTOS_PACKAGE_FILES_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include "../system/libs/name_registry.h"
+#include "package_store.h"
+
+// Installed-file index (PACKAGE_FILES_PATH)
+//
+// Maps every file and symlink an installed package owns, as an absolute
+// path under the install root, to that package. Directories are shared
+// and not indexed. The index is two files:
+//
+//   <path>      sorted, prefix-compressed table, mapped read-only
+//   <path>.log  changes committed since the table was written
+//
+// The table is laid out like the package database, little-endian with
+// 8-byte aligned sections:
+//
+//   header | owner offsets | block offsets | blocks | owner names
+//
+// Paths are sorted bytewise and cut into blocks of PACKAGE_FILES_BLOCK
+// entries. The first entry of a block holds its whole path; each later
+// one holds the length it shares with the previous path and the rest. A
+// lookup binary-searches the first paths of the blocks and decodes at
+// most one block.
+//
+// Each commit appends one line per change to the log ("+<owner>\t<path>"
+// or "-<path>") and syncs it, so installing a package costs O(its files).
+// Opening the index replays the log into an in-memory overlay that is
+// consulted before the table. When the log outgrows a quarter of the
+// table, the two are merged into a new table and the log is emptied.
+// Replaying a log over a table it was already merged into is harmless.
+//
+// Not thread-safe; callers serialize access.
+
+#define PACKAGE_FILES_MAGIC   0x49464b50u   // "PKFI"
+#define PACKAGE_FILES_VERSION 1
+#define PACKAGE_FILES_LOG_SUFFIX ".log"
+#define PACKAGE_FILES_BLOCK 16              // Paths per prefix-compressed block
+#define PACKAGE_FILES_LOG_MIN 16384         // Log lines before a merge is considered
+#define PACKAGE_FILES_REMOVED (-2)          // Overlay value of a removed path
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t entry_count;
+    uint32_t block_count;
+    uint32_t owner_count;
+    uint32_t reserved;
+    uint64_t owners_offset;         // uint32 string offset per owner
+    uint64_t blocks_offset;         // uint64 data offset per block
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t file_size;
+} PackageFilesHeader;
+
+// Entry header inside a block, followed by `suffix` bytes of path
+typedef struct {
+    uint16_t shared;                // Bytes shared with the previous path
+    uint16_t suffix;
+    uint32_t owner;                 // Index into the owner offsets
+} PackageFilesEntry;
+
+typedef struct PackageFiles {
+    // Table, mapped
+    const uint8_t* base;
+    size_t size;
+    const PackageFilesHeader* header;
+    const uint32_t* owners;
+    const uint64_t* blocks;
+    const uint8_t* data;
+    const char* strings;
+
+    // Overlay replayed from the log: path -> id in `owner_names`, or
+    // PACKAGE_FILES_REMOVED
+    NameRegistry changes;
+    NameRegistry owner_names;
+    uint32_t log_lines;
+    int log_fd;
+    char path[PATH_MAX];
+} PackageFiles;
+
+// Map the table and replay the log. A missing index opens empty.
+bool package_files_open(PackageFiles* files, const char* path);
+void package_files_close(PackageFiles* files);
+
+// Package owning an absolute path, or NULL. The string stays valid until
+// the next commit.
+const char* package_files_owner(const PackageFiles* files, const char* path);
+
+// Absolute path of a manifest entry installed under `install_path`
+bool package_files_key(const char* install_path, const char* relative, char* key, size_t size);
+
+// Find a file of `manifest` that a package other than `owner` already
+// owns. Costs one lookup per file. Returns false and the first clash in
+// `conflict` and `conflict_owner`, or true when there is none.
+bool package_files_check(const PackageFiles* files, const char* owner, const char* install_path,
+                         const PackageManifest* manifest, char* conflict, size_t size,
+                         const char** conflict_owner);
+
+// Commit a package's change of files: entries of `removed` that `owner`
+// still owns are dropped, then every entry of `added` is assigned to it.
+// Either manifest may be NULL. The log is synced before this returns.
+bool package_files_commit(PackageFiles* files, const char* owner, const char* install_path,
+                          const PackageManifest* removed, const PackageManifest* added);
+
+// Merge the log into a new table
+bool package_files_compact(PackageFiles* files);
+
+static inline uint32_t package_files_count(const PackageFiles* files) {
+    return files->header ? files->header->entry_count : 0;
+}
+
+#endif // PROMPTOS_PACKAGE_FILES_H
@@ -1,193 +1,921 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../system/libs/name_registry.h"
+#include "../system/libs/arena.h"
+#include "package_manager.h"
+#include "package_db.h"
+#include "package_store.h"
+#include "package_files.h"
 
-// Package manager configuration
-#define MAX_PACKAGE_NAME_LEN 64
-#define MAX_PACKAGE_VERSION_LEN 32
-#define MAX_PACKAGE_DESC_LEN 256
-#define MAX_PACKAGES 1024
-#define MAX_DEPENDENCIES 32
-#define PACKAGE_DB_PATH "/var/lib/packages/db"
-#define PACKAGE_CACHE_PATH "/var/cache/packages"
-
-// Package states
-typedef enum {
-    PACKAGE_STATE_NOT_INSTALLED,
-    PACKAGE_STATE_INSTALLED,
-    PACKAGE_STATE_UPGRADING,
-    PACKAGE_STATE_REMOVING,
-    PACKAGE_STATE_BROKEN
-} PackageState;
-
-// Package dependency
+#define PACKAGE_TABLE_INITIAL 256
+
+// Global package registry: dense entries plus parallel cold details,
+// both grown on demand; strings and dependency lists live in the arena
+static PackageEntry* packages;
+static PackageDetails* package_info;
+static int package_count = 0;
+static int package_capacity = 0;
+static NameRegistry package_names;
+static Arena package_arena;
+
+// Reverse dependencies: for every interned name, the registered packages
+// that depend on it, as lists threaded through one edge pool. Edges are
+// added when a package is registered and replaced when its catalog entry
+// changes; whether a dependent is installed is read from its entry when
+// the list is walked, so installs and removals need no update.
 typedef struct {
-    char name[MAX_PACKAGE_NAME_LEN];
-    char version[MAX_PACKAGE_VERSION_LEN];
+    int32_t package;        // Dependent's table index
+    int32_t next;           // Next edge of the same name, or -1
     bool optional;
-} PackageDependency;
+} PackageRdepEdge;
 
-// Package definition
-typedef struct {
-    char name[MAX_PACKAGE_NAME_LEN];
-    char version[MAX_PACKAGE_VERSION_LEN];
-    char description[MAX_PACKAGE_DESC_LEN];
-    PackageState state;
-    size_t installed_size;
-    char install_path[256];
-    
-    // Dependencies
-    PackageDependency dependencies[MAX_DEPENDENCIES];
-    int dependency_count;
-    
-    // Installation hooks
-    bool (*pre_install)(void);
-    bool (*post_install)(void);
-    bool (*pre_remove)(void);
-    bool (*post_remove)(void);
-} Package;
-
-// Global package registry
-static Package packages[MAX_PACKAGES];
-static int package_count = 0;
+static int32_t* rdep_heads;         // First edge per name id, or -1
+static uint32_t rdep_head_capacity;
+static PackageRdepEdge* rdep_edges;
+static uint32_t rdep_edge_count;
+static uint32_t rdep_edge_capacity;
+static int32_t rdep_free = -1;      // Unlinked edges, chained through `next`
+
+// Mapped on-disk catalog; packages are imported from it on first use
+static PackageDb package_db;
+
+// Where archives come from and how the install pipeline is sized
+static PackagePipelineConfig pipeline_config = {
+    PACKAGE_REPO_URL, PACKAGE_CACHE_PATH, PACKAGE_MANIFEST_PATH, "/", PACKAGE_FILES_PATH, 0, 0, 0, 0
+};
+static PackagePipelineStats last_install;
+static PackageVerifyStats last_verify;
+static PackageSyncStats last_sync;
+
+// Which package owns each installed file, opened on first use
+static PackageFiles package_files;
+static bool package_files_tried = false;
+static bool package_files_ready = false;
+
+static PackageEntry* package_find(const char* name);
+static PackageEntry* package_import(uint32_t index);
+
+// Table index of a dependency, or -1 while it is not registered
+int package_dep_index(const PackageDepRef* dep) {
+    return name_registry_value(&package_names, dep->id);
+}
+
+const char* package_dep_name(const PackageDepRef* dep) {
+    return name_registry_name(&package_names, dep->id);
+}
+
+void package_manager_configure(const PackagePipelineConfig* config) {
+    if (package_files_ready) {
+        package_files_close(&package_files);
+    }
+    package_files_tried = false;
+    package_files_ready = false;
+    pipeline_config = *config;
+}
+
+PackageFiles* package_file_index(void) {
+    if (!package_files_tried && pipeline_config.files_path) {
+        package_files_tried = true;
+        package_files_ready = package_files_open(&package_files, pipeline_config.files_path);
+        if (!package_files_ready) {
+            fprintf(stderr, "package: cannot open file index %s\n", pipeline_config.files_path);
+        }
+    }
+    return package_files_ready ? &package_files : NULL;
+}
+
+// Package that installed `path` (absolute, below the install root)
+const char* package_file_owner(const char* path) {
+    PackageFiles* files = package_file_index();
+    return files ? package_files_owner(files, path) : NULL;
+}
+
+// Stage statistics of the most recent package_install
+const PackagePipelineStats* package_manager_last_install(void) {
+    return &last_install;
+}
+
+// Sequences and bytes of the most recent package_update_database
+const PackageSyncStats* package_manager_last_sync(void) {
+    return &last_sync;
+}
+
+// Files, bytes and problems of the most recent package_verify
+const PackageVerifyStats* package_manager_last_verify(void) {
+    return &last_verify;
+}
+
+int package_entry_count(void) {
+    return package_count;
+}
+
+PackageEntry* package_entry(int index) {
+    return &packages[index];
+}
+
+PackageDetails* package_details(int index) {
+    return &package_info[index];
+}
+
+int package_index(const char* name) {
+    PackageEntry* package = package_find(name);
+    return package ? (int)(package - packages) : -1;
+}
+
+// Copy a list of dependency or conflict names into the arena, interned
+static PackageDepRef* package_intern_refs(const PackageDependency* deps, int count) {
+    PackageDepRef* refs = count > 0 ? arena_alloc(&package_arena, (size_t)count * sizeof(*refs)) : NULL;
+    if (count > 0 && !refs) {
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        refs[i].id = name_registry_intern(&package_names, deps[i].name);
+        refs[i].version = arena_strdup(&package_arena, deps[i].version);
+        refs[i].optional = deps[i].optional;
+        if (refs[i].id < 0 || !refs[i].version) {
+            return NULL;
+        }
+    }
+    return refs;
+}
+
+// Make room for one more package; entries move, indices stay valid
+static bool package_table_reserve(void) {
+    if (package_count < package_capacity) {
+        return true;
+    }
+    int capacity = package_capacity ? package_capacity * 2 : PACKAGE_TABLE_INITIAL;
+    PackageEntry* entries = realloc(packages, (size_t)capacity * sizeof(*entries));
+    if (!entries) {
+        return false;
+    }
+    packages = entries;
+    PackageDetails* details = realloc(package_info, (size_t)capacity * sizeof(*details));
+    if (!details) {
+        return false;
+    }
+    package_info = details;
+    package_capacity = capacity;
+    return true;
+}
+
+// Grow the list heads to cover every interned name
+static bool rdep_reserve_heads(void) {
+    if (package_names.count <= rdep_head_capacity) {
+        return true;
+    }
+    uint32_t capacity = rdep_head_capacity ? rdep_head_capacity : PACKAGE_TABLE_INITIAL;
+    while (capacity < package_names.count) {
+        capacity *= 2;
+    }
+    int32_t* heads = realloc(rdep_heads, capacity * sizeof(*heads));
+    if (!heads) {
+        return false;
+    }
+    for (uint32_t i = rdep_head_capacity; i < capacity; i++) {
+        heads[i] = -1;
+    }
+    rdep_heads = heads;
+    rdep_head_capacity = capacity;
+    return true;
+}
+
+// Record that package `index` depends on each of its dependencies
+static bool rdep_link(int index) {
+    const PackageEntry* entry = &packages[index];
+    if (!rdep_reserve_heads()) {
+        return false;
+    }
+    for (int i = 0; i < entry->dependency_count; i++) {
+        int32_t edge = rdep_free;
+        if (edge >= 0) {
+            rdep_free = rdep_edges[edge].next;
+        } else {
+            if (rdep_edge_count == rdep_edge_capacity) {
+                uint32_t capacity = rdep_edge_capacity ? rdep_edge_capacity * 2 : PACKAGE_TABLE_INITIAL * 4;
+                PackageRdepEdge* edges = realloc(rdep_edges, capacity * sizeof(*edges));
+                if (!edges) {
+                    return false;
+                }
+                rdep_edges = edges;
+                rdep_edge_capacity = capacity;
+            }
+            edge = (int32_t)rdep_edge_count++;
+        }
+        int32_t id = entry->dependencies[i].id;
+        rdep_edges[edge].package = index;
+        rdep_edges[edge].optional = entry->dependencies[i].optional;
+        rdep_edges[edge].next = rdep_heads[id];
+        rdep_heads[id] = edge;
+    }
+    return true;
+}
+
+// Drop the edges rdep_link() added for package `index`
+static void rdep_unlink(int index) {
+    const PackageEntry* entry = &packages[index];
+    for (int i = 0; i < entry->dependency_count; i++) {
+        for (int32_t* link = &rdep_heads[entry->dependencies[i].id]; *link >= 0; link = &rdep_edges[*link].next) {
+            int32_t edge = *link;
+            if (rdep_edges[edge].package == index) {
+                *link = rdep_edges[edge].next;
+                rdep_edges[edge].next = rdep_free;
+                rdep_free = edge;
+                break;
+            }
+        }
+    }
+}
+
+static int32_t rdep_head(const char* name) {
+    int32_t id = name_registry_lookup(&package_names, name);
+    return id >= 0 && (uint32_t)id < rdep_head_capacity ? rdep_heads[id] : -1;
+}
+
+// First installed package that needs package `index`, or -1. Walks only
+// the packages that name it as a dependency.
+static int package_installed_dependent(int index, bool include_optional) {
+    int32_t edge = rdep_head(packages[index].name);
+    for (; edge >= 0; edge = rdep_edges[edge].next) {
+        const PackageRdepEdge* rdep = &rdep_edges[edge];
+        if (packages[rdep->package].state == PACKAGE_STATE_INSTALLED && (include_optional || !rdep->optional)) {
+            return rdep->package;
+        }
+    }
+    return -1;
+}
 
 // Initialize the package manager
 bool package_manager_init(void) {
-    memset(packages, 0, sizeof(packages));
-    // TODO: Load package database
+    free(rdep_heads);
+    free(rdep_edges);
+    rdep_heads = NULL;
+    rdep_edges = NULL;
+    rdep_head_capacity = 0;
+    rdep_edge_count = 0;
+    rdep_edge_capacity = 0;
+    rdep_free = -1;
+    free(packages);
+    free(package_info);
+    packages = NULL;
+    package_info = NULL;
+    package_count = 0;
+    package_capacity = 0;
+    arena_free(&package_arena);
+    name_registry_free(&package_names);
+    if (!name_registry_init(&package_names, PACKAGE_TABLE_INITIAL)) {
+        return false;
+    }
+    
+    // Map the package database; a missing database is an empty catalog.
+    // Only installed packages are imported now, the rest on first lookup.
+    package_db_close(&package_db);
+    if (package_db_open(&package_db, PACKAGE_DB_PATH)) {
+        for (uint32_t i = 0; i < package_db.header->installed_count; i++) {
+            if (package_db.installed[i] < package_db_count(&package_db)) {
+                package_import(package_db.installed[i]);
+            }
+        }
+    }
+    
+    // Finish or drop the transactions a crash left open, so a package whose
+    // commit was cut short is completed before anything looks at its files
+    if (!package_stage_sweep()) {
+        fprintf(stderr, "package: cannot finish an interrupted transaction\n");
+    }
     return true;
 }
 
-// Register a new package
+// Register a new package. Only the dependencies and strings actually in
+// use are copied, into the arena.
 bool package_register(Package* package) {
-    if (package_count >= MAX_PACKAGES) {
+    if (!package_table_reserve()) {
         return false;
     }
     
     // Check for duplicate package
-    for (int i = 0; i < package_count; i++) {
-        if (strcmp(packages[i].name, package->name) == 0) {
-            return false;
-        }
+    int32_t id = name_registry_intern(&package_names, package->name);
+    if (id < 0 || name_registry_value(&package_names, id) != NAME_REGISTRY_UNBOUND) {
+        return false;
+    }
+    
+    // Intern dependency names; they may be registered later
+    PackageEntry* entry = &packages[package_count];
+    PackageDetails* details = &package_info[package_count];
+    int dependency_count = package->dependency_count < MAX_DEPENDENCIES ?
+        package->dependency_count : MAX_DEPENDENCIES;
+    int conflict_count = package->conflict_count < MAX_CONFLICTS ?
+        package->conflict_count : MAX_CONFLICTS;
+    entry->dependencies = package_intern_refs(package->dependencies, dependency_count);
+    entry->conflicts = package_intern_refs(package->conflicts, conflict_count);
+    if ((dependency_count > 0 && !entry->dependencies) || (conflict_count > 0 && !entry->conflicts)) {
+        return false;
     }
+    entry->dependency_count = (uint8_t)dependency_count;
+    entry->conflict_count = (uint8_t)conflict_count;
     
-    memcpy(&packages[package_count], package, sizeof(Package));
+    entry->name = name_registry_name(&package_names, id);
+    entry->version = arena_strdup(&package_arena, package->version);
+    entry->state = package->state;
+    details->description = arena_strdup(&package_arena, package->description);
+    details->install_path = arena_strdup(&package_arena, package->install_path);
+    if (!entry->version || !details->description || !details->install_path) {
+        return false;
+    }
+    details->installed_size = package->installed_size;
+    details->pre_install = package->pre_install;
+    details->post_install = package->post_install;
+    details->pre_remove = package->pre_remove;
+    details->post_remove = package->post_remove;
+    entry->automatic = package->automatic;
+    if (!rdep_link(package_count)) {
+        rdep_unlink(package_count);
+        return false;
+    }
+    name_registry_bind(&package_names, id, package_count);
     package_count++;
     return true;
 }
 
+// Fill a package from its database record
+static void package_from_record(uint32_t index, Package* package) {
+    const PackageDbRecord* record = package_db_record(&package_db, index);
+    
+    memset(package, 0, sizeof(*package));
+    snprintf(package->name, sizeof(package->name), "%s", package_db_string(&package_db, record->name));
+    snprintf(package->version, sizeof(package->version), "%s", package_db_string(&package_db, record->version));
+    snprintf(package->description, sizeof(package->description), "%s",
+             package_db_string(&package_db, record->description));
+    snprintf(package->install_path, sizeof(package->install_path), "%s",
+             package_db_string(&package_db, record->install_path));
+    package->state = (PackageState)record->state;
+    package->automatic = (record->flags & PACKAGE_DB_RECORD_AUTOMATIC) != 0;
+    package->installed_size = record->installed_size;
+    
+    for (uint32_t i = 0; i < record->dependency_count; i++) {
+        const PackageDbDependency* dep = package_db_dependency(&package_db, record, i);
+        if (!dep) {
+            break;
+        }
+        PackageDependency* out;
+        if (dep->flags & PACKAGE_DB_DEP_CONFLICT) {
+            if (package->conflict_count == MAX_CONFLICTS) {
+                continue;
+            }
+            out = &package->conflicts[package->conflict_count++];
+        } else {
+            if (package->dependency_count == MAX_DEPENDENCIES) {
+                continue;
+            }
+            out = &package->dependencies[package->dependency_count++];
+        }
+        snprintf(out->name, sizeof(out->name), "%s", package_db_string(&package_db, dep->name));
+        snprintf(out->version, sizeof(out->version), "%s", package_db_string(&package_db, dep->constraint));
+        out->optional = (dep->flags & PACKAGE_DB_DEP_OPTIONAL) != 0;
+    }
+}
+
+// Register a package from its database record
+static PackageEntry* package_import(uint32_t index) {
+    static Package package;
+    package_from_record(index, &package);
+    if (!package_register(&package)) {
+        return NULL;
+    }
+    return &packages[package_count - 1];
+}
+
+// Replace a registered package's catalog fields with its database record.
+// State, hooks and, once installed, the install path stay.
+static bool package_refresh(int index, uint32_t record) {
+    static Package package;
+    package_from_record(record, &package);
+    PackageEntry* entry = &packages[index];
+    PackageDetails* details = &package_info[index];
+    PackageDepRef* dependencies = package_intern_refs(package.dependencies, package.dependency_count);
+    PackageDepRef* conflicts = package_intern_refs(package.conflicts, package.conflict_count);
+    const char* version = arena_strdup(&package_arena, package.version);
+    const char* description = arena_strdup(&package_arena, package.description);
+    const char* install_path = entry->state == PACKAGE_STATE_NOT_INSTALLED ?
+        arena_strdup(&package_arena, package.install_path) : details->install_path;
+    if ((package.dependency_count > 0 && !dependencies) || (package.conflict_count > 0 && !conflicts) ||
+        !version || !description || !install_path) {
+        return false;
+    }
+    
+    rdep_unlink(index);
+    entry->dependencies = dependencies;
+    entry->conflicts = conflicts;
+    entry->dependency_count = (uint8_t)package.dependency_count;
+    entry->conflict_count = (uint8_t)package.conflict_count;
+    entry->version = version;
+    details->description = description;
+    details->install_path = install_path;
+    details->installed_size = package.installed_size;
+    return rdep_link(index);
+}
+
 // Install a package
 bool package_install(const char* name) {
-    Package* package = package_find(name);
-    if (!package) {
+    PackagePlan plan;
+    
+    // Resolve the whole transaction before any hook runs
+    if (!package_plan_install(&name, 1, &plan)) {
+        fprintf(stderr, "package: cannot install %s: %s\n", name, plan.error);
+        package_plan_free(&plan);
         return false;
     }
     
-    // Check if already installed
-    if (package->state == PACKAGE_STATE_INSTALLED) {
+    // Packages pulled in only as dependencies are marked for
+    // package_autoremove; naming an installed one makes it explicit
+    for (int i = 0; i < plan.count; i++) {
+        packages[plan.order[i]].automatic = true;
+    }
+    int target = package_index(name);
+    if (target >= 0) {
+        packages[target].automatic = false;
+    }
+    
+    // Fetch, verify and extract; dependencies are extracted first
+    bool success = package_pipeline_run(&pipeline_config, &plan, &last_install);
+    
+    package_plan_free(&plan);
+    return success;
+}
+
+// Delete the files in a package's installed manifest and the manifest
+// itself as one staged transaction. The file index drops the files before
+// the commit and takes them back if the commit does not happen.
+// Directories stay, since other packages may share them. A package
+// installed without a repository has no manifest and nothing to delete.
+// `*committed` tells whether the removal was decided, even if it failed.
+static bool package_remove_files(int index, bool* committed) {
+    const PackageEntry* package = &packages[index];
+    const PackageDetails* details = &package_info[index];
+    char path[PATH_MAX], dest[PATH_MAX * 2];
+    *committed = false;
+    snprintf(path, sizeof(path), "%s/%s" PACKAGE_MANIFEST_SUFFIX, pipeline_config.manifest_dir, package->name);
+    if (access(path, F_OK) < 0) {
         return true;
     }
     
-    // Install dependencies first
-    for (int i = 0; i < package->dependency_count; i++) {
-        Package* dep = package_find(package->dependencies[i].name);
-        if (!dep) {
-            if (!package->dependencies[i].optional) {
-                return false;
-            }
-            continue;
-        }
-        
-        if (!package_install(dep->name)) {
-            if (!package->dependencies[i].optional) {
-                return false;
-            }
+    PackageManifest installed;
+    PackageStage stage;
+    snprintf(dest, sizeof(dest), "%s/%s", pipeline_config.root, details->install_path);
+    if (!package_manifest_load(&installed, path)) {
+        return false;
+    }
+    bool ok = package_stage_begin(&stage, dest, package->name);
+    bool staged = ok;
+    for (uint32_t i = 0; ok && i < installed.file_count; i++) {
+        if (installed.files[i].type != STORE_FILE_DIRECTORY) {
+            ok = package_stage_remove(&stage, installed.files[i].path);
         }
     }
+    ok = ok && package_stage_manifest(&stage, NULL, path);
     
-    // Run pre-install hook
-    if (package->pre_install && !package->pre_install()) {
+    PackageFiles* files = package_file_index();
+    ok = ok && (!files || package_files_commit(files, package->name, details->install_path, &installed, NULL));
+    bool indexed = ok;
+    if (ok) {
+        ok = package_stage_commit(&stage);
+        *committed = stage.committed;
+    } else if (staged) {
+        package_stage_abort(&stage);
+    }
+    if (indexed && !*committed && files) {
+        package_files_commit(files, package->name, details->install_path, NULL, &installed);
+    }
+    package_manifest_free(&installed);
+    return ok;
+}
+
+// Run the hooks and delete the files of an installed package. Once the
+// removal is decided the package never goes back to installed: a failure
+// after that point leaves it broken until the removal is finished.
+static bool package_remove_index(int target) {
+    PackageEntry* package = &packages[target];
+    PackageDetails* details = &package_info[target];
+    
+    // Run pre-remove hook
+    if (details->pre_remove && !details->pre_remove()) {
         return false;
     }
     
-    // Perform installation
-    // TODO: Implement actual package installation
-    package->state = PACKAGE_STATE_INSTALLED;
+    package->state = PACKAGE_STATE_REMOVING;
     
-    // Run post-install hook
-    if (package->post_install && !package->post_install()) {
-        // Installation succeeded but post-install failed
-        // Mark as broken but don't fail
-        package->state = PACKAGE_STATE_BROKEN;
+    // Perform removal
+    bool committed;
+    if (!package_remove_files(target, &committed)) {
+        fprintf(stderr, "package: cannot remove the files of %s\n", package->name);
+        package->state = committed ? PACKAGE_STATE_BROKEN : PACKAGE_STATE_INSTALLED;
+        return false;
     }
     
+    // Run post-remove hook
+    if (details->post_remove) {
+        details->post_remove();
+    }
+    
+    package->state = PACKAGE_STATE_NOT_INSTALLED;
+    package->automatic = false;
     return true;
 }
 
 // Remove a package
 bool package_remove(const char* name) {
-    Package* package = package_find(name);
+    PackageEntry* package = package_find(name);
     if (!package || package->state != PACKAGE_STATE_INSTALLED) {
         return false;
     }
+    int target = (int)(package - packages);
     
     // Check if other packages depend on this one
+    int dependent = package_installed_dependent(target, false);
+    if (dependent >= 0) {
+        fprintf(stderr, "package: cannot remove %s: %s depends on it\n", name, packages[dependent].name);
+        return false;
+    }
+    return package_remove_index(target);
+}
+
+// Remove the packages that were installed only as dependencies and that
+// no package kept by the user needs any more. One pass marks everything
+// reachable from the explicitly installed packages, optional dependencies
+// included; the installed automatic packages left unmarked are orphans.
+// They are removed dependents first, counting each orphan's installed
+// dependents through the reverse index. Orphans that depend on each other
+// in a cycle are removed together at the end.
+bool package_autoremove(int* removed) {
+    *removed = 0;
+    bool* keep = calloc((size_t)package_count + 1, sizeof(bool));
+    int* stack = malloc(((size_t)package_count + 1) * sizeof(int));
+    int* pending = calloc((size_t)package_count + 1, sizeof(int));
+    if (!keep || !stack || !pending) {
+        free(keep);
+        free(stack);
+        free(pending);
+        return false;
+    }
+    
+    // Roots: whatever is on disk, except installed automatic packages
+    int depth = 0;
     for (int i = 0; i < package_count; i++) {
-        if (packages[i].state == PACKAGE_STATE_INSTALLED) {
-            for (int j = 0; j < packages[i].dependency_count; j++) {
-                if (strcmp(packages[i].dependencies[j].name, name) == 0 &&
-                    !packages[i].dependencies[j].optional) {
-                    return false;
-                }
+        bool candidate = packages[i].state == PACKAGE_STATE_INSTALLED && packages[i].automatic;
+        if (packages[i].state != PACKAGE_STATE_NOT_INSTALLED && !candidate) {
+            keep[i] = true;
+            stack[depth++] = i;
+        }
+    }
+    while (depth > 0) {
+        const PackageEntry* entry = &packages[stack[--depth]];
+        for (int d = 0; d < entry->dependency_count; d++) {
+            int target = package_dep_index(&entry->dependencies[d]);
+            if (target >= 0 && !keep[target] && packages[target].state == PACKAGE_STATE_INSTALLED) {
+                keep[target] = true;
+                stack[depth++] = target;
             }
         }
     }
     
-    // Run pre-remove hook
-    if (package->pre_remove && !package->pre_remove()) {
-        return false;
+    // Orphans with no orphaned dependents go first
+    for (int i = 0; i < package_count; i++) {
+        if (packages[i].state != PACKAGE_STATE_INSTALLED || keep[i]) {
+            continue;
+        }
+        for (int32_t edge = rdep_head(packages[i].name); edge >= 0; edge = rdep_edges[edge].next) {
+            int dependent = rdep_edges[edge].package;
+            pending[i] += packages[dependent].state == PACKAGE_STATE_INSTALLED && !keep[dependent];
+        }
+        if (pending[i] == 0) {
+            stack[depth++] = i;
+        }
     }
     
-    package->state = PACKAGE_STATE_REMOVING;
+    bool success = true;
+    for (int pass = 0; pass < 2; pass++) {
+        while (depth > 0) {
+            int index = stack[--depth];
+            if (packages[index].state != PACKAGE_STATE_INSTALLED) {
+                continue;
+            }
+            if (!package_remove_index(index)) {
+                success = false;
+                continue;   // Its dependencies stay installed
+            }
+            (*removed)++;
+            const PackageEntry* entry = &packages[index];
+            for (int d = 0; d < entry->dependency_count; d++) {
+                int target = package_dep_index(&entry->dependencies[d]);
+                if (target >= 0 && !keep[target] && packages[target].state == PACKAGE_STATE_INSTALLED &&
+                    --pending[target] == 0) {
+                    stack[depth++] = target;
+                }
+            }
+        }
+        
+        // What is left waits on itself through a cycle
+        for (int i = 0; pass == 0 && success && i < package_count; i++) {
+            if (packages[i].state == PACKAGE_STATE_INSTALLED && !keep[i]) {
+                stack[depth++] = i;
+            }
+        }
+    }
     
-    // Perform removal
-    // TODO: Implement actual package removal
+    free(keep);
+    free(stack);
+    free(pending);
+    return success;
+}
+
+// Find a package by name
+static PackageEntry* package_find(const char* name) {
+    int index = name_registry_find(&package_names, name);
+    if (index >= 0) {
+        return &packages[index];
+    }
     
-    // Run post-remove hook
-    if (package->post_remove) {
-        package->post_remove();
+    int32_t record = package_db_find(&package_db, name);
+    return record >= 0 ? package_import((uint32_t)record) : NULL;
+}
+
+// Add a registered package to a database being written
+static bool package_commit_entry(PackageDbBuilder* builder, int index) {
+    const PackageEntry* entry = &packages[index];
+    const PackageDetails* details = &package_info[index];
+    PackageDbDependencyInput deps[MAX_DEPENDENCIES + MAX_CONFLICTS];
+    uint32_t count = 0;
+    for (int i = 0; i < entry->dependency_count; i++) {
+        deps[count].name = package_dep_name(&entry->dependencies[i]);
+        deps[count].constraint = entry->dependencies[i].version;
+        deps[count].flags = entry->dependencies[i].optional ? PACKAGE_DB_DEP_OPTIONAL : 0;
+        count++;
+    }
+    for (int i = 0; i < entry->conflict_count; i++) {
+        deps[count].name = package_dep_name(&entry->conflicts[i]);
+        deps[count].constraint = entry->conflicts[i].version;
+        deps[count].flags = PACKAGE_DB_DEP_CONFLICT;
+        count++;
     }
     
-    package->state = PACKAGE_STATE_NOT_INSTALLED;
+    if (!package_db_builder_add(builder, entry->name, entry->version, details->description,
+                                details->install_path, details->installed_size, (uint8_t)entry->state,
+                                deps, count)) {
+        return false;
+    }
+    if (entry->automatic && entry->state != PACKAGE_STATE_NOT_INSTALLED) {
+        builder->records[builder->record_count - 1].flags |= PACKAGE_DB_RECORD_AUTOMATIC;
+    }
     return true;
 }
 
-// Find a package by name
-static Package* package_find(const char* name) {
-    for (int i = 0; i < package_count; i++) {
-        if (strcmp(packages[i].name, name) == 0) {
-            return &packages[i];
+// Persist package states. Records that were never imported are copied
+// from the mapped database unchanged; the new file replaces the old one
+// atomically and is then mapped in its place.
+bool package_manager_commit(void) {
+    PackageDbBuilder builder;
+    if (!package_db_builder_init(&builder, package_db_count(&package_db) + (uint32_t)package_count)) {
+        return false;
+    }
+    
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < package_db_count(&package_db); i++) {
+        const PackageDbRecord* record = package_db_record(&package_db, i);
+        int index = name_registry_find(&package_names, package_db_string(&package_db, record->name));
+        ok = index >= 0 ? package_commit_entry(&builder, index)
+                        : package_db_builder_copy(&builder, &package_db, i, record->state);
+    }
+    for (int i = 0; ok && i < package_count; i++) {
+        if (package_db_find(&package_db, packages[i].name) < 0) {
+            ok = package_commit_entry(&builder, i);
         }
     }
-    return NULL;
+    
+    // Local changes do not move the repository sync position
+    builder.sequence = package_db.sequence;
+    builder.origin = package_db.origin;
+    ok = ok && package_db_write(&builder, PACKAGE_DB_PATH);
+    package_db_builder_free(&builder);
+    
+    if (ok) {
+        package_db_close(&package_db);
+        package_db_open(&package_db, PACKAGE_DB_PATH);
+    }
+    return ok;
 }
 
 // Update package database
+// Local state is committed first, then the repository's changes since the
+// last update are merged into the database file, and registered packages
+// pick up their new catalog entries. Packages not yet imported are read
+// from the new file on first use.
 bool package_update_database(void) {
-    // TODO: Implement database update from repository
-    return true;
+    const char* repository = pipeline_config.repository ? package_repository_dir(pipeline_config.repository) : NULL;
+    if (!repository) {
+        fprintf(stderr, "package: database updates need a local repository\n");
+        return false;
+    }
+    if (!package_manager_commit() || !package_sync_run(repository, PACKAGE_DB_PATH, &last_sync)) {
+        return false;
+    }
+    if (last_sync.from_sequence == last_sync.to_sequence) {
+        return true;
+    }
+    
+    package_db_close(&package_db);
+    if (!package_db_open(&package_db, PACKAGE_DB_PATH)) {
+        return false;
+    }
+    bool ok = true;
+    for (int i = 0; ok && i < package_count; i++) {
+        int32_t record = package_db_find(&package_db, packages[i].name);
+        ok = record < 0 || package_refresh(i, (uint32_t)record);
+    }
+    return ok;
+}
+
+// Upgrade one package from its installed manifest to the registered
+// version. When the repository publishes a manifest and chunks for that
+// version only the changed chunks are fetched and only changed files are
+// rewritten; otherwise the whole archive goes through the pipeline.
+// Either way files the new version dropped are deleted with the commit.
+static bool package_upgrade(int index, const PackageManifest* installed) {
+    PackageEntry* package = &packages[index];
+    PackageDetails* details = &package_info[index];
+    const char* repository = package_repository_dir(pipeline_config.repository);
+    char path[PATH_MAX], source[PATH_MAX], store[PATH_MAX], dest[PATH_MAX * 2];
+    PackageManifest target;
+    
+    snprintf(path, sizeof(path), "%s/%s-%s" PACKAGE_MANIFEST_SUFFIX, repository, package->name, package->version);
+    if (!package_manifest_load(&target, path)) {
+        // The solver plans what is not installed, so while the package is
+        // upgrading it is planned after whatever its new version needs.
+        // The pipeline replaces the manifest of a package in that state.
+        // Planning can import packages and move the entry table.
+        PackagePlan plan;
+        const char* name = package->name;
+        package->state = PACKAGE_STATE_UPGRADING;
+        if (!package_plan_install(&name, 1, &plan)) {
+            fprintf(stderr, "package: cannot upgrade %s: %s\n", name, plan.error);
+            package_plan_free(&plan);
+            packages[index].state = PACKAGE_STATE_INSTALLED;
+            return false;
+        }
+        for (int i = 0; i < plan.count; i++) {
+            if (plan.order[i] != index) {
+                packages[plan.order[i]].automatic = true;
+            }
+        }
+        bool ok = package_pipeline_run(&pipeline_config, &plan, &last_install);
+        package_plan_free(&plan);
+        package = &packages[index];
+        if (package->state == PACKAGE_STATE_UPGRADING) {
+            package->state = PACKAGE_STATE_INSTALLED;   // Failed before the commit
+        }
+        if (ok) {
+            printf("package: upgraded %s %s -> %s: fetched %llu bytes (full archive)\n",
+                   package->name, installed->version, package->version,
+                   (unsigned long long)last_install.fetch.bytes);
+        }
+        return ok;
+    }
+    
+    snprintf(source, sizeof(source), "%s/chunks", repository);
+    snprintf(store, sizeof(store), "%s/chunks", pipeline_config.cache_dir);
+    snprintf(dest, sizeof(dest), "%s/%s", pipeline_config.root, details->install_path);
+    snprintf(path, sizeof(path), "%s/%s" PACKAGE_MANIFEST_SUFFIX, pipeline_config.manifest_dir, package->name);
+    
+    // The new version may not take over another package's files
+    PackageFiles* files = package_file_index();
+    char conflict[PATH_MAX];
+    const char* owner = NULL;
+    if (files && !package_files_check(files, package->name, details->install_path, &target,
+                                      conflict, sizeof(conflict), &owner)) {
+        fprintf(stderr, "package: cannot upgrade %s: %s belongs to %s\n", package->name, conflict, owner);
+        package_manifest_free(&target);
+        return false;
+    }
+    
+    // Run pre-install hook
+    if (details->pre_install && !details->pre_install()) {
+        package_manifest_free(&target);
+        return false;
+    }
+    
+    // The new files, the manifest and the file index change together: the
+    // index takes the new version's files before the commit and gives them
+    // back if the commit does not happen. A failure before the commit
+    // leaves the installed version in place and its manifest says so; the
+    // next package_upgrade_all() retries it. One after it is finished by
+    // the next sweep, and the package is broken until then.
+    PackageUpgradeStats stats;
+    PackageStage stage;
+    package->state = PACKAGE_STATE_UPGRADING;
+    bool ok = package_stage_begin(&stage, dest, package->name);
+    bool staged = ok;
+    ok = ok && package_store_upgrade(source, store, installed, &target, &stage, &stats) &&
+         package_stage_manifest(&stage, &target, path) &&
+         (!files || package_files_commit(files, package->name, details->install_path, installed, &target));
+    bool indexed = ok;
+    bool committed = false;
+    if (ok) {
+        ok = package_stage_commit(&stage);
+        committed = stage.committed;
+    } else if (staged) {
+        package_stage_abort(&stage);
+    }
+    if (indexed && !committed && files) {
+        package_files_commit(files, package->name, details->install_path, &target, installed);
+    }
+    package->state = ok || !committed ? PACKAGE_STATE_INSTALLED : PACKAGE_STATE_BROKEN;
+    
+    // Run post-install hook
+    if (ok && details->post_install && !details->post_install()) {
+        package->state = PACKAGE_STATE_BROKEN;
+    }
+    
+    if (ok) {
+        printf("package: upgraded %s %s -> %s: fetched %llu and wrote %llu of %llu bytes "
+               "(%llu fetch and %llu write bytes saved, %u files changed, %u removed)\n",
+               package->name, installed->version, package->version,
+               (unsigned long long)stats.fetched_bytes, (unsigned long long)stats.written_bytes,
+               (unsigned long long)stats.total_bytes,
+               (unsigned long long)(stats.total_bytes - stats.fetched_bytes),
+               (unsigned long long)(stats.total_bytes - stats.written_bytes),
+               stats.files_changed, stats.files_removed);
+    } else {
+        fprintf(stderr, "package: upgrade of %s failed\n", package->name);
+    }
+    package_manifest_free(&target);
+    return ok;
 }
 
 // Upgrade all installed packages
 bool package_upgrade_all(void) {
     bool success = true;
     
+    if (!pipeline_config.repository || !package_repository_dir(pipeline_config.repository)) {
+        fprintf(stderr, "package: upgrades need a local repository\n");
+        return false;
+    }
+    
+    for (int i = 0; i < package_count; i++) {
+        if (packages[i].state != PACKAGE_STATE_INSTALLED) {
+            continue;
+        }
+        
+        // The installed manifest records which version is on disk
+        char path[PATH_MAX];
+        PackageManifest installed;
+        snprintf(path, sizeof(path), "%s/%s" PACKAGE_MANIFEST_SUFFIX, pipeline_config.manifest_dir, packages[i].name);
+        if (!package_manifest_load(&installed, path)) {
+            continue;
+        }
+        if (package_version_compare(packages[i].version, installed.version) > 0 &&
+            !package_upgrade(i, &installed)) {
+            success = false;
+        }
+        package_manifest_free(&installed);
+    }
+    
+    return success;
+}
+
+// Verify one installed package
+bool package_verify(const char* name) {
+    int index = package_index(name);
+    if (index < 0 || packages[index].state != PACKAGE_STATE_INSTALLED) {
+        fprintf(stderr, "package: %s is not installed\n", name);
+        return false;
+    }
+    PackageVerifyTarget target = { packages[index].name, package_info[index].install_path };
+    return package_verify_run(&pipeline_config, &target, 1, &last_verify);
+}
+
+// Verify every installed package in one pass, spread over all workers
+bool package_verify_all(void) {
+    PackageVerifyTarget* targets = malloc(((size_t)package_count + 1) * sizeof(PackageVerifyTarget));
+    if (!targets) {
+        return false;
+    }
+    
+    // Installed packages were imported from the database at init
+    int count = 0;
     for (int i = 0; i < package_count; i++) {
         if (packages[i].state == PACKAGE_STATE_INSTALLED) {
-            // TODO: Check for updates and upgrade if needed
+            targets[count].name = packages[i].name;
+            targets[count].install_path = package_info[i].install_path;
+            count++;
         }
     }
     
+    bool success = package_verify_run(&pipeline_config, targets, count, &last_verify);
+    free(targets);
     return success;
-}
\ No newline at end of file
+}
@@ -0,0 +1,225 @@
+#ifndef PROMPTOS_PACKAGE_MANAGER_H
+#define PROMPTOS_PACKAGE_MANAGER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Package manager configuration
+#define MAX_PACKAGE_NAME_LEN 64
+#define MAX_PACKAGE_VERSION_LEN 32
+#define MAX_PACKAGE_DESC_LEN 256
+#define MAX_DEPENDENCIES 32
+#define MAX_CONFLICTS 8
+#define PACKAGE_DB_PATH "/var/lib/packages/db"
+#define PACKAGE_FILES_PATH "/var/lib/packages/files"       // Which package owns each file
+#define PACKAGE_CACHE_PATH "/var/cache/packages"
+#define PACKAGE_MANIFEST_PATH "/var/lib/packages/manifests"   // Installed file lists
+#define PACKAGE_PENDING_PATH "/var/lib/packages/pending"     // Open stage transactions
+#define PACKAGE_REPO_URL "file:///var/lib/packages/repo/stable"
+#define PACKAGE_ARCHIVE_SUFFIX ".pkg"       // gzip-compressed tar
+#define PACKAGE_CHECKSUM_SUFFIX ".sha256"   // Hex digest next to each archive
+#define PACKAGE_INDEX_DIR "index"           // Catalog snapshot and deltas in the repository
+#define PACKAGE_INDEX_SNAPSHOT "snapshot"
+#define PACKAGE_INDEX_DELTA_SUFFIX ".delta" // <repo>/index/<sequence>.delta
+#define PACKAGE_INDEX_KEEP 256              // Deltas a repository keeps
+#define PACKAGE_SYNC_MAX_DELTAS 64          // Further behind, a client takes the snapshot
+
+// Package states
+typedef enum {
+    PACKAGE_STATE_NOT_INSTALLED,
+    PACKAGE_STATE_INSTALLED,
+    PACKAGE_STATE_UPGRADING,
+    PACKAGE_STATE_REMOVING,
+    PACKAGE_STATE_BROKEN
+} PackageState;
+
+// Package dependency. `version` holds a constraint such as ">= 2.0" or
+// ">= 2.0, < 3.0"; a bare version means ">=" and an empty one matches any.
+typedef struct {
+    char name[MAX_PACKAGE_NAME_LEN];
+    char version[MAX_PACKAGE_VERSION_LEN];
+    bool optional;
+} PackageDependency;
+
+// Package definition
+typedef struct {
+    char name[MAX_PACKAGE_NAME_LEN];
+    char version[MAX_PACKAGE_VERSION_LEN];
+    char description[MAX_PACKAGE_DESC_LEN];
+    PackageState state;
+    bool automatic;             // Installed only as a dependency
+    size_t installed_size;
+    char install_path[256];
+
+    // Dependencies
+    PackageDependency dependencies[MAX_DEPENDENCIES];
+    int dependency_count;
+
+    // Conflicting packages; `version` optionally narrows the conflict
+    PackageDependency conflicts[MAX_CONFLICTS];
+    int conflict_count;
+
+    // Installation hooks
+    bool (*pre_install)(void);
+    bool (*post_install)(void);
+    bool (*pre_remove)(void);
+    bool (*post_remove)(void);
+} Package;
+
+// Dependency of a registered package, stored as an interned name id. The
+// id resolves to a table index once the dependency is registered.
+typedef struct {
+    int32_t id;
+    bool optional;
+    const char* version;    // Constraint, in the package arena
+} PackageDepRef;
+
+// Registry entry for a registered package: the fields dependency solving
+// and lookups touch. Entries live in a table that grows as packages are
+// registered or imported, so keep table indices, not entry pointers,
+// across calls that can register packages.
+typedef struct {
+    const char* name;               // Interned in the package name registry
+    const char* version;            // Arena strings and arrays from here on
+    PackageDepRef* dependencies;
+    PackageDepRef* conflicts;
+    uint8_t dependency_count;
+    uint8_t conflict_count;
+    bool automatic;                 // Installed as a dependency; see package_autoremove
+    PackageState state;
+} PackageEntry;
+
+// Rarely used fields of a registered package, in a table parallel to the
+// entries
+typedef struct {
+    const char* description;
+    const char* install_path;
+    size_t installed_size;
+
+    bool (*pre_install)(void);
+    bool (*post_install)(void);
+    bool (*pre_remove)(void);
+    bool (*post_remove)(void);
+} PackageDetails;
+
+// Ordered set of packages to install, dependencies first
+typedef struct {
+    int* order;             // Package table indices
+    int count;
+    char error[256];        // Why planning failed
+} PackagePlan;
+
+// Install pipeline configuration. Worker counts of 0 pick a default.
+typedef struct {
+    const char* repository;     // file:// URL or directory; NULL skips file work
+    const char* cache_dir;      // Archives in flight and the chunk store
+    const char* manifest_dir;   // Manifests of installed packages
+    const char* root;           // Prefix for every install_path
+    const char* files_path;     // Installed-file index; NULL keeps none
+    int fetch_workers;
+    int verify_workers;
+    int extract_workers;
+    int queue_depth;            // Bound on fetched-but-unverified archives
+} PackagePipelineConfig;
+
+typedef struct {
+    uint64_t items;
+    uint64_t bytes;
+    uint64_t busy_ns;           // Summed over the stage's workers
+} PackageStageStats;
+
+typedef struct {
+    PackageStageStats fetch;
+    PackageStageStats verify;
+    PackageStageStats extract;
+    uint64_t stored_bytes;      // Extracted bytes new to the chunk store
+    uint64_t shared_bytes;      // Extracted bytes the store already held
+    uint64_t wall_ns;
+    int installed;
+    int failed;
+} PackagePipelineStats;
+
+// Installed package to verify
+typedef struct {
+    const char* name;           // Manifest name in the manifest directory
+    const char* install_path;   // Under the configured root
+} PackageVerifyTarget;
+
+typedef struct {
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t wall_ns;
+    uint32_t packages;
+    uint32_t skipped;           // Installed without a manifest
+    uint32_t missing;
+    uint32_t modified;
+    int workers;
+} PackageVerifyStats;
+
+// One database update, or one index publish
+typedef struct {
+    uint64_t from_sequence;     // 0 = never synced with this repository
+    uint64_t to_sequence;
+    uint64_t bytes_read;        // Index files mapped from the repository
+    uint64_t wall_ns;
+    uint32_t deltas;            // Applied, or written by a publish
+    uint32_t updated;           // Packages added or changed
+    uint32_t removed;
+    bool snapshot;
+} PackageSyncStats;
+
+// Package manager API (package_manager.c)
+bool package_manager_init(void);
+void package_manager_configure(const PackagePipelineConfig* config);
+const PackagePipelineStats* package_manager_last_install(void);
+bool package_manager_commit(void);
+bool package_register(Package* package);
+bool package_install(const char* name);
+bool package_remove(const char* name);             // Refused while an installed package needs it
+bool package_autoremove(int* removed);              // Remove orphaned dependencies
+bool package_update_database(void);                 // Sync the catalog from the repository index
+const PackageSyncStats* package_manager_last_sync(void);
+bool package_upgrade_all(void);
+bool package_verify(const char* name);             // Re-hash the installed files
+bool package_verify_all(void);
+const PackageVerifyStats* package_manager_last_verify(void);
+const char* package_file_owner(const char* path);   // Path under the root; NULL if unowned
+
+// Registry access for the other package manager modules
+int package_entry_count(void);
+PackageEntry* package_entry(int index);
+PackageDetails* package_details(int index);
+int package_index(const char* name);            // Imports from the database; -1 if unknown
+int package_dep_index(const PackageDepRef* dep);
+const char* package_dep_name(const PackageDepRef* dep);
+struct PackageFiles* package_file_index(void);  // Opened on first use; NULL without one
+
+// Versions and dependency solving (package_solver.c)
+int package_version_compare(const char* a, const char* b);
+bool package_version_satisfies(const char* version, const char* constraint);
+bool package_plan_install(const char* const* names, int name_count, PackagePlan* plan);
+void package_plan_free(PackagePlan* plan);
+
+// Fetch, verify and extract a plan, then run install hooks (package_pipeline.c)
+bool package_pipeline_run(const PackagePipelineConfig* config, const PackagePlan* plan,
+                          PackagePipelineStats* stats);
+void package_pipeline_report(const PackagePipelineStats* stats, char* buffer, size_t size);
+const char* package_repository_dir(const char* repository);    // NULL if not local
+
+// Check installed files against their manifests on `verify_workers`
+// threads (package_verify.c). False if any file is missing or modified.
+bool package_verify_run(const PackagePipelineConfig* config, const PackageVerifyTarget* targets,
+                        int count, PackageVerifyStats* stats);
+void package_verify_report(const PackageVerifyStats* stats, char* buffer, size_t size);
+
+// Bring the database at `db_path` up to the index of a local repository
+// directory, from deltas or the snapshot (package_sync.c). Publishing
+// writes a catalog database as the repository's next sequence, unless it
+// is unchanged, and prunes deltas older than `keep`.
+bool package_sync_run(const char* repository, const char* db_path, PackageSyncStats* stats);
+bool package_index_publish(const char* repository, const char* catalog_path, uint32_t keep,
+                           PackageSyncStats* stats);
+void package_sync_report(const PackageSyncStats* stats, char* buffer, size_t size);
+
+#endif // PROMPTOS_PACKAGE_MANAGER_H
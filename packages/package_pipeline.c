@@ -0,0 +1,980 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "package_manager.h"
+#include "../system/libs/sha256.h"
+#include "package_store.h"
+#include "package_files.h"
+
+// Install pipeline
+//
+// Archives move through three stages, each served by its own worker pool:
+//
+//   fetch   copy <repo>/<name>-<version>.pkg into the cache
+//   verify  check the copy against <archive>.sha256 from the repository
+//   extract unpack into root + install_path and run the install hooks
+//
+// Extraction also cuts every file into the chunk store (package_store.c)
+// and records the package's manifest, which later upgrades diff against;
+// the archive itself is dropped from the cache once installed. Before a
+// package's files are committed they are checked against the file index
+// (package_files.c), and a package that would overwrite another's files
+// fails instead.
+//
+// Fetch and verify are connected by bounded queues, so archive N+1 is
+// being copied while archive N is hashed or unpacked. A package is only
+// extracted once every package it depends on within the plan has been
+// extracted, so independent branches of the plan extract in parallel.
+
+#define PIPELINE_MAX_WORKERS 64
+#define PIPELINE_DEFAULT_FETCHERS 2
+#define PIPELINE_DEFAULT_QUEUE_DEPTH 8
+#define PIPELINE_COPY_SIZE (256 * 1024)
+#define TAR_BLOCK_SIZE 512
+
+typedef struct {
+    int package;                // Package table index
+    int pending_deps;           // Planned dependencies not yet extracted
+    int dependent_start;        // Dependents in Pipeline.dependents
+    int dependent_count;
+    bool verified;
+    bool finalized;             // Extracted or failed
+    uint64_t archive_size;
+    char cached[PATH_MAX];
+} PipelineJob;
+
+// Bounded FIFO of job indices
+typedef struct {
+    int* items;
+    int capacity;
+    int head;
+    int count;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} JobQueue;
+
+typedef struct {
+    const PackagePipelineConfig* config;
+    const char* repository;
+    PipelineJob* jobs;
+    int job_count;
+    int* dependents;
+    JobQueue fetch_queue;
+    JobQueue verify_queue;
+    int fetchers_running;
+
+    // Extraction readiness, guarded by `lock`
+    pthread_mutex_t lock;
+    pthread_cond_t ready_cond;
+    int* ready;
+    int ready_count;
+    int remaining;
+
+    // Conflict checks, commits and index updates run one package at a time
+    PackageFiles* files;
+    pthread_mutex_t files_lock;
+
+    PackagePipelineStats* stats;
+} Pipeline;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static bool queue_init(JobQueue* queue, int capacity) {
+    memset(queue, 0, sizeof(*queue));
+    queue->items = malloc((size_t)capacity * sizeof(int));
+    queue->capacity = capacity;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return queue->items != NULL;
+}
+
+static void queue_destroy(JobQueue* queue) {
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+}
+
+static void queue_push(JobQueue* queue, int job) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->capacity) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    queue->items[(queue->head + queue->count++) % queue->capacity] = job;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Pop the next job, or -1 once the queue is closed and drained
+static int queue_pop(JobQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    int job = -1;
+    if (queue->count > 0) {
+        job = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+static void queue_close(JobQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void stage_account(Pipeline* pipeline, PackageStageStats* stage, uint64_t bytes, uint64_t begin) {
+    uint64_t elapsed = monotonic_ns() - begin;
+    pthread_mutex_lock(&pipeline->lock);
+    stage->items++;
+    stage->bytes += bytes;
+    stage->busy_ns += elapsed;
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+// Settle a job and release or fail its dependents (lock held)
+static void job_finalize(Pipeline* pipeline, int index, bool ok) {
+    PipelineJob* job = &pipeline->jobs[index];
+    if (job->finalized) {
+        return;
+    }
+    job->finalized = true;
+    pipeline->remaining--;
+    if (ok) {
+        pipeline->stats->installed++;
+    } else {
+        pipeline->stats->failed++;
+    }
+
+    for (int i = job->dependent_start; i < job->dependent_start + job->dependent_count; i++) {
+        int dependent = pipeline->dependents[i];
+        PipelineJob* next = &pipeline->jobs[dependent];
+        if (!ok) {
+            job_finalize(pipeline, dependent, false);
+        } else if (--next->pending_deps == 0 && next->verified && !next->finalized) {
+            pipeline->ready[pipeline->ready_count++] = dependent;
+        }
+    }
+    pthread_cond_broadcast(&pipeline->ready_cond);
+}
+
+static void job_fail(Pipeline* pipeline, int index, const char* stage, const char* detail) {
+    fprintf(stderr, "package: %s of %s failed: %s\n", stage,
+            package_entry(pipeline->jobs[index].package)->name, detail);
+    pthread_mutex_lock(&pipeline->lock);
+    job_finalize(pipeline, index, false);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static bool job_skipped(Pipeline* pipeline, int index) {
+    pthread_mutex_lock(&pipeline->lock);
+    bool finalized = pipeline->jobs[index].finalized;
+    pthread_mutex_unlock(&pipeline->lock);
+    return finalized;
+}
+
+static void archive_name(const PackageEntry* package, char* buffer, size_t size) {
+    snprintf(buffer, size, "%s-%s" PACKAGE_ARCHIVE_SUFFIX, package->name, package->version);
+}
+
+static bool copy_fd(int in, int out, uint64_t* copied) {
+    static __thread char buffer[PIPELINE_COPY_SIZE];
+    for (;;) {
+        ssize_t got = read(in, buffer, sizeof(buffer));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return got == 0;
+        }
+        for (ssize_t done = 0; done < got;) {
+            ssize_t put = write(out, buffer + done, (size_t)(got - done));
+            if (put < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            done += put;
+        }
+        *copied += (uint64_t)got;
+    }
+}
+
+// Stage 1: copy the archive from the repository into the cache
+static bool fetch_archive(Pipeline* pipeline, PipelineJob* job, const char** error) {
+    char name[PATH_MAX], source[PATH_MAX], partial[PATH_MAX];
+    archive_name(package_entry(job->package), name, sizeof(name));
+    snprintf(source, sizeof(source), "%s/%s", pipeline->repository, name);
+    snprintf(job->cached, sizeof(job->cached), "%s/%s", pipeline->config->cache_dir, name);
+    snprintf(partial, sizeof(partial), "%s.part", job->cached);
+
+    int in = open(source, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        *error = strerror(errno);
+        return false;
+    }
+
+    // An up-to-date cached copy is reused; verification catches stale ones
+    struct stat src_st, cached_st;
+    if (fstat(in, &src_st) == 0 && stat(job->cached, &cached_st) == 0 &&
+        cached_st.st_size == src_st.st_size && cached_st.st_mtime >= src_st.st_mtime) {
+        job->archive_size = (uint64_t)src_st.st_size;
+        close(in);
+        return true;
+    }
+
+    int out = open(partial, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        *error = strerror(errno);
+        close(in);
+        return false;
+    }
+
+    job->archive_size = 0;
+    bool ok = copy_fd(in, out, &job->archive_size);
+    if (!ok) {
+        *error = strerror(errno);
+    }
+    close(in);
+    if (close(out) < 0 && ok) {
+        *error = strerror(errno);
+        ok = false;
+    }
+    if (ok && rename(partial, job->cached) < 0) {
+        *error = strerror(errno);
+        ok = false;
+    }
+    if (!ok) {
+        unlink(partial);
+    }
+    return ok;
+}
+
+// Stage 2: hash the cached archive and compare with the repository digest
+static bool verify_archive(Pipeline* pipeline, PipelineJob* job, const char** error) {
+    char name[PATH_MAX], sum_path[PATH_MAX], hex[SHA256_HEX_SIZE] = {0};
+    archive_name(package_entry(job->package), name, sizeof(name));
+    snprintf(sum_path, sizeof(sum_path), "%s/%s" PACKAGE_CHECKSUM_SUFFIX, pipeline->repository, name);
+
+    uint8_t expected[SHA256_DIGEST_SIZE], actual[SHA256_DIGEST_SIZE];
+    FILE* sum = fopen(sum_path, "r");
+    bool have_sum = sum && fread(hex, 1, SHA256_HEX_SIZE - 1, sum) == SHA256_HEX_SIZE - 1 &&
+                    sha256_from_hex(hex, expected);
+    if (sum) {
+        fclose(sum);
+    }
+    if (!have_sum) {
+        *error = "missing or malformed checksum";
+        return false;
+    }
+
+    int fd = open(job->cached, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = strerror(errno);
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    bool ok = sha256_file(fd, actual, NULL);
+    close(fd);
+
+    if (!ok) {
+        *error = strerror(errno);
+        return false;
+    }
+    if (memcmp(expected, actual, SHA256_DIGEST_SIZE) != 0) {
+        *error = "checksum mismatch";
+        unlink(job->cached);   // Do not reuse a bad copy
+        return false;
+    }
+    return true;
+}
+
+static uint64_t tar_octal(const char* field, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value * 8 + (uint64_t)(field[i] - '0');
+    }
+    return value;
+}
+
+static bool gz_read_exact(gzFile gz, void* buffer, size_t size) {
+    return gzread(gz, buffer, (unsigned)size) == (int)size;
+}
+
+static bool gz_skip(gzFile gz, uint64_t size) {
+    char buffer[TAR_BLOCK_SIZE * 8];
+    while (size > 0) {
+        size_t take = size < sizeof(buffer) ? (size_t)size : sizeof(buffer);
+        if (!gz_read_exact(gz, buffer, take)) {
+            return false;
+        }
+        size -= take;
+    }
+    return true;
+}
+
+// Read a long name (GNU 'L' entry or pax "path=" record) into `name`
+static bool tar_long_name(gzFile gz, uint64_t size, bool pax, char* name, size_t name_size) {
+    uint64_t padded = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+    char* data = malloc(padded + 1);
+    if (!data || !gz_read_exact(gz, data, padded)) {
+        free(data);
+        return false;
+    }
+    data[size] = '\0';
+
+    if (!pax) {
+        snprintf(name, name_size, "%s", data);
+    } else {
+        // Records are "<length> <key>=<value>\n"
+        for (char* record = data; record < data + size;) {
+            char* end;
+            unsigned long length = strtoul(record, &end, 10);
+            if (length == 0 || record + length > data + size) {
+                break;
+            }
+            if (strncmp(end, " path=", 6) == 0) {
+                int value_len = (int)(record + length - (end + 6) - 1);
+                snprintf(name, name_size, "%.*s", value_len, end + 6);
+            }
+            record += length;
+        }
+    }
+    free(data);
+    return true;
+}
+
+// Stage 3: unpack a gzip-compressed tar archive under `dest`, streaming
+// file contents into the chunk store as they are written
+static bool extract_archive(const char* archive, const char* dest, PackageStoreWriter* store,
+                            uint64_t* bytes, const char** error) {
+    gzFile gz = gzopen(archive, "rb");
+    if (!gz) {
+        *error = "cannot open archive";
+        return false;
+    }
+    gzbuffer(gz, PIPELINE_COPY_SIZE);
+
+    static __thread char data[PIPELINE_COPY_SIZE];
+    char header[TAR_BLOCK_SIZE];
+    char long_name[PATH_MAX] = {0};
+    int root_fd = open(dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    bool ok = root_fd >= 0;
+
+    *error = ok ? "corrupt archive" : strerror(errno);
+    while (ok && gz_read_exact(gz, header, sizeof(header))) {
+        if (header[0] == '\0') {
+            break;   // End-of-archive marker
+        }
+
+        uint64_t size = tar_octal(header + 124, 12);
+        char type = header[156];
+        uint64_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+        if (type == 'L' || type == 'x') {
+            ok = tar_long_name(gz, size, type == 'x', long_name, sizeof(long_name));
+            continue;
+        }
+        if (type == 'g') {
+            ok = gz_skip(gz, size + padding);
+            continue;
+        }
+
+        char name[PATH_MAX];
+        if (long_name[0]) {
+            snprintf(name, sizeof(name), "%s", long_name);
+            long_name[0] = '\0';
+        } else if (memcmp(header + 257, "ustar", 5) == 0 && header[345]) {
+            snprintf(name, sizeof(name), "%.155s/%.100s", header + 345, header);
+        } else {
+            snprintf(name, sizeof(name), "%.100s", header);
+        }
+
+        while (strncmp(name, "./", 2) == 0) {
+            memmove(name, name + 2, strlen(name) - 1);
+        }
+        if (name[0] == '\0' || strcmp(name, ".") == 0) {
+            ok = gz_skip(gz, size + padding);
+            continue;
+        }
+        if (!package_path_safe(name)) {
+            *error = "unsafe path in archive";
+            ok = false;
+            break;
+        }
+
+        mode_t mode = (mode_t)tar_octal(header + 100, 8) & 07777;
+        const char* leaf;
+        int parent = package_open_parent(root_fd, name, true, &leaf);
+        if (parent < 0) {
+            *error = errno == ELOOP || errno == ENOTDIR ? "archive path leads through a link" : strerror(errno);
+            ok = false;
+            break;
+        }
+
+        if (type == '5') {
+            struct stat st;
+            ok = mkdirat(parent, leaf, mode ? mode : 0755) == 0 ||
+                 (errno == EEXIST && fstatat(parent, leaf, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode));
+            ok = ok && package_manifest_add(store->manifest, STORE_FILE_DIRECTORY, name, NULL, mode ? mode : 0755);
+        } else if (type == '2' || type == '1') {
+            char target[101];
+            snprintf(target, sizeof(target), "%.100s", header + 157);
+            unlinkat(parent, leaf, 0);
+            if (!package_path_safe(target)) {
+                // Absolute or escaping targets would point outside the
+                // install path once committed
+                ok = false;
+            } else if (type == '2') {
+                ok = symlinkat(target, parent, leaf) == 0 &&
+                     package_manifest_add(store->manifest, STORE_FILE_SYMLINK, name, target, 0777);
+            } else {
+                // The manifest cannot share entries, so record a hard link
+                // as a copy of its target's contents. linkat() without
+                // AT_SYMLINK_FOLLOW links a symlink itself, which the
+                // O_NOFOLLOW open then refuses.
+                const char* target_leaf;
+                int target_parent = package_open_parent(root_fd, target, false, &target_leaf);
+                ok = target_parent >= 0 && linkat(target_parent, target_leaf, parent, leaf, 0) == 0;
+                if (target_parent >= 0) {
+                    close(target_parent);
+                }
+                int fd = ok ? openat(parent, leaf, O_RDONLY | O_NOFOLLOW | O_CLOEXEC) : -1;
+                ok = fd >= 0 && package_store_begin_file(store, name, mode ? mode : 0644);
+                ssize_t got = 0;
+                while (ok && (got = read(fd, data, sizeof(data))) > 0) {
+                    ok = package_store_write(store, data, (size_t)got);
+                }
+                ok = ok && got == 0 && package_store_end_file(store);
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+            if (!ok) {
+                *error = "cannot create link";
+            }
+        } else if (type == '0' || type == '\0' || type == '7') {
+            unlinkat(parent, leaf, 0);
+            int fd = openat(parent, leaf, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, mode ? mode : 0644);
+            ok = fd >= 0 && package_store_begin_file(store, name, mode ? mode : 0644);
+            if (!ok) {
+                *error = strerror(errno);
+            }
+            for (uint64_t left = size; ok && left > 0;) {
+                size_t take = left < sizeof(data) ? (size_t)left : sizeof(data);
+                ok = gz_read_exact(gz, data, take) && write(fd, data, take) == (ssize_t)take;
+                if (ok) {
+                    *bytes += take;
+                }
+                ok = ok && package_store_write(store, data, take);
+                left -= take;
+            }
+            ok = ok && package_store_end_file(store);
+            if (fd >= 0 && close(fd) < 0) {
+                ok = false;
+            }
+            close(parent);
+            ok = ok && gz_skip(gz, padding);
+            continue;
+        }
+        close(parent);
+
+        // Links, directories and unsupported types carry no data to keep
+        ok = ok && gz_skip(gz, size + padding);
+    }
+
+    if (root_fd >= 0) {
+        close(root_fd);
+    }
+    gzclose(gz);
+    return ok;
+}
+
+// Commit a staged package and its manifest unless one of its files
+// belongs to another package. The file index takes the files before the
+// commit and gives them back if the commit does not happen, so no
+// installed file is ever missing from it. Only the check and the claim
+// hold `files_lock`; the sync and the moves run outside it, so workers
+// commit side by side, and a claimed file already counts as taken for
+// a concurrent check. `installed` is the manifest an upgrade replaces,
+// whose files the index releases, or NULL.
+static bool commit_package(Pipeline* pipeline, const char* name, const char* install_path,
+                           const PackageManifest* installed, const PackageManifest* manifest,
+                           const char* manifest_path, PackageStage* stage, const char** error) {
+    char conflict[PATH_MAX];
+    const char* owner = NULL;
+    bool ok = true;
+    if (pipeline->files) {
+        pthread_mutex_lock(&pipeline->files_lock);
+        ok = package_files_check(pipeline->files, name, install_path, manifest, conflict, sizeof(conflict), &owner);
+        if (!ok) {
+            fprintf(stderr, "package: %s: %s belongs to %s\n", name, conflict, owner);
+            *error = "file conflict";
+        } else if (!package_files_commit(pipeline->files, name, install_path, installed, manifest)) {
+            *error = "cannot update file index";
+            ok = false;
+        }
+        pthread_mutex_unlock(&pipeline->files_lock);
+    }
+    bool claimed = ok && pipeline->files;
+
+    if (ok && !package_stage_manifest(stage, manifest, manifest_path)) {
+        *error = "cannot write manifest";
+        ok = false;
+    }
+    if (!ok) {
+        package_stage_abort(stage);
+    } else if (!package_stage_commit(stage)) {
+        *error = "cannot commit staged files";
+        ok = false;
+    }
+    if (!ok && claimed && !stage->committed) {
+        pthread_mutex_lock(&pipeline->files_lock);
+        package_files_commit(pipeline->files, name, install_path, manifest, installed);
+        pthread_mutex_unlock(&pipeline->files_lock);
+    }
+    return ok;
+}
+
+// Extract into a stage under the install path and into the chunk store,
+// then commit the stage together with the package's manifest. A corrupt
+// or truncated archive, or a file another package owns, leaves the
+// install path untouched. A commit that fails once decided is finished
+// later, and the package is marked broken meanwhile. A package being
+// upgraded replaces its installed manifest: files the new version no
+// longer has are deleted in the same commit.
+static bool extract_package(Pipeline* pipeline, PipelineJob* job, uint64_t* bytes, const char** error) {
+    const PackagePipelineConfig* config = pipeline->config;
+    PackageEntry* package = package_entry(job->package);
+    char dest[PATH_MAX * 2], store_dir[PATH_MAX], manifest_path[PATH_MAX];
+    snprintf(dest, sizeof(dest), "%s/%s", config->root, package_details(job->package)->install_path);
+    snprintf(store_dir, sizeof(store_dir), "%s/chunks", config->cache_dir);
+    snprintf(manifest_path, sizeof(manifest_path), "%s/%s" PACKAGE_MANIFEST_SUFFIX,
+             config->manifest_dir, package->name);
+    if (!package_make_parents(dest, 0755) || (mkdir(dest, 0755) < 0 && errno != EEXIST) ||
+        !package_make_parents(manifest_path, 0755)) {
+        *error = strerror(errno);
+        return false;
+    }
+
+    PackageManifest manifest, installed;
+    PackageStage stage;
+    bool upgrade = package->state == PACKAGE_STATE_UPGRADING;
+    if (upgrade && !package_manifest_load(&installed, manifest_path)) {
+        *error = "cannot read installed manifest";
+        return false;
+    }
+    PackageStoreWriter* store = malloc(sizeof(PackageStoreWriter));
+    package_manifest_init(&manifest, package->name, package->version);
+    bool ok = store != NULL;
+    if (ok && !package_stage_begin(&stage, dest, package->name)) {
+        *error = "cannot create staging directory";
+        ok = false;
+    } else if (ok) {
+        package_store_writer_init(store, store_dir, &manifest);
+        ok = extract_archive(job->cached, stage.tree, store, bytes, error);
+        if (ok && store->failed) {
+            *error = "cannot write chunk store";
+            ok = false;
+        }
+        uint32_t removed = 0;
+        if (ok && upgrade && !package_stage_remove_dropped(&stage, &installed, &manifest, &removed)) {
+            *error = "cannot queue removals";
+            ok = false;
+        }
+        if (ok) {
+            ok = commit_package(pipeline, package->name, package_details(job->package)->install_path,
+                                upgrade ? &installed : NULL, &manifest, manifest_path, &stage, error);
+            if (!ok && stage.committed) {
+                package->state = PACKAGE_STATE_BROKEN;
+            }
+        } else {
+            package_stage_abort(&stage);
+        }
+    }
+    if (ok) {
+        unlink(job->cached);
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->stats->stored_bytes += store->stored_bytes;
+        pipeline->stats->shared_bytes += store->shared_bytes;
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+    free(store);
+    package_manifest_free(&manifest);
+    if (upgrade) {
+        package_manifest_free(&installed);
+    }
+    return ok;
+}
+
+// Stage 3 plus hooks: pre_install, extract, post_install
+static bool install_package(Pipeline* pipeline, PipelineJob* job, uint64_t* bytes, const char** error) {
+    PackageEntry* package = package_entry(job->package);
+    PackageDetails* details = package_details(job->package);
+
+    // Run pre-install hook
+    if (details->pre_install && !details->pre_install()) {
+        *error = "pre-install hook failed";
+        return false;
+    }
+
+    // Perform installation
+    if (pipeline->repository && !extract_package(pipeline, job, bytes, error)) {
+        return false;
+    }
+    package->state = PACKAGE_STATE_INSTALLED;
+
+    // Run post-install hook
+    if (details->post_install && !details->post_install()) {
+        // Installation succeeded but post-install failed
+        // Mark as broken but don't fail
+        package->state = PACKAGE_STATE_BROKEN;
+    }
+    return true;
+}
+
+static void* fetch_worker(void* arg) {
+    Pipeline* pipeline = arg;
+    int index;
+
+    while ((index = queue_pop(&pipeline->fetch_queue)) >= 0) {
+        PipelineJob* job = &pipeline->jobs[index];
+        const char* error = NULL;
+        if (job_skipped(pipeline, index)) {
+            continue;
+        }
+
+        uint64_t begin = monotonic_ns();
+        if (!fetch_archive(pipeline, job, &error)) {
+            job_fail(pipeline, index, "fetch", error);
+            continue;
+        }
+        stage_account(pipeline, &pipeline->stats->fetch, job->archive_size, begin);
+        queue_push(&pipeline->verify_queue, index);
+    }
+
+    // The last fetcher out closes the verify stage's input
+    pthread_mutex_lock(&pipeline->lock);
+    bool last = --pipeline->fetchers_running == 0;
+    pthread_mutex_unlock(&pipeline->lock);
+    if (last) {
+        queue_close(&pipeline->verify_queue);
+    }
+    return NULL;
+}
+
+static void* verify_worker(void* arg) {
+    Pipeline* pipeline = arg;
+    int index;
+
+    while ((index = queue_pop(&pipeline->verify_queue)) >= 0) {
+        PipelineJob* job = &pipeline->jobs[index];
+        const char* error = NULL;
+        if (job_skipped(pipeline, index)) {
+            continue;
+        }
+
+        uint64_t begin = monotonic_ns();
+        if (!verify_archive(pipeline, job, &error)) {
+            job_fail(pipeline, index, "verification", error);
+            continue;
+        }
+        stage_account(pipeline, &pipeline->stats->verify, job->archive_size, begin);
+
+        pthread_mutex_lock(&pipeline->lock);
+        job->verified = true;
+        if (job->pending_deps == 0 && !job->finalized) {
+            pipeline->ready[pipeline->ready_count++] = index;
+            pthread_cond_signal(&pipeline->ready_cond);
+        }
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+    return NULL;
+}
+
+static void* extract_worker(void* arg) {
+    Pipeline* pipeline = arg;
+
+    pthread_mutex_lock(&pipeline->lock);
+    for (;;) {
+        while (pipeline->ready_count == 0 && pipeline->remaining > 0) {
+            pthread_cond_wait(&pipeline->ready_cond, &pipeline->lock);
+        }
+        if (pipeline->ready_count == 0) {
+            break;
+        }
+        int index = pipeline->ready[--pipeline->ready_count];
+        pthread_mutex_unlock(&pipeline->lock);
+
+        const char* error = NULL;
+        uint64_t bytes = 0;
+        uint64_t begin = monotonic_ns();
+        bool ok = install_package(pipeline, &pipeline->jobs[index], &bytes, &error);
+        if (ok) {
+            stage_account(pipeline, &pipeline->stats->extract, bytes, begin);
+        } else {
+            fprintf(stderr, "package: installation of %s failed: %s\n",
+                    package_entry(pipeline->jobs[index].package)->name, error);
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        job_finalize(pipeline, index, ok);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+// Link each job to the planned jobs that depend on it
+static bool pipeline_build_graph(Pipeline* pipeline, const PackagePlan* plan) {
+    int table_size = package_entry_count();
+    int* job_of = malloc((size_t)table_size * sizeof(int));
+    int* counts = calloc((size_t)plan->count + 1, sizeof(int));
+    if (!job_of || !counts) {
+        free(job_of);
+        free(counts);
+        return false;
+    }
+    for (int i = 0; i < table_size; i++) {
+        job_of[i] = -1;
+    }
+    for (int i = 0; i < plan->count; i++) {
+        job_of[plan->order[i]] = i;
+        pipeline->jobs[i].package = plan->order[i];
+    }
+
+    int edges = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < plan->count; i++) {
+            PackageEntry* package = package_entry(plan->order[i]);
+            for (int d = 0; d < package->dependency_count; d++) {
+                int dep = package_dep_index(&package->dependencies[d]);
+                int dep_job = dep >= 0 ? job_of[dep] : -1;
+                if (dep_job < 0 || dep_job == i) {
+                    continue;
+                }
+                // Cycle members are planned in discovery order; only wait
+                // on dependencies that come earlier in the plan
+                if (dep_job > i) {
+                    continue;
+                }
+                if (pass == 0) {
+                    pipeline->jobs[dep_job].dependent_count++;
+                    edges++;
+                } else {
+                    PipelineJob* from = &pipeline->jobs[dep_job];
+                    pipeline->dependents[from->dependent_start + counts[dep_job]++] = i;
+                    pipeline->jobs[i].pending_deps++;
+                }
+            }
+        }
+        if (pass == 0) {
+            pipeline->dependents = malloc((size_t)(edges + 1) * sizeof(int));
+            if (!pipeline->dependents) {
+                free(job_of);
+                free(counts);
+                return false;
+            }
+            int offset = 0;
+            for (int i = 0; i < plan->count; i++) {
+                pipeline->jobs[i].dependent_start = offset;
+                offset += pipeline->jobs[i].dependent_count;
+            }
+        }
+    }
+
+    free(job_of);
+    free(counts);
+    return true;
+}
+
+static int default_workers(int wanted) {
+    if (wanted > 0) {
+        return wanted < PIPELINE_MAX_WORKERS ? wanted : PIPELINE_MAX_WORKERS;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : cpus > PIPELINE_MAX_WORKERS ? PIPELINE_MAX_WORKERS : (int)cpus;
+}
+
+static int start_workers(pthread_t* threads, int count, void* (*worker)(void*), Pipeline* pipeline) {
+    int started = 0;
+    for (int i = 0; i < count; i++) {
+        if (pthread_create(&threads[started], NULL, worker, pipeline) == 0) {
+            started++;
+        }
+    }
+    return started;
+}
+
+// Local directory behind a repository URL; other schemes are unsupported
+const char* package_repository_dir(const char* repository) {
+    if (strncmp(repository, "file://", 7) == 0) {
+        return repository + 7;
+    }
+    return strstr(repository, "://") ? NULL : repository;
+}
+
+bool package_pipeline_run(const PackagePipelineConfig* config, const PackagePlan* plan,
+                          PackagePipelineStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    uint64_t begin = monotonic_ns();
+    if (plan->count == 0) {
+        return true;
+    }
+
+    const char* repository = config->repository ? package_repository_dir(config->repository) : NULL;
+    if (config->repository && !repository) {
+        fprintf(stderr, "package: unsupported repository %s\n", config->repository);
+        return false;
+    }
+
+    Pipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.config = config;
+    pipeline.repository = repository;
+    pipeline.stats = stats;
+    pipeline.job_count = plan->count;
+    pipeline.remaining = plan->count;
+    pipeline.jobs = calloc((size_t)plan->count, sizeof(PipelineJob));
+    pipeline.ready = malloc((size_t)plan->count * sizeof(int));
+    pipeline.files = repository ? package_file_index() : NULL;
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_mutex_init(&pipeline.files_lock, NULL);
+    pthread_cond_init(&pipeline.ready_cond, NULL);
+
+    bool ok = pipeline.jobs && pipeline.ready && pipeline_build_graph(&pipeline, plan);
+    if (ok && repository && mkdir(config->cache_dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "package: cannot create cache %s: %s\n", config->cache_dir, strerror(errno));
+        ok = false;
+    }
+
+    if (ok && !repository) {
+        // Nothing to fetch: install in plan order on this thread
+        for (int i = 0; i < plan->count; i++) {
+            if (pipeline.jobs[i].finalized) {
+                continue;
+            }
+            const char* error = NULL;
+            uint64_t unused = 0;
+            bool installed = pipeline.jobs[i].pending_deps == 0 &&
+                             install_package(&pipeline, &pipeline.jobs[i], &unused, &error);
+            job_finalize(&pipeline, i, installed);
+        }
+    } else if (ok) {
+        int depth = config->queue_depth > 0 ? config->queue_depth : PIPELINE_DEFAULT_QUEUE_DEPTH;
+        pthread_t fetchers[PIPELINE_MAX_WORKERS], verifiers[PIPELINE_MAX_WORKERS];
+        pthread_t extractors[PIPELINE_MAX_WORKERS];
+
+        ok = queue_init(&pipeline.fetch_queue, depth) && queue_init(&pipeline.verify_queue, depth);
+        int fetch_count = 0, verify_count = 0, extract_count = 0;
+        if (ok) {
+            pipeline.fetchers_running = default_workers(config->fetch_workers ? config->fetch_workers
+                                                                              : PIPELINE_DEFAULT_FETCHERS);
+            fetch_count = start_workers(fetchers, pipeline.fetchers_running, fetch_worker, &pipeline);
+            pipeline.fetchers_running = fetch_count;
+            verify_count = start_workers(verifiers, default_workers(config->verify_workers),
+                                         verify_worker, &pipeline);
+            extract_count = start_workers(extractors, default_workers(config->extract_workers),
+                                          extract_worker, &pipeline);
+            ok = fetch_count > 0 && verify_count > 0 && extract_count > 0;
+        }
+
+        // Feed archives in plan order; the bounded queue throttles fetching
+        for (int i = 0; i < plan->count; i++) {
+            if (ok) {
+                queue_push(&pipeline.fetch_queue, i);
+            } else {
+                pthread_mutex_lock(&pipeline.lock);
+                job_finalize(&pipeline, i, false);
+                pthread_mutex_unlock(&pipeline.lock);
+            }
+        }
+        queue_close(&pipeline.fetch_queue);
+        if (fetch_count == 0) {
+            queue_close(&pipeline.verify_queue);
+        }
+
+        for (int i = 0; i < fetch_count; i++) {
+            pthread_join(fetchers[i], NULL);
+        }
+        for (int i = 0; i < verify_count; i++) {
+            pthread_join(verifiers[i], NULL);
+        }
+
+        // Jobs that never reached extraction (lost to a failed stage) are
+        // already finalized; anything still pending can no longer run
+        pthread_mutex_lock(&pipeline.lock);
+        for (int i = 0; i < plan->count; i++) {
+            if (!pipeline.jobs[i].verified && !pipeline.jobs[i].finalized) {
+                job_finalize(&pipeline, i, false);
+            }
+        }
+        pthread_mutex_unlock(&pipeline.lock);
+
+        for (int i = 0; i < extract_count; i++) {
+            pthread_join(extractors[i], NULL);
+        }
+        queue_destroy(&pipeline.fetch_queue);
+        queue_destroy(&pipeline.verify_queue);
+    }
+
+    stats->wall_ns = monotonic_ns() - begin;
+    pthread_cond_destroy(&pipeline.ready_cond);
+    pthread_mutex_destroy(&pipeline.files_lock);
+    pthread_mutex_destroy(&pipeline.lock);
+    free(pipeline.jobs);
+    free(pipeline.ready);
+    free(pipeline.dependents);
+    return ok && stats->failed == 0;
+}
+
+static void report_stage(char* buffer, size_t size, size_t* used, const char* name,
+                         const PackageStageStats* stage, uint64_t wall_ns) {
+    double busy = stage->busy_ns / 1e9;
+    double wall = wall_ns / 1e9;
+    if (*used >= size) {
+        return;
+    }
+    *used += (size_t)snprintf(buffer + *used, size - *used,
+        "%-8s %6llu items %10.1f MB  %8.1f MB/s per worker  %8.1f MB/s overall\n",
+        name, (unsigned long long)stage->items, stage->bytes / 1e6,
+        busy > 0 ? stage->bytes / 1e6 / busy : 0.0,
+        wall > 0 ? stage->bytes / 1e6 / wall : 0.0);
+}
+
+// Describe per-stage throughput of a pipeline run
+void package_pipeline_report(const PackagePipelineStats* stats, char* buffer, size_t size) {
+    size_t used = (size_t)snprintf(buffer, size, "installed %d, failed %d in %.1f ms\n",
+                                   stats->installed, stats->failed, stats->wall_ns / 1e6);
+    report_stage(buffer, size, &used, "fetch", &stats->fetch, stats->wall_ns);
+    report_stage(buffer, size, &used, "verify", &stats->verify, stats->wall_ns);
+    report_stage(buffer, size, &used, "extract", &stats->extract, stats->wall_ns);
+    if (used < size) {
+        snprintf(buffer + used, size - used, "store    %10.1f MB new, %.1f MB already stored\n",
+                 stats->stored_bytes / 1e6, stats->shared_bytes / 1e6);
+    }
+}
@@ -0,0 +1,368 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "package_manager.h"
+
+// Per-package decisions, memoized for the whole transaction
+typedef enum {
+    SOLVE_UNVISITED,
+    SOLVE_VISITING,     // On the DFS stack; reaching it again is a cycle
+    SOLVE_OK,
+    SOLVE_FAILED
+} SolveState;
+
+typedef struct {
+    int index;
+    int next_dep;
+} SolveFrame;
+
+typedef struct {
+    unsigned char* state;
+    SolveFrame* stack;
+    int capacity;
+    PackagePlan* plan;
+    int plan_capacity;
+} Solver;
+
+// Compare two version strings segment by segment. Numeric segments
+// compare as numbers and alphabetic ones as strings; a numeric segment
+// sorts after an alphabetic one, so "1.1" > "1.a".
+int package_version_compare(const char* a, const char* b) {
+    for (;;) {
+        while (*a && !isalnum((unsigned char)*a)) {
+            a++;
+        }
+        while (*b && !isalnum((unsigned char)*b)) {
+            b++;
+        }
+        if (!*a || !*b) {
+            return (*a != '\0') - (*b != '\0');
+        }
+
+        bool a_digit = isdigit((unsigned char)*a);
+        bool b_digit = isdigit((unsigned char)*b);
+        if (a_digit != b_digit) {
+            return a_digit ? 1 : -1;
+        }
+
+        const char* a_end = a;
+        const char* b_end = b;
+        if (a_digit) {
+            while (*a == '0') a++;
+            while (*b == '0') b++;
+            a_end = a;
+            b_end = b;
+            while (isdigit((unsigned char)*a_end)) a_end++;
+            while (isdigit((unsigned char)*b_end)) b_end++;
+            if (a_end - a != b_end - b) {
+                return a_end - a > b_end - b ? 1 : -1;
+            }
+        } else {
+            while (isalpha((unsigned char)*a_end)) a_end++;
+            while (isalpha((unsigned char)*b_end)) b_end++;
+        }
+
+        size_t a_len = (size_t)(a_end - a);
+        size_t b_len = (size_t)(b_end - b);
+        int cmp = strncmp(a, b, a_len < b_len ? a_len : b_len);
+        if (cmp != 0) {
+            return cmp > 0 ? 1 : -1;
+        }
+        if (a_len != b_len) {
+            return a_len > b_len ? 1 : -1;
+        }
+        a = a_end;
+        b = b_end;
+    }
+}
+
+// Check one clause such as ">= 2.0"; a bare version means ">="
+static bool clause_satisfied(const char* version, const char* clause, size_t len) {
+    char op[3] = {0};
+    size_t i = 0;
+
+    while (i < len && isspace((unsigned char)clause[i])) {
+        i++;
+    }
+    size_t op_len = 0;
+    while (i < len && op_len < 2 && strchr("<>=!", clause[i])) {
+        op[op_len++] = clause[i++];
+    }
+    while (i < len && isspace((unsigned char)clause[i])) {
+        i++;
+    }
+
+    char wanted[MAX_PACKAGE_VERSION_LEN];
+    size_t wanted_len = len - i;
+    while (wanted_len > 0 && isspace((unsigned char)clause[i + wanted_len - 1])) {
+        wanted_len--;
+    }
+    if (wanted_len == 0) {
+        return op_len == 0;   // Empty clause matches anything
+    }
+    if (wanted_len >= sizeof(wanted)) {
+        return false;
+    }
+    memcpy(wanted, clause + i, wanted_len);
+    wanted[wanted_len] = '\0';
+
+    int cmp = package_version_compare(version, wanted);
+    if (op_len == 0 || strcmp(op, ">=") == 0) return cmp >= 0;
+    if (strcmp(op, ">") == 0) return cmp > 0;
+    if (strcmp(op, "<=") == 0) return cmp <= 0;
+    if (strcmp(op, "<") == 0) return cmp < 0;
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return cmp == 0;
+    if (strcmp(op, "!=") == 0) return cmp != 0;
+    return false;
+}
+
+// Check a comma-separated list of clauses; all must hold
+bool package_version_satisfies(const char* version, const char* constraint) {
+    while (*constraint) {
+        size_t len = strcspn(constraint, ",");
+        if (!clause_satisfied(version, constraint, len)) {
+            return false;
+        }
+        constraint += len;
+        if (*constraint == ',') {
+            constraint++;
+        }
+    }
+    return true;
+}
+
+// Grow the per-package arrays as imports add packages to the table
+static bool solver_reserve(Solver* solver) {
+    int needed = package_entry_count();
+    if (needed <= solver->capacity) {
+        return true;
+    }
+
+    int capacity = solver->capacity ? solver->capacity : 256;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    unsigned char* state = realloc(solver->state, (size_t)capacity);
+    SolveFrame* stack = realloc(solver->stack, (size_t)capacity * sizeof(SolveFrame));
+    if (state) {
+        solver->state = state;
+    }
+    if (stack) {
+        solver->stack = stack;
+    }
+    if (!state || !stack) {
+        return false;
+    }
+    memset(solver->state + solver->capacity, SOLVE_UNVISITED, (size_t)(capacity - solver->capacity));
+    solver->capacity = capacity;
+    return true;
+}
+
+static bool plan_append(Solver* solver, int index) {
+    PackagePlan* plan = solver->plan;
+    if (plan->count == solver->plan_capacity) {
+        int capacity = solver->plan_capacity ? solver->plan_capacity * 2 : 64;
+        int* order = realloc(plan->order, (size_t)capacity * sizeof(int));
+        if (!order) {
+            return false;
+        }
+        plan->order = order;
+        solver->plan_capacity = capacity;
+    }
+    plan->order[plan->count++] = index;
+    return true;
+}
+
+// Resolve a dependency to a table index, importing it from the database
+static int solver_resolve(const PackageDepRef* dep) {
+    int index = package_dep_index(dep);
+    return index >= 0 ? index : package_index(package_dep_name(dep));
+}
+
+// Depth-first walk from `root`, appending packages to the plan in post
+// order so dependencies come before their dependents. Every package is
+// decided at most once per transaction.
+static bool solver_visit(Solver* solver, int root) {
+    PackagePlan* plan = solver->plan;
+    int depth = 0;
+
+    solver->state[root] = SOLVE_VISITING;
+    solver->stack[depth++] = (SolveFrame){ root, 0 };
+
+    while (depth > 0) {
+        SolveFrame* frame = &solver->stack[depth - 1];
+        PackageEntry* package = package_entry(frame->index);
+        bool failed = false;
+
+        if (frame->next_dep < package->dependency_count) {
+            // Dependency lists live in the arena and stay put, but
+            // resolving can import a package and move the entry table
+            int index = frame->index;
+            const PackageDepRef* dep = &package->dependencies[frame->next_dep++];
+            int target = solver_resolve(dep);
+            package = package_entry(index);
+            if (!solver_reserve(solver)) {
+                snprintf(plan->error, sizeof(plan->error), "out of memory");
+                return false;
+            }
+
+            if (target < 0) {
+                failed = !dep->optional;
+                if (failed) {
+                    snprintf(plan->error, sizeof(plan->error), "%s requires missing package %s",
+                             package->name, package_dep_name(dep));
+                }
+            } else if (!package_version_satisfies(package_entry(target)->version, dep->version)) {
+                failed = !dep->optional;
+                if (failed) {
+                    snprintf(plan->error, sizeof(plan->error), "%s requires %s %s, found %s",
+                             package->name, package_dep_name(dep), dep->version,
+                             package_entry(target)->version);
+                }
+            } else if (solver->state[target] == SOLVE_FAILED) {
+                failed = !dep->optional;
+            } else if (solver->state[target] == SOLVE_UNVISITED) {
+                if (package_entry(target)->state == PACKAGE_STATE_INSTALLED) {
+                    // Installed packages already have their dependencies
+                    solver->state[target] = SOLVE_OK;
+                } else {
+                    solver->state[target] = SOLVE_VISITING;
+                    solver->stack[depth++] = (SolveFrame){ target, 0 };
+                }
+            }
+            // SOLVE_OK and SOLVE_VISITING (a dependency cycle) need nothing:
+            // members of a cycle are installed in discovery order
+
+            if (!failed) {
+                continue;
+            }
+        }
+
+        // Finished this package, successfully or not. Re-read the frame:
+        // importing a dependency may have moved the stack.
+        int index = solver->stack[depth - 1].index;
+        depth--;
+        if (failed) {
+            solver->state[index] = SOLVE_FAILED;
+        } else {
+            solver->state[index] = SOLVE_OK;
+            if (!plan_append(solver, index)) {
+                snprintf(plan->error, sizeof(plan->error), "out of memory");
+                return false;
+            }
+            continue;
+        }
+
+        // Propagate the failure to the dependent unless the edge is optional
+        while (depth > 0) {
+            SolveFrame* parent = &solver->stack[depth - 1];
+            PackageEntry* dependent = package_entry(parent->index);
+            if (dependent->dependencies[parent->next_dep - 1].optional) {
+                break;
+            }
+            solver->state[parent->index] = SOLVE_FAILED;
+            depth--;
+        }
+    }
+
+    return solver->state[root] == SOLVE_OK;
+}
+
+// Check the conflicts of `package` against the plan, and against the
+// installed set when `with_installed` is set
+static bool conflict_found(const Solver* solver, const PackageEntry* package,
+                           const unsigned char* in_plan, bool with_installed,
+                           char* error, size_t size) {
+    for (int i = 0; i < package->conflict_count; i++) {
+        const PackageDepRef* conflict = &package->conflicts[i];
+        int target = package_dep_index(conflict);
+        if (target < 0 || target >= solver->capacity) {
+            continue;
+        }
+        PackageEntry* other = package_entry(target);
+        if ((in_plan[target] || (with_installed && other->state == PACKAGE_STATE_INSTALLED)) &&
+            package_version_satisfies(other->version, conflict->version)) {
+            snprintf(error, size, "%s conflicts with %s %s", package->name, other->name, other->version);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Plan the installation of `names` and everything they need. On success
+// the plan lists the packages to install, dependencies first; packages
+// that are already installed are left out.
+bool package_plan_install(const char* const* names, int name_count, PackagePlan* plan) {
+    Solver solver;
+    memset(&solver, 0, sizeof(solver));
+    memset(plan, 0, sizeof(*plan));
+    solver.plan = plan;
+
+    bool ok = true;
+    for (int i = 0; ok && i < name_count; i++) {
+        int root = package_index(names[i]);
+        if (root < 0) {
+            snprintf(plan->error, sizeof(plan->error), "unknown package %s", names[i]);
+            ok = false;
+            break;
+        }
+        if (!solver_reserve(&solver)) {
+            snprintf(plan->error, sizeof(plan->error), "out of memory");
+            ok = false;
+            break;
+        }
+        if (solver.state[root] == SOLVE_UNVISITED &&
+            package_entry(root)->state != PACKAGE_STATE_INSTALLED) {
+            ok = solver_visit(&solver, root);
+        } else {
+            ok = solver.state[root] != SOLVE_FAILED;
+        }
+        if (!ok && plan->error[0] == '\0') {
+            snprintf(plan->error, sizeof(plan->error), "dependencies of %s cannot be satisfied", names[i]);
+        }
+    }
+
+    // Conflicts: planned packages against the plan and the installed set,
+    // then installed packages against the plan
+    if (ok && plan->count > 0) {
+        unsigned char* in_plan = calloc((size_t)solver.capacity, 1);
+        if (!in_plan) {
+            snprintf(plan->error, sizeof(plan->error), "out of memory");
+            ok = false;
+        } else {
+            for (int i = 0; i < plan->count; i++) {
+                in_plan[plan->order[i]] = 1;
+            }
+            for (int i = 0; ok && i < plan->count; i++) {
+                ok = !conflict_found(&solver, package_entry(plan->order[i]), in_plan, true,
+                                     plan->error, sizeof(plan->error));
+            }
+            for (int i = 0; ok && i < package_entry_count() && i < solver.capacity; i++) {
+                PackageEntry* installed = package_entry(i);
+                if (installed->state == PACKAGE_STATE_INSTALLED && installed->conflict_count > 0) {
+                    ok = !conflict_found(&solver, installed, in_plan, false,
+                                         plan->error, sizeof(plan->error));
+                }
+            }
+            free(in_plan);
+        }
+    }
+
+    free(solver.state);
+    free(solver.stack);
+    if (!ok) {
+        free(plan->order);
+        plan->order = NULL;
+        plan->count = 0;
+    }
+    return ok;
+}
+
+void package_plan_free(PackagePlan* plan) {
+    free(plan->order);
+    plan->order = NULL;
+    plan->count = 0;
+}
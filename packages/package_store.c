@@ -0,0 +1,1031 @@
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include "../system/libs/name_registry.h"
+#include "package_store.h"
+
+#define MANIFEST_MAGIC "promptos-manifest 1"
+#define STAGE_COMMITTED "committed"
+#define STAGE_REMOVALS "removals"
+#define STAGE_MANIFEST "manifest"      // "+<path>" to install <path>.tmp, "-<path>" to delete
+#define MANIFEST_TMP_SUFFIX ".tmp"
+
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+// Fixed pseudo-random table so every machine cuts at the same places
+static void gear_init(void) {
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+// Create the directories leading up to `path`
+bool package_make_parents(char* path, uint32_t mode) {
+    for (char* p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            bool ok = mkdir(path, mode) == 0 || errno == EEXIST;
+            *p = '/';
+            if (!ok) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Reject absolute paths and ".." components, which would lead an entry
+// of an archive or a manifest out of the install path
+bool package_path_safe(const char* path) {
+    if (path[0] == '/' || path[0] == '\0') {
+        return false;
+    }
+    for (const char* p = path; *p;) {
+        size_t len = strcspn(p, "/");
+        if (len == 2 && p[0] == '.' && p[1] == '.') {
+            return false;
+        }
+        p += len;
+        while (*p == '/') {
+            p++;
+        }
+    }
+    return true;
+}
+
+// Open the directory that holds `name` below `root_fd`, one component at
+// a time with O_NOFOLLOW, so no symlink planted in the tree can lead an
+// entry out of it. Missing directories are created when `create` is set.
+// `name` must be package_path_safe(); `*leaf` is set to its last
+// component and trailing slashes are cut off.
+int package_open_parent(int root_fd, char* name, bool create, const char** leaf) {
+    size_t len = strlen(name);
+    while (len > 1 && name[len - 1] == '/') {
+        name[--len] = '\0';
+    }
+    int dir = dup(root_fd);
+    char* component = name;
+    for (char* slash; dir >= 0 && (slash = strchr(component, '/')) != NULL;) {
+        *slash = '\0';
+        if (component[0] != '\0' && strcmp(component, ".") != 0) {
+            if (create && mkdirat(dir, component, 0755) < 0 && errno != EEXIST) {
+                close(dir);
+                dir = -1;
+            } else {
+                int next = openat(dir, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                close(dir);
+                dir = next;
+            }
+        }
+        *slash = '/';
+        component = slash + 1;
+    }
+    *leaf = component;
+    return dir;
+}
+
+static void chunk_path(const char* store, const uint8_t digest[SHA256_DIGEST_SIZE], char* buffer, size_t size) {
+    char hex[SHA256_HEX_SIZE];
+    sha256_to_hex(digest, hex);
+    snprintf(buffer, size, "%s/%.2s/%s", store, hex, hex);
+}
+
+bool package_store_has_chunk(const char* store, const StoreChunkRef* chunk) {
+    char path[PATH_MAX];
+    struct stat st;
+    chunk_path(store, chunk->digest, path, sizeof(path));
+    return stat(path, &st) == 0 && (uint64_t)st.st_size == chunk->size;
+}
+
+// Write a chunk under its digest. Concurrent writers of the same chunk
+// each rename a complete private copy into place.
+static bool store_put(const char* store, const uint8_t digest[SHA256_DIGEST_SIZE], const void* data, size_t size) {
+    char path[PATH_MAX], tmp[PATH_MAX + 32];
+    chunk_path(store, digest, path, sizeof(path));
+    if (!package_make_parents(path, 0755)) {
+        return false;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.%d.%lx", path, (int)getpid(), (unsigned long)pthread_self());
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write(fd, data, size) == (ssize_t)size;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) {
+        unlink(tmp);
+    }
+    return ok;
+}
+
+// Copy a chunk between stores, checking it against its name
+static bool store_copy(const char* source, const char* store, const StoreChunkRef* chunk) {
+    static __thread uint8_t data[STORE_CHUNK_MAX];
+    char path[PATH_MAX];
+    chunk_path(source, chunk->digest, path, sizeof(path));
+    if (chunk->size > STORE_CHUNK_MAX) {
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = read(fd, data, chunk->size) == (ssize_t)chunk->size;
+    close(fd);
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256(data, chunk->size, digest);
+    if (!ok || memcmp(digest, chunk->digest, SHA256_DIGEST_SIZE) != 0) {
+        fprintf(stderr, "package: corrupt chunk %s\n", path);
+        return false;
+    }
+    return store_put(store, chunk->digest, data, chunk->size);
+}
+
+void package_manifest_init(PackageManifest* manifest, const char* name, const char* version) {
+    memset(manifest, 0, sizeof(*manifest));
+    snprintf(manifest->name, sizeof(manifest->name), "%s", name);
+    snprintf(manifest->version, sizeof(manifest->version), "%s", version);
+}
+
+void package_manifest_free(PackageManifest* manifest) {
+    for (uint32_t i = 0; i < manifest->file_count; i++) {
+        free(manifest->files[i].path);
+        free(manifest->files[i].target);
+    }
+    free(manifest->files);
+    free(manifest->chunks);
+    memset(manifest, 0, sizeof(*manifest));
+}
+
+bool package_manifest_add(PackageManifest* manifest, StoreFileType type, const char* path,
+                          const char* target, uint32_t mode) {
+    // Tabs and newlines would break the manifest's line format
+    if (strpbrk(path, "\t\n") || (target && strpbrk(target, "\t\n"))) {
+        return false;
+    }
+    if (manifest->file_count == manifest->file_capacity) {
+        uint32_t capacity = manifest->file_capacity ? manifest->file_capacity * 2 : 64;
+        StoreFile* files = realloc(manifest->files, capacity * sizeof(StoreFile));
+        if (!files) {
+            return false;
+        }
+        manifest->files = files;
+        manifest->file_capacity = capacity;
+    }
+
+    StoreFile* file = &manifest->files[manifest->file_count];
+    memset(file, 0, sizeof(*file));
+    file->path = strdup(path);
+    file->target = target ? strdup(target) : NULL;
+    file->type = type;
+    file->mode = mode;
+    file->first_chunk = manifest->chunk_count;
+    if (!file->path || (target && !file->target)) {
+        free(file->path);
+        free(file->target);
+        return false;
+    }
+    manifest->file_count++;
+    return true;
+}
+
+static bool manifest_add_chunk(PackageManifest* manifest, const uint8_t digest[SHA256_DIGEST_SIZE], uint32_t size) {
+    if (manifest->file_count == 0) {
+        return false;
+    }
+    if (manifest->chunk_count == manifest->chunk_capacity) {
+        uint32_t capacity = manifest->chunk_capacity ? manifest->chunk_capacity * 2 : 256;
+        StoreChunkRef* chunks = realloc(manifest->chunks, capacity * sizeof(StoreChunkRef));
+        if (!chunks) {
+            return false;
+        }
+        manifest->chunks = chunks;
+        manifest->chunk_capacity = capacity;
+    }
+
+    StoreChunkRef* chunk = &manifest->chunks[manifest->chunk_count++];
+    memcpy(chunk->digest, digest, SHA256_DIGEST_SIZE);
+    chunk->size = size;
+    StoreFile* file = &manifest->files[manifest->file_count - 1];
+    file->chunk_count++;
+    file->size += size;
+    return true;
+}
+
+// Manifest text format, one entry per line:
+//
+//   promptos-manifest 1
+//   package <name> <version>
+//   dir <mode> <path>
+//   file <mode> <path>
+//   chunk <sha256> <size>          (belongs to the preceding file)
+//   symlink <path>\t<target>
+//
+// Paths and symlink targets are relative and never leave the install path;
+// a manifest with any other entry is rejected.
+bool package_manifest_load(PackageManifest* manifest, const char* path) {
+    FILE* in = fopen(path, "r");
+    if (!in) {
+        return false;
+    }
+
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    bool ok = getline(&line, &capacity, in) > 0 && strncmp(line, MANIFEST_MAGIC "\n", sizeof(MANIFEST_MAGIC)) == 0;
+    package_manifest_init(manifest, "", "");
+
+    while (ok && (len = getline(&line, &capacity, in)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        char name[MAX_PACKAGE_NAME_LEN], version[MAX_PACKAGE_VERSION_LEN], hex[SHA256_HEX_SIZE];
+        unsigned int mode, size;
+        int offset = 0;
+
+        if (sscanf(line, "package %63s %31s", name, version) == 2) {
+            snprintf(manifest->name, sizeof(manifest->name), "%s", name);
+            snprintf(manifest->version, sizeof(manifest->version), "%s", version);
+        } else if (sscanf(line, "dir %o %n", &mode, &offset) == 1 && offset > 0) {
+            ok = package_path_safe(line + offset) &&
+                 package_manifest_add(manifest, STORE_FILE_DIRECTORY, line + offset, NULL, mode);
+        } else if (sscanf(line, "file %o %n", &mode, &offset) == 1 && offset > 0) {
+            ok = package_path_safe(line + offset) &&
+                 package_manifest_add(manifest, STORE_FILE_REGULAR, line + offset, NULL, mode);
+        } else if (sscanf(line, "chunk %64s %u", hex, &size) == 2) {
+            uint8_t digest[SHA256_DIGEST_SIZE];
+            ok = size <= STORE_CHUNK_MAX && sha256_from_hex(hex, digest) &&
+                 manifest_add_chunk(manifest, digest, size);
+        } else if (strncmp(line, "symlink ", 8) == 0 && strchr(line, '\t')) {
+            char* target = strchr(line, '\t');
+            *target++ = '\0';
+            ok = package_path_safe(line + 8) && package_path_safe(target) &&
+                 package_manifest_add(manifest, STORE_FILE_SYMLINK, line + 8, target, 0777);
+        } else {
+            ok = false;
+        }
+    }
+
+    free(line);
+    fclose(in);
+    if (!ok) {
+        package_manifest_free(manifest);
+    }
+    return ok;
+}
+
+// Write the manifest to `path` and sync it
+static bool manifest_write(const PackageManifest* manifest, const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        return false;
+    }
+
+    fprintf(out, MANIFEST_MAGIC "\npackage %s %s\n", manifest->name, manifest->version);
+    for (uint32_t i = 0; i < manifest->file_count; i++) {
+        const StoreFile* file = &manifest->files[i];
+        if (file->type == STORE_FILE_DIRECTORY) {
+            fprintf(out, "dir %04o %s\n", file->mode, file->path);
+        } else if (file->type == STORE_FILE_SYMLINK) {
+            fprintf(out, "symlink %s\t%s\n", file->path, file->target);
+        } else {
+            fprintf(out, "file %04o %s\n", file->mode, file->path);
+            for (uint32_t c = file->first_chunk; c < file->first_chunk + file->chunk_count; c++) {
+                char hex[SHA256_HEX_SIZE];
+                sha256_to_hex(manifest->chunks[c].digest, hex);
+                fprintf(out, "chunk %s %u\n", hex, manifest->chunks[c].size);
+            }
+        }
+    }
+
+    bool ok = fflush(out) == 0 && fsync(fileno(out)) == 0;
+    ok = fclose(out) == 0 && ok;
+    if (!ok) {
+        unlink(path);
+    }
+    return ok;
+}
+
+// Write the manifest to a temporary file and rename it into place
+bool package_manifest_save(const PackageManifest* manifest, const char* path) {
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s" MANIFEST_TMP_SUFFIX, path);
+    if (!manifest_write(manifest, tmp)) {
+        return false;
+    }
+    if (rename(tmp, path) < 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+void package_store_writer_init(PackageStoreWriter* writer, const char* store, PackageManifest* manifest) {
+    pthread_once(&gear_once, gear_init);
+    writer->store = store;
+    writer->manifest = manifest;
+    writer->hash = 0;
+    writer->used = 0;
+    writer->stored_bytes = 0;
+    writer->shared_bytes = 0;
+    writer->failed = false;
+}
+
+// Hash the pending chunk, store it unless the store already has it, and
+// append it to the current file
+static bool writer_flush(PackageStoreWriter* writer) {
+    if (writer->used == 0) {
+        return true;
+    }
+
+    StoreChunkRef chunk;
+    chunk.size = (uint32_t)writer->used;
+    sha256(writer->buffer, writer->used, chunk.digest);
+    if (package_store_has_chunk(writer->store, &chunk)) {
+        writer->shared_bytes += chunk.size;
+    } else if (store_put(writer->store, chunk.digest, writer->buffer, writer->used)) {
+        writer->stored_bytes += chunk.size;
+    } else {
+        writer->failed = true;
+    }
+
+    writer->used = 0;
+    writer->hash = 0;
+    writer->failed |= !manifest_add_chunk(writer->manifest, chunk.digest, chunk.size);
+    return !writer->failed;
+}
+
+bool package_store_begin_file(PackageStoreWriter* writer, const char* path, uint32_t mode) {
+    writer->used = 0;
+    writer->hash = 0;
+    writer->failed |= !package_manifest_add(writer->manifest, STORE_FILE_REGULAR, path, NULL, mode);
+    return !writer->failed;
+}
+
+// Feed file contents, cutting a chunk wherever the rolling hash hits the
+// mask (after STORE_CHUNK_MIN bytes) or the chunk reaches STORE_CHUNK_MAX
+bool package_store_write(PackageStoreWriter* writer, const void* data, size_t size) {
+    const uint8_t* p = data;
+    while (size > 0 && !writer->failed) {
+        size_t n = 0;
+        bool cut = false;
+        uint64_t hash = writer->hash;
+        while (n < size) {
+            hash = (hash << 1) + gear[p[n++]];
+            size_t length = writer->used + n;
+            if (length >= STORE_CHUNK_MAX || (length >= STORE_CHUNK_MIN && (hash & STORE_CHUNK_MASK) == 0)) {
+                cut = true;
+                break;
+            }
+        }
+
+        memcpy(writer->buffer + writer->used, p, n);
+        writer->used += n;
+        writer->hash = hash;
+        p += n;
+        size -= n;
+        if (cut) {
+            writer_flush(writer);
+        }
+    }
+    return !writer->failed;
+}
+
+bool package_store_end_file(PackageStoreWriter* writer) {
+    return writer_flush(writer);
+}
+
+static bool add_tree(PackageStoreWriter* writer, char* path, size_t root_len, size_t len) {
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return false;
+    }
+
+    bool ok = true;
+    struct dirent* entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        size_t name_len = strlen(entry->d_name);
+        if (len + 1 + name_len >= PATH_MAX) {
+            ok = false;
+            break;
+        }
+        path[len] = '/';
+        memcpy(path + len + 1, entry->d_name, name_len + 1);
+        const char* relative = path + root_len + 1;
+
+        struct stat st;
+        if (lstat(path, &st) < 0) {
+            ok = false;
+        } else if (S_ISDIR(st.st_mode)) {
+            ok = package_manifest_add(writer->manifest, STORE_FILE_DIRECTORY, relative, NULL, st.st_mode & 07777) &&
+                 add_tree(writer, path, root_len, len + 1 + name_len);
+        } else if (S_ISLNK(st.st_mode)) {
+            char target[PATH_MAX];
+            ssize_t target_len = readlink(path, target, sizeof(target) - 1);
+            ok = target_len >= 0;
+            if (ok) {
+                target[target_len] = '\0';
+                ok = package_manifest_add(writer->manifest, STORE_FILE_SYMLINK, relative, target, 0777);
+            }
+        } else if (S_ISREG(st.st_mode)) {
+            static __thread char data[STORE_CHUNK_MAX];
+            int fd = open(path, O_RDONLY | O_CLOEXEC);
+            ok = fd >= 0 && package_store_begin_file(writer, relative, st.st_mode & 07777);
+            ssize_t got = 0;
+            while (ok && (got = read(fd, data, sizeof(data))) > 0) {
+                ok = package_store_write(writer, data, (size_t)got);
+            }
+            ok = ok && got == 0 && package_store_end_file(writer);
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        path[len] = '\0';
+    }
+
+    closedir(dir);
+    return ok;
+}
+
+// Chunk every file below `root` into the store (used to publish a tree)
+bool package_store_add_tree(PackageStoreWriter* writer, const char* root) {
+    char path[PATH_MAX];
+    size_t len = strlen(root);
+    while (len > 1 && root[len - 1] == '/') {
+        len--;
+    }
+    if (len >= sizeof(path)) {
+        return false;
+    }
+    memcpy(path, root, len);
+    path[len] = '\0';
+    return add_tree(writer, path, len, len);
+}
+
+// Delete `path` and everything below it
+static void remove_tree(char* path, size_t len) {
+    DIR* dir = opendir(path);
+    struct dirent* entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        size_t name_len = strlen(entry->d_name);
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            len + 1 + name_len >= PATH_MAX) {
+            continue;
+        }
+        path[len] = '/';
+        memcpy(path + len + 1, entry->d_name, name_len + 1);
+        if (unlink(path) < 0 && (errno == EISDIR || errno == EPERM)) {
+            remove_tree(path, len + 1 + name_len);
+        }
+        path[len] = '\0';
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    rmdir(path);
+}
+
+// Move everything below `from` to the same place below `to`. Directories
+// are created or reused, so packages sharing an install path merge.
+static bool move_tree(char* from, size_t from_len, char* to, size_t to_len) {
+    DIR* dir = opendir(from);
+    if (!dir) {
+        return false;
+    }
+
+    bool ok = true;
+    struct dirent* entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        size_t name_len = strlen(entry->d_name);
+        if (from_len + 1 + name_len >= PATH_MAX || to_len + 1 + name_len >= PATH_MAX) {
+            ok = false;
+            break;
+        }
+        from[from_len] = '/';
+        memcpy(from + from_len + 1, entry->d_name, name_len + 1);
+        to[to_len] = '/';
+        memcpy(to + to_len + 1, entry->d_name, name_len + 1);
+
+        struct stat st;
+        if (lstat(from, &st) < 0) {
+            ok = false;
+        } else if (S_ISDIR(st.st_mode)) {
+            // An existing entry must be a real directory; merging through a
+            // symlink would put the files wherever it points
+            struct stat existing;
+            ok = (mkdir(to, st.st_mode & 07777) == 0 ||
+                  (errno == EEXIST && lstat(to, &existing) == 0 && S_ISDIR(existing.st_mode))) &&
+                 move_tree(from, from_len + 1 + name_len, to, to_len + 1 + name_len);
+        } else {
+            ok = rename(from, to) == 0;
+        }
+        from[from_len] = '\0';
+        to[to_len] = '\0';
+    }
+
+    closedir(dir);
+    return ok;
+}
+
+// Every open transaction has an entry in PACKAGE_PENDING_PATH, a symlink
+// to its stage directory named after the digest of that path, so startup
+// finds leftover stages without walking every install path
+static void pending_entry(const PackageStage* stage, char* buffer, size_t size) {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    sha256(stage->dir, strlen(stage->dir), digest);
+    sha256_to_hex(digest, hex);
+    snprintf(buffer, size, PACKAGE_PENDING_PATH "/%s", hex);
+}
+
+static bool pending_add(const PackageStage* stage) {
+    char path[PATH_MAX];
+    pending_entry(stage, path, sizeof(path));
+    if (!package_make_parents(path, 0755)) {
+        return false;
+    }
+    return symlink(stage->dir, path) == 0 || errno == EEXIST;
+}
+
+static void pending_drop(const PackageStage* stage) {
+    char path[PATH_MAX];
+    pending_entry(stage, path, sizeof(path));
+    unlink(path);
+}
+
+// Move the staged tree into place and apply the removals. Safe to repeat:
+// whatever an interrupted run already moved is simply no longer staged.
+static bool finish_commit(PackageStage* stage) {
+    char from[PATH_MAX], to[PATH_MAX], path[PATH_MAX * 2];
+    snprintf(from, sizeof(from), "%s", stage->tree);
+    snprintf(to, sizeof(to), "%s", stage->dest);
+    bool ok = access(from, F_OK) < 0 || move_tree(from, strlen(from), to, strlen(to));
+
+    snprintf(path, sizeof(path), "%s/" STAGE_REMOVALS, stage->dir);
+    FILE* removals = fopen(path, "r");
+    char line[PATH_MAX];
+    while (ok && removals && fgets(line, sizeof(line), removals)) {
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(path, sizeof(path), "%s/%s", stage->dest, line);
+        ok = unlink(path) == 0 || errno == ENOENT;
+    }
+    if (removals) {
+        fclose(removals);
+    }
+
+    // The manifest goes last, so it never lists files that are not in place
+    snprintf(path, sizeof(path), "%s/" STAGE_MANIFEST, stage->dir);
+    FILE* record = ok ? fopen(path, "r") : NULL;
+    if (record && fgets(line, sizeof(line), record)) {
+        line[strcspn(line, "\n")] = '\0';
+        const char* manifest = line + 1;
+        snprintf(path, sizeof(path), "%s" MANIFEST_TMP_SUFFIX, manifest);
+        if (line[0] == '+') {
+            // A replay finds the rename already done
+            ok = rename(path, manifest) == 0 || (errno == ENOENT && access(manifest, F_OK) == 0);
+        } else {
+            ok = unlink(manifest) == 0 || errno == ENOENT;
+        }
+    }
+    if (record) {
+        fclose(record);
+    }
+
+    if (ok) {
+        snprintf(path, sizeof(path), "%s", stage->dir);
+        remove_tree(path, strlen(path));
+        pending_drop(stage);
+    }
+    return ok;
+}
+
+// A package name becomes part of the stage path, so it must stay one
+// component
+static bool stage_name_valid(const char* name) {
+    return name[0] != '\0' && !strchr(name, '/') && !strstr(name, "..");
+}
+
+static bool stage_paths(PackageStage* stage, const char* dest, const char* name) {
+    stage->removals = -1;
+    stage->committed = false;
+    stage->manifest[0] = '\0';
+    return stage_name_valid(name) &&
+           snprintf(stage->dest, sizeof(stage->dest), "%s", dest) < (int)sizeof(stage->dest) &&
+           snprintf(stage->dir, sizeof(stage->dir), "%s/" PACKAGE_STAGE_PREFIX "%s", dest, name) < (int)sizeof(stage->dir) &&
+           snprintf(stage->tree, sizeof(stage->tree), "%s/tree", stage->dir) < (int)sizeof(stage->tree);
+}
+
+// Complete a transaction a crash left behind if it was committed, or drop it
+static bool stage_recover(PackageStage* stage) {
+    char path[PATH_MAX * 2];
+    snprintf(path, sizeof(path), "%s/" STAGE_COMMITTED, stage->dir);
+    if (access(path, F_OK) == 0) {
+        return finish_commit(stage);
+    }
+    snprintf(path, sizeof(path), "%s", stage->dir);
+    remove_tree(path, strlen(path));
+    pending_drop(stage);
+    return true;
+}
+
+// Open a transaction for `name` under `dest`, first completing or dropping
+// one a crash left behind
+bool package_stage_begin(PackageStage* stage, const char* dest, const char* name) {
+    char path[PATH_MAX * 2];
+    if (!stage_paths(stage, dest, name) || !stage_recover(stage) || !pending_add(stage)) {
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "%s/", stage->tree);
+    if (!package_make_parents(path, 0755)) {
+        return false;
+    }
+    snprintf(path, sizeof(path), "%s/" STAGE_REMOVALS, stage->dir);
+    stage->removals = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    return stage->removals >= 0;
+}
+
+// Recover every transaction listed in PACKAGE_PENDING_PATH, whichever
+// package and install path it was for. False if one that was committed
+// still cannot be completed.
+bool package_stage_sweep(void) {
+    DIR* dir = opendir(PACKAGE_PENDING_PATH);
+    if (!dir) {
+        return errno == ENOENT;
+    }
+    bool ok = true;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char path[PATH_MAX], stage_dir[PATH_MAX];
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), PACKAGE_PENDING_PATH "/%s", entry->d_name);
+        ssize_t len = readlink(path, stage_dir, sizeof(stage_dir) - 1);
+        char* base = NULL;
+        if (len > 0) {
+            stage_dir[len] = '\0';
+            base = strrchr(stage_dir, '/');
+        }
+        if (!base || strncmp(base + 1, PACKAGE_STAGE_PREFIX, strlen(PACKAGE_STAGE_PREFIX)) != 0) {
+            unlink(path);   // Not an entry pending_add() wrote
+            continue;
+        }
+
+        // <dest>/.pkg-stage-<name>
+        PackageStage stage;
+        *base = '\0';
+        if (!stage_paths(&stage, stage_dir, base + 1 + strlen(PACKAGE_STAGE_PREFIX)) || !stage_recover(&stage)) {
+            ok = false;
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+// Queue `path` (relative to dest) for deletion when the stage commits
+bool package_stage_remove(PackageStage* stage, const char* path) {
+    size_t len = strlen(path);
+    if (!package_path_safe(path) || strchr(path, '\n') || len >= PATH_MAX - 1) {
+        return false;
+    }
+    char line[PATH_MAX];
+    memcpy(line, path, len);
+    line[len] = '\n';
+    return write(stage->removals, line, len + 1) == (ssize_t)(len + 1);
+}
+
+// Install `manifest` at `path` when the stage commits, or delete the
+// manifest at `path` if `manifest` is NULL. A new manifest is written to
+// <path>.tmp now and renamed into place after the staged files are.
+bool package_stage_manifest(PackageStage* stage, const PackageManifest* manifest, const char* path) {
+    char record[PATH_MAX + 2], file[PATH_MAX * 2];
+    int len = snprintf(record, sizeof(record), "%c%s\n", manifest ? '+' : '-', path);
+    if (strchr(path, '\n') || len >= (int)sizeof(record) || strlen(path) + 8 >= PATH_MAX) {
+        return false;
+    }
+    snprintf(stage->manifest, sizeof(stage->manifest), "%s" MANIFEST_TMP_SUFFIX, path);
+    if (manifest && !manifest_write(manifest, stage->manifest)) {
+        stage->manifest[0] = '\0';
+        return false;
+    }
+
+    snprintf(file, sizeof(file), "%s/" STAGE_MANIFEST, stage->dir);
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && write(fd, record, (size_t)len) == len;
+    if (fd >= 0 && close(fd) < 0) {
+        ok = false;
+    }
+    return ok;
+}
+
+// Commits running side by side share their filesystem syncs. A commit
+// needs a sync that began after its stage was written: it waits for the
+// next one if a sync is already running, and starts one itself otherwise,
+// so a burst of commits costs a couple of syncs rather than one each.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    bool running;
+    uint64_t started;           // Syncs begun
+    uint64_t finished;          // Number of the last sync to end
+    dev_t device;               // Filesystem it synced
+    bool ok;                    // Whether it succeeded
+} stage_sync_group = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, 0, 0, 0, false };
+
+static bool stage_sync(int dir) {
+    struct stat st;
+    if (fstat(dir, &st) < 0) {
+        return false;
+    }
+    pthread_mutex_lock(&stage_sync_group.lock);
+    uint64_t need = stage_sync_group.started + 1;
+    bool ok;
+    for (;;) {
+        if (stage_sync_group.finished >= need) {
+            if (stage_sync_group.device == st.st_dev) {
+                ok = stage_sync_group.ok;
+                break;
+            }
+            need = stage_sync_group.started + 1;   // That one synced another filesystem
+        }
+        if (stage_sync_group.running) {
+            pthread_cond_wait(&stage_sync_group.done, &stage_sync_group.lock);
+            continue;
+        }
+        stage_sync_group.running = true;
+        uint64_t number = ++stage_sync_group.started;
+        pthread_mutex_unlock(&stage_sync_group.lock);
+        bool synced = syncfs(dir) == 0;
+        pthread_mutex_lock(&stage_sync_group.lock);
+        stage_sync_group.running = false;
+        stage_sync_group.finished = number;
+        stage_sync_group.device = st.st_dev;
+        stage_sync_group.ok = synced;
+        pthread_cond_broadcast(&stage_sync_group.done);
+    }
+    pthread_mutex_unlock(&stage_sync_group.lock);
+    return ok;
+}
+
+// Make the stage and its pending entry durable with a filesystem sync
+// shared with concurrent commits, record the decision, then move it into
+// place. Only the moves follow the marker, and they are replayed after a
+// crash, so dest never ends up half old, half new.
+bool package_stage_commit(PackageStage* stage) {
+    char path[PATH_MAX * 2];
+    bool ok = close(stage->removals) == 0;
+    stage->removals = -1;
+    int dir = open(stage->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int pending = open(PACKAGE_PENDING_PATH, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ok = ok && dir >= 0 && stage_sync(dir) && pending >= 0 && fsync(pending) == 0;
+    if (pending >= 0) {
+        close(pending);
+    }
+
+    snprintf(path, sizeof(path), "%s/" STAGE_COMMITTED, stage->dir);
+    int marker = ok ? open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    ok = marker >= 0 && fsync(marker) == 0 && fsync(dir) == 0;
+    if (marker >= 0) {
+        close(marker);
+    }
+    if (dir >= 0) {
+        close(dir);
+    }
+    if (!ok) {
+        package_stage_abort(stage);
+        return false;
+    }
+    stage->committed = true;
+    return finish_commit(stage);
+}
+
+// Drop everything staged; dest is untouched
+void package_stage_abort(PackageStage* stage) {
+    char path[PATH_MAX];
+    if (stage->removals >= 0) {
+        close(stage->removals);
+        stage->removals = -1;
+    }
+    if (stage->manifest[0]) {
+        unlink(stage->manifest);
+        stage->manifest[0] = '\0';
+    }
+    snprintf(path, sizeof(path), "%s", stage->dir);
+    remove_tree(path, strlen(path));
+    pending_drop(stage);
+}
+
+static bool same_chunks(const PackageManifest* a, const StoreFile* fa,
+                        const PackageManifest* b, const StoreFile* fb) {
+    return fa->chunk_count == fb->chunk_count && fa->size == fb->size &&
+           memcmp(&a->chunks[fa->first_chunk], &b->chunks[fb->first_chunk],
+                  fa->chunk_count * sizeof(StoreChunkRef)) == 0;
+}
+
+// Index a manifest's paths; each name is bound to its file index
+static bool index_paths(NameRegistry* registry, const PackageManifest* manifest) {
+    if (!name_registry_init(registry, manifest->file_count + 1)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < manifest->file_count; i++) {
+        int32_t id = name_registry_intern(registry, manifest->files[i].path);
+        if (id < 0) {
+            return false;
+        }
+        name_registry_bind(registry, id, (int32_t)i);
+    }
+    return true;
+}
+
+// Copy `size` bytes of `in` to `offset` in `out` inside the kernel, with
+// read and write as the fallback where copy_file_range is refused
+static bool copy_range(int in, int out, uint64_t offset, uint64_t size) {
+    loff_t in_offset = 0, out_offset = (loff_t)offset;
+    while (size > 0) {
+        ssize_t n = copy_file_range(in, &in_offset, out, &out_offset, size, 0);
+        if (n > 0) {
+            size -= (uint64_t)n;
+            continue;
+        }
+        if (n == 0 || (errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP && errno != EINVAL)) {
+            return false;
+        }
+        static __thread uint8_t data[STORE_CHUNK_MAX];
+        while (size > 0) {
+            size_t want = size < sizeof(data) ? (size_t)size : sizeof(data);
+            ssize_t got = pread(in, data, want, in_offset);
+            if (got <= 0 || pwrite(out, data, (size_t)got, out_offset) != got) {
+                return false;
+            }
+            in_offset += got;
+            out_offset += got;
+            size -= (uint64_t)got;
+        }
+    }
+    return true;
+}
+
+// Assemble a file from local chunks at `leaf` in `dir` of the stage.
+// Chunks at a block boundary are reflinked from the store where the
+// filesystem shares extents (btrfs, XFS), the rest are copied by the
+// kernel; no file data passes through this process either way.
+static bool materialize(const char* store, const PackageManifest* manifest, const StoreFile* file,
+                        int dir, const char* leaf, PackageUpgradeStats* stats) {
+    int out = openat(dir, leaf, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, file->mode);
+    struct stat st;
+    if (out < 0 || fstat(out, &st) < 0) {
+        if (out >= 0) {
+            close(out);
+        }
+        return false;
+    }
+
+    bool ok = true;
+    bool try_clone = true;
+    uint64_t offset = 0;
+    for (uint32_t c = file->first_chunk; ok && c < file->first_chunk + file->chunk_count; c++) {
+        const StoreChunkRef* chunk = &manifest->chunks[c];
+        char chunk_file[PATH_MAX];
+        chunk_path(store, chunk->digest, chunk_file, sizeof(chunk_file));
+        int in = open(chunk_file, O_RDONLY | O_CLOEXEC);
+        ok = in >= 0;
+
+        // A length of 0 clones to the end of the chunk; one refusal means
+        // the filesystem cannot, so the rest of the file is copied
+        bool cloned = false;
+        if (ok && try_clone && offset % (uint64_t)st.st_blksize == 0) {
+            struct file_clone_range range = { in, 0, 0, offset };
+            cloned = ioctl(out, FICLONERANGE, &range) == 0;
+            try_clone = cloned;
+        }
+        if (cloned) {
+            stats->cloned_bytes += chunk->size;
+        } else {
+            ok = ok && copy_range(in, out, offset, chunk->size);
+        }
+        offset += chunk->size;
+        if (in >= 0) {
+            close(in);
+        }
+    }
+
+    ok = fchmod(out, file->mode) == 0 && ok;
+    return close(out) == 0 && ok;
+}
+
+// Queue the files of `installed` that `target` no longer has for deletion
+// when `stage` commits. Directories stay, since other packages may share
+// them.
+bool package_stage_remove_dropped(PackageStage* stage, const PackageManifest* installed,
+                                  const PackageManifest* target, uint32_t* removed) {
+    NameRegistry new_paths;
+    memset(&new_paths, 0, sizeof(new_paths));
+    bool ok = index_paths(&new_paths, target);
+    for (uint32_t i = 0; ok && i < installed->file_count; i++) {
+        const StoreFile* file = &installed->files[i];
+        if (file->type != STORE_FILE_DIRECTORY && name_registry_lookup(&new_paths, file->path) < 0) {
+            ok = package_stage_remove(stage, file->path);
+            (*removed)++;
+        }
+    }
+    name_registry_free(&new_paths);
+    return ok;
+}
+
+// Stage the move from the installed manifest to the target one in
+// `stage`. Chunks the local store lacks are copied from `source`; files
+// whose chunk lists are unchanged are left alone, and files the target no
+// longer has are queued for removal. Nothing under the install path
+// changes until the caller commits the stage; on failure it aborts it.
+bool package_store_upgrade(const char* source, const char* store, const PackageManifest* installed,
+                           const PackageManifest* target, PackageStage* stage, PackageUpgradeStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    NameRegistry old_paths;
+    memset(&old_paths, 0, sizeof(old_paths));
+    bool ok = index_paths(&old_paths, installed);
+    int root_fd = ok ? open(stage->tree, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    ok = root_fd >= 0;
+    char path[PATH_MAX];
+
+    for (uint32_t i = 0; ok && i < target->file_count; i++) {
+        const StoreFile* file = &target->files[i];
+        int32_t old_index = name_registry_find(&old_paths, file->path);
+        const StoreFile* old = old_index >= 0 ? &installed->files[old_index] : NULL;
+        if (file->type == STORE_FILE_REGULAR) {
+            stats->total_bytes += file->size;
+            if (old && old->type == STORE_FILE_REGULAR && old->mode == file->mode &&
+                same_chunks(installed, old, target, file)) {
+                continue;
+            }
+        } else if (file->type == STORE_FILE_SYMLINK && old && old->type == STORE_FILE_SYMLINK &&
+                   strcmp(old->target, file->target) == 0) {
+            continue;
+        }
+
+        // Entries are created from the stage root down with O_NOFOLLOW, as
+        // archives are, so a symlink in the stage cannot redirect them
+        const char* leaf;
+        snprintf(path, sizeof(path), "%s", file->path);
+        int parent = package_open_parent(root_fd, path, true, &leaf);
+        ok = parent >= 0;
+        if (ok && file->type == STORE_FILE_DIRECTORY) {
+            struct stat st;
+            ok = mkdirat(parent, leaf, file->mode) == 0 ||
+                 (errno == EEXIST && fstatat(parent, leaf, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode));
+        } else if (ok && file->type == STORE_FILE_SYMLINK) {
+            ok = symlinkat(file->target, parent, leaf) == 0;
+            stats->files_changed++;
+        } else if (ok) {
+            for (uint32_t c = file->first_chunk; ok && c < file->first_chunk + file->chunk_count; c++) {
+                const StoreChunkRef* chunk = &target->chunks[c];
+                if (!package_store_has_chunk(store, chunk)) {
+                    ok = store_copy(source, store, chunk);
+                    stats->fetched_bytes += chunk->size;
+                }
+            }
+            ok = ok && materialize(store, target, file, parent, leaf, stats);
+            stats->written_bytes += file->size;
+            stats->files_changed++;
+        }
+        if (parent >= 0) {
+            close(parent);
+        }
+    }
+
+    ok = ok && package_stage_remove_dropped(stage, installed, target, &stats->files_removed);
+
+    if (root_fd >= 0) {
+        close(root_fd);
+    }
+    name_registry_free(&old_paths);
+    return ok;
+}
@@ -0,0 +1,132 @@
+#ifndef PROMPTOS_PACKAGE_STORE_H
+#define PROMPTOS_PACKAGE_STORE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include "../system/libs/sha256.h"
+#include "package_manager.h"
+
+// Content-addressed chunk store
+//
+// File contents are cut into variable-size chunks at content-defined
+// boundaries (a gear rolling hash), so an edit only changes the chunks
+// around it. Each chunk is stored once, named by its SHA-256:
+//
+//   <store>/ab/ab12...ef
+//
+// A manifest lists the files of one package version and the chunks that
+// make up each file. The local store lives in PACKAGE_CACHE_PATH/chunks;
+// a repository publishes the same layout in <repo>/chunks next to
+// <name>-<version>.manifest, which lets an upgrade fetch and rewrite only
+// what changed between the installed manifest and the new one.
+
+#define STORE_CHUNK_MIN  (2 * 1024)
+#define STORE_CHUNK_MAX  (64 * 1024)
+#define STORE_CHUNK_MASK 0x1fffULL     // ~8 KiB average chunk
+#define PACKAGE_MANIFEST_SUFFIX ".manifest"
+#define PACKAGE_STAGE_PREFIX ".pkg-stage-"    // <install path>/.pkg-stage-<name>
+
+typedef enum {
+    STORE_FILE_REGULAR,
+    STORE_FILE_DIRECTORY,
+    STORE_FILE_SYMLINK
+} StoreFileType;
+
+typedef struct {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint32_t size;
+} StoreChunkRef;
+
+typedef struct {
+    char* path;                 // Relative to the install path
+    char* target;               // Symlink target
+    StoreFileType type;
+    uint32_t mode;
+    uint64_t size;
+    uint32_t first_chunk;       // Index into PackageManifest.chunks
+    uint32_t chunk_count;
+} StoreFile;
+
+typedef struct {
+    char name[MAX_PACKAGE_NAME_LEN];
+    char version[MAX_PACKAGE_VERSION_LEN];
+    StoreFile* files;
+    uint32_t file_count;
+    uint32_t file_capacity;
+    StoreChunkRef* chunks;
+    uint32_t chunk_count;
+    uint32_t chunk_capacity;
+} PackageManifest;
+
+// Streams file contents into the store while recording a manifest
+typedef struct {
+    const char* store;
+    PackageManifest* manifest;
+    uint64_t hash;              // Rolling gear hash of the pending chunk
+    size_t used;
+    uint64_t stored_bytes;      // Chunk bytes written to the store
+    uint64_t shared_bytes;      // Chunk bytes the store already had
+    bool failed;
+    uint8_t buffer[STORE_CHUNK_MAX];
+} PackageStoreWriter;
+
+// Byte counts of one delta upgrade
+typedef struct {
+    uint64_t total_bytes;       // Payload of the new version
+    uint64_t fetched_bytes;     // Chunks copied from the repository
+    uint64_t written_bytes;     // File bytes rewritten under the install path
+    uint64_t cloned_bytes;      // Of those, shared with the store by reflink
+    uint32_t files_changed;
+    uint32_t files_removed;
+} PackageUpgradeStats;
+
+// A staged transaction. Files are written under `tree` and only moved into
+// `dest` by package_stage_commit(), so a failed install or upgrade leaves
+// the installed tree as it was. The package's manifest can be installed
+// or deleted as part of the same commit. A transaction interrupted after
+// it was committed is completed by package_stage_sweep(), which finds it
+// through its entry in PACKAGE_PENDING_PATH, or by the next
+// package_stage_begin() for the same package; one interrupted before is
+// discarded.
+typedef struct {
+    char dir[PATH_MAX];         // <dest>/.pkg-stage-<name>
+    char tree[PATH_MAX];        // <dir>/tree, mirrors dest
+    char dest[PATH_MAX];
+    char manifest[PATH_MAX];    // New manifest written for the commit, or empty
+    int removals;               // <dir>/removals: dest paths to delete on commit
+    bool committed;             // Set once the commit is decided; a failure after
+                                // that is finished later, not undone
+} PackageStage;
+
+void package_manifest_init(PackageManifest* manifest, const char* name, const char* version);
+void package_manifest_free(PackageManifest* manifest);
+bool package_manifest_load(PackageManifest* manifest, const char* path);
+bool package_manifest_save(const PackageManifest* manifest, const char* path);
+bool package_manifest_add(PackageManifest* manifest, StoreFileType type, const char* path,
+                          const char* target, uint32_t mode);
+
+void package_store_writer_init(PackageStoreWriter* writer, const char* store, PackageManifest* manifest);
+bool package_store_begin_file(PackageStoreWriter* writer, const char* path, uint32_t mode);
+bool package_store_write(PackageStoreWriter* writer, const void* data, size_t size);
+bool package_store_end_file(PackageStoreWriter* writer);
+bool package_store_add_tree(PackageStoreWriter* writer, const char* root);
+
+bool package_stage_begin(PackageStage* stage, const char* dest, const char* name);
+bool package_stage_remove(PackageStage* stage, const char* path);
+bool package_stage_remove_dropped(PackageStage* stage, const PackageManifest* installed,
+                                  const PackageManifest* target, uint32_t* removed);
+bool package_stage_manifest(PackageStage* stage, const PackageManifest* manifest, const char* path);
+bool package_stage_commit(PackageStage* stage);
+void package_stage_abort(PackageStage* stage);
+bool package_stage_sweep(void);
+
+bool package_make_parents(char* path, uint32_t mode);
+bool package_path_safe(const char* path);
+int package_open_parent(int root_fd, char* name, bool create, const char** leaf);
+bool package_store_has_chunk(const char* store, const StoreChunkRef* chunk);
+bool package_store_upgrade(const char* source, const char* store, const PackageManifest* installed,
+                           const PackageManifest* target, PackageStage* stage, PackageUpgradeStats* stats);
+
+#endif // PROMPTOS_PACKAGE_STORE_H
@@ -0,0 +1,366 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../system/libs/name_registry.h"
+#include "package_manager.h"
+#include "package_db.h"
+
+// Repository index sync
+//
+// A repository publishes its catalog under <repo>/index as package
+// databases (package_db.c), so nothing is parsed on either side:
+//
+//   snapshot        the whole catalog at the newest sequence number
+//   <n>.delta       what changed from sequence n - 1 to n: new and changed
+//                   records, and PACKAGE_DB_RECORD_REMOVED tombstones
+//
+// Every index file carries the repository's origin id and its sequence in
+// the header. The local database records the ones it was last synced to,
+// so an update maps only the deltas after that and merges them in a single
+// pass over the local records. A client on another origin, more than
+// PACKAGE_SYNC_MAX_DELTAS behind, or missing a delta that was pruned,
+// merges the snapshot instead. Either way local state is kept: installed
+// packages keep their state and install path, and are never dropped.
+//
+// The publisher writes the delta before the snapshot, so a client that
+// sees sequence n in the snapshot always finds <n>.delta.
+
+#define SYNC_ORIGIN_ANY 0
+
+typedef struct {
+    uint32_t delta;
+    uint32_t record;
+    bool merged;                // Matched a local record
+} SyncRef;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// <repo>/index/snapshot for sequence 0, <repo>/index/<n>.delta otherwise
+static void index_path(const char* repository, uint64_t sequence, char* path, size_t size) {
+    if (sequence == 0) {
+        snprintf(path, size, "%s/" PACKAGE_INDEX_DIR "/" PACKAGE_INDEX_SNAPSHOT, repository);
+    } else {
+        snprintf(path, size, "%s/" PACKAGE_INDEX_DIR "/%llu" PACKAGE_INDEX_DELTA_SUFFIX, repository,
+                 (unsigned long long)sequence);
+    }
+}
+
+static bool strings_equal(const PackageDb* a, uint32_t x, const PackageDb* b, uint32_t y) {
+    return strcmp(package_db_string(a, x), package_db_string(b, y)) == 0;
+}
+
+// Same catalog metadata, state aside
+static bool record_equal(const PackageDb* a, uint32_t i, const PackageDb* b, uint32_t j) {
+    const PackageDbRecord* left = package_db_record(a, i);
+    const PackageDbRecord* right = package_db_record(b, j);
+    if (left->installed_size != right->installed_size || left->dependency_count != right->dependency_count ||
+        !strings_equal(a, left->version, b, right->version) ||
+        !strings_equal(a, left->description, b, right->description) ||
+        !strings_equal(a, left->install_path, b, right->install_path)) {
+        return false;
+    }
+    for (uint32_t d = 0; d < left->dependency_count; d++) {
+        const PackageDbDependency* x = package_db_dependency(a, left, d);
+        const PackageDbDependency* y = package_db_dependency(b, right, d);
+        if (!x || !y || x->flags != y->flags || !strings_equal(a, x->name, b, y->name) ||
+            !strings_equal(a, x->constraint, b, y->constraint)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int32_t find_record(const PackageDb* db, const PackageDb* from, uint32_t index) {
+    const PackageDbRecord* record = package_db_record(from, index);
+    return package_db_find_hashed(db, package_db_string(from, record->name), record->name_hash);
+}
+
+// Merge the whole catalog: its records, with local state where the
+// package is known, plus the local packages that are installed
+static bool merge_snapshot(PackageDbBuilder* builder, const PackageDb* local, const PackageDb* snapshot,
+                           PackageSyncStats* stats) {
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < package_db_count(snapshot); i++) {
+        int32_t known = find_record(local, snapshot, i);
+        if (known < 0) {
+            ok = package_db_builder_copy(builder, snapshot, i, PACKAGE_STATE_NOT_INSTALLED);
+            stats->updated++;
+        } else {
+            ok = package_db_builder_update(builder, snapshot, i, local, (uint32_t)known);
+            stats->updated += !record_equal(local, (uint32_t)known, snapshot, i);
+        }
+    }
+    for (uint32_t i = 0; ok && i < package_db_count(local); i++) {
+        const PackageDbRecord* record = package_db_record(local, i);
+        if (find_record(snapshot, local, i) >= 0) {
+            continue;
+        }
+        if (record->state != PACKAGE_STATE_NOT_INSTALLED) {
+            ok = package_db_builder_copy(builder, local, i, record->state);
+        } else {
+            stats->removed++;
+        }
+    }
+    return ok;
+}
+
+// Merge deltas in order: the newest record of each package wins. The
+// builder starts from the local database, so only the records the deltas
+// name are touched.
+static bool merge_deltas(PackageDbBuilder* builder, const PackageDb* local, const PackageDb* deltas,
+                         uint32_t delta_count, PackageSyncStats* stats) {
+    uint32_t total = 0;
+    for (uint32_t d = 0; d < delta_count; d++) {
+        total += package_db_count(&deltas[d]);
+    }
+    NameRegistry latest;
+    SyncRef* refs = malloc((total + 1) * sizeof(SyncRef));
+    if (!refs || !name_registry_init(&latest, total + 1)) {
+        free(refs);
+        return false;
+    }
+
+    bool ok = true;
+    uint32_t ref_count = 0;
+    for (uint32_t d = 0; ok && d < delta_count; d++) {
+        for (uint32_t i = 0; ok && i < package_db_count(&deltas[d]); i++) {
+            const PackageDbRecord* record = package_db_record(&deltas[d], i);
+            int32_t id = name_registry_intern_hashed(&latest, package_db_string(&deltas[d], record->name),
+                                                     record->name_hash);
+            ok = id >= 0;
+            if (ok && name_registry_value(&latest, id) == NAME_REGISTRY_UNBOUND) {
+                name_registry_bind(&latest, id, (int32_t)ref_count++);
+            }
+            if (ok) {
+                SyncRef* ref = &refs[name_registry_value(&latest, id)];
+                ref->delta = d;
+                ref->record = i;
+                ref->merged = false;
+            }
+        }
+    }
+
+    // Local records last first: replacing or dropping one moves the last
+    // record into its place, and that one has been merged already
+    ok = ok && package_db_builder_init_from(builder, local, ref_count);
+    for (uint32_t i = package_db_count(local); ok && i-- > 0;) {
+        const PackageDbRecord* record = package_db_record(local, i);
+        int32_t id = name_registry_lookup_hashed(&latest, package_db_string(local, record->name), record->name_hash);
+        if (id < 0) {
+            continue;
+        }
+        SyncRef* ref = &refs[name_registry_value(&latest, id)];
+        const PackageDb* delta = &deltas[ref->delta];
+        ref->merged = true;
+        if (!(package_db_record(delta, ref->record)->flags & PACKAGE_DB_RECORD_REMOVED)) {
+            ok = package_db_builder_update(builder, delta, ref->record, local, i);
+            if (ok) {
+                package_db_builder_remove(builder, i);
+            }
+            stats->updated++;
+        } else if (record->state == PACKAGE_STATE_NOT_INSTALLED) {
+            package_db_builder_remove(builder, i);
+            stats->removed++;
+        }
+    }
+
+    // Then the packages new to this client
+    for (uint32_t r = 0; ok && r < ref_count; r++) {
+        const PackageDb* delta = &deltas[refs[r].delta];
+        if (!refs[r].merged && !(package_db_record(delta, refs[r].record)->flags & PACKAGE_DB_RECORD_REMOVED)) {
+            ok = package_db_builder_copy(builder, delta, refs[r].record, PACKAGE_STATE_NOT_INSTALLED);
+            stats->updated++;
+        }
+    }
+
+    name_registry_free(&latest);
+    free(refs);
+    return ok;
+}
+
+bool package_sync_run(const char* repository, const char* db_path, PackageSyncStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    uint64_t begin = monotonic_ns();
+
+    char path[PATH_MAX];
+    PackageDb local, snapshot;
+    index_path(repository, 0, path, sizeof(path));
+    if (!package_db_open(&snapshot, path) || snapshot.origin == SYNC_ORIGIN_ANY) {
+        fprintf(stderr, "package: %s has no index\n", repository);
+        package_db_close(&snapshot);
+        return false;
+    }
+    package_db_open(&local, db_path);   // A missing database syncs from the snapshot
+    stats->from_sequence = local.origin == snapshot.origin ? local.sequence : 0;
+    stats->to_sequence = snapshot.sequence;
+    if (stats->from_sequence == stats->to_sequence) {
+        package_db_close(&local);
+        package_db_close(&snapshot);
+        stats->wall_ns = monotonic_ns() - begin;
+        return true;
+    }
+
+    // Map the deltas since the last sync; any gap means the snapshot
+    PackageDb deltas[PACKAGE_SYNC_MAX_DELTAS];
+    uint32_t delta_count = 0;
+    uint64_t behind = stats->to_sequence - stats->from_sequence;
+    bool use_deltas = stats->from_sequence != 0 && stats->from_sequence < stats->to_sequence &&
+                      behind <= PACKAGE_SYNC_MAX_DELTAS;
+    while (use_deltas && delta_count < behind) {
+        uint64_t sequence = stats->from_sequence + delta_count + 1;
+        index_path(repository, sequence, path, sizeof(path));
+        PackageDb* delta = &deltas[delta_count];
+        use_deltas = package_db_open(delta, path);
+        if (use_deltas && (delta->origin != snapshot.origin || delta->sequence != sequence)) {
+            package_db_close(delta);
+            use_deltas = false;
+        }
+        if (use_deltas) {
+            stats->bytes_read += delta->size;
+            delta_count++;
+        }
+    }
+
+    PackageDbBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    bool ok;
+    if (use_deltas) {
+        stats->deltas = delta_count;
+        ok = merge_deltas(&builder, &local, deltas, delta_count, stats);
+    } else {
+        stats->snapshot = true;
+        stats->bytes_read = snapshot.size;
+        ok = package_db_builder_init(&builder, package_db_count(&local) + package_db_count(&snapshot) + 1) &&
+             merge_snapshot(&builder, &local, &snapshot, stats);
+    }
+    builder.sequence = stats->to_sequence;
+    builder.origin = snapshot.origin;
+    ok = ok && package_db_write(&builder, db_path);
+
+    package_db_builder_free(&builder);
+    for (uint32_t d = 0; d < delta_count; d++) {
+        package_db_close(&deltas[d]);
+    }
+    package_db_close(&local);
+    package_db_close(&snapshot);
+    stats->wall_ns = monotonic_ns() - begin;
+    return ok;
+}
+
+// Remove deltas `keep` or more sequences old; they stop at the first gap
+static void prune_deltas(const char* repository, uint64_t sequence, uint32_t keep) {
+    char path[PATH_MAX];
+    for (uint64_t old = sequence > keep ? sequence - keep : 0; old > 0; old--) {
+        index_path(repository, old, path, sizeof(path));
+        if (unlink(path) < 0) {
+            break;
+        }
+    }
+}
+
+bool package_index_publish(const char* repository, const char* catalog_path, uint32_t keep,
+                           PackageSyncStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    uint64_t begin = monotonic_ns();
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/" PACKAGE_INDEX_DIR, repository);
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+        perror(path);
+        return false;
+    }
+    PackageDb catalog, previous;
+    if (!package_db_open(&catalog, catalog_path)) {
+        fprintf(stderr, "package: cannot open catalog %s\n", catalog_path);
+        return false;
+    }
+
+    // A new index gets a fresh origin, so clients of another one resync
+    index_path(repository, 0, path, sizeof(path));
+    uint64_t origin = SYNC_ORIGIN_ANY;
+    if (package_db_open(&previous, path)) {
+        origin = previous.origin;
+        stats->from_sequence = previous.sequence;
+    }
+    if (origin == SYNC_ORIGIN_ANY) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        origin = name_hash(repository) ^ ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec) ^
+                 ((uint64_t)getpid() << 32);
+        origin += origin == SYNC_ORIGIN_ANY;
+    }
+    stats->to_sequence = stats->from_sequence + 1;
+
+    // The delta: new and changed records, then tombstones
+    PackageDbBuilder delta, snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    bool ok = package_db_builder_init(&delta, 64);
+    for (uint32_t i = 0; ok && i < package_db_count(&catalog); i++) {
+        int32_t known = find_record(&previous, &catalog, i);
+        if (known < 0 || !record_equal(&previous, (uint32_t)known, &catalog, i)) {
+            ok = package_db_builder_copy(&delta, &catalog, i, PACKAGE_STATE_NOT_INSTALLED);
+            stats->updated++;
+        }
+    }
+    for (uint32_t i = 0; ok && i < package_db_count(&previous); i++) {
+        if (find_record(&catalog, &previous, i) < 0) {
+            const PackageDbRecord* record = package_db_record(&previous, i);
+            ok = package_db_builder_add(&delta, package_db_string(&previous, record->name), "", "", "", 0,
+                                        PACKAGE_STATE_NOT_INSTALLED, NULL, 0);
+            if (ok) {
+                delta.records[delta.record_count - 1].flags |= PACKAGE_DB_RECORD_REMOVED;
+            }
+            stats->removed++;
+        }
+    }
+
+    bool changed = stats->updated + stats->removed > 0 || stats->from_sequence == 0;
+    if (ok && changed) {
+        delta.sequence = stats->to_sequence;
+        delta.origin = origin;
+        index_path(repository, stats->to_sequence, path, sizeof(path));
+        ok = package_db_write(&delta, path);
+        stats->deltas = 1;
+
+        // The snapshot is the catalog itself, with no local state
+        ok = ok && package_db_builder_init_from(&snapshot, &catalog, 0);
+        for (uint32_t i = 0; ok && i < snapshot.record_count; i++) {
+            snapshot.records[i].state = PACKAGE_STATE_NOT_INSTALLED;
+        }
+        snapshot.sequence = stats->to_sequence;
+        snapshot.origin = origin;
+        index_path(repository, 0, path, sizeof(path));
+        ok = ok && package_db_write(&snapshot, path);
+        package_db_builder_free(&snapshot);
+        if (ok) {
+            prune_deltas(repository, stats->to_sequence, keep);
+        }
+    } else {
+        stats->to_sequence = stats->from_sequence;
+    }
+
+    package_db_builder_free(&delta);
+    package_db_close(&previous);
+    package_db_close(&catalog);
+    stats->wall_ns = monotonic_ns() - begin;
+    return ok;
+}
+
+void package_sync_report(const PackageSyncStats* stats, char* buffer, size_t size) {
+    snprintf(buffer, size, "sequence %llu -> %llu: %s, %u updated, %u removed, %.1f KB read in %.2f ms\n",
+             (unsigned long long)stats->from_sequence, (unsigned long long)stats->to_sequence,
+             stats->snapshot ? "snapshot" : stats->deltas ? "deltas" : "up to date",
+             stats->updated, stats->removed, stats->bytes_read / 1e3, stats->wall_ns / 1e6);
+}
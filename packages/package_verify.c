@@ -0,0 +1,278 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "package_manager.h"
+#include "../system/libs/sha256.h"
+#include "package_store.h"
+
+// Integrity verification
+//
+// Re-hashes installed files against the chunk digests in their packages'
+// manifests. Every file and symlink of every target becomes one work item.
+// Items are sorted largest first and handed to a pool of workers through
+// an atomic counter, so a few big files do not leave the rest of the pool
+// idle at the end. A worker reads a file in batches of whole chunks and
+// hashes each batch with sha256_many(), which uses the fastest kernel the
+// CPU has (sha256.c). A file whose size already differs from the manifest
+// is reported without being read.
+
+#define VERIFY_MAX_WORKERS 64
+#define VERIFY_BATCH_SIZE (1024 * 1024)     // Holds at least one STORE_CHUNK_MAX chunk
+#define VERIFY_BATCH_CHUNKS (VERIFY_BATCH_SIZE / STORE_CHUNK_MIN)
+
+typedef enum {
+    VERIFY_OK,
+    VERIFY_MISSING,
+    VERIFY_MODIFIED
+} VerifyResult;
+
+typedef struct {
+    uint32_t target;
+    uint32_t file;
+    uint64_t size;
+    uint8_t result;             // VerifyResult
+} VerifyItem;
+
+typedef struct {
+    const PackagePipelineConfig* config;
+    const PackageVerifyTarget* targets;
+    PackageManifest* manifests;
+    VerifyItem* items;
+    size_t item_count;
+    size_t next;                // Next item to claim, atomic
+} Verifier;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int verify_workers(int wanted, size_t items) {
+    long count = wanted;
+    if (count <= 0) {
+        count = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (count > VERIFY_MAX_WORKERS) {
+        count = VERIFY_MAX_WORKERS;
+    }
+    if ((size_t)count > items) {
+        count = (long)items;
+    }
+    return count < 1 ? 1 : (int)count;
+}
+
+static bool read_full(int fd, uint8_t* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t got = read(fd, buffer, size);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        buffer += got;
+        size -= (size_t)got;
+    }
+    return true;
+}
+
+// Hash the file in batches of whole chunks and compare every digest
+static VerifyResult verify_regular(const PackageManifest* manifest, const StoreFile* file,
+                                   const char* path, uint8_t* buffer) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        return errno == ENOENT ? VERIFY_MISSING : VERIFY_MODIFIED;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size != file->size) {
+        close(fd);
+        return VERIFY_MODIFIED;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    const StoreChunkRef* chunks = &manifest->chunks[file->first_chunk];
+    const void* data[VERIFY_BATCH_CHUNKS];
+    size_t sizes[VERIFY_BATCH_CHUNKS];
+    uint8_t digests[VERIFY_BATCH_CHUNKS][SHA256_DIGEST_SIZE];
+    VerifyResult result = VERIFY_OK;
+    for (uint32_t first = 0; result == VERIFY_OK && first < file->chunk_count;) {
+        size_t count = 0, used = 0;
+        while (first + count < file->chunk_count && count < VERIFY_BATCH_CHUNKS &&
+               used + chunks[first + count].size <= VERIFY_BATCH_SIZE) {
+            data[count] = buffer + used;
+            sizes[count] = chunks[first + count].size;
+            used += sizes[count++];
+        }
+        if (count == 0 || !read_full(fd, buffer, used)) {
+            result = VERIFY_MODIFIED;
+            break;
+        }
+        sha256_many(data, sizes, count, digests);
+        for (size_t i = 0; i < count; i++) {
+            if (memcmp(digests[i], chunks[first + i].digest, SHA256_DIGEST_SIZE) != 0) {
+                result = VERIFY_MODIFIED;
+                break;
+            }
+        }
+        first += (uint32_t)count;
+    }
+    close(fd);
+    return result;
+}
+
+static VerifyResult verify_symlink(const StoreFile* file, const char* path) {
+    char target[PATH_MAX];
+    ssize_t length = readlink(path, target, sizeof(target) - 1);
+    if (length < 0) {
+        return errno == ENOENT ? VERIFY_MISSING : VERIFY_MODIFIED;
+    }
+    target[length] = '\0';
+    return strcmp(target, file->target) == 0 ? VERIFY_OK : VERIFY_MODIFIED;
+}
+
+static void* verify_worker(void* arg) {
+    Verifier* verifier = arg;
+    uint8_t* buffer = malloc(VERIFY_BATCH_SIZE);
+    char path[PATH_MAX * 2];
+    for (;;) {
+        size_t index = __atomic_fetch_add(&verifier->next, 1, __ATOMIC_RELAXED);
+        if (index >= verifier->item_count) {
+            break;
+        }
+        VerifyItem* item = &verifier->items[index];
+        const PackageVerifyTarget* target = &verifier->targets[item->target];
+        const PackageManifest* manifest = &verifier->manifests[item->target];
+        const StoreFile* file = &manifest->files[item->file];
+        snprintf(path, sizeof(path), "%s/%s/%s", verifier->config->root, target->install_path, file->path);
+
+        if (file->type == STORE_FILE_SYMLINK) {
+            item->result = verify_symlink(file, path);
+        } else {
+            item->result = buffer ? verify_regular(manifest, file, path, buffer) : VERIFY_MODIFIED;
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+static int item_compare(const void* a, const void* b) {
+    const VerifyItem* left = a;
+    const VerifyItem* right = b;
+    return left->size < right->size ? 1 : left->size > right->size ? -1 : 0;
+}
+
+bool package_verify_run(const PackagePipelineConfig* config, const PackageVerifyTarget* targets,
+                        int count, PackageVerifyStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    uint64_t begin = monotonic_ns();
+    if (count == 0) {
+        return true;
+    }
+
+    Verifier verifier;
+    memset(&verifier, 0, sizeof(verifier));
+    verifier.config = config;
+    verifier.targets = targets;
+    verifier.manifests = calloc((size_t)count, sizeof(PackageManifest));
+    bool* loaded = calloc((size_t)count, sizeof(bool));
+    bool ok = verifier.manifests && loaded;
+
+    // Load every manifest first so the item count is known up front
+    size_t capacity = 0;
+    for (int t = 0; ok && t < count; t++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s" PACKAGE_MANIFEST_SUFFIX, config->manifest_dir, targets[t].name);
+        if (access(path, F_OK) < 0) {
+            stats->skipped++;     // Installed without a repository: no file list
+            continue;
+        }
+        loaded[t] = package_manifest_load(&verifier.manifests[t], path);
+        if (!loaded[t]) {
+            fprintf(stderr, "package: verify: cannot load manifest %s\n", path);
+            ok = false;
+            break;
+        }
+        capacity += verifier.manifests[t].file_count;
+        stats->packages++;
+    }
+
+    verifier.items = ok ? malloc((capacity ? capacity : 1) * sizeof(VerifyItem)) : NULL;
+    ok = ok && verifier.items;
+    for (int t = 0; ok && t < count; t++) {
+        const PackageManifest* manifest = &verifier.manifests[t];
+        for (uint32_t f = 0; loaded[t] && f < manifest->file_count; f++) {
+            if (manifest->files[f].type != STORE_FILE_DIRECTORY) {
+                VerifyItem* item = &verifier.items[verifier.item_count++];
+                item->target = (uint32_t)t;
+                item->file = f;
+                item->size = manifest->files[f].size;
+                item->result = VERIFY_OK;
+            }
+        }
+    }
+
+    if (ok && verifier.item_count > 0) {
+        qsort(verifier.items, verifier.item_count, sizeof(VerifyItem), item_compare);
+        pthread_t workers[VERIFY_MAX_WORKERS];
+        int wanted = verify_workers(config->verify_workers, verifier.item_count);
+        int started = 0;
+        while (started < wanted && pthread_create(&workers[started], NULL, verify_worker, &verifier) == 0) {
+            started++;
+        }
+        if (started == 0) {
+            verify_worker(&verifier);
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        stats->workers = started ? started : 1;
+    }
+
+    for (size_t i = 0; ok && i < verifier.item_count; i++) {
+        const VerifyItem* item = &verifier.items[i];
+        stats->files++;
+        stats->bytes += item->size;
+        if (item->result != VERIFY_OK) {
+            fprintf(stderr, "package: verify: %s: %s %s\n", targets[item->target].name,
+                    verifier.manifests[item->target].files[item->file].path,
+                    item->result == VERIFY_MISSING ? "missing" : "modified");
+            if (item->result == VERIFY_MISSING) {
+                stats->missing++;
+            } else {
+                stats->modified++;
+            }
+        }
+    }
+
+    for (int t = 0; loaded && t < count; t++) {
+        if (loaded[t]) {
+            package_manifest_free(&verifier.manifests[t]);
+        }
+    }
+    free(loaded);
+    free(verifier.manifests);
+    free(verifier.items);
+    stats->wall_ns = monotonic_ns() - begin;
+    return ok && stats->missing == 0 && stats->modified == 0;
+}
+
+void package_verify_report(const PackageVerifyStats* stats, char* buffer, size_t size) {
+    double seconds = stats->wall_ns / 1e9;
+    snprintf(buffer, size,
+             "verified %u packages, %llu files, %.1f MB in %.1f ms (%.0f MB/s, %d workers, %s)\n"
+             "missing %u, modified %u, %u packages without a manifest\n",
+             stats->packages, (unsigned long long)stats->files, stats->bytes / 1e6, stats->wall_ns / 1e6,
+             seconds > 0 ? stats->bytes / 1e6 / seconds : 0.0, stats->workers,
+             sha256_kernel_name(sha256_kernel()), stats->missing, stats->modified, stats->skipped);
+}
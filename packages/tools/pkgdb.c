@@ -0,0 +1,443 @@
+// pkgdb - convert package metadata into the binary package database
+//
+//   pkgdb convert -o <db> <metadata>...   Build a database from metadata files
+//   pkgdb dump <db> [name]                 Print one package or the whole catalog
+//   pkgdb publish <repo> <name> <version> <dir>
+//                                          Chunk a package tree into <repo>/chunks
+//                                          and write its manifest for delta upgrades
+//   pkgdb owner <index> <path>...          Print the package that owns each path
+//   pkgdb verify <db> <manifests> <root> [-j workers] (--all | <name>...)
+//                                          Re-hash installed files against their
+//                                          manifests on all cores
+//   pkgdb index <repo> <db> [keep]         Publish a catalog as the repository
+//                                          index's next sequence
+//   pkgdb sync <repo> <db>                 Update a local database from the index
+//
+// Metadata files use the format from packages/README.md, with any number
+// of packages per file:
+//
+//   package:
+//     name: example
+//     version: 1.0.0
+//     description: Example package
+//     install_path: /usr
+//     size: 4096
+//     state: installed
+//     dependencies:
+//       - lib-core >= 2.0
+//     optional:
+//       - lib-extra
+//     conflicts:
+//       - old-package
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include "../package_db.h"
+#include "../package_store.h"
+#include "../package_files.h"
+
+#define MAX_LINE 1024
+#define MAX_ENTRIES 256
+
+typedef enum {
+    LIST_NONE,
+    LIST_DEPENDENCIES,
+    LIST_OPTIONAL,
+    LIST_CONFLICTS
+} ListKind;
+
+typedef struct {
+    char name[MAX_LINE];
+    char version[MAX_LINE];
+    char description[MAX_LINE];
+    char install_path[MAX_LINE];
+    unsigned long long size;
+    int state;
+    char entry_names[MAX_ENTRIES][128];
+    char entry_constraints[MAX_ENTRIES][64];
+    PackageDbDependencyInput entries[MAX_ENTRIES];
+    int entry_count;
+    bool open;
+} Metadata;
+
+static char* trim(char* text) {
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    char* end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return text;
+}
+
+static bool flush_package(PackageDbBuilder* builder, Metadata* meta, const char* path) {
+    if (!meta->open) {
+        return true;
+    }
+    meta->open = false;
+
+    if (meta->name[0] == '\0') {
+        fprintf(stderr, "pkgdb: %s: package without a name\n", path);
+        return false;
+    }
+    if (!package_db_builder_add(builder, meta->name, meta->version, meta->description,
+                                meta->install_path, meta->size, (uint8_t)meta->state,
+                                meta->entries, (uint32_t)meta->entry_count)) {
+        fprintf(stderr, "pkgdb: %s: cannot add %s\n", path, meta->name);
+        return false;
+    }
+    return true;
+}
+
+// Parse "name [op version]" list items
+static bool add_entry(Metadata* meta, ListKind list, char* item) {
+    if (meta->entry_count >= MAX_ENTRIES) {
+        return false;
+    }
+
+    int i = meta->entry_count++;
+    char* constraint = item + strcspn(item, " \t<>=");
+    snprintf(meta->entry_constraints[i], sizeof(meta->entry_constraints[i]), "%s", trim(constraint));
+    *constraint = '\0';
+    snprintf(meta->entry_names[i], sizeof(meta->entry_names[i]), "%s", item);
+
+    meta->entries[i].name = meta->entry_names[i];
+    meta->entries[i].constraint = meta->entry_constraints[i];
+    meta->entries[i].flags = list == LIST_OPTIONAL ? PACKAGE_DB_DEP_OPTIONAL :
+                             list == LIST_CONFLICTS ? PACKAGE_DB_DEP_CONFLICT : 0;
+    return true;
+}
+
+static bool convert_file(PackageDbBuilder* builder, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    static Metadata meta;
+    ListKind list = LIST_NONE;
+    char line[MAX_LINE];
+    bool ok = true;
+    meta.open = false;
+
+    while (ok && fgets(line, sizeof(line), file)) {
+        char* text = trim(line);
+        if (*text == '\0' || *text == '#') {
+            continue;
+        }
+
+        if (strcmp(text, "package:") == 0) {
+            ok = flush_package(builder, &meta, path);
+            memset(&meta, 0, sizeof(meta));
+            meta.open = true;
+            list = LIST_NONE;
+            continue;
+        }
+        if (!meta.open) {
+            fprintf(stderr, "pkgdb: %s: '%s' outside a package block\n", path, text);
+            ok = false;
+            break;
+        }
+
+        if (text[0] == '-') {
+            if (list == LIST_NONE || !add_entry(&meta, list, trim(text + 1))) {
+                fprintf(stderr, "pkgdb: %s: unexpected list item '%s'\n", path, text);
+                ok = false;
+            }
+            continue;
+        }
+
+        char* colon = strchr(text, ':');
+        if (!colon) {
+            fprintf(stderr, "pkgdb: %s: expected 'key: value', got '%s'\n", path, text);
+            ok = false;
+            break;
+        }
+        *colon = '\0';
+        char* key = trim(text);
+        char* value = trim(colon + 1);
+
+        list = LIST_NONE;
+        if (strcmp(key, "name") == 0) {
+            snprintf(meta.name, sizeof(meta.name), "%s", value);
+        } else if (strcmp(key, "version") == 0) {
+            snprintf(meta.version, sizeof(meta.version), "%s", value);
+        } else if (strcmp(key, "description") == 0) {
+            snprintf(meta.description, sizeof(meta.description), "%s", value);
+        } else if (strcmp(key, "install_path") == 0) {
+            snprintf(meta.install_path, sizeof(meta.install_path), "%s", value);
+        } else if (strcmp(key, "size") == 0) {
+            meta.size = strtoull(value, NULL, 10);
+        } else if (strcmp(key, "state") == 0) {
+            meta.state = strcmp(value, "installed") == 0 ? PACKAGE_DB_STATE_INSTALLED : 0;
+        } else if (strcmp(key, "dependencies") == 0) {
+            list = LIST_DEPENDENCIES;
+        } else if (strcmp(key, "optional") == 0) {
+            list = LIST_OPTIONAL;
+        } else if (strcmp(key, "conflicts") == 0) {
+            list = LIST_CONFLICTS;
+        }
+    }
+
+    ok = ok && flush_package(builder, &meta, path);
+    fclose(file);
+    return ok;
+}
+
+static int convert(int argc, char** argv) {
+    const char* output = NULL;
+    PackageDbBuilder builder;
+
+    if (!package_db_builder_init(&builder, 1024)) {
+        fprintf(stderr, "pkgdb: out of memory\n");
+        return 1;
+    }
+
+    bool ok = true;
+    for (int i = 0; ok && i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            ok = convert_file(&builder, argv[i]);
+        }
+    }
+
+    if (ok && !output) {
+        fprintf(stderr, "pkgdb: no output database given (-o)\n");
+        ok = false;
+    }
+    if (ok && !package_db_write(&builder, output)) {
+        perror(output);
+        ok = false;
+    }
+    if (ok) {
+        printf("%u packages, %u dependencies, %llu bytes of strings\n",
+               builder.record_count, builder.dependency_count,
+               (unsigned long long)builder.strings_size);
+    }
+
+    package_db_builder_free(&builder);
+    return ok ? 0 : 1;
+}
+
+static void dump_record(const PackageDb* db, uint32_t index) {
+    const PackageDbRecord* record = package_db_record(db, index);
+    bool installed = record->state == PACKAGE_DB_STATE_INSTALLED;
+    printf("%s %s%s\n", package_db_string(db, record->name), package_db_string(db, record->version),
+           !installed ? "" : record->flags & PACKAGE_DB_RECORD_AUTOMATIC ? " [installed, automatic]" : " [installed]");
+
+    for (uint32_t i = 0; i < record->dependency_count; i++) {
+        const PackageDbDependency* dep = package_db_dependency(db, record, i);
+        if (!dep) {
+            break;
+        }
+        printf("  %s %s %s\n",
+               dep->flags & PACKAGE_DB_DEP_CONFLICT ? "conflicts" :
+               dep->flags & PACKAGE_DB_DEP_OPTIONAL ? "optional" : "depends",
+               package_db_string(db, dep->name), package_db_string(db, dep->constraint));
+    }
+}
+
+static int dump(int argc, char** argv) {
+    PackageDb db;
+    if (argc < 1 || !package_db_open(&db, argv[0])) {
+        fprintf(stderr, "pkgdb: cannot open database %s\n", argc > 0 ? argv[0] : "");
+        return 1;
+    }
+
+    int status = 0;
+    if (argc > 1) {
+        int32_t index = package_db_find(&db, argv[1]);
+        if (index < 0) {
+            fprintf(stderr, "pkgdb: %s: not found\n", argv[1]);
+            status = 1;
+        } else {
+            dump_record(&db, (uint32_t)index);
+        }
+    } else {
+        for (uint32_t i = 0; i < package_db_count(&db); i++) {
+            dump_record(&db, i);
+        }
+    }
+
+    package_db_close(&db);
+    return status;
+}
+
+static int owner(int argc, char** argv) {
+    PackageFiles files;
+    if (argc < 2 || !package_files_open(&files, argv[0])) {
+        fprintf(stderr, "pkgdb: cannot open file index %s\n", argc > 0 ? argv[0] : "");
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* name = package_files_owner(&files, argv[i]);
+        if (name) {
+            printf("%s: %s\n", argv[i], name);
+        } else {
+            fprintf(stderr, "pkgdb: %s: not owned by any package\n", argv[i]);
+            status = 1;
+        }
+    }
+
+    package_files_close(&files);
+    return status;
+}
+
+static int verify(int argc, char** argv) {
+    PackageDb db;
+    if (argc < 4 || !package_db_open(&db, argv[0])) {
+        fprintf(stderr, "pkgdb: verify needs <db> <manifests> <root> (--all | <name>...)\n");
+        return 2;
+    }
+
+    PackagePipelineConfig config;
+    memset(&config, 0, sizeof(config));
+    config.manifest_dir = argv[1];
+    config.root = argv[2];
+    int first = 3;
+    if (argc > first + 1 && strcmp(argv[first], "-j") == 0) {
+        config.verify_workers = atoi(argv[first + 1]);
+        first += 2;
+    }
+
+    // Every installed package, or the ones named
+    bool all = first < argc && strcmp(argv[first], "--all") == 0;
+    uint32_t capacity = all ? db.header->installed_count : (uint32_t)(argc - first);
+    PackageVerifyTarget* targets = malloc((capacity + 1) * sizeof(PackageVerifyTarget));
+    int count = 0, status = targets ? 0 : 1;
+    for (uint32_t i = 0; targets && i < capacity; i++) {
+        int32_t index = all ? (int32_t)db.installed[i] : package_db_find(&db, argv[first + (int)i]);
+        const PackageDbRecord* record = index >= 0 && (uint32_t)index < package_db_count(&db)
+                                        ? package_db_record(&db, (uint32_t)index) : NULL;
+        if (!record || record->state != PACKAGE_STATE_INSTALLED) {
+            fprintf(stderr, "pkgdb: %s: not installed\n", all ? "?" : argv[first + (int)i]);
+            status = 1;
+            continue;
+        }
+        targets[count].name = package_db_string(&db, record->name);
+        targets[count].install_path = package_db_string(&db, record->install_path);
+        count++;
+    }
+
+    PackageVerifyStats stats;
+    char report[512];
+    if (targets && !package_verify_run(&config, targets, count, &stats)) {
+        status = 1;
+    }
+    if (targets) {
+        package_verify_report(&stats, report, sizeof(report));
+        fputs(report, stdout);
+    }
+
+    free(targets);
+    package_db_close(&db);
+    return status;
+}
+
+static int index_publish(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "pkgdb: index needs <repo> <db> [keep]\n");
+        return 2;
+    }
+    PackageSyncStats stats;
+    char report[256];
+    uint32_t keep = argc == 3 ? (uint32_t)strtoul(argv[2], NULL, 10) : PACKAGE_INDEX_KEEP;
+    if (!package_index_publish(argv[0], argv[1], keep, &stats)) {
+        return 1;
+    }
+    package_sync_report(&stats, report, sizeof(report));
+    fputs(report, stdout);
+    return 0;
+}
+
+static int sync_database(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "pkgdb: sync needs <repo> <db>\n");
+        return 2;
+    }
+    PackageSyncStats stats;
+    char report[256];
+    if (!package_sync_run(argv[0], argv[1], &stats)) {
+        return 1;
+    }
+    package_sync_report(&stats, report, sizeof(report));
+    fputs(report, stdout);
+    return 0;
+}
+
+static int publish(int argc, char** argv) {
+    if (argc != 4) {
+        fprintf(stderr, "pkgdb: publish needs <repo> <name> <version> <dir>\n");
+        return 2;
+    }
+
+    char store[PATH_MAX], path[PATH_MAX];
+    snprintf(store, sizeof(store), "%s/chunks", argv[0]);
+    snprintf(path, sizeof(path), "%s/%s-%s" PACKAGE_MANIFEST_SUFFIX, argv[0], argv[1], argv[2]);
+
+    PackageManifest manifest;
+    PackageStoreWriter* writer = malloc(sizeof(PackageStoreWriter));
+    package_manifest_init(&manifest, argv[1], argv[2]);
+    bool ok = writer != NULL;
+    if (ok) {
+        package_store_writer_init(writer, store, &manifest);
+        ok = package_store_add_tree(writer, argv[3]) && !writer->failed;
+        if (!ok) {
+            fprintf(stderr, "pkgdb: cannot chunk %s\n", argv[3]);
+        }
+    }
+    if (ok && !package_manifest_save(&manifest, path)) {
+        perror(path);
+        ok = false;
+    }
+    if (ok) {
+        printf("%u files, %u chunks, %llu bytes new, %llu bytes already published\n",
+               manifest.file_count, manifest.chunk_count,
+               (unsigned long long)writer->stored_bytes, (unsigned long long)writer->shared_bytes);
+    }
+
+    free(writer);
+    package_manifest_free(&manifest);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 2 && strcmp(argv[1], "convert") == 0) {
+        return convert(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "dump") == 0) {
+        return dump(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "publish") == 0) {
+        return publish(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "owner") == 0) {
+        return owner(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "verify") == 0) {
+        return verify(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "index") == 0) {
+        return index_publish(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && strcmp(argv[1], "sync") == 0) {
+        return sync_database(argc - 2, argv + 2);
+    }
+
+    fprintf(stderr, "usage: pkgdb convert -o <db> <metadata>...\n"
+                    "       pkgdb dump <db> [name]\n"
+                    "       pkgdb publish <repo> <name> <version> <dir>\n"
+                    "       pkgdb owner <index> <path>...\n"
+                    "       pkgdb verify <db> <manifests> <root> [-j workers] (--all | <name>...)\n"
+                    "       pkgdb index <repo> <db> [keep]\n"
+                    "       pkgdb sync <repo> <db>\n");
+    return 2;
+}
@@ -0,0 +1,85 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGN sizeof(void*)
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t used;
+    size_t size;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+void arena_init(Arena* arena) {
+    arena->blocks = NULL;
+    arena->reserved = 0;
+}
+
+void arena_free(Arena* arena) {
+    while (arena->blocks) {
+        ArenaBlock* next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    arena->reserved = 0;
+}
+
+static ArenaBlock* block_new(Arena* arena, size_t size) {
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+    if (block) {
+        block->used = 0;
+        block->size = size;
+        arena->reserved += sizeof(ArenaBlock) + size;
+    }
+    return block;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    ArenaBlock* block = arena->blocks;
+
+    if (size > ARENA_BLOCK_SIZE / 4) {
+        // Large requests get a block of their own behind the current one,
+        // which keeps serving small allocations
+        ArenaBlock* large = block_new(arena, size);
+        if (!large) {
+            return NULL;
+        }
+        large->used = size;
+        if (block) {
+            large->next = block->next;
+            block->next = large;
+        } else {
+            large->next = NULL;
+            arena->blocks = large;
+        }
+        return large->data;
+    }
+
+    if (!block || block->size - block->used < size) {
+        block = block_new(arena, ARENA_BLOCK_SIZE);
+        if (!block) {
+            return NULL;
+        }
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    void* memory = block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+const char* arena_strdup(Arena* arena, const char* text) {
+    if (text[0] == '\0') {
+        return "";
+    }
+    size_t len = strlen(text) + 1;
+    char* copy = arena_alloc(arena, len);
+    if (copy) {
+        memcpy(copy, text, len);
+    }
+    return copy;
+}
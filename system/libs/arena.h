@@ -0,0 +1,28 @@
+#ifndef PROMPTOS_ARENA_H
+#define PROMPTOS_ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Bump allocator for data that lives as long as its owner's table:
+// registry strings, dependency lists and hooks. Allocations never move
+// and are released all at once by arena_free, so entries can point into
+// the arena while the tables that own them grow.
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock* blocks;     // Newest first
+    size_t reserved;        // Bytes obtained from malloc
+} Arena;
+
+void arena_init(Arena* arena);
+void arena_free(Arena* arena);
+
+// Pointer-aligned memory, uninitialized; NULL on allocation failure
+void* arena_alloc(Arena* arena, size_t size);
+
+// Copy of `text`; every empty string shares one static ""
+const char* arena_strdup(Arena* arena, const char* text);
+
+#endif // PROMPTOS_ARENA_H
@@ -0,0 +1,252 @@
+#include "boot_trace.h"
+
+#if BOOT_TRACE_ENABLED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+typedef struct {
+    BootSpanId id;              // Span held by this slot; slots are reused
+    BootSpanId parent;
+    BootSpanId after;
+    uint32_t tid;
+    uint64_t begin_ns;
+    uint64_t end_ns;            // 0 while the span is open
+    const char* category;
+    const char* name;
+} BootSpan;
+
+static BootSpan spans[BOOT_TRACE_SPANS];
+static uint32_t next_span;
+static __thread BootSpanId current_span = BOOT_SPAN_NONE;
+static __thread uint32_t current_tid;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+BootSpanId boot_trace_begin(const char* category, const char* name, BootSpanId after) {
+    BootSpanId id = (BootSpanId)(__atomic_fetch_add(&next_span, 1, __ATOMIC_RELAXED) & INT32_MAX);
+    BootSpan* span = &spans[(uint32_t)id % BOOT_TRACE_SPANS];
+    if (current_tid == 0) {
+        current_tid = (uint32_t)syscall(SYS_gettid);
+    }
+
+    // Invalidate the slot while it is rewritten so exports skip it
+    __atomic_store_n(&span->id, BOOT_SPAN_NONE, __ATOMIC_RELAXED);
+    span->parent = current_span;
+    span->after = after;
+    span->tid = current_tid;
+    span->category = category;
+    span->name = name;
+    span->end_ns = 0;
+    span->begin_ns = monotonic_ns();
+    __atomic_store_n(&span->id, id, __ATOMIC_RELEASE);
+
+    current_span = id;
+    return id;
+}
+
+void boot_trace_end(BootSpanId id) {
+    if (id == BOOT_SPAN_NONE) {
+        return;
+    }
+    BootSpan* span = &spans[(uint32_t)id % BOOT_TRACE_SPANS];
+    if (__atomic_load_n(&span->id, __ATOMIC_ACQUIRE) == id) {
+        span->end_ns = monotonic_ns();
+        if (current_span == id) {
+            current_span = span->parent;
+        }
+    }
+}
+
+// Snapshot of the closed spans, ordered by start time
+typedef struct {
+    BootSpan* spans;
+    int count;
+    uint64_t epoch_ns;
+} Timeline;
+
+static int compare_begin(const void* a, const void* b) {
+    const BootSpan* left = a;
+    const BootSpan* right = b;
+    if (left->begin_ns != right->begin_ns) {
+        return left->begin_ns < right->begin_ns ? -1 : 1;
+    }
+    return left->id < right->id ? -1 : left->id > right->id;
+}
+
+static bool timeline_collect(Timeline* timeline) {
+    timeline->spans = malloc(sizeof(spans));
+    timeline->count = 0;
+    timeline->epoch_ns = 0;
+    if (!timeline->spans) {
+        return false;
+    }
+
+    for (int i = 0; i < BOOT_TRACE_SPANS; i++) {
+        BootSpanId id = __atomic_load_n(&spans[i].id, __ATOMIC_ACQUIRE);
+        BootSpan copy = spans[i];
+        if (id == BOOT_SPAN_NONE || copy.id != id || copy.end_ns == 0 || copy.name == NULL) {
+            continue;
+        }
+        timeline->spans[timeline->count++] = copy;
+    }
+    qsort(timeline->spans, (size_t)timeline->count, sizeof(BootSpan), compare_begin);
+    if (timeline->count > 0) {
+        timeline->epoch_ns = timeline->spans[0].begin_ns;
+    }
+    return true;
+}
+
+static int timeline_find(const Timeline* timeline, BootSpanId id) {
+    for (int i = 0; id != BOOT_SPAN_NONE && i < timeline->count; i++) {
+        if (timeline->spans[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void json_string(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+bool boot_trace_write_json(const char* path) {
+    Timeline timeline;
+    if (!timeline_collect(&timeline)) {
+        return false;
+    }
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        free(timeline.spans);
+        return false;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (int i = 0; i < timeline.count; i++) {
+        const BootSpan* span = &timeline.spans[i];
+        fprintf(out, "%s\n{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"cat\":",
+                i ? "," : "", span->tid, (span->begin_ns - timeline.epoch_ns) / 1e3,
+                (span->end_ns - span->begin_ns) / 1e3);
+        json_string(out, span->category ? span->category : "");
+        fprintf(out, ",\"name\":");
+        json_string(out, span->name);
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n]}\n");
+
+    free(timeline.spans);
+    return fclose(out) == 0;
+}
+
+// Follow a span down to the descendant that finished last: that is what
+// the span was still busy with when it ended
+static int deepest_last(const Timeline* timeline, int index) {
+    for (;;) {
+        int child = -1;
+        for (int i = 0; i < timeline->count; i++) {
+            if (timeline->spans[i].parent == timeline->spans[index].id &&
+                (child < 0 || timeline->spans[i].end_ns > timeline->spans[child].end_ns)) {
+                child = i;
+            }
+        }
+        if (child < 0) {
+            return index;
+        }
+        index = child;
+    }
+}
+
+// What `index` waited for: its declared `after` span, or else the span
+// that finished last before it began
+static int predecessor(const Timeline* timeline, int index) {
+    const BootSpan* span = &timeline->spans[index];
+    int after = timeline_find(timeline, span->after);
+    if (after >= 0 && after != index && timeline->spans[after].end_ns <= span->begin_ns) {
+        return deepest_last(timeline, after);
+    }
+
+    int best = -1;
+    for (int i = 0; i < timeline->count; i++) {
+        if (i != index && timeline->spans[i].end_ns <= span->begin_ns &&
+            (best < 0 || timeline->spans[i].end_ns > timeline->spans[best].end_ns)) {
+            best = i;
+        }
+    }
+    return best < 0 ? -1 : deepest_last(timeline, best);
+}
+
+void boot_trace_critical_path(char* buffer, size_t size) {
+    Timeline timeline;
+    buffer[0] = '\0';
+    if (!timeline_collect(&timeline) || timeline.count == 0) {
+        snprintf(buffer, size, "no boot spans recorded\n");
+        free(timeline.spans);
+        return;
+    }
+
+    // Start from whatever finished last and walk backwards
+    int last = 0;
+    for (int i = 1; i < timeline.count; i++) {
+        if (timeline.spans[i].end_ns > timeline.spans[last].end_ns) {
+            last = i;
+        }
+    }
+
+    int* chain = malloc((size_t)timeline.count * sizeof(int));
+    int length = 0;
+    for (int i = deepest_last(&timeline, last); chain && i >= 0 && length < timeline.count;
+         i = predecessor(&timeline, i)) {
+        chain[length++] = i;
+    }
+
+    uint64_t total = timeline.spans[last].end_ns - timeline.epoch_ns;
+    size_t used = (size_t)snprintf(buffer, size, "critical path: %.3f ms over %d spans\n"
+                                   "     start ms  duration ms      gap ms  span\n",
+                                   total / 1e6, length);
+    uint64_t previous_end = timeline.epoch_ns;
+    for (int i = length - 1; i >= 0 && used < size; i--) {
+        const BootSpan* span = &timeline.spans[chain[i]];
+        uint64_t gap = span->begin_ns > previous_end ? span->begin_ns - previous_end : 0;
+        used += (size_t)snprintf(buffer + used, size - used, "  %11.3f  %11.3f  %10.3f  %s/%s\n",
+                                 (span->begin_ns - timeline.epoch_ns) / 1e6,
+                                 (span->end_ns - span->begin_ns) / 1e6, gap / 1e6,
+                                 span->category ? span->category : "", span->name);
+        previous_end = span->end_ns;
+    }
+
+    free(chain);
+    free(timeline.spans);
+}
+
+bool boot_trace_export(const char* json_path, const char* summary_path) {
+    static char summary[16384];
+    bool ok = boot_trace_write_json(json_path);
+
+    boot_trace_critical_path(summary, sizeof(summary));
+    FILE* out = fopen(summary_path, "w");
+    if (!out) {
+        return false;
+    }
+    fputs(summary, out);
+    return fclose(out) == 0 && ok;
+}
+
+#endif // BOOT_TRACE_ENABLED
@@ -0,0 +1,56 @@
+#ifndef PROMPTOS_BOOT_TRACE_H
+#define PROMPTOS_BOOT_TRACE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "../../kernel/config.h"
+
+// Boot timeline tracing
+//
+// Spans are timed with CLOCK_MONOTONIC and written into a preallocated
+// ring of BOOT_TRACE_SPANS entries; the oldest spans are overwritten
+// when it wraps. Recording is lock-free and never allocates. Span names
+// are stored by pointer and must stay valid until the trace is exported.
+//
+// Tracing is compiled in when DEBUG_LEVEL >= BOOT_TRACE_LEVEL (or when
+// BOOT_TRACE_ENABLED is defined on the command line). Otherwise the
+// macros below expand to nothing and boot_trace.c is empty.
+
+#ifndef BOOT_TRACE_ENABLED
+#define BOOT_TRACE_ENABLED (DEBUG_LEVEL >= BOOT_TRACE_LEVEL)
+#endif
+
+#define BOOT_TRACE_JSON_PATH    "/run/boot-trace.json"          // Chrome trace-event format
+#define BOOT_TRACE_SUMMARY_PATH "/run/boot-critical-path.txt"
+
+// Span handle; BOOT_SPAN_NONE when tracing is off
+typedef int32_t BootSpanId;
+#define BOOT_SPAN_NONE (-1)
+
+#if BOOT_TRACE_ENABLED
+// Open a span nested in the calling thread's current span. `after` names
+// a span this one waited for (BOOT_SPAN_NONE if unknown), which lets the
+// critical path follow real dependencies instead of guessing.
+BootSpanId boot_trace_begin(const char* category, const char* name, BootSpanId after);
+void boot_trace_end(BootSpanId span);
+
+// Write the closed spans as trace-event JSON (chrome://tracing, Perfetto)
+bool boot_trace_write_json(const char* path);
+
+// Describe the chain of spans that determined when the last one finished
+void boot_trace_critical_path(char* buffer, size_t size);
+bool boot_trace_export(const char* json_path, const char* summary_path);
+
+#define BOOT_TRACE_BEGIN(category, name) boot_trace_begin(category, name, BOOT_SPAN_NONE)
+#define BOOT_TRACE_BEGIN_AFTER(category, name, after) boot_trace_begin(category, name, after)
+#define BOOT_TRACE_END(span) boot_trace_end(span)
+#define BOOT_TRACE_EXPORT() boot_trace_export(BOOT_TRACE_JSON_PATH, BOOT_TRACE_SUMMARY_PATH)
+#else
+#define BOOT_TRACE_BEGIN(category, name) (BOOT_SPAN_NONE)
+#define BOOT_TRACE_BEGIN_AFTER(category, name, after) ((void)(after), BOOT_SPAN_NONE)
+#define BOOT_TRACE_END(span) ((void)(span))
+#define BOOT_TRACE_EXPORT() (true)
+#endif
+
+#endif // PROMPTOS_BOOT_TRACE_H
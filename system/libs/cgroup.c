@@ -0,0 +1,222 @@
+#include "cgroup.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+
+// Slices by ServiceType, with their share of CPU and I/O
+static const struct {
+    const char* name;
+    uint32_t weight;
+} slices[] = {
+    [SERVICE_TYPE_SYSTEM] = { "system.slice", 400 },
+    [SERVICE_TYPE_NETWORK] = { "network.slice", 200 },
+    [SERVICE_TYPE_USER] = { "user.slice", 100 }
+};
+#define SLICE_COUNT (int)(sizeof(slices) / sizeof(slices[0]))
+
+static char cgroup_root[CGROUP_MAX_PATH] = CGROUP_ROOT;
+
+static bool write_value(const char* dir, const char* file, const char* value) {
+    char path[CGROUP_MAX_PATH + 64];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t length = (ssize_t)strlen(value);
+    bool ok = write(fd, value, (size_t)length) == length;
+    close(fd);
+    return ok;
+}
+
+static bool write_u64(const char* dir, const char* file, uint64_t value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%llu", (unsigned long long)value);
+    return write_value(dir, file, text);
+}
+
+// Let the children of `dir` use each controller the kernel offers
+static void enable_controllers(const char* dir) {
+    static const char* const controllers[] = { "+cpu", "+io", "+memory" };
+    for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++) {
+        write_value(dir, "cgroup.subtree_control", controllers[i]);
+    }
+}
+
+bool cgroup_setup(const char* root) {
+    char path[CGROUP_MAX_PATH + 64];
+    snprintf(cgroup_root, sizeof(cgroup_root), "%s", root);
+    snprintf(path, sizeof(path), "%s/cgroup.controllers", cgroup_root);
+    if (access(path, F_OK) < 0 && mount("cgroup2", cgroup_root, "cgroup2", 0, NULL) < 0) {
+        return false;
+    }
+    if (access(path, F_OK) < 0) {
+        return false;
+    }
+
+    enable_controllers(cgroup_root);
+    for (int i = 0; i < SLICE_COUNT; i++) {
+        snprintf(path, sizeof(path), "%s/%s", cgroup_root, slices[i].name);
+        if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+            return false;
+        }
+        write_u64(path, "cpu.weight", slices[i].weight);
+        write_u64(path, "io.weight", slices[i].weight);
+        enable_controllers(path);
+    }
+    return true;
+}
+
+void cgroup_limits_for(ServiceType type, int priority, uint64_t memory_max,
+                       uint32_t cpu_max_percent, CgroupLimits* limits) {
+    if ((int)type < 0 || (int)type >= SLICE_COUNT) {
+        type = SERVICE_TYPE_USER;
+    }
+    if (priority < 0) {
+        priority = 0;
+    }
+
+    // Priority 0 gets the slice weight, 10 half of it, 90 a tenth
+    uint32_t weight = (uint32_t)((uint64_t)slices[type].weight * 10 / (10 + (uint64_t)priority));
+    limits->cpu_weight = weight < 1 ? 1 : weight > 10000 ? 10000 : weight;
+    limits->io_weight = limits->cpu_weight;
+
+    limits->memory_high = 0;
+    if (type == SERVICE_TYPE_USER) {
+        struct sysinfo info;
+        if (sysinfo(&info) == 0) {
+            uint64_t ram = (uint64_t)info.totalram * info.mem_unit;
+            limits->memory_high = ram / 100 * CGROUP_USER_MEMORY_HIGH_PERCENT;
+            if (priority >= CGROUP_BACKGROUND_PRIORITY) {
+                limits->memory_high /= 2;
+            }
+        }
+    }
+
+    // Declared limits are hard; reclaim starts a little below them
+    limits->memory_max = memory_max;
+    if (memory_max > 0 && (limits->memory_high == 0 || limits->memory_high > memory_max / 10 * 9)) {
+        limits->memory_high = memory_max / 10 * 9;
+    }
+    limits->cpu_max_percent = cpu_max_percent;
+}
+
+bool cgroup_service_path(ServiceType type, const char* name, char* path, size_t size) {
+    if ((int)type < 0 || (int)type >= SLICE_COUNT) {
+        type = SERVICE_TYPE_USER;
+    }
+    int length = snprintf(path, size, "%s/%s/%s.service", cgroup_root, slices[type].name, name);
+    return length > 0 && (size_t)length < size;
+}
+
+bool cgroup_create(const char* path, const CgroupLimits* limits) {
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+        return false;
+    }
+
+    write_u64(path, "cpu.weight", limits->cpu_weight);
+    write_u64(path, "io.weight", limits->io_weight);
+    if (limits->memory_high > 0) {
+        write_u64(path, "memory.high", limits->memory_high);
+    } else {
+        write_value(path, "memory.high", "max");
+    }
+    if (limits->memory_max > 0) {
+        write_u64(path, "memory.max", limits->memory_max);
+    } else {
+        write_value(path, "memory.max", "max");
+    }
+
+    char cpu_max[48];
+    if (limits->cpu_max_percent > 0) {
+        snprintf(cpu_max, sizeof(cpu_max), "%llu %u",
+                 (unsigned long long)limits->cpu_max_percent * CGROUP_CPU_PERIOD_US / 100,
+                 CGROUP_CPU_PERIOD_US);
+    } else {
+        snprintf(cpu_max, sizeof(cpu_max), "max %u", CGROUP_CPU_PERIOD_US);
+    }
+    write_value(path, "cpu.max", cpu_max);
+    return true;
+}
+
+bool cgroup_attach(const char* path, pid_t pid) {
+    char text[16];
+    snprintf(text, sizeof(text), "%d", (int)pid);
+    return write_value(path, "cgroup.procs", text);
+}
+
+bool cgroup_remove(const char* path) {
+    return rmdir(path) == 0 || errno == ENOENT;
+}
+
+// Parse the "some" or "full" line of a pressure file
+static void parse_stall(const char* text, const char* kind, CgroupStall* stall) {
+    memset(stall, 0, sizeof(*stall));
+    const char* line = strstr(text, kind);
+    unsigned avg10[2], avg60[2], avg300[2];
+    unsigned long long total;
+    if (line && sscanf(line + strlen(kind), " avg10=%u.%u avg60=%u.%u avg300=%u.%u total=%llu",
+                       &avg10[0], &avg10[1], &avg60[0], &avg60[1],
+                       &avg300[0], &avg300[1], &total) == 7) {
+        stall->avg10 = avg10[0] * 100 + avg10[1];
+        stall->avg60 = avg60[0] * 100 + avg60[1];
+        stall->avg300 = avg300[0] * 100 + avg300[1];
+        stall->total_us = total;
+    }
+}
+
+static bool read_stall_file(const char* dir, const char* file, CgroupStall* some, CgroupStall* full) {
+    char path[CGROUP_MAX_PATH + 64], text[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t length = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (length <= 0) {
+        return false;
+    }
+    text[length] = '\0';
+    parse_stall(text, "some", some);
+    if (full) {
+        parse_stall(text, "full", full);
+    }
+    return true;
+}
+
+bool cgroup_read_pressure(const char* path, CgroupPressure* pressure) {
+    memset(pressure, 0, sizeof(*pressure));
+    // PSI may be compiled out or disabled (psi=0); then nothing is readable
+    bool cpu = read_stall_file(path, "cpu.pressure", &pressure->cpu_some, NULL);
+    bool memory = read_stall_file(path, "memory.pressure", &pressure->memory_some,
+                                  &pressure->memory_full);
+    bool io = read_stall_file(path, "io.pressure", &pressure->io_some, &pressure->io_full);
+    return cpu || memory || io;
+}
+
+bool cgroup_path_of_pid(pid_t pid, char* path, size_t size) {
+    char file[64], line[CGROUP_MAX_PATH];
+    snprintf(file, sizeof(file), "/proc/%d/cgroup", (int)pid);
+    FILE* cgroups = fopen(file, "re");
+    if (!cgroups) {
+        return false;
+    }
+
+    // The unified hierarchy is the "0::" line
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), cgroups)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            int length = snprintf(path, size, "%s%s", cgroup_root, line + 3);
+            found = length > 0 && (size_t)length < size;
+        }
+    }
+    fclose(cgroups);
+    return found;
+}
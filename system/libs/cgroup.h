@@ -0,0 +1,77 @@
+#ifndef PROMPTOS_CGROUP_H
+#define PROMPTOS_CGROUP_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../service_manager.h"
+
+// cgroup v2 resource control for services
+//
+// Every service runs in its own group, <root>/<type>.slice/<name>.service.
+// The slices split CPU and I/O between system, network and user services.
+// Within a slice, a service's weights fall as its priority number rises.
+// User services also get a memory.high soft limit. Limits a service
+// declares go to memory.max and cpu.max, which the kernel enforces.
+// Pressure (PSI) is read back per group, so contention can be measured.
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define CGROUP_MAX_PATH 256
+#define CGROUP_USER_MEMORY_HIGH_PERCENT 50      // Of RAM, for user services
+#define CGROUP_BACKGROUND_PRIORITY 50           // At or above: half that again
+#define CGROUP_CPU_PERIOD_US 100000
+
+typedef struct {
+    uint32_t cpu_weight;        // 1-10000; cgroup default 100
+    uint32_t io_weight;         // 1-10000
+    uint64_t memory_high;       // Bytes; reclaimed and throttled above; 0 = none
+    uint64_t memory_max;        // Bytes; OOM-killed above; 0 = none
+    uint32_t cpu_max_percent;   // Of one CPU; 0 = none
+} CgroupLimits;
+
+// One line of a *.pressure file. Averages are hundredths of a percent of
+// wall time that some (or all) tasks were stalled.
+typedef struct {
+    uint32_t avg10;
+    uint32_t avg60;
+    uint32_t avg300;
+    uint64_t total_us;
+} CgroupStall;
+
+typedef struct CgroupPressure {
+    CgroupStall cpu_some;
+    CgroupStall memory_some;
+    CgroupStall memory_full;
+    CgroupStall io_some;
+    CgroupStall io_full;
+} CgroupPressure;
+
+// Mount cgroup2 at `root` if needed, enable the cpu, io and memory
+// controllers and create the slices. False when cgroup v2 is unusable.
+bool cgroup_setup(const char* root);
+
+// Weights and soft limits for a service, plus what it declares
+void cgroup_limits_for(ServiceType type, int priority, uint64_t memory_max,
+                       uint32_t cpu_max_percent, CgroupLimits* limits);
+
+// Path of a service's group under the root given to cgroup_setup()
+bool cgroup_service_path(ServiceType type, const char* name, char* path, size_t size);
+
+// Create the group and write its limits. Controllers that are not
+// available are skipped; only failing to create the group is an error.
+bool cgroup_create(const char* path, const CgroupLimits* limits);
+
+// Move a process into the group; pid 0 is the caller (use it in a child
+// between fork and exec)
+bool cgroup_attach(const char* path, pid_t pid);
+
+// Remove an empty group
+bool cgroup_remove(const char* path);
+
+bool cgroup_read_pressure(const char* path, CgroupPressure* pressure);
+
+// Group of a running process, from /proc/<pid>/cgroup
+bool cgroup_path_of_pid(pid_t pid, char* path, size_t size);
+
+#endif // PROMPTOS_CGROUP_H
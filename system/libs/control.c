@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include "control.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CLIENT_BUFFER_INITIAL (64 * 1024)
+
+static size_t padded(size_t size) {
+    return (size + 3) & ~(size_t)3;
+}
+
+size_t control_encode_request(uint8_t* out, size_t size, uint32_t tag, ControlOp op,
+                              const char* const* names, uint32_t count) {
+    ControlHeader header = { 0, tag, count, (uint8_t)op, CONTROL_OK, 0 };
+    size_t used = sizeof(header);
+    for (uint32_t i = 0; i < count; i++) {
+        size_t length = strlen(names[i]);
+        if (length > CONTROL_MAX_NAME || used + 1 + length > size) {
+            return 0;
+        }
+        out[used++] = (uint8_t)length;
+        memcpy(out + used, names[i], length);
+        used += length;
+    }
+    if (used > size || used - sizeof(header) > CONTROL_MAX_REQUEST) {
+        return 0;
+    }
+    header.length = (uint32_t)(used - sizeof(header));
+    memcpy(out, &header, sizeof(header));
+    return used;
+}
+
+bool control_next_name(const uint8_t* body, size_t length, size_t* offset, char* name) {
+    if (*offset >= length) {
+        return false;
+    }
+    size_t name_length = body[*offset];
+    if (name_length > CONTROL_MAX_NAME || *offset + 1 + name_length > length) {
+        return false;
+    }
+    memcpy(name, body + *offset + 1, name_length);
+    name[name_length] = '\0';
+    *offset += 1 + name_length;
+    return true;
+}
+
+size_t control_put_record(uint8_t* out, const ControlRecord* record, const char* name) {
+    ControlRecord copy = *record;
+    size_t length = strnlen(name, CONTROL_MAX_NAME);
+    copy.name_length = (uint8_t)length;
+    copy.reserved = 0;
+    memcpy(out, &copy, sizeof(copy));
+    memcpy(out + sizeof(copy), name, length);
+    size_t size = padded(sizeof(copy) + length);
+    memset(out + sizeof(copy) + length, 0, size - sizeof(copy) - length);
+    return size;
+}
+
+bool control_next_record(const uint8_t* body, size_t length, size_t* offset, ControlRecord* record,
+                         const char** name) {
+    if (*offset + sizeof(ControlRecord) > length) {
+        return false;
+    }
+    memcpy(record, body + *offset, sizeof(*record));
+    size_t size = padded(sizeof(*record) + record->name_length);
+    if (*offset + size > length) {
+        return false;
+    }
+    *name = (const char*)body + *offset + sizeof(*record);
+    *offset += size;
+    return true;
+}
+
+bool control_client_open(ControlClient* client, const char* path) {
+    memset(client, 0, sizeof(*client));
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+    client->buffer = malloc(CLIENT_BUFFER_INITIAL);
+    client->capacity = CLIENT_BUFFER_INITIAL;
+    client->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (!client->buffer || client->fd < 0 || connect(client->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        int saved = errno;
+        control_client_close(client);
+        errno = saved;
+        return false;
+    }
+    return true;
+}
+
+void control_client_close(ControlClient* client) {
+    if (client->fd >= 0) {
+        close(client->fd);
+    }
+    free(client->buffer);
+    memset(client, 0, sizeof(*client));
+    client->fd = -1;
+}
+
+bool control_send(ControlClient* client, const void* data, size_t size) {
+    const uint8_t* p = data;
+    while (size > 0) {
+        ssize_t written = send(client->fd, p, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        p += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+// Make room for a whole frame of `size` bytes after `start`
+static bool client_reserve(ControlClient* client, size_t size) {
+    if (client->start > 0 && client->start + size > client->capacity) {
+        memmove(client->buffer, client->buffer + client->start, client->end - client->start);
+        client->end -= client->start;
+        client->start = 0;
+    }
+    if (size <= client->capacity) {
+        return true;
+    }
+    uint8_t* buffer = realloc(client->buffer, size);
+    if (!buffer) {
+        return false;
+    }
+    client->buffer = buffer;
+    client->capacity = size;
+    return true;
+}
+
+bool control_receive(ControlClient* client, ControlHeader* header, const uint8_t** body) {
+    size_t wanted = sizeof(*header);
+    for (;;) {
+        size_t available = client->end - client->start;
+        if (available >= sizeof(*header)) {
+            memcpy(header, client->buffer + client->start, sizeof(*header));
+            if (header->length > CONTROL_MAX_REPLY) {
+                errno = EPROTO;
+                return false;
+            }
+            wanted = sizeof(*header) + header->length;
+            if (available >= wanted) {
+                *body = client->buffer + client->start + sizeof(*header);
+                client->start += wanted;
+                if (client->start == client->end) {
+                    client->start = client->end = 0;    // Body stays in place until the next read
+                }
+                return true;
+            }
+        }
+        if (!client_reserve(client, wanted)) {
+            return false;
+        }
+        ssize_t got = recv(client->fd, client->buffer + client->end, client->capacity - client->end, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            if (got == 0) {
+                errno = ECONNRESET;
+            }
+            return false;
+        }
+        client->end += (size_t)got;
+    }
+}
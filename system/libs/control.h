@@ -0,0 +1,104 @@
+#ifndef PROMPTOS_CONTROL_H
+#define PROMPTOS_CONTROL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Init control socket protocol
+//
+// Init serves CONTROL_SOCKET_PATH from its event loop. Every message, in
+// either direction, is a ControlHeader followed by `length` bytes of body,
+// in host byte order since both ends are on the same machine. A request
+// body is `count` service names, each a length byte and the name. A reply
+// carries the request's tag and op, and `count` ControlRecords, each
+// followed by its name and padded to 4 bytes. A status request with no
+// names asks for every service.
+//
+// Clients may send any number of requests without waiting for replies.
+// Init answers them in order, and writes the replies to everything that
+// arrived in one read with a single writev().
+
+#define CONTROL_SOCKET_PATH "/run/initctl.sock"
+#define CONTROL_MAX_NAME 31                     // Longest service name init keeps
+#define CONTROL_MAX_REQUEST (64 * 1024)         // Largest request body
+#define CONTROL_MAX_REPLY (16 * 1024 * 1024)    // Largest reply body a client accepts
+#define CONTROL_RECORD_MAX (sizeof(ControlRecord) + CONTROL_MAX_NAME + 1)
+
+typedef enum {
+    CONTROL_OP_STATUS = 1,
+    CONTROL_OP_START,
+    CONTROL_OP_STOP
+} ControlOp;
+
+// Per record, or for a whole reply when the request could not be read
+typedef enum {
+    CONTROL_OK,
+    CONTROL_UNKNOWN_SERVICE,
+    CONTROL_REFUSED,            // start or stop not possible in this state
+    CONTROL_BAD_REQUEST
+} ControlResult;
+
+// Service states, in the order of init's own
+typedef enum {
+    CONTROL_STATE_STOPPED,
+    CONTROL_STATE_STARTING,
+    CONTROL_STATE_RUNNING,
+    CONTROL_STATE_STOPPING,
+    CONTROL_STATE_FAILED,
+    CONTROL_STATE_LISTENING
+} ControlState;
+
+typedef struct {
+    uint32_t length;            // Body bytes after the header
+    uint32_t tag;               // Chosen by the client, echoed in the reply
+    uint32_t count;             // Names in a request, records in a reply
+    uint8_t op;                 // ControlOp
+    uint8_t result;             // Replies: ControlResult of the whole request
+    uint16_t reserved;
+} ControlHeader;
+
+typedef struct {
+    uint8_t state;              // ControlState
+    uint8_t result;             // ControlResult
+    uint8_t name_length;
+    uint8_t reserved;
+    int32_t pid;                // -1 when not running
+    int32_t exit_status;        // Last wait status
+} ControlRecord;
+
+// Buffered client connection
+typedef struct {
+    int fd;
+    uint8_t* buffer;
+    size_t capacity;
+    size_t start;               // Received bytes not yet returned
+    size_t end;
+} ControlClient;
+
+// Request encoding. Returns the frame size, or 0 if it does not fit in
+// `size` or a name is too long.
+size_t control_encode_request(uint8_t* out, size_t size, uint32_t tag, ControlOp op,
+                              const char* const* names, uint32_t count);
+
+// Name at `*offset` in a request body; false when the body ends or is
+// malformed. `name` holds CONTROL_MAX_NAME + 1 bytes.
+bool control_next_name(const uint8_t* body, size_t length, size_t* offset, char* name);
+
+// Append a record with its name; `out` holds CONTROL_RECORD_MAX bytes.
+// Returns the bytes written.
+size_t control_put_record(uint8_t* out, const ControlRecord* record, const char* name);
+
+// Record at `*offset` in a reply body. `name` points into the body and
+// is not terminated; its length is record->name_length.
+bool control_next_record(const uint8_t* body, size_t length, size_t* offset, ControlRecord* record,
+                         const char** name);
+
+bool control_client_open(ControlClient* client, const char* path);
+void control_client_close(ControlClient* client);
+bool control_send(ControlClient* client, const void* data, size_t size);
+
+// Wait for the next reply. The body stays valid until the next call.
+bool control_receive(ControlClient* client, ControlHeader* header, const uint8_t** body);
+
+#endif // PROMPTOS_CONTROL_H
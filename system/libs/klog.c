@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+#include "klog.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+
+static const char* const level_names[] = {
+    [KLOG_ERROR] = "error",
+    [KLOG_WARN] = "warn",
+    [KLOG_INFO] = "info",
+    [KLOG_DEBUG] = "debug"
+};
+
+static const char* const subsystem_names[KLOG_SUBSYSTEM_COUNT] = {
+    [KLOG_SUBSYSTEM_KERNEL] = "kernel",
+    [KLOG_SUBSYSTEM_INIT] = "init",
+    [KLOG_SUBSYSTEM_SERVICE] = "service",
+    [KLOG_SUBSYSTEM_PACKAGE] = "package"
+};
+
+static const char* const message_formats[KLOG_MSG_COUNT] = {
+    [KLOG_MSG_PAD] = "",
+    [KLOG_MSG_SERVICE_STARTED] = "%s started as pid %u",
+    [KLOG_MSG_SERVICE_EXITED] = "%s exited with status %d",
+    [KLOG_MSG_SERVICE_KILLED] = "%s killed by signal %d",
+    [KLOG_MSG_SERVICE_RESPAWN_LIMIT] = "%s respawning too fast, giving up",
+    [KLOG_MSG_SERVICE_ACTIVATED] = "%s activated on first use",
+    [KLOG_MSG_SERVICE_STOP_TIMEOUT] = "%s did not stop within %u ms, killing",
+    [KLOG_MSG_SHUTDOWN] = "%u services stopped in %u ms, %u killed",
+    [KLOG_MSG_RECORDS_DROPPED] = "%u records dropped, ring full",
+    [KLOG_MSG_STRESS] = "writer %u record %u check %x"
+};
+
+static size_t page_size_for(uint32_t ring_count) {
+    return sizeof(KlogPage) + (size_t)ring_count * sizeof(KlogRing);
+}
+
+static bool map_page(Klog* log, int fd, size_t size) {
+    void* page = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+        return false;
+    }
+    log->page = page;
+    log->size = size;
+    log->next_ring = 0;
+    return true;
+}
+
+bool klog_create(Klog* log, const char* name) {
+    memset(log, 0, sizeof(*log));
+    int cpus = get_nprocs_conf();
+    uint32_t ring_count = cpus < 1 ? 1 : cpus > KLOG_MAX_CPUS ? KLOG_MAX_CPUS : (uint32_t)cpus;
+    size_t size = page_size_for(ring_count);
+
+    // Truncating first zeroes a region left over from an earlier run
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ftruncate(fd, 0) == 0 && ftruncate(fd, (off_t)size) == 0 && map_page(log, fd, size);
+    close(fd);
+    if (!ok) {
+        return false;
+    }
+
+    log->page->version = KLOG_VERSION;
+    log->page->size = (uint32_t)size;
+    log->page->ring_count = ring_count;
+    log->page->ring_size = KLOG_RING_SIZE;
+    __atomic_store_n(&log->page->magic, KLOG_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool klog_open(Klog* log, const char* name) {
+    memset(log, 0, sizeof(*log));
+    int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    struct stat st;
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(KlogPage) &&
+              map_page(log, fd, (size_t)st.st_size);
+    close(fd);
+    if (!ok) {
+        return false;
+    }
+
+    const KlogPage* page = log->page;
+    if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != KLOG_MAGIC ||
+        page->version != KLOG_VERSION || page->ring_size != KLOG_RING_SIZE ||
+        page->ring_count == 0 || page->ring_count > KLOG_MAX_CPUS ||
+        page->size != log->size || page_size_for(page->ring_count) != log->size) {
+        klog_close(log);
+        return false;
+    }
+    return true;
+}
+
+void klog_close(Klog* log) {
+    if (log->page) {
+        munmap(log->page, log->size);
+        log->page = NULL;
+    }
+}
+
+static inline KlogRecord* ring_record(KlogRing* ring, uint64_t position) {
+    return (KlogRecord*)&ring->data[position % KLOG_RING_SIZE];
+}
+
+bool klog_write(Klog* log, KlogLevel level, KlogSubsystem subsystem, KlogMessage message,
+                const char* text, uint32_t arg_count, const uint64_t* args) {
+    KlogPage* page = log->page;
+    if (!page) {
+        return false;
+    }
+    if (level > DEBUG_LEVEL) {
+        return true;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (arg_count > KLOG_MAX_ARGS) {
+        arg_count = KLOG_MAX_ARGS;
+    }
+    size_t text_length = text ? strnlen(text, KLOG_MAX_TEXT) : 0;
+    uint64_t length = (sizeof(KlogRecord) + arg_count * sizeof(uint64_t) + text_length + 7) & ~7ULL;
+
+    int cpu = sched_getcpu();
+    KlogRing* ring = &page->rings[(uint32_t)(cpu < 0 ? 0 : cpu) % page->ring_count];
+
+    // Reserve. A record never wraps: if it does not fit before the end of
+    // the ring, the rest of the lap is reserved with it and skipped.
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint64_t skip;
+    do {
+        uint64_t room = KLOG_RING_SIZE - head % KLOG_RING_SIZE;
+        skip = room < length ? room : 0;
+        if (head + skip + length - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > KLOG_RING_SIZE) {
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&ring->head, &head, head + skip + length, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // A skip too short for a header is implied; the reader makes the same check
+    if (skip >= sizeof(KlogRecord)) {
+        KlogRecord* pad = ring_record(ring, head);
+        pad->length = (uint16_t)skip;
+        pad->message = KLOG_MSG_PAD;
+        __atomic_store_n(&pad->commit, head + 1, __ATOMIC_RELEASE);
+    }
+
+    uint64_t position = head + skip;
+    KlogRecord* record = ring_record(ring, position);
+    record->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    record->length = (uint16_t)length;
+    record->message = (uint16_t)message;
+    record->level = (uint8_t)level;
+    record->subsystem = (uint8_t)subsystem;
+    record->arg_count = (uint8_t)arg_count;
+    record->text_length = (uint8_t)text_length;
+    if (arg_count > 0) {
+        memcpy(record->args, args, arg_count * sizeof(uint64_t));
+    }
+    if (text_length > 0) {
+        memcpy(&record->args[arg_count], text, text_length);
+    }
+    __atomic_store_n(&record->commit, position + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Drain one ring until it is empty, a record is still being written or
+// the budget runs out
+static size_t drain_ring(KlogRing* ring, KlogSink sink, void* context, size_t budget) {
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t drained = 0;
+
+    while (tail < head && drained < budget) {
+        uint64_t room = KLOG_RING_SIZE - tail % KLOG_RING_SIZE;
+        if (room < sizeof(KlogRecord)) {
+            tail += room;
+            continue;
+        }
+        KlogRecord* record = ring_record(ring, tail);
+        if (__atomic_load_n(&record->commit, __ATOMIC_ACQUIRE) != tail + 1) {
+            break;      // Reserved but not yet committed; picked up next batch
+        }
+        uint16_t length = record->length;
+        if (record->message != KLOG_MSG_PAD) {
+            sink(record, context);
+            drained++;
+        }
+        // Cleared so that a later record written over this space is not
+        // mistaken for committed before its producer is done
+        memset(record, 0, length);
+        tail += length;
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return drained;
+}
+
+size_t klog_drain(Klog* log, KlogSink sink, void* context, size_t max_records) {
+    KlogPage* page = log->page;
+    size_t drained = 0;
+    if (!page) {
+        return 0;
+    }
+
+    // Rotate the starting ring so a busy CPU cannot starve the others
+    uint32_t first = log->next_ring;
+    for (uint32_t i = 0; i < page->ring_count && drained < max_records; i++) {
+        uint32_t index = (first + i) % page->ring_count;
+        drained += drain_ring(&page->rings[index], sink, context, max_records - drained);
+    }
+    log->next_ring = (first + 1) % page->ring_count;
+    return drained;
+}
+
+uint64_t klog_dropped(const Klog* log) {
+    uint64_t dropped = 0;
+    for (uint32_t i = 0; log->page && i < log->page->ring_count; i++) {
+        dropped += __atomic_load_n(&log->page->rings[i].dropped, __ATOMIC_RELAXED);
+    }
+    return dropped;
+}
+
+size_t klog_format(const KlogRecord* record, char* buffer, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    const char* level = record->level <= KLOG_DEBUG && level_names[record->level]
+                        ? level_names[record->level] : "?";
+    const char* subsystem = record->subsystem < KLOG_SUBSYSTEM_COUNT
+                            ? subsystem_names[record->subsystem] : "?";
+    const char* format = record->message < KLOG_MSG_COUNT && message_formats[record->message]
+                         ? message_formats[record->message] : "unknown message";
+
+    int written = snprintf(buffer, size, "[%5llu.%06llu] %s %s: ",
+                           (unsigned long long)(record->timestamp_ns / 1000000000ULL),
+                           (unsigned long long)(record->timestamp_ns % 1000000000ULL / 1000),
+                           level, subsystem);
+    size_t used = written < 0 ? 0 : (size_t)written < size ? (size_t)written : size - 1;
+
+    uint32_t arg = 0;
+    for (const char* p = format; *p && used + 1 < size; p++) {
+        if (*p != '%' || !p[1]) {
+            buffer[used++] = *p;
+            continue;
+        }
+        p++;
+        uint64_t value = arg < record->arg_count ? record->args[arg] : 0;
+        int length = 0;
+        switch (*p) {
+        case 's':
+            length = snprintf(buffer + used, size - used, "%.*s",
+                              (int)record->text_length, klog_record_text(record));
+            break;
+        case 'u':
+            length = snprintf(buffer + used, size - used, "%llu", (unsigned long long)value);
+            arg++;
+            break;
+        case 'd':
+            length = snprintf(buffer + used, size - used, "%lld", (long long)value);
+            arg++;
+            break;
+        case 'x':
+            length = snprintf(buffer + used, size - used, "%llx", (unsigned long long)value);
+            arg++;
+            break;
+        default:
+            buffer[used++] = *p;
+            break;
+        }
+        if (length > 0) {
+            used += (size_t)length < size - used ? (size_t)length : size - used - 1;
+        }
+    }
+    buffer[used] = '\0';
+    return used;
+}
@@ -0,0 +1,128 @@
+#ifndef PROMPTOS_KLOG_H
+#define PROMPTOS_KLOG_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "../../kernel/config.h"
+
+// System log ring
+//
+// Producers append binary records (timestamp, level, subsystem, message
+// id, integer arguments and an optional short string) to the ring of the
+// CPU they run on; text is only formatted when the syslog service reads
+// them. The rings live in the shared memory object KLOG_SHM_NAME, which
+// init creates at boot.
+//
+// Each ring is multi-producer, single-consumer and lock-free. A producer
+// reserves space by advancing `head` with a CAS, fills in the record and
+// publishes it by storing `commit` last. The reader consumes committed
+// records in order from `tail`, clears them and advances `tail` once per
+// batch. A full ring never blocks a producer: the record is dropped and
+// counted in `dropped`.
+
+#define KLOG_SHM_NAME "/promptos-klog"
+#define KLOG_MAGIC 0x474f4c4bu              // "KLOG"
+#define KLOG_VERSION 1
+#define KLOG_RING_SIZE KERNEL_LOG_BUFFER_SIZE   // Per CPU, a multiple of 8
+#define KLOG_MAX_CPUS 256
+#define KLOG_MAX_ARGS 6
+#define KLOG_MAX_TEXT 63                    // Longer strings are truncated
+
+// Levels match DEBUG_LEVEL; records above it are not written
+typedef enum {
+    KLOG_ERROR = 1,
+    KLOG_WARN,
+    KLOG_INFO,
+    KLOG_DEBUG
+} KlogLevel;
+
+typedef enum {
+    KLOG_SUBSYSTEM_KERNEL,
+    KLOG_SUBSYSTEM_INIT,
+    KLOG_SUBSYSTEM_SERVICE,
+    KLOG_SUBSYSTEM_PACKAGE,
+    KLOG_SUBSYSTEM_COUNT
+} KlogSubsystem;
+
+// Message ids; their format strings are in klog.c. Formats take %s for
+// the record's string and %u, %d or %x for the next integer argument.
+typedef enum {
+    KLOG_MSG_PAD,                   // Fills the end of the ring; never read
+    KLOG_MSG_SERVICE_STARTED,
+    KLOG_MSG_SERVICE_EXITED,
+    KLOG_MSG_SERVICE_KILLED,
+    KLOG_MSG_SERVICE_RESPAWN_LIMIT,
+    KLOG_MSG_SERVICE_ACTIVATED,
+    KLOG_MSG_SERVICE_STOP_TIMEOUT,
+    KLOG_MSG_SHUTDOWN,
+    KLOG_MSG_RECORDS_DROPPED,
+    KLOG_MSG_STRESS,                // Used by bench/bench_klog.c
+    KLOG_MSG_COUNT
+} KlogMessage;
+
+// Record header, followed by the arguments and then the string. Records
+// are padded to 8 bytes.
+typedef struct {
+    uint64_t commit;            // Ring position + 1, stored last
+    uint64_t timestamp_ns;      // CLOCK_MONOTONIC
+    uint16_t length;            // Whole record, padding included
+    uint16_t message;           // KlogMessage
+    uint8_t level;
+    uint8_t subsystem;
+    uint8_t arg_count;
+    uint8_t text_length;
+    uint64_t args[];
+} KlogRecord;
+
+typedef struct {
+    uint64_t head;              // Bytes reserved by producers
+    uint64_t dropped;           // Records refused because the ring was full
+    uint64_t reserved[6];       // Keep the reader's tail on its own cache line
+    uint64_t tail;              // Bytes consumed by the reader
+    uint64_t reserved2[7];
+    uint8_t data[KLOG_RING_SIZE];
+} KlogRing;
+
+// Layout of the shared object
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;              // Whole mapping
+    uint32_t ring_count;
+    uint32_t ring_size;
+    uint32_t reserved[11];
+    KlogRing rings[];
+} KlogPage;
+
+typedef struct {
+    KlogPage* page;
+    size_t size;
+    uint32_t next_ring;         // Reader: ring the next batch starts with
+} Klog;
+
+// Called by the reader for each record; the record is only valid during
+// the call
+typedef void (*KlogSink)(const KlogRecord* record, void* context);
+
+bool klog_create(Klog* log, const char* name);  // One ring per CPU
+bool klog_open(Klog* log, const char* name);
+void klog_close(Klog* log);
+
+// Returns false when the record was dropped (ring full or no log)
+bool klog_write(Klog* log, KlogLevel level, KlogSubsystem subsystem, KlogMessage message,
+                const char* text, uint32_t arg_count, const uint64_t* args);
+
+// Hand up to `max_records` committed records to `sink`, across all rings.
+// Only one reader may drain a log at a time. Returns the number handed out.
+size_t klog_drain(Klog* log, KlogSink sink, void* context, size_t max_records);
+uint64_t klog_dropped(const Klog* log);
+
+// Format a record as one line without a newline; returns its length
+size_t klog_format(const KlogRecord* record, char* buffer, size_t size);
+
+static inline const char* klog_record_text(const KlogRecord* record) {
+    return (const char*)&record->args[record->arg_count];
+}
+
+#endif // PROMPTOS_KLOG_H
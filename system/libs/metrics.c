@@ -0,0 +1,234 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+
+#define METRICS_READ_SIZE (64 * 1024)
+#define METRICS_READ_RETRIES 100000
+
+// Copy the part of the snapshot that is in use
+static size_t snapshot_size(uint32_t cpu_count) {
+    if (cpu_count > METRICS_MAX_CPUS) {
+        cpu_count = METRICS_MAX_CPUS;
+    }
+    return offsetof(MetricsSnapshot, cpus) + cpu_count * sizeof(MetricsCpu);
+}
+
+bool metrics_reader_open(MetricsReader* reader) {
+    reader->page = NULL;
+    int fd = shm_open(METRICS_SHM_NAME, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    void* page = mmap(NULL, sizeof(MetricsPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        return false;
+    }
+
+    const MetricsPage* mapped = page;
+    if (mapped->magic != METRICS_MAGIC || mapped->version != METRICS_VERSION ||
+        mapped->size != sizeof(MetricsPage)) {
+        munmap(page, sizeof(MetricsPage));
+        return false;
+    }
+    reader->page = mapped;
+    return true;
+}
+
+void metrics_reader_close(MetricsReader* reader) {
+    if (reader->page) {
+        munmap((void*)reader->page, sizeof(MetricsPage));
+        reader->page = NULL;
+    }
+}
+
+// Take a consistent copy of the latest sample. Returns false before the
+// collector has published anything.
+bool metrics_read(const MetricsReader* reader, MetricsSnapshot* snapshot) {
+    const MetricsPage* page = reader->page;
+    for (int attempt = 0; attempt < METRICS_READ_RETRIES; attempt++) {
+        uint32_t begin = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+        if (begin & 1) {
+            continue;   // Writer is mid-update; it holds the page for microseconds
+        }
+
+        uint32_t cpu_count = __atomic_load_n(&page->snapshot.cpu_count, __ATOMIC_RELAXED);
+        memcpy(snapshot, &page->snapshot, snapshot_size(cpu_count));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) == begin) {
+            snapshot->cpu_count = cpu_count <= METRICS_MAX_CPUS ? cpu_count : METRICS_MAX_CPUS;
+            return snapshot->samples > 0;
+        }
+    }
+    return false;   // The writer died mid-update
+}
+
+bool metrics_writer_open(MetricsWriter* writer) {
+    memset(writer, 0, sizeof(*writer));
+    writer->stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    writer->meminfo_fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+    writer->loadavg_fd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+    writer->uptime_fd = open("/proc/uptime", O_RDONLY | O_CLOEXEC);
+
+    int fd = shm_open(METRICS_SHM_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        metrics_writer_close(writer);
+        return false;
+    }
+    void* page = MAP_FAILED;
+    if (ftruncate(fd, sizeof(MetricsPage)) == 0) {
+        page = mmap(NULL, sizeof(MetricsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (page == MAP_FAILED) {
+        metrics_writer_close(writer);
+        return false;
+    }
+
+    writer->page = page;
+    writer->page->magic = METRICS_MAGIC;
+    writer->page->version = METRICS_VERSION;
+    writer->page->size = sizeof(MetricsPage);
+    writer->page->interval_ms = METRICS_INTERVAL_MS;
+    return writer->stat_fd >= 0 && writer->meminfo_fd >= 0 &&
+           writer->loadavg_fd >= 0 && writer->uptime_fd >= 0;
+}
+
+void metrics_writer_close(MetricsWriter* writer) {
+    int* fds[] = { &writer->stat_fd, &writer->meminfo_fd, &writer->loadavg_fd, &writer->uptime_fd };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (*fds[i] >= 0) {
+            close(*fds[i]);
+        }
+        *fds[i] = -1;
+    }
+    if (writer->page) {
+        munmap(writer->page, sizeof(MetricsPage));
+        writer->page = NULL;
+    }
+}
+
+// Read a whole /proc file from the start into `buffer`
+static ssize_t read_proc(int fd, char* buffer, size_t size) {
+    ssize_t total = 0;
+    while ((size_t)total < size - 1) {
+        ssize_t got = pread(fd, buffer + total, size - 1 - (size_t)total, total);
+        if (got <= 0) {
+            break;
+        }
+        total += got;
+    }
+    buffer[total] = '\0';
+    return total;
+}
+
+static uint64_t meminfo_field(const char* text, const char* key) {
+    const char* line = strstr(text, key);
+    return line ? strtoull(line + strlen(key), NULL, 10) : 0;
+}
+
+// Parse "cpu  ..." / "cpuN ..." lines and derive busy time since the
+// previous sample
+static void parse_cpu(const char* line, MetricsCpu* cpu) {
+    MetricsCpu previous = *cpu;
+    uint64_t* fields[] = { &cpu->user, &cpu->nice, &cpu->system, &cpu->idle,
+                           &cpu->iowait, &cpu->irq, &cpu->softirq, &cpu->steal };
+    char* end = (char*)line;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        *fields[i] = strtoull(end, &end, 10);
+    }
+
+    uint64_t idle = (cpu->idle + cpu->iowait) - (previous.idle + previous.iowait);
+    uint64_t all = (cpu->user + cpu->nice + cpu->system + cpu->idle + cpu->iowait +
+                    cpu->irq + cpu->softirq + cpu->steal) -
+                   (previous.user + previous.nice + previous.system + previous.idle +
+                    previous.iowait + previous.irq + previous.softirq + previous.steal);
+    cpu->busy_permille = all > 0 && idle <= all ? (uint32_t)((all - idle) * 1000 / all) : 0;
+}
+
+// Sample /proc into writer->current; the shared page is not touched
+bool metrics_sample(MetricsWriter* writer) {
+    static char buffer[METRICS_READ_SIZE];
+    MetricsSnapshot* s = &writer->current;
+
+    // CPU lines come first in /proc/stat
+    if (read_proc(writer->stat_fd, buffer, sizeof(buffer)) <= 0) {
+        return false;
+    }
+    uint32_t cpu_count = 0;
+    for (char* line = buffer; strncmp(line, "cpu", 3) == 0;) {
+        if (line[3] == ' ') {
+            parse_cpu(line + 3, &s->total);
+        } else if (cpu_count < METRICS_MAX_CPUS) {
+            char* fields;
+            strtoul(line + 3, &fields, 10);
+            parse_cpu(fields, &s->cpus[cpu_count++]);
+        }
+        char* next = strchr(line, '\n');
+        if (!next) {
+            break;
+        }
+        line = next + 1;
+    }
+    s->cpu_count = cpu_count;
+
+    if (read_proc(writer->meminfo_fd, buffer, sizeof(buffer)) <= 0) {
+        return false;
+    }
+    s->mem_total_kb = meminfo_field(buffer, "MemTotal:");
+    s->mem_free_kb = meminfo_field(buffer, "MemFree:");
+    s->mem_available_kb = meminfo_field(buffer, "MemAvailable:");
+    s->buffers_kb = meminfo_field(buffer, "Buffers:");
+    s->cached_kb = meminfo_field(buffer, "\nCached:");
+    s->swap_total_kb = meminfo_field(buffer, "SwapTotal:");
+    s->swap_free_kb = meminfo_field(buffer, "SwapFree:");
+
+    // "0.52 0.58 0.59 2/1024 12345"
+    if (read_proc(writer->loadavg_fd, buffer, sizeof(buffer)) <= 0) {
+        return false;
+    }
+    char* p = buffer;
+    for (int i = 0; i < 3; i++) {
+        s->load_milli[i] = (uint32_t)(strtod(p, &p) * 1000.0 + 0.5);
+    }
+    s->tasks_running = (uint32_t)strtoul(p, &p, 10);
+    s->tasks_total = (uint32_t)strtoul(*p == '/' ? p + 1 : p, NULL, 10);
+
+    if (read_proc(writer->uptime_fd, buffer, sizeof(buffer)) <= 0) {
+        return false;
+    }
+    s->uptime_sec = strtoull(buffer, NULL, 10);
+
+    // The host name can change at runtime
+    struct utsname names;
+    if (uname(&names) == 0) {
+        snprintf(s->sysname, sizeof(s->sysname), "%s", names.sysname);
+        snprintf(s->release, sizeof(s->release), "%s", names.release);
+        snprintf(s->machine, sizeof(s->machine), "%s", names.machine);
+        snprintf(s->hostname, sizeof(s->hostname), "%s", names.nodename);
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    s->sample_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    return true;
+}
+
+// Copy the sampled snapshot into the shared page under the sequence lock
+void metrics_publish(MetricsWriter* writer) {
+    MetricsPage* page = writer->page;
+    writer->current.samples++;
+
+    uint32_t sequence = page->sequence;
+    __atomic_store_n(&page->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&page->snapshot, &writer->current, snapshot_size(writer->current.cpu_count));
+    __atomic_store_n(&page->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,96 @@
+#ifndef PROMPTOS_METRICS_H
+#define PROMPTOS_METRICS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Shared system metrics
+//
+// The metrics collector samples /proc on an interval and publishes the
+// result in a POSIX shared memory page (METRICS_SHM_NAME). The page is
+// guarded by a sequence lock: the writer makes `sequence` odd, updates
+// the snapshot and makes it even again. Readers copy the snapshot and
+// retry if the sequence was odd or changed meanwhile, so reading takes
+// no locks and no system calls once the page is mapped.
+
+#define METRICS_SHM_NAME "/promptos-metrics"
+#define METRICS_MAGIC 0x5254454du           // "METR"
+#define METRICS_VERSION 1
+#define METRICS_INTERVAL_MS 250
+#define METRICS_MAX_CPUS 256
+#define METRICS_NAME_LEN 65                 // Matches struct utsname fields
+
+// Jiffies per state from /proc/stat, plus busy time over the last interval
+typedef struct {
+    uint64_t user;
+    uint64_t nice;
+    uint64_t system;
+    uint64_t idle;
+    uint64_t iowait;
+    uint64_t irq;
+    uint64_t softirq;
+    uint64_t steal;
+    uint32_t busy_permille;     // Non-idle share of the last interval
+    uint32_t reserved;
+} MetricsCpu;
+
+typedef struct {
+    uint64_t sample_ns;         // CLOCK_MONOTONIC time of the sample
+    uint64_t samples;           // Samples published so far
+    uint64_t uptime_sec;
+    uint64_t mem_total_kb;
+    uint64_t mem_free_kb;
+    uint64_t mem_available_kb;
+    uint64_t buffers_kb;
+    uint64_t cached_kb;
+    uint64_t swap_total_kb;
+    uint64_t swap_free_kb;
+    uint32_t load_milli[3];     // 1, 5 and 15 minute load average x1000
+    uint32_t tasks_running;
+    uint32_t tasks_total;
+    uint32_t cpu_count;         // Entries used in `cpus`
+    char sysname[METRICS_NAME_LEN];
+    char release[METRICS_NAME_LEN];
+    char machine[METRICS_NAME_LEN];
+    char hostname[METRICS_NAME_LEN];
+    MetricsCpu total;
+    MetricsCpu cpus[METRICS_MAX_CPUS];
+} MetricsSnapshot;
+
+// Layout of the shared page
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;              // sizeof(MetricsPage)
+    uint32_t interval_ms;
+    uint32_t sequence;          // Odd while the writer is updating
+    uint32_t reserved[11];      // Keep the snapshot off the header's cache line
+    MetricsSnapshot snapshot;
+} MetricsPage;
+
+// Read side
+typedef struct {
+    const MetricsPage* page;
+} MetricsReader;
+
+bool metrics_reader_open(MetricsReader* reader);
+void metrics_reader_close(MetricsReader* reader);
+bool metrics_read(const MetricsReader* reader, MetricsSnapshot* snapshot);
+
+// Write side (the collector)
+typedef struct {
+    MetricsPage* page;
+    int stat_fd;                // /proc files stay open between samples
+    int meminfo_fd;
+    int loadavg_fd;
+    int uptime_fd;
+    MetricsSnapshot current;    // Sampled here, then published in one step
+} MetricsWriter;
+
+bool metrics_writer_open(MetricsWriter* writer);
+void metrics_writer_close(MetricsWriter* writer);
+bool metrics_sample(MetricsWriter* writer);
+void metrics_publish(MetricsWriter* writer);
+
+#endif // PROMPTOS_METRICS_H
@@ -0,0 +1,181 @@
+#include "name_registry.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NAME_POOL_BLOCK_SIZE 16384
+
+struct NamePoolBlock {
+    NamePoolBlock* next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+uint64_t name_hash(const char* name) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint32_t slot_tag(uint64_t hash) {
+    return (uint32_t)(hash >> 32);
+}
+
+// Copy a name into the pool; strings never move once interned
+static const char* pool_store(NameRegistry* registry, const char* name) {
+    size_t len = strlen(name) + 1;
+    NamePoolBlock* block = registry->pool;
+
+    if (!block || block->size - block->used < len) {
+        size_t size = len > NAME_POOL_BLOCK_SIZE ? len : NAME_POOL_BLOCK_SIZE;
+        block = malloc(sizeof(NamePoolBlock) + size);
+        if (!block) {
+            return NULL;
+        }
+        block->next = registry->pool;
+        block->used = 0;
+        block->size = size;
+        registry->pool = block;
+    }
+
+    char* copy = block->data + block->used;
+    memcpy(copy, name, len);
+    block->used += len;
+    return copy;
+}
+
+static bool grow_slots(NameRegistry* registry, uint32_t slot_count) {
+    NameSlot* slots = calloc(slot_count, sizeof(NameSlot));
+    if (!slots) {
+        return false;
+    }
+
+    // Rehash from the stored hashes; names are never rehashed
+    uint32_t mask = slot_count - 1;
+    for (uint32_t id = 0; id < registry->count; id++) {
+        uint32_t slot = (uint32_t)registry->hashes[id] & mask;
+        while (slots[slot].id_plus1 != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot].hash = slot_tag(registry->hashes[id]);
+        slots[slot].id_plus1 = id + 1;
+    }
+
+    free(registry->slots);
+    registry->slots = slots;
+    registry->slot_mask = mask;
+    return true;
+}
+
+static bool grow_entries(NameRegistry* registry, uint32_t capacity) {
+    uint64_t* hashes = realloc(registry->hashes, capacity * sizeof(*hashes));
+    if (!hashes) {
+        return false;
+    }
+    registry->hashes = hashes;
+
+    const char** names = realloc(registry->names, capacity * sizeof(*names));
+    if (!names) {
+        return false;
+    }
+    registry->names = names;
+
+    int32_t* values = realloc(registry->values, capacity * sizeof(*values));
+    if (!values) {
+        return false;
+    }
+    registry->values = values;
+
+    registry->capacity = capacity;
+    return true;
+}
+
+bool name_registry_init(NameRegistry* registry, uint32_t expected) {
+    memset(registry, 0, sizeof(*registry));
+
+    uint32_t slot_count = 16;
+    while (slot_count < expected * 2) {
+        slot_count *= 2;
+    }
+
+    if (!grow_entries(registry, expected > 8 ? expected : 8) ||
+        !grow_slots(registry, slot_count)) {
+        name_registry_free(registry);
+        return false;
+    }
+    return true;
+}
+
+void name_registry_free(NameRegistry* registry) {
+    while (registry->pool) {
+        NamePoolBlock* next = registry->pool->next;
+        free(registry->pool);
+        registry->pool = next;
+    }
+    free(registry->slots);
+    free(registry->hashes);
+    free(registry->names);
+    free(registry->values);
+    memset(registry, 0, sizeof(*registry));
+}
+
+int32_t name_registry_lookup_hashed(const NameRegistry* registry, const char* name, uint64_t hash) {
+    uint32_t tag = slot_tag(hash);
+    uint32_t slot = (uint32_t)hash & registry->slot_mask;
+
+    while (registry->slots[slot].id_plus1 != 0) {
+        const NameSlot* entry = &registry->slots[slot];
+        if (entry->hash == tag && strcmp(registry->names[entry->id_plus1 - 1], name) == 0) {
+            return (int32_t)entry->id_plus1 - 1;
+        }
+        slot = (slot + 1) & registry->slot_mask;
+    }
+    return -1;
+}
+
+int32_t name_registry_lookup(const NameRegistry* registry, const char* name) {
+    return name_registry_lookup_hashed(registry, name, name_hash(name));
+}
+
+int32_t name_registry_intern_hashed(NameRegistry* registry, const char* name, uint64_t hash) {
+    int32_t id = name_registry_lookup_hashed(registry, name, hash);
+    if (id >= 0) {
+        return id;
+    }
+
+    // Keep the load factor at or below one half
+    if ((registry->count + 1) * 2 > registry->slot_mask + 1 &&
+        !grow_slots(registry, (registry->slot_mask + 1) * 2)) {
+        return -1;
+    }
+    if (registry->count == registry->capacity &&
+        !grow_entries(registry, registry->capacity * 2)) {
+        return -1;
+    }
+
+    const char* copy = pool_store(registry, name);
+    if (!copy) {
+        return -1;
+    }
+
+    id = (int32_t)registry->count++;
+    registry->hashes[id] = hash;
+    registry->names[id] = copy;
+    registry->values[id] = NAME_REGISTRY_UNBOUND;
+
+    uint32_t slot = (uint32_t)hash & registry->slot_mask;
+    while (registry->slots[slot].id_plus1 != 0) {
+        slot = (slot + 1) & registry->slot_mask;
+    }
+    registry->slots[slot].hash = slot_tag(hash);
+    registry->slots[slot].id_plus1 = (uint32_t)id + 1;
+
+    return id;
+}
+
+int32_t name_registry_intern(NameRegistry* registry, const char* name) {
+    return name_registry_intern_hashed(registry, name, name_hash(name));
+}
@@ -0,0 +1,66 @@
+#ifndef PROMPTOS_NAME_REGISTRY_H
+#define PROMPTOS_NAME_REGISTRY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Interned-name registry shared by init, the service manager and the
+// package manager. Every distinct name gets a dense id on first sight, and
+// each id carries one int32 value (usually the owner's table index, -1
+// until bound). Callers store ids instead of name strings, so resolving a
+// dependency is an array load instead of a table scan.
+
+#define NAME_REGISTRY_UNBOUND (-1)
+
+typedef struct {
+    uint32_t hash;      // Upper 32 bits of the name hash, checked before strcmp
+    uint32_t id_plus1;  // 0 marks an empty slot
+} NameSlot;
+
+typedef struct NamePoolBlock NamePoolBlock;
+
+typedef struct {
+    NameSlot* slots;        // Open-addressed, linear probing
+    uint32_t slot_mask;
+    uint32_t count;
+    uint32_t capacity;      // Allocated entries in the per-id arrays
+    uint64_t* hashes;       // Precomputed hash per id, reused when growing
+    const char** names;     // Interned strings, stable for the registry's life
+    int32_t* values;
+    NamePoolBlock* pool;    // String storage, grows in blocks
+} NameRegistry;
+
+// Hash a name (FNV-1a, 64-bit)
+uint64_t name_hash(const char* name);
+
+bool name_registry_init(NameRegistry* registry, uint32_t expected);
+void name_registry_free(NameRegistry* registry);
+
+// Return the id for a name, adding it if new; -1 on allocation failure
+int32_t name_registry_intern(NameRegistry* registry, const char* name);
+int32_t name_registry_intern_hashed(NameRegistry* registry, const char* name, uint64_t hash);
+
+// Return the id for a name, or -1 if it was never interned
+int32_t name_registry_lookup(const NameRegistry* registry, const char* name);
+int32_t name_registry_lookup_hashed(const NameRegistry* registry, const char* name, uint64_t hash);
+
+static inline const char* name_registry_name(const NameRegistry* registry, int32_t id) {
+    return registry->names[id];
+}
+
+static inline int32_t name_registry_value(const NameRegistry* registry, int32_t id) {
+    return registry->values[id];
+}
+
+static inline void name_registry_bind(NameRegistry* registry, int32_t id, int32_t value) {
+    registry->values[id] = value;
+}
+
+// Look up a name and return its bound value, or NAME_REGISTRY_UNBOUND
+static inline int32_t name_registry_find(const NameRegistry* registry, const char* name) {
+    int32_t id = name_registry_lookup(registry, name);
+    return id < 0 ? NAME_REGISTRY_UNBOUND : registry->values[id];
+}
+
+#endif // PROMPTOS_NAME_REGISTRY_H
@@ -0,0 +1,513 @@
+#define _GNU_SOURCE
+#include "readahead.h"
+#include "name_registry.h"
+#include "boot_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/fanotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+#define RECORD_POLL_MS 100
+#define RECORD_EVENT_BUFFER 8192
+
+// Recorder state; the registry is only touched by the recorder thread
+// until readahead_record_stop has joined it
+static pthread_t record_thread;
+static int record_fd = -1;
+static bool record_running = false;
+static NameRegistry record_paths;
+static char record_pack_path[4096];    // Where readahead_record_finish writes
+
+bool readahead_record_requested(void) {
+    char cmdline[4096];
+    int fd = open("/proc/cmdline", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t len = read(fd, cmdline, sizeof(cmdline) - 1);
+    close(fd);
+    if (len <= 0) {
+        return false;
+    }
+    cmdline[len] = '\0';
+
+    size_t token = strlen(READAHEAD_CMDLINE_RECORD);
+    for (const char* p = strstr(cmdline, READAHEAD_CMDLINE_RECORD); p;
+         p = strstr(p + 1, READAHEAD_CMDLINE_RECORD)) {
+        bool starts = p == cmdline || p[-1] == ' ';
+        bool ends = p[token] == '\0' || p[token] == ' ' || p[token] == '\n';
+        if (starts && ends) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// ---- Replay ----
+
+typedef struct {
+    char* data;
+    size_t size;
+    const ReadaheadHeader* header;
+    const ReadaheadFile* files;
+    const ReadaheadRange* ranges;
+    const char* strings;
+} Pack;
+
+static bool pack_load(Pack* pack, const char* path) {
+    memset(pack, 0, sizeof(*pack));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ReadaheadHeader) ||
+        !(pack->data = malloc((size_t)st.st_size))) {
+        close(fd);
+        return false;
+    }
+    pack->size = (size_t)st.st_size;
+    size_t done = 0;
+    while (done < pack->size) {
+        ssize_t got = read(fd, pack->data + done, pack->size - done);
+        if (got <= 0) {
+            break;
+        }
+        done += (size_t)got;
+    }
+    close(fd);
+
+    const ReadaheadHeader* header = (const ReadaheadHeader*)pack->data;
+    size_t files_size = (size_t)header->file_count * sizeof(ReadaheadFile);
+    size_t ranges_size = (size_t)header->range_count * sizeof(ReadaheadRange);
+    if (done != pack->size || header->magic != READAHEAD_MAGIC || header->version != READAHEAD_VERSION ||
+        header->page_size == 0 ||
+        sizeof(*header) + files_size + ranges_size + header->strings_size != pack->size ||
+        (header->strings_size > 0 && pack->data[pack->size - 1] != '\0')) {
+        free(pack->data);
+        pack->data = NULL;
+        return false;
+    }
+    pack->header = header;
+    pack->files = (const ReadaheadFile*)(pack->data + sizeof(*header));
+    pack->ranges = (const ReadaheadRange*)((const char*)pack->files + files_size);
+    pack->strings = (const char*)pack->ranges + ranges_size;
+    return true;
+}
+
+static void* replay_loop(void* arg) {
+    Pack* pack = arg;
+    const ReadaheadHeader* header = pack->header;
+    BootSpanId span = BOOT_TRACE_BEGIN("readahead", "replay");
+
+    // Files are in disk order and ranges ascend within each file, so the
+    // requests sweep across the disk once
+    for (uint32_t f = 0; f < header->file_count; f++) {
+        const ReadaheadFile* file = &pack->files[f];
+        if (file->path >= header->strings_size ||
+            file->first_range > header->range_count ||
+            file->range_count > header->range_count - file->first_range) {
+            continue;
+        }
+        int fd = open(pack->strings + file->path, O_RDONLY | O_CLOEXEC | O_NOATIME);
+        if (fd < 0 && errno == EPERM) {
+            fd = open(pack->strings + file->path, O_RDONLY | O_CLOEXEC);
+        }
+        if (fd < 0) {
+            continue;   // Removed or replaced since the recording
+        }
+        for (uint32_t r = 0; r < file->range_count; r++) {
+            const ReadaheadRange* range = &pack->ranges[file->first_range + r];
+            readahead(fd, (off64_t)range->page * header->page_size,
+                      (size_t)range->pages * header->page_size);
+        }
+        close(fd);
+    }
+
+    BOOT_TRACE_END(span);
+    free(pack->data);
+    free(pack);
+    return NULL;
+}
+
+bool readahead_replay_start(const char* pack_path) {
+    Pack* pack = malloc(sizeof(Pack));
+    if (!pack || !pack_load(pack, pack_path)) {
+        free(pack);
+        return false;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, replay_loop, pack) != 0) {
+        free(pack->data);
+        free(pack);
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+// ---- Record ----
+
+static void record_path(const char* path) {
+    if (path[0] == '/' && record_paths.count < READAHEAD_MAX_FILES) {
+        name_registry_intern(&record_paths, path);
+    }
+}
+
+// Resolve the fds fanotify hands us to paths
+static void record_drain(void) {
+    char buffer[RECORD_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+    char link[64], path[4096];
+    pid_t self = getpid();
+
+    for (;;) {
+        ssize_t len = read(record_fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            return;
+        }
+        struct fanotify_event_metadata* event = (struct fanotify_event_metadata*)buffer;
+        for (; FAN_EVENT_OK(event, len); event = FAN_EVENT_NEXT(event, len)) {
+            if (event->fd < 0) {
+                continue;   // Queue overflow; the mapped-file sweep fills gaps
+            }
+            if (event->pid != self) {
+                snprintf(link, sizeof(link), "/proc/self/fd/%d", event->fd);
+                ssize_t n = readlink(link, path, sizeof(path) - 1);
+                if (n > 0) {
+                    path[n] = '\0';
+                    record_path(path);
+                }
+            }
+            close(event->fd);
+        }
+    }
+}
+
+static void* record_loop(void* arg) {
+    (void)arg;
+    struct pollfd poll_fd = { .fd = record_fd, .events = POLLIN };
+    while (__atomic_load_n(&record_running, __ATOMIC_ACQUIRE)) {
+        if (poll(&poll_fd, 1, RECORD_POLL_MS) > 0) {
+            record_drain();
+        }
+    }
+    record_drain();
+    return NULL;
+}
+
+bool readahead_record_start(void) {
+    if (!name_registry_init(&record_paths, 1024)) {
+        return false;
+    }
+
+    // Watch every open on the root filesystem. Without fanotify (no
+    // CAP_SYS_ADMIN or an old kernel) only the mapped-file sweep at the
+    // end is used.
+    record_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK,
+                              O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (record_fd >= 0 &&
+        fanotify_mark(record_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FAN_OPEN, AT_FDCWD, "/") < 0 &&
+        fanotify_mark(record_fd, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_OPEN, AT_FDCWD, "/") < 0) {
+        close(record_fd);
+        record_fd = -1;
+    }
+
+    record_running = true;
+    if (record_fd >= 0 && pthread_create(&record_thread, NULL, record_loop, NULL) != 0) {
+        close(record_fd);
+        record_fd = -1;
+    }
+    return true;
+}
+
+// Add every file currently mapped by a process: binaries and libraries
+static void record_mapped_files(void) {
+    DIR* proc = opendir("/proc");
+    struct dirent* entry;
+    char maps_path[64], line[4352];
+    if (!proc) {
+        return;
+    }
+
+    while ((entry = readdir(proc)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+            continue;
+        }
+        snprintf(maps_path, sizeof(maps_path), "/proc/%s/maps", entry->d_name);
+        FILE* maps = fopen(maps_path, "re");
+        if (!maps) {
+            continue;
+        }
+        while (fgets(line, sizeof(line), maps)) {
+            char* path = strchr(line, '/');
+            if (!path) {
+                continue;
+            }
+            path[strcspn(path, "\n")] = '\0';
+            if (!strstr(path, " (deleted)")) {
+                record_path(path);
+            }
+        }
+        fclose(maps);
+    }
+    closedir(proc);
+}
+
+// Physical position of a file's first extent, or its inode number when
+// the filesystem cannot tell (inodes roughly follow allocation order)
+static uint64_t disk_order(int fd, const struct stat* st) {
+    struct {
+        struct fiemap map;
+        struct fiemap_extent extent;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.map.fm_length = FIEMAP_MAX_OFFSET;
+    request.map.fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, &request) == 0 && request.map.fm_mapped_extents > 0) {
+        return request.extent.fe_physical;
+    }
+    return (uint64_t)st->st_ino;
+}
+
+typedef struct {
+    ReadaheadFile* files;
+    ReadaheadRange* ranges;
+    char* strings;
+    uint32_t file_count;
+    uint32_t range_count;
+    uint32_t range_capacity;
+    uint32_t strings_size;
+    uint32_t strings_capacity;
+} PackBuilder;
+
+static bool builder_add_range(PackBuilder* builder, uint32_t page, uint32_t pages) {
+    if (builder->range_count == builder->range_capacity) {
+        uint32_t capacity = builder->range_capacity ? builder->range_capacity * 2 : 1024;
+        ReadaheadRange* ranges = realloc(builder->ranges, capacity * sizeof(*ranges));
+        if (!ranges) {
+            return false;
+        }
+        builder->ranges = ranges;
+        builder->range_capacity = capacity;
+    }
+    builder->ranges[builder->range_count++] = (ReadaheadRange){ page, pages };
+    return true;
+}
+
+static bool builder_add_string(PackBuilder* builder, const char* text, uint32_t* offset) {
+    uint32_t size = (uint32_t)strlen(text) + 1;
+    if (builder->strings_size + size > builder->strings_capacity) {
+        uint32_t capacity = builder->strings_capacity ? builder->strings_capacity : 16384;
+        while (builder->strings_size + size > capacity) {
+            capacity *= 2;
+        }
+        char* strings = realloc(builder->strings, capacity);
+        if (!strings) {
+            return false;
+        }
+        builder->strings = strings;
+        builder->strings_capacity = capacity;
+    }
+    memcpy(builder->strings + builder->strings_size, text, size);
+    *offset = builder->strings_size;
+    builder->strings_size += size;
+    return true;
+}
+
+// Record the resident runs of one file, merging runs separated by small
+// gaps: one longer read costs less than two seeks
+static bool builder_add_file(PackBuilder* builder, const char* path, size_t page_size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0) {
+        return true;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    size_t pages = ((size_t)st.st_size + page_size - 1) / page_size;
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    unsigned char* resident = malloc(pages);
+    bool ok = true;
+    if (map != MAP_FAILED && resident && mincore(map, (size_t)st.st_size, resident) == 0) {
+        ReadaheadFile* file = &builder->files[builder->file_count];
+        file->first_range = builder->range_count;
+        file->range_count = 0;
+
+        size_t page = 0;
+        while (ok && page < pages) {
+            if (!(resident[page] & 1)) {
+                page++;
+                continue;
+            }
+            size_t start = page, end = page + 1, gap = 0;
+            for (page++; page < pages && gap <= READAHEAD_GAP_PAGES; page++) {
+                if (resident[page] & 1) {
+                    end = page + 1;
+                    gap = 0;
+                } else {
+                    gap++;
+                }
+            }
+            page = end;
+            ok = builder_add_range(builder, (uint32_t)start, (uint32_t)(end - start));
+            file->range_count++;
+        }
+
+        if (ok && file->range_count > 0) {
+            file->disk_order = disk_order(fd, &st);
+            ok = builder_add_string(builder, path, &file->path);
+            builder->file_count += ok;
+        } else {
+            builder->range_count = file->first_range;
+        }
+    }
+    if (map != MAP_FAILED) {
+        munmap(map, (size_t)st.st_size);
+    }
+    free(resident);
+    close(fd);
+    return ok;
+}
+
+static const char* sort_strings;
+
+static int compare_disk_order(const void* a, const void* b) {
+    const ReadaheadFile* left = a;
+    const ReadaheadFile* right = b;
+    if (left->disk_order != right->disk_order) {
+        return left->disk_order < right->disk_order ? -1 : 1;
+    }
+    return strcmp(sort_strings + left->path, sort_strings + right->path);
+}
+
+static bool make_parent_dir(const char* path) {
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char* slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+            return false;
+        }
+        *slash = '/';
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+    const char* p = data;
+    while (size > 0) {
+        ssize_t written = write(fd, p, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        p += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+// Write the pack under a temporary name and rename it into place
+static bool pack_write(const PackBuilder* builder, const char* path, uint32_t page_size) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!make_parent_dir(path)) {
+        return false;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    ReadaheadHeader header = {
+        READAHEAD_MAGIC, READAHEAD_VERSION, page_size,
+        builder->file_count, builder->range_count, builder->strings_size
+    };
+    bool ok = write_all(fd, &header, sizeof(header)) &&
+              write_all(fd, builder->files, builder->file_count * sizeof(ReadaheadFile)) &&
+              write_all(fd, builder->ranges, builder->range_count * sizeof(ReadaheadRange)) &&
+              write_all(fd, builder->strings, builder->strings_size) &&
+              fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+bool readahead_record_stop(const char* pack_path) {
+    if (!__atomic_load_n(&record_running, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    __atomic_store_n(&record_running, false, __ATOMIC_RELEASE);
+    if (record_fd >= 0) {
+        pthread_join(record_thread, NULL);
+        close(record_fd);
+        record_fd = -1;
+    }
+
+    // fanotify misses files opened before recording began (init itself,
+    // early mounts); whatever is mapped now covers those
+    record_mapped_files();
+
+    PackBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    builder.files = calloc(record_paths.count > 0 ? record_paths.count : 1, sizeof(ReadaheadFile));
+    bool ok = builder.files != NULL;
+    for (uint32_t id = 0; ok && id < record_paths.count; id++) {
+        ok = builder_add_file(&builder, name_registry_name(&record_paths, (int32_t)id), page_size);
+    }
+
+    // Replay walks the files in the order the disk stores them
+    if (ok) {
+        sort_strings = builder.strings;
+        qsort(builder.files, builder.file_count, sizeof(ReadaheadFile), compare_disk_order);
+        ok = pack_write(&builder, pack_path, (uint32_t)page_size);
+    }
+
+    free(builder.files);
+    free(builder.ranges);
+    free(builder.strings);
+    name_registry_free(&record_paths);
+    return ok;
+}
+
+static void* record_finish_loop(void* arg) {
+    (void)arg;
+    if (!readahead_record_stop(record_pack_path)) {
+        fprintf(stderr, "readahead: cannot save pack %s\n", record_pack_path);
+    }
+    return NULL;
+}
+
+bool readahead_record_finish(const char* pack_path) {
+    static bool finishing = false;
+    pthread_t thread;
+    if (!__atomic_load_n(&record_running, __ATOMIC_ACQUIRE) ||
+        __atomic_exchange_n(&finishing, true, __ATOMIC_ACQ_REL) ||
+        snprintf(record_pack_path, sizeof(record_pack_path), "%s", pack_path) >= (int)sizeof(record_pack_path) ||
+        pthread_create(&thread, NULL, record_finish_loop, NULL) != 0) {
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
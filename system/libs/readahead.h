@@ -0,0 +1,65 @@
+#ifndef PROMPTOS_READAHEAD_H
+#define PROMPTOS_READAHEAD_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Boot readahead
+//
+// Record mode watches which files are opened during boot (fanotify, or
+// the files mapped by running processes when fanotify is unavailable).
+// When boot is done it asks mincore() which of their pages were read and
+// writes those ranges into a pack file, sorted by the files' physical
+// location on disk. Replay mode reads the pack on a background thread and
+// issues readahead() for every range in that order, so the page cache
+// fills with a few long sequential sweeps instead of the random faults of
+// services starting up.
+
+#define READAHEAD_PACK_PATH "/var/lib/readahead/boot.pack"
+#define READAHEAD_CMDLINE_RECORD "readahead=record"    // Force a new recording
+#define READAHEAD_MAGIC 0x4b504152u                     // "RAPK"
+#define READAHEAD_VERSION 1
+#define READAHEAD_GAP_PAGES 16          // Merge resident runs this close together
+#define READAHEAD_MAX_FILES 8192
+
+// Pack layout: header, files (in replay order), ranges, path strings
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t file_count;
+    uint32_t range_count;
+    uint32_t strings_size;
+} ReadaheadHeader;
+
+typedef struct {
+    uint64_t disk_order;        // Physical offset of the first extent
+    uint32_t path;              // Offset into the string table
+    uint32_t first_range;
+    uint32_t range_count;
+    uint32_t reserved;
+} ReadaheadFile;
+
+typedef struct {
+    uint32_t page;              // In units of the header's page_size
+    uint32_t pages;
+} ReadaheadRange;
+
+// True when the kernel command line asks for a new recording
+bool readahead_record_requested(void);
+
+// Start replaying `pack_path` in the background; false if there is none
+bool readahead_replay_start(const char* pack_path);
+
+// Record file accesses from now until readahead_record_stop, which
+// writes the pack
+bool readahead_record_start(void);
+bool readahead_record_stop(const char* pack_path);
+
+// readahead_record_stop on a background thread, for callers that cannot
+// wait for every recorded file to be probed and the pack synced. Failures
+// are reported on stderr. False if recording is off or no thread starts.
+bool readahead_record_finish(const char* pack_path);
+
+#endif // PROMPTOS_READAHEAD_H
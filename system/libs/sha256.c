@@ -0,0 +1,445 @@
+#include "sha256.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA256_X86 1
+#endif
+
+#define SHA256_READ_SIZE (256 * 1024)
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA256_LANES 8
+
+static const uint32_t initial_state[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static void sha256_blocks_scalar(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    while (blocks--) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 |
+                   (uint32_t)data[i * 4 + 2] << 8 | (uint32_t)data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        data += SHA256_BLOCK_SIZE;
+    }
+}
+
+#ifdef SHA256_X86
+// Two rounds per sha256rnds2; the state is kept as ABEF and CDGH
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i cdab = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xb1);
+    __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1b);
+    __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+    __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xf0);
+
+    while (blocks--) {
+        __m128i abef_saved = abef, cdgh_saved = cdgh;
+        __m128i w[4];
+        for (int i = 0; i < 4; i++) {
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + i * 16)), byte_swap);
+        }
+
+        // Group r covers rounds 4r..4r+3; w[r & 3] then becomes group r + 4
+        for (int r = 0; r < 16; r++) {
+            __m128i wk = _mm_add_epi32(w[r & 3], _mm_loadu_si128((const __m128i*)&K[r * 4]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e));
+            if (r < 12) {
+                __m128i next = _mm_sha256msg1_epu32(w[r & 3], w[(r + 1) & 3]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(r + 3) & 3], w[(r + 2) & 3], 4));
+                w[r & 3] = _mm_sha256msg2_epu32(next, w[(r + 3) & 3]);
+            }
+        }
+
+        abef = _mm_add_epi32(abef, abef_saved);
+        cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+        data += SHA256_BLOCK_SIZE;
+    }
+
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+    _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(feba, dchg, 0xf0));
+    _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+
+#define ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+// One block for each of eight messages. state[word][lane] holds the eight
+// states side by side, so every round is one set of vector operations.
+__attribute__((target("avx2")))
+static void sha256_block_x8(uint32_t state[8][SHA256_LANES], const uint8_t* const blocks[SHA256_LANES]) {
+    const __m256i byte_swap = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+                                                0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m256i w[16];
+
+    // Load eight rows of eight words and transpose them into lanes
+    for (int half = 0; half < 2; half++) {
+        __m256i r[8], t[8], u[8];
+        for (int l = 0; l < 8; l++) {
+            r[l] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(blocks[l] + half * 32)), byte_swap);
+        }
+        for (int l = 0; l < 8; l += 2) {
+            t[l] = _mm256_unpacklo_epi32(r[l], r[l + 1]);
+            t[l + 1] = _mm256_unpackhi_epi32(r[l], r[l + 1]);
+        }
+        for (int l = 0; l < 8; l += 4) {
+            u[l] = _mm256_unpacklo_epi64(t[l], t[l + 2]);
+            u[l + 1] = _mm256_unpackhi_epi64(t[l], t[l + 2]);
+            u[l + 2] = _mm256_unpacklo_epi64(t[l + 1], t[l + 3]);
+            u[l + 3] = _mm256_unpackhi_epi64(t[l + 1], t[l + 3]);
+        }
+        for (int i = 0; i < 4; i++) {
+            w[half * 8 + i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+            w[half * 8 + i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+        }
+    }
+
+    __m256i s[8];
+    for (int i = 0; i < 8; i++) {
+        s[i] = _mm256_load_si256((const __m256i*)state[i]);
+    }
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16) {
+            __m256i w15 = w[(i + 1) & 15], w2 = w[(i + 14) & 15];
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w15, 7), ROTR8(w15, 18)), _mm256_srli_epi32(w15, 3));
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w2, 17), ROTR8(w2, 19)), _mm256_srli_epi32(w2, 10));
+            w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), _mm256_add_epi32(w[(i + 9) & 15], s1));
+        }
+        __m256i sum1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(e, 6), ROTR8(e, 11)), ROTR8(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sum1),
+                                      _mm256_add_epi32(_mm256_add_epi32(ch, _mm256_set1_epi32((int)K[i])), w[i & 15]));
+        __m256i sum0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(a, 2), ROTR8(a, 13)), ROTR8(a, 22));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        __m256i t2 = _mm256_add_epi32(sum0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, t2);
+    }
+
+    __m256i out[8] = { a, b, c, d, e, f, g, h };
+    for (int i = 0; i < 8; i++) {
+        _mm256_store_si256((__m256i*)state[i], _mm256_add_epi32(s[i], out[i]));
+    }
+}
+#endif
+
+static void (*sha256_blocks)(uint32_t state[8], const uint8_t* data, size_t blocks) = sha256_blocks_scalar;
+static Sha256Kernel active_kernel = SHA256_KERNEL_SCALAR;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static bool kernel_supported(Sha256Kernel kernel) {
+#ifdef SHA256_X86
+    __builtin_cpu_init();
+    if (kernel == SHA256_KERNEL_SHANI) {
+        return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+    }
+    if (kernel == SHA256_KERNEL_AVX2) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return kernel == SHA256_KERNEL_SCALAR;
+}
+
+bool sha256_use_kernel(Sha256Kernel kernel) {
+    if (!kernel_supported(kernel)) {
+        return false;
+    }
+    active_kernel = kernel;
+    sha256_blocks = sha256_blocks_scalar;
+#ifdef SHA256_X86
+    if (kernel == SHA256_KERNEL_SHANI) {
+        sha256_blocks = sha256_blocks_shani;
+    }
+#endif
+    return true;
+}
+
+static void kernel_select(void) {
+    if (!sha256_use_kernel(SHA256_KERNEL_SHANI)) {
+        sha256_use_kernel(SHA256_KERNEL_AVX2);
+    }
+}
+
+Sha256Kernel sha256_kernel(void) {
+    pthread_once(&kernel_once, kernel_select);
+    return active_kernel;
+}
+
+const char* sha256_kernel_name(Sha256Kernel kernel) {
+    switch (kernel) {
+    case SHA256_KERNEL_SHANI:
+        return "sha-ni";
+    case SHA256_KERNEL_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+void sha256_init(Sha256Context* ctx) {
+    pthread_once(&kernel_once, kernel_select);
+    memcpy(ctx->state, initial_state, sizeof(initial_state));
+    ctx->length = 0;
+    ctx->block_used = 0;
+}
+
+void sha256_update(Sha256Context* ctx, const void* data, size_t size) {
+    const uint8_t* p = data;
+    ctx->length += size;
+
+    if (ctx->block_used > 0) {
+        size_t take = SHA256_BLOCK_SIZE - ctx->block_used;
+        if (take > size) {
+            take = size;
+        }
+        memcpy(ctx->block + ctx->block_used, p, take);
+        ctx->block_used += take;
+        p += take;
+        size -= take;
+        if (ctx->block_used < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        sha256_blocks(ctx->state, ctx->block, 1);
+        ctx->block_used = 0;
+    }
+
+    // Hash whole blocks straight from the caller's buffer
+    sha256_blocks(ctx->state, p, size / SHA256_BLOCK_SIZE);
+    p += size - size % SHA256_BLOCK_SIZE;
+    size %= SHA256_BLOCK_SIZE;
+
+    memcpy(ctx->block, p, size);
+    ctx->block_used = size;
+}
+
+static void store_digest(const uint32_t state[8], uint8_t digest[SHA256_DIGEST_SIZE]) {
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (uint8_t)(state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)state[i];
+    }
+}
+
+#ifdef SHA256_X86
+// A message in one lane: whole blocks straight from the caller's buffer,
+// then one or two padded blocks from `tail`
+typedef struct {
+    const uint8_t* data;
+    size_t full;
+    size_t total;
+    size_t next;
+    size_t item;
+    uint8_t tail[2 * SHA256_BLOCK_SIZE];
+} Sha256Lane;
+
+static void lane_load(Sha256Lane* lane, uint32_t state[8][SHA256_LANES], int l,
+                      const uint8_t* data, size_t size, size_t item) {
+    size_t rest = size % SHA256_BLOCK_SIZE;
+    lane->data = data;
+    lane->full = size / SHA256_BLOCK_SIZE;
+    lane->total = lane->full + (rest + 9 > SHA256_BLOCK_SIZE ? 2 : 1);
+    lane->next = 0;
+    lane->item = item;
+    memset(lane->tail, 0, sizeof(lane->tail));
+    memcpy(lane->tail, data + size - rest, rest);
+    lane->tail[rest] = 0x80;
+    uint8_t* length = lane->tail + (lane->total - lane->full) * SHA256_BLOCK_SIZE - 8;
+    for (int i = 0; i < 8; i++) {
+        length[i] = (uint8_t)((uint64_t)size * 8 >> (56 - i * 8));
+    }
+    for (int i = 0; i < 8; i++) {
+        state[i][l] = initial_state[i];
+    }
+}
+
+// Lanes take the next message as soon as theirs is done, so messages of
+// different lengths keep all eight lanes busy until the queue runs dry
+static void sha256_many_x8(const void* const* data, const size_t* sizes, size_t count,
+                           uint8_t (*digests)[SHA256_DIGEST_SIZE]) {
+    static const uint8_t idle[SHA256_BLOCK_SIZE];
+    _Alignas(32) uint32_t state[8][SHA256_LANES];
+    Sha256Lane lanes[SHA256_LANES];
+    bool active[SHA256_LANES];
+    size_t queued = 0;
+    int running = 0;
+    for (int l = 0; l < SHA256_LANES; l++) {
+        active[l] = queued < count;
+        if (active[l]) {
+            lane_load(&lanes[l], state, l, data[queued], sizes[queued], queued);
+            queued++;
+            running++;
+        }
+    }
+
+    while (running > 0) {
+        const uint8_t* blocks[SHA256_LANES];
+        for (int l = 0; l < SHA256_LANES; l++) {
+            Sha256Lane* lane = &lanes[l];
+            blocks[l] = !active[l] ? idle :
+                        lane->next < lane->full ? lane->data + lane->next * SHA256_BLOCK_SIZE :
+                        lane->tail + (lane->next - lane->full) * SHA256_BLOCK_SIZE;
+        }
+        sha256_block_x8(state, blocks);
+
+        for (int l = 0; l < SHA256_LANES; l++) {
+            if (!active[l] || ++lanes[l].next < lanes[l].total) {
+                continue;
+            }
+            uint32_t words[8];
+            for (int i = 0; i < 8; i++) {
+                words[i] = state[i][l];
+            }
+            store_digest(words, digests[lanes[l].item]);
+            if (queued < count) {
+                lane_load(&lanes[l], state, l, data[queued], sizes[queued], queued);
+                queued++;
+            } else {
+                active[l] = false;
+                running--;
+            }
+        }
+    }
+}
+#endif
+
+void sha256_many(const void* const* data, const size_t* sizes, size_t count,
+                 uint8_t (*digests)[SHA256_DIGEST_SIZE]) {
+#ifdef SHA256_X86
+    if (sha256_kernel() == SHA256_KERNEL_AVX2 && count > 1) {
+        sha256_many_x8(data, sizes, count, digests);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++) {
+        sha256(data[i], sizes[i], digests[i]);
+    }
+}
+
+void sha256_final(Sha256Context* ctx, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    uint64_t bits = ctx->length * 8;
+    uint8_t pad = 0x80;
+    uint8_t zero = 0;
+
+    sha256_update(ctx, &pad, 1);
+    while (ctx->block_used != SHA256_BLOCK_SIZE - 8) {
+        sha256_update(ctx, &zero, 1);
+    }
+
+    uint8_t length[8];
+    for (int i = 0; i < 8; i++) {
+        length[i] = (uint8_t)(bits >> (56 - i * 8));
+    }
+    sha256_update(ctx, length, sizeof(length));
+    store_digest(ctx->state, digest);
+}
+
+void sha256(const void* data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    Sha256Context ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, size);
+    sha256_final(&ctx, digest);
+}
+
+bool sha256_file(int fd, uint8_t digest[SHA256_DIGEST_SIZE], uint64_t* size) {
+    static __thread uint8_t buffer[SHA256_READ_SIZE];
+    Sha256Context ctx;
+    sha256_init(&ctx);
+
+    for (;;) {
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (got == 0) {
+            break;
+        }
+        sha256_update(&ctx, buffer, (size_t)got);
+    }
+
+    if (size) {
+        *size = ctx.length;
+    }
+    sha256_final(&ctx, digest);
+    return true;
+}
+
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE]) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0xf];
+    }
+    hex[SHA256_DIGEST_SIZE * 2] = '\0';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool sha256_from_hex(const char* hex, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        int high = hex_value(hex[i * 2]);
+        int low = high < 0 ? -1 : hex_value(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        digest[i] = (uint8_t)(high << 4 | low);
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef PROMPTOS_SHA256_H
+#define PROMPTOS_SHA256_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1)
+
+// Block kernels, picked at run time from what the CPU supports. The SHA
+// extensions (with SSE4.1 shuffles) hash one stream several times faster
+// than scalar code. Without them, AVX2 hashes eight independent messages
+// at once in sha256_many(), one per 32-bit lane; single streams stay scalar.
+typedef enum {
+    SHA256_KERNEL_SCALAR,
+    SHA256_KERNEL_AVX2,
+    SHA256_KERNEL_SHANI
+} Sha256Kernel;
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;            // Bytes hashed so far
+    uint8_t block[SHA256_BLOCK_SIZE];
+    size_t block_used;
+} Sha256Context;
+
+void sha256_init(Sha256Context* ctx);
+void sha256_update(Sha256Context* ctx, const void* data, size_t size);
+void sha256_final(Sha256Context* ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+// One-shot helpers
+void sha256(const void* data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+// Hash `count` independent buffers, e.g. the chunks of a file
+void sha256_many(const void* const* data, const size_t* sizes, size_t count,
+                 uint8_t (*digests)[SHA256_DIGEST_SIZE]);
+bool sha256_file(int fd, uint8_t digest[SHA256_DIGEST_SIZE], uint64_t* size);
+
+Sha256Kernel sha256_kernel(void);
+const char* sha256_kernel_name(Sha256Kernel kernel);
+
+// Switch kernels, for benchmarks; false if the CPU lacks it. Not while
+// other threads are hashing.
+bool sha256_use_kernel(Sha256Kernel kernel);
+
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE]);
+bool sha256_from_hex(const char* hex, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif // PROMPTOS_SHA256_H
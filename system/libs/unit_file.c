@@ -0,0 +1,650 @@
+#define _GNU_SOURCE
+#include "unit_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "../service_manager.h"
+
+// A slice of the unit text; never NUL-terminated
+typedef struct {
+    const char* begin;
+    const char* end;
+} Span;
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static Span trim(const char* begin, const char* end) {
+    while (begin < end && is_space(*begin)) {
+        begin++;
+    }
+    while (end > begin && is_space(end[-1])) {
+        end--;
+    }
+    return (Span){ begin, end };
+}
+
+static bool span_is(Span span, const char* word) {
+    size_t length = strlen(word);
+    return (size_t)(span.end - span.begin) == length && strncasecmp(span.begin, word, length) == 0;
+}
+
+static bool span_copy(Span span, char* out, size_t size) {
+    size_t length = (size_t)(span.end - span.begin);
+    if (length == 0 || length >= size) {
+        return false;
+    }
+    memcpy(out, span.begin, length);
+    out[length] = '\0';
+    return true;
+}
+
+static bool parse_bool(Span value, bool* out) {
+    if (span_is(value, "yes") || span_is(value, "true") || span_is(value, "1")) {
+        *out = true;
+        return true;
+    }
+    if (span_is(value, "no") || span_is(value, "false") || span_is(value, "0")) {
+        *out = false;
+        return true;
+    }
+    return false;
+}
+
+// Decimal number with an optional K, M or G suffix (powers of 1024) or a
+// suffix of `unit` that is accepted and ignored, such as "%"
+static bool parse_number(Span value, const char* unit, uint64_t* out) {
+    const char* p = value.begin;
+    uint64_t number = 0;
+    if (p == value.end) {
+        return false;
+    }
+    for (; p < value.end && *p >= '0' && *p <= '9'; p++) {
+        if (number > (UINT64_MAX - 9) / 10) {
+            return false;
+        }
+        number = number * 10 + (uint64_t)(*p - '0');
+    }
+    if (p == value.begin) {
+        return false;
+    }
+
+    Span suffix = trim(p, value.end);
+    int shift = 0;
+    if (suffix.begin == suffix.end || (unit && span_is(suffix, unit))) {
+        shift = 0;
+    } else if (!unit && span_is(suffix, "K")) {
+        shift = 10;
+    } else if (!unit && span_is(suffix, "M")) {
+        shift = 20;
+    } else if (!unit && span_is(suffix, "G")) {
+        shift = 30;
+    } else {
+        return false;
+    }
+    if (shift > 0 && number > (UINT64_MAX >> shift)) {
+        return false;
+    }
+    *out = number << shift;
+    return true;
+}
+
+static bool parse_priority(Span value, int32_t* out) {
+    bool negative = value.begin < value.end && *value.begin == '-';
+    uint64_t number;
+    if (!parse_number((Span){ value.begin + negative, value.end }, "", &number) || number > INT32_MAX) {
+        return false;
+    }
+    *out = negative ? -(int32_t)number : (int32_t)number;
+    return true;
+}
+
+static bool parse_type(Span value, uint8_t* out) {
+    if (span_is(value, "daemon") || span_is(value, "system")) {
+        *out = SERVICE_TYPE_SYSTEM;
+    } else if (span_is(value, "network")) {
+        *out = SERVICE_TYPE_NETWORK;
+    } else if (span_is(value, "user")) {
+        *out = SERVICE_TYPE_USER;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Comma- or space-separated names, appended to the unit's list
+static bool parse_dependencies(Span value, UnitRecord* unit) {
+    const char* p = value.begin;
+    while (p < value.end) {
+        const char* begin = p;
+        while (p < value.end && *p != ',' && !is_space(*p)) {
+            p++;
+        }
+        if (p > begin) {
+            if (unit->dependency_count >= UNIT_MAX_DEPENDENCIES ||
+                !span_copy((Span){ begin, p }, unit->dependency_names[unit->dependency_count],
+                           UNIT_NAME_MAX)) {
+                return false;
+            }
+            unit->dependency_count++;
+        }
+        p++;
+    }
+    return true;
+}
+
+// kind:path, e.g. stream:/run/networkd.sock
+static bool parse_listen(Span value, UnitRecord* unit) {
+    const char* colon = memchr(value.begin, ':', (size_t)(value.end - value.begin));
+    if (!colon || unit->listen_count >= UNIT_MAX_LISTENERS) {
+        return false;
+    }
+    Span kind = trim(value.begin, colon);
+    uint8_t* out = &unit->listen_kinds[unit->listen_count];
+    if (span_is(kind, "stream")) {
+        *out = UNIT_LISTEN_STREAM;
+    } else if (span_is(kind, "datagram")) {
+        *out = UNIT_LISTEN_DATAGRAM;
+    } else if (span_is(kind, "fifo")) {
+        *out = UNIT_LISTEN_FIFO;
+    } else {
+        return false;
+    }
+    if (!span_copy(trim(colon + 1, value.end), unit->listen_paths[unit->listen_count],
+                   UNIT_LISTEN_PATH_MAX)) {
+        return false;
+    }
+    unit->listen_count++;
+    return true;
+}
+
+static bool parse_key(Span key, Span value, UnitRecord* unit) {
+    uint64_t number;
+    if (span_is(key, "Name")) {
+        return span_copy(value, unit->name, sizeof(unit->name));
+    } else if (span_is(key, "Exec")) {
+        return span_copy(value, unit->exec_path, sizeof(unit->exec_path));
+    } else if (span_is(key, "Dependencies")) {
+        return parse_dependencies(value, unit);
+    } else if (span_is(key, "Type")) {
+        return parse_type(value, &unit->type);
+    } else if (span_is(key, "Priority")) {
+        return parse_priority(value, &unit->priority);
+    } else if (span_is(key, "Autostart")) {
+        return parse_bool(value, &unit->autostart);
+    } else if (span_is(key, "Respawn")) {
+        return parse_bool(value, &unit->respawn);
+    } else if (span_is(key, "MemoryMax")) {
+        return parse_number(value, NULL, &unit->memory_max);
+    } else if (span_is(key, "CPUMax")) {
+        if (!parse_number(value, "%", &number) || number > UINT32_MAX) {
+            return false;
+        }
+        unit->cpu_max_percent = (uint32_t)number;
+        return true;
+    } else if (span_is(key, "StopTimeout")) {
+        if (!parse_number(value, "s", &number) || number > 3600) {
+            return false;
+        }
+        unit->stop_timeout_sec = (uint32_t)number;
+        return true;
+    } else if (span_is(key, "Listen")) {
+        return parse_listen(value, unit);
+    }
+    return true;    // Unknown keys are left for newer versions
+}
+
+bool unit_parse(const char* text, size_t length, uint8_t directory, UnitRecord* unit) {
+    memset(unit, 0, sizeof(*unit));
+    unit->directory = directory;
+    unit->autostart = true;
+    unit->priority = UNIT_DEFAULT_PRIORITY;
+    unit->type = SERVICE_TYPE_SYSTEM;
+
+    const char* p = text;
+    const char* end = text + length;
+    bool in_service = false;
+    bool seen_service = false;
+    while (p < end) {
+        const char* line_end = memchr(p, '\n', (size_t)(end - p));
+        if (!line_end) {
+            line_end = end;
+        }
+        Span line = trim(p, line_end);
+        p = line_end + 1;
+
+        if (line.begin == line.end || *line.begin == '#' || *line.begin == ';') {
+            continue;
+        }
+        if (*line.begin == '[') {
+            in_service = span_is(line, "[Service]");
+            seen_service |= in_service;
+            continue;
+        }
+        if (!in_service) {
+            continue;
+        }
+        const char* equals = memchr(line.begin, '=', (size_t)(line.end - line.begin));
+        if (!equals || !parse_key(trim(line.begin, equals), trim(equals + 1, line.end), unit)) {
+            return false;
+        }
+    }
+    return seen_service && unit->exec_path[0] != '\0';
+}
+
+// ---- Loading ----
+
+static int64_t mtime_ns(const struct stat* st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static int64_t dir_mtime(const char* dir) {
+    struct stat st;
+    if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        return -1;
+    }
+    return mtime_ns(&st);
+}
+
+// FNV-1a of `text`, terminator included
+static uint32_t hash_string(uint32_t hash, const char* text) {
+    for (const char* c = text; ; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+        if (*c == '\0') {
+            return hash;
+        }
+    }
+}
+
+static uint32_t hash_dirs(const char* const* dirs, int dir_count) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < dir_count; i++) {
+        hash = hash_string(hash, dirs[i]);
+    }
+    return hash;
+}
+
+// Length of a unit file's name, or 0 for an entry that is not one
+static size_t unit_entry(const struct dirent64* entry) {
+    size_t suffix_length = strlen(UNIT_SUFFIX);
+    size_t name_length = strlen(entry->d_name);
+    if (entry->d_name[0] == '.' || name_length <= suffix_length ||
+        strcmp(entry->d_name + name_length - suffix_length, UNIT_SUFFIX) != 0 ||
+        (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN)) {
+        return 0;
+    }
+    return name_length;
+}
+
+// Stamp of an overridden unit file. The header holds their sum, so the
+// order the files are listed in does not matter.
+static uint64_t file_stamp(uint8_t directory, uint32_t name_hash, int64_t mtime, uint64_t size) {
+    uint64_t stamp = ((uint64_t)directory << 32 | name_hash) * 0x9e3779b97f4a7c15ULL;
+    stamp = (stamp ^ (uint64_t)mtime) * 0xbf58476d1ce4e5b9ULL;
+    stamp = (stamp ^ size) * 0x94d049bb133111ebULL;
+    return stamp ^ (stamp >> 31);
+}
+
+static bool terminated(const char* field, size_t size) {
+    return memchr(field, '\0', size) != NULL;
+}
+
+// A damaged cache must not send init to a record, a listener kind or a
+// string end that does not exist
+static bool record_valid(const UnitRecord* unit, uint32_t count, uint32_t* unresolved) {
+    if (unit->dependency_count > UNIT_MAX_DEPENDENCIES || unit->listen_count > UNIT_MAX_LISTENERS ||
+        unit->type > SERVICE_TYPE_USER || !terminated(unit->name, sizeof(unit->name)) ||
+        !terminated(unit->exec_path, sizeof(unit->exec_path))) {
+        return false;
+    }
+    for (int d = 0; d < unit->dependency_count; d++) {
+        int32_t dep = unit->dependencies[d];
+        if (dep < -1 || dep >= (int32_t)count ||
+            !terminated(unit->dependency_names[d], sizeof(unit->dependency_names[d]))) {
+            return false;
+        }
+        *unresolved += dep < 0;
+    }
+    for (int l = 0; l < unit->listen_count; l++) {
+        if (unit->listen_kinds[l] > UNIT_LISTEN_FIFO ||
+            !terminated(unit->listen_paths[l], sizeof(unit->listen_paths[l]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The record parsed from file `name` of `directory`, or NULL if a later
+// unit overrode it. A unit is usually named after its file, so look that
+// name up first.
+static const UnitRecord* file_record(const UnitRecord* units, uint32_t count, uint8_t directory,
+                                     const char* name, size_t stem_length, uint32_t hash) {
+    char stem[UNIT_NAME_MAX];
+    UnitTable lookup = { .units = units, .count = count };
+    if (stem_length < sizeof(stem)) {
+        memcpy(stem, name, stem_length);
+        stem[stem_length] = '\0';
+        int index = unit_find(&lookup, stem);
+        if (index >= 0 && units[index].directory == directory && units[index].file_hash == hash) {
+            return &units[index];
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (units[i].directory == directory && units[i].file_hash == hash) {
+            return &units[i];
+        }
+    }
+    return NULL;
+}
+
+// Stat every unit file without reading it. Each must have the mtime and
+// size its record was parsed from, and the overridden ones must add up to
+// the header's count and stamp.
+static bool units_unchanged(const char* const* dirs, int dir_count, const UnitCacheHeader* header,
+                            const UnitRecord* units) {
+    char entries[16384] __attribute__((aligned(8)));
+    size_t suffix_length = strlen(UNIT_SUFFIX);
+    uint32_t files = 0;
+    uint64_t overridden = 0;
+    long length = 0;
+    bool ok = true;
+    for (int i = 0; ok && i < dir_count; i++) {
+        int dir_fd = open(dirs[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0) {
+            continue;   // Missing when the cache was written too: its mtime is -1
+        }
+        while (ok && (length = syscall(SYS_getdents64, dir_fd, entries, sizeof(entries))) > 0) {
+            for (long offset = 0; ok && offset < length; ) {
+                struct dirent64* entry = (struct dirent64*)(entries + offset);
+                offset += entry->d_reclen;
+                size_t name_length = unit_entry(entry);
+                struct stat st;
+                if (name_length == 0) {
+                    continue;
+                }
+                if (fstatat(dir_fd, entry->d_name, &st, 0) < 0) {
+                    ok = false;
+                    break;
+                }
+                files++;
+                uint32_t hash = hash_string(2166136261u, entry->d_name);
+                const UnitRecord* unit = file_record(units, header->count, (uint8_t)i, entry->d_name,
+                                                     name_length - suffix_length, hash);
+                if (unit) {
+                    ok = unit->file_mtime_ns == mtime_ns(&st) && unit->file_size == (uint64_t)st.st_size;
+                } else {
+                    overridden += file_stamp((uint8_t)i, hash, mtime_ns(&st), (uint64_t)st.st_size);
+                }
+            }
+        }
+        ok = ok && length == 0;
+        close(dir_fd);
+    }
+    return ok && files == header->file_count && overridden == header->overridden_stamp;
+}
+
+// Map the cache if it was built from the directories and unit files as
+// they are now and holds no more than `capacity` units. Anything else is
+// parsed again.
+static bool cache_map(const char* path, const UnitCacheHeader* expected, const char* const* dirs,
+                      uint32_t capacity, UnitTable* table) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(UnitCacheHeader)) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const UnitCacheHeader* header = map;
+    const UnitRecord* units = (const UnitRecord*)(header + 1);
+    size_t size = (size_t)st.st_size;
+    bool valid = header->magic == expected->magic && header->version == expected->version &&
+                 header->record_size == expected->record_size &&
+                 header->dir_count == expected->dir_count && header->dirs_hash == expected->dirs_hash &&
+                 memcmp(header->dir_mtime_ns, expected->dir_mtime_ns, sizeof(header->dir_mtime_ns)) == 0 &&
+                 header->count <= capacity &&
+                 size == sizeof(*header) + (size_t)header->count * sizeof(UnitRecord);
+
+    uint32_t unresolved = 0;
+    for (uint32_t i = 0; valid && i < header->count; i++) {
+        valid = record_valid(&units[i], header->count, &unresolved);
+    }
+    valid = valid && units_unchanged(dirs, (int)header->dir_count, header, units);
+    if (!valid) {
+        munmap(map, size);
+        return false;
+    }
+
+    table->units = units;
+    table->count = header->count;
+    table->unresolved = unresolved;
+    table->rejected = 0;
+    table->from_cache = true;
+    table->map = map;
+    table->map_size = size;
+    return true;
+}
+
+// Parse every unit in `dir` into storage[*count...]. Directory entries are
+// read with getdents64 into a stack buffer, so nothing is allocated.
+static void parse_directory(const char* dir, uint8_t index, UnitRecord* storage, uint32_t* count,
+                            uint32_t capacity, uint32_t* rejected) {
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        return;
+    }
+
+    char entries[16384] __attribute__((aligned(8)));
+    char text[UNIT_MAX_FILE_SIZE];
+    size_t suffix_length = strlen(UNIT_SUFFIX);
+    long length;
+    while ((length = syscall(SYS_getdents64, dir_fd, entries, sizeof(entries))) > 0) {
+        for (long offset = 0; offset < length; ) {
+            struct dirent64* entry = (struct dirent64*)(entries + offset);
+            offset += entry->d_reclen;
+            size_t name_length = unit_entry(entry);
+            if (name_length == 0) {
+                continue;
+            }
+            if (*count >= capacity) {
+                (*rejected)++;
+                continue;
+            }
+
+            // Stat before reading, so an edit racing the read leaves an
+            // mtime that the next load sees as stale
+            int fd = openat(dir_fd, entry->d_name, O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            ssize_t size = fd >= 0 && fstat(fd, &st) == 0 ? read(fd, text, sizeof(text)) : -1;
+            if (fd >= 0) {
+                close(fd);
+            }
+            UnitRecord* unit = &storage[*count];
+            if (size < 0 || size == (ssize_t)sizeof(text) || !unit_parse(text, (size_t)size, index, unit)) {
+                (*rejected)++;
+                continue;
+            }
+            // Without Name= the unit is named after its file
+            if (unit->name[0] == '\0' &&
+                !span_copy((Span){ entry->d_name, entry->d_name + name_length - suffix_length },
+                           unit->name, sizeof(unit->name))) {
+                (*rejected)++;
+                continue;
+            }
+            unit->file_hash = hash_string(2166136261u, entry->d_name);
+            unit->file_mtime_ns = mtime_ns(&st);
+            unit->file_size = (uint64_t)st.st_size;
+            (*count)++;
+        }
+    }
+    close(dir_fd);
+}
+
+static int compare_units(const void* a, const void* b) {
+    const UnitRecord* left = a;
+    const UnitRecord* right = b;
+    int order = strcmp(left->name, right->name);
+    return order != 0 ? order : (int)left->directory - (int)right->directory;
+}
+
+// Sort by name, keep the last directory's copy of each unit and turn
+// dependency names into record indices. The stamps of the copies dropped
+// are added to `*overridden`.
+static uint32_t compile_units(UnitRecord* units, uint32_t* count, uint64_t* overridden) {
+    qsort(units, *count, sizeof(UnitRecord), compare_units);
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < *count; i++) {
+        if (i + 1 < *count && strcmp(units[i].name, units[i + 1].name) == 0) {
+            *overridden += file_stamp(units[i].directory, units[i].file_hash, units[i].file_mtime_ns,
+                                      units[i].file_size);
+            continue;
+        }
+        if (kept != i) {
+            units[kept] = units[i];
+        }
+        kept++;
+    }
+    *count = kept;
+
+    UnitTable lookup = { .units = units, .count = kept };
+    uint32_t unresolved = 0;
+    for (uint32_t i = 0; i < kept; i++) {
+        for (int d = 0; d < units[i].dependency_count; d++) {
+            units[i].dependencies[d] = unit_find(&lookup, units[i].dependency_names[d]);
+            unresolved += units[i].dependencies[d] < 0;
+        }
+    }
+    return unresolved;
+}
+
+static bool make_parent_dir(const char* path) {
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char* slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+            return false;
+        }
+        *slash = '/';
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+    const char* p = data;
+    while (size > 0) {
+        ssize_t written = write(fd, p, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        p += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+// Write the cache under a temporary name and rename it into place
+static bool cache_write(const char* path, const UnitCacheHeader* header, const UnitRecord* units) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!make_parent_dir(path)) {
+        return false;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write_all(fd, header, sizeof(*header)) &&
+              write_all(fd, units, (size_t)header->count * sizeof(UnitRecord)) &&
+              fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+bool unit_load(const char* const* dirs, int dir_count, const char* cache_path,
+               UnitRecord* storage, uint32_t capacity, UnitTable* table) {
+    memset(table, 0, sizeof(*table));
+    if (dir_count < 0 || dir_count > UNIT_MAX_DIRS) {
+        return false;
+    }
+
+    UnitCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = UNIT_MAGIC;
+    header.version = UNIT_VERSION;
+    header.record_size = sizeof(UnitRecord);
+    header.dir_count = (uint32_t)dir_count;
+    header.dirs_hash = hash_dirs(dirs, dir_count);
+    for (int i = 0; i < UNIT_MAX_DIRS; i++) {
+        header.dir_mtime_ns[i] = i < dir_count ? dir_mtime(dirs[i]) : -1;
+    }
+    if (cache_path && cache_map(cache_path, &header, dirs, capacity, table)) {
+        return true;
+    }
+
+    uint32_t count = 0;
+    uint32_t rejected = 0;
+    for (int i = 0; i < dir_count; i++) {
+        parse_directory(dirs[i], (uint8_t)i, storage, &count, capacity, &rejected);
+    }
+    header.file_count = count;
+    table->unresolved = compile_units(storage, &count, &header.overridden_stamp);
+    table->units = storage;
+    table->count = count;
+    table->rejected = rejected;
+
+    // Units that failed to parse are not cached, so they are retried (and
+    // reported) next boot rather than silently dropped for good
+    header.count = count;
+    if (cache_path && rejected == 0) {
+        cache_write(cache_path, &header, storage);
+    }
+    return true;
+}
+
+int unit_find(const UnitTable* table, const char* name) {
+    uint32_t low = 0;
+    uint32_t high = table->count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int order = strcmp(table->units[mid].name, name);
+        if (order == 0) {
+            return (int)mid;
+        }
+        if (order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return -1;
+}
+
+void unit_table_close(UnitTable* table) {
+    if (table->map) {
+        munmap(table->map, table->map_size);
+    }
+    memset(table, 0, sizeof(*table));
+}
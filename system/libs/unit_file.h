@@ -0,0 +1,107 @@
+#ifndef PROMPTOS_UNIT_FILE_H
+#define PROMPTOS_UNIT_FILE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Service unit files and their compiled cache
+//
+// A unit is an INI file with a [Service] section (see init/README.md).
+// unit_load() compares the mtimes of the unit directories with the ones
+// stored in the cache, then stats every unit file and compares its mtime
+// and size with the ones its record was parsed from. When all of them
+// match it maps the cache and returns its records without reading a
+// single unit file. Otherwise it parses every unit, sorts them by name,
+// resolves dependencies to record indices and writes a new cache. The
+// parser makes one pass over the file text and writes straight into a
+// fixed-size record; nothing is allocated.
+//
+// A directory's mtime catches a unit added, removed or renamed into
+// place, and a file's mtime and size an edit in place. Files whose unit
+// is overridden by a later directory have no record; the header keeps
+// their count and a stamp of their names, mtimes and sizes.
+
+#define UNIT_DIRS { "/lib/promptos/services", "/etc/promptos/services" }
+#define UNIT_CACHE_PATH "/var/cache/promptos/units.cache"
+#define UNIT_SUFFIX ".service"
+#define UNIT_MAGIC 0x54494e55u          // "UNIT"
+#define UNIT_VERSION 3
+#define UNIT_MAX_DIRS 4                 // Later directories override earlier ones
+#define UNIT_MAX_FILE_SIZE 8192
+#define UNIT_NAME_MAX 32
+#define UNIT_EXEC_MAX 256
+#define UNIT_LISTEN_PATH_MAX 108        // sun_path
+#define UNIT_MAX_DEPENDENCIES 8
+#define UNIT_MAX_LISTENERS 4
+#define UNIT_DEFAULT_PRIORITY 50
+
+typedef enum {
+    UNIT_LISTEN_STREAM,
+    UNIT_LISTEN_DATAGRAM,
+    UNIT_LISTEN_FIFO
+} UnitListenKind;
+
+// One unit, as stored in the cache. Fixed size so the cache is an array.
+typedef struct {
+    char name[UNIT_NAME_MAX];
+    char exec_path[UNIT_EXEC_MAX];
+    char dependency_names[UNIT_MAX_DEPENDENCIES][UNIT_NAME_MAX];
+    int32_t dependencies[UNIT_MAX_DEPENDENCIES];    // Record index, -1 if missing
+    char listen_paths[UNIT_MAX_LISTENERS][UNIT_LISTEN_PATH_MAX];
+    uint8_t listen_kinds[UNIT_MAX_LISTENERS];       // UnitListenKind
+    uint8_t dependency_count;
+    uint8_t listen_count;
+    uint8_t type;                   // ServiceType
+    uint8_t directory;              // Index into the directory list
+    bool autostart;
+    bool respawn;
+    int32_t priority;
+    uint32_t cpu_max_percent;
+    uint32_t stop_timeout_sec;      // SIGTERM to SIGKILL; 0 = init's default
+    uint32_t file_hash;             // Of the unit's file name
+    uint64_t memory_max;
+    int64_t file_mtime_ns;          // Of the unit file when it was parsed
+    uint64_t file_size;
+} UnitRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;           // sizeof(UnitRecord), catches layout changes
+    uint32_t count;
+    uint32_t dir_count;
+    uint32_t dirs_hash;             // Of the directory paths, in order
+    int64_t dir_mtime_ns[UNIT_MAX_DIRS];    // -1 for a missing directory
+    uint32_t file_count;            // Unit files, overridden ones included
+    uint32_t reserved;
+    uint64_t overridden_stamp;      // Sum of the overridden files' stamps
+} UnitCacheHeader;
+
+typedef struct {
+    const UnitRecord* units;        // Sorted by name
+    uint32_t count;
+    uint32_t unresolved;            // Dependencies on units that do not exist
+    uint32_t rejected;              // Unit files that failed to parse
+    bool from_cache;
+    void* map;                      // Cache mapping, or NULL
+    size_t map_size;
+} UnitTable;
+
+// Parse one unit file. `directory` is recorded for overrides.
+bool unit_parse(const char* text, size_t length, uint8_t directory, UnitRecord* unit);
+
+// Load the units of `dirs` from the cache, or parse them into `storage`
+// and rewrite the cache. A cache holding more than `capacity` units or a
+// damaged record is ignored and the units are parsed instead.
+// `cache_path` may be NULL to skip the cache.
+bool unit_load(const char* const* dirs, int dir_count, const char* cache_path,
+               UnitRecord* storage, uint32_t capacity, UnitTable* table);
+
+// Index of the unit called `name`, or -1
+int unit_find(const UnitTable* table, const char* name);
+
+// Unmap the cache, if the table came from it
+void unit_table_close(UnitTable* table);
+
+#endif // PROMPTOS_UNIT_FILE_H
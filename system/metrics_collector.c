@@ -0,0 +1,93 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "libs/metrics.h"
+#include "service_manager.h"
+
+// Metrics collector service
+//
+// Samples memory, uptime, load and per-CPU counters every
+// METRICS_INTERVAL_MS and publishes them in the shared metrics page, so
+// neofetch and monitoring agents can poll without touching /proc.
+
+static MetricsWriter writer;
+static pthread_t collector_thread;
+static bool collector_running = false;
+
+static void* collector_loop(void* arg) {
+    (void)arg;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (__atomic_load_n(&collector_running, __ATOMIC_ACQUIRE)) {
+        // Absolute deadlines keep the interval from drifting
+        next.tv_nsec += METRICS_INTERVAL_MS * 1000000L;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        if (metrics_sample(&writer)) {
+            metrics_publish(&writer);
+        }
+    }
+    return NULL;
+}
+
+// Service lifecycle functions
+static bool metrics_start(void) {
+    if (!metrics_writer_open(&writer)) {
+        metrics_writer_close(&writer);
+        return false;
+    }
+
+    // Publish one sample before reporting ready so dependents see data
+    if (metrics_sample(&writer)) {
+        metrics_publish(&writer);
+    }
+
+    __atomic_store_n(&collector_running, true, __ATOMIC_RELEASE);
+    if (pthread_create(&collector_thread, NULL, collector_loop, NULL) != 0) {
+        __atomic_store_n(&collector_running, false, __ATOMIC_RELEASE);
+        metrics_writer_close(&writer);
+        return false;
+    }
+    return true;
+}
+
+static bool metrics_stop(void) {
+    if (!__atomic_exchange_n(&collector_running, false, __ATOMIC_ACQ_REL)) {
+        return true;
+    }
+    pthread_join(collector_thread, NULL);
+    metrics_writer_close(&writer);
+    shm_unlink(METRICS_SHM_NAME);
+    return true;
+}
+
+static void metrics_status(char* buffer, size_t size) {
+    snprintf(buffer, size, "Metrics collector: %llu samples every %d ms",
+             (unsigned long long)writer.current.samples, METRICS_INTERVAL_MS);
+}
+
+// Initialize metrics collector service
+bool init_metrics_collector_service(void) {
+    Service metrics = {
+        .name = "metrics",
+        .description = "Shared-memory system metrics collector",
+        .type = SERVICE_TYPE_SYSTEM,
+        .state = SERVICE_STATE_INACTIVE,
+        .priority = 5,
+        .enabled = true,
+        .start = metrics_start,
+        .stop = metrics_stop,
+        .reload = NULL,
+        .status = metrics_status
+    };
+    
+    return service_register(&metrics);
+}
@@ -1,148 +1,173 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/utsname.h>
-#include <sys/sysinfo.h>
-
-#define BUFFER_SIZE 1024
-#define COLOR_RESET "\033[0m"
-#define COLOR_BOLD "\033[1m"
-#define COLOR_BLUE "\033[34m"
-
-// ASCII art logo for PromptOS
-static const char* LOGO[] = {
-    "blahaj hehehehe",
-
-    NULL
-};
-
-// Get system information
-static void get_system_info(char* buffer, size_t size) {
-    struct utsname sys_info;
-    struct sysinfo si;
-    
-    if (uname(&sys_info) < 0) {
-        snprintf(buffer, size, "Error getting system information\n");
-        return;
-    }
-    
-    if (sysinfo(&si) < 0) {
-        snprintf(buffer, size, "Error getting system information\n");
-        return;
-    }
-    
-    // Format memory sizes
-    unsigned long total_ram = si.totalram * si.mem_unit / (1024 * 1024);
-    unsigned long free_ram = si.freeram * si.mem_unit / (1024 * 1024);
-    unsigned long used_ram = total_ram - free_ram;
-    
-    // Get current user
-    char* username = getenv("USER");
-    if (!username) username = "root";
-    
-    // Get hostname
-    char hostname[256] = {0};
-    gethostname(hostname, sizeof(hostname));
-    
-    // Format system information
-    snprintf(buffer, size,
-        "\n%s@%s\n"
-        "---------------\n"
-        "OS: PromptOS %s\n"
-        "Kernel: %s %s\n"
-        "Uptime: %ld days, %ld hours, %ld mins\n"
-        "Memory: %luMB / %luMB (Used/Total)\n"
-        "Architecture: %s\n"
-        "Shell: %s\n",
-        username, hostname,
-        "1.0.0",  // OS version
-        sys_info.sysname, sys_info.release,
-        si.uptime / 86400, (si.uptime % 86400) / 3600, (si.uptime % 3600) / 60,
-        used_ram, total_ram,
-        sys_info.machine,
-        getenv("SHELL") ? getenv("SHELL") : "bash"
-    );
-}
-
-// Display the logo and system information
-static void display_info(void) {
-    char info_buffer[BUFFER_SIZE];
-    get_system_info(info_buffer, sizeof(info_buffer));
-    
-    // Print logo and information side by side
-    const char** logo_line = LOGO;
-    char* info_line = info_buffer;
-    char* next_line;
-    
-    printf("\n%s", COLOR_BLUE);  // Set blue color for logo
-    
-    while (*logo_line) {
-        next_line = strchr(info_line, '\n');
-        if (next_line) {
-            *next_line = '\0';
-        }
-        
-        printf("%-60s", *logo_line);  // Print logo line
-        if (*info_line) {
-            printf("%s%s", COLOR_BOLD, info_line);  // Print info line
-        }
-        printf("\n");
-        
-        logo_line++;
-        if (next_line) {
-            info_line = next_line + 1;
-        } else {
-            info_line = "";
-        }
-    }
-    
-    // Print remaining info lines if any
-    while (*info_line) {
-        next_line = strchr(info_line, '\n');
-        if (next_line) {
-            *next_line = '\0';
-            printf("%-60s%s%s\n", "", COLOR_BOLD, info_line);
-            info_line = next_line + 1;
-        } else {
-            if (*info_line) {
-                printf("%-60s%s%s\n", "", COLOR_BOLD, info_line);
-            }
-            break;
-        }
-    }
-    
-    printf(COLOR_RESET "\n");  // Reset colors
-}
-
-// Service lifecycle functions
-static bool neofetch_start(void) {
-    display_info();
-    return true;
-}
-
-static bool neofetch_stop(void) {
-    return true;
-}
-
-static void neofetch_status(char* buffer, size_t size) {
-    snprintf(buffer, size, "Neofetch service is ready");
-}
-
-// Initialize neofetch service
-bool init_neofetch_service(void) {
-    Service neofetch = {
-        .name = "neofetch",
-        .description = "System information display utility",
-        .type = SERVICE_TYPE_USER,
-        .state = SERVICE_STATE_INACTIVE,
-        .priority = 10,
-        .enabled = true,
-        .start = neofetch_start,
-        .stop = neofetch_stop,
-        .reload = NULL,
-        .status = neofetch_status
-    };
-    
-    return service_register(&neofetch);
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <sys/sysinfo.h>
+#include "libs/metrics.h"
+#include "service_manager.h"
+
+#define INFO_LINES 16
+#define INFO_LINE_SIZE 160
+#define COLOR_RESET "\033[0m"
+#define COLOR_BOLD "\033[1m"
+#define COLOR_BLUE "\033[34m"
+
+// ASCII art logo for PromptOS
+static const char* LOGO[] = {
+    "blahaj hehehehe",
+
+    NULL
+};
+
+typedef struct {
+    char lines[INFO_LINES][INFO_LINE_SIZE];
+    int count;
+} SystemInfo;
+
+// Read the snapshot published by the metrics collector. The page is
+// mapped on first use; after that a read is a memory copy.
+static bool read_metrics(MetricsSnapshot* snapshot) {
+    static MetricsReader reader;
+    static bool mapped = false;
+    if (!mapped) {
+        mapped = metrics_reader_open(&reader);
+    }
+    return mapped && metrics_read(&reader, snapshot);
+}
+
+// Sample directly when no collector is running
+static bool sample_directly(MetricsSnapshot* snapshot) {
+    struct utsname sys_info;
+    struct sysinfo si;
+    
+    if (uname(&sys_info) < 0 || sysinfo(&si) < 0) {
+        return false;
+    }
+    
+    memset(snapshot, 0, offsetof(MetricsSnapshot, cpus));
+    snprintf(snapshot->sysname, sizeof(snapshot->sysname), "%s", sys_info.sysname);
+    snprintf(snapshot->release, sizeof(snapshot->release), "%s", sys_info.release);
+    snprintf(snapshot->machine, sizeof(snapshot->machine), "%s", sys_info.machine);
+    snprintf(snapshot->hostname, sizeof(snapshot->hostname), "%s", sys_info.nodename);
+    snapshot->uptime_sec = (uint64_t)si.uptime;
+    snapshot->mem_total_kb = (uint64_t)si.totalram * si.mem_unit / 1024;
+    snapshot->mem_available_kb = (uint64_t)si.freeram * si.mem_unit / 1024;
+    for (int i = 0; i < 3; i++) {
+        snapshot->load_milli[i] = (uint32_t)(si.loads[i] * 1000 / (1 << SI_LOAD_SHIFT));
+    }
+    return true;
+}
+
+static void info_add(SystemInfo* info, const char* label, const char* format, ...) {
+    if (info->count == INFO_LINES) {
+        return;
+    }
+    char* line = info->lines[info->count++];
+    int used = label ? snprintf(line, INFO_LINE_SIZE, "%s: ", label) : 0;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line + used, INFO_LINE_SIZE - (size_t)used, format, args);
+    va_end(args);
+}
+
+// Get system information
+static bool get_system_info(SystemInfo* info) {
+    static MetricsSnapshot snapshot;
+    info->count = 0;
+    
+    if (!read_metrics(&snapshot) && !sample_directly(&snapshot)) {
+        info_add(info, NULL, "Error getting system information");
+        return false;
+    }
+    
+    // Get current user
+    char* username = getenv("USER");
+    if (!username) username = "root";
+    
+    // Format memory sizes
+    uint64_t total_ram = snapshot.mem_total_kb / 1024;
+    uint64_t used_ram = total_ram - snapshot.mem_available_kb / 1024;
+    uint64_t uptime = snapshot.uptime_sec;
+    
+    // Format system information
+    info_add(info, NULL, "%s@%s", username, snapshot.hostname);
+    info_add(info, NULL, "---------------");
+    info_add(info, "OS", "PromptOS %s", "1.0.0");
+    info_add(info, "Kernel", "%s %s", snapshot.sysname, snapshot.release);
+    info_add(info, "Uptime", "%llu days, %llu hours, %llu mins",
+             (unsigned long long)(uptime / 86400), (unsigned long long)(uptime % 86400 / 3600),
+             (unsigned long long)(uptime % 3600 / 60));
+    info_add(info, "Memory", "%lluMB / %lluMB (Used/Total)",
+             (unsigned long long)used_ram, (unsigned long long)total_ram);
+    info_add(info, "Load", "%u.%02u %u.%02u %u.%02u",
+             snapshot.load_milli[0] / 1000, snapshot.load_milli[0] % 1000 / 10,
+             snapshot.load_milli[1] / 1000, snapshot.load_milli[1] % 1000 / 10,
+             snapshot.load_milli[2] / 1000, snapshot.load_milli[2] % 1000 / 10);
+    if (snapshot.cpu_count > 0) {
+        info_add(info, "CPU", "%u cores, %u.%u%% busy", snapshot.cpu_count,
+                 snapshot.total.busy_permille / 10, snapshot.total.busy_permille % 10);
+    }
+    info_add(info, "Architecture", "%s", snapshot.machine);
+    info_add(info, "Shell", "%s", getenv("SHELL") ? getenv("SHELL") : "bash");
+    return true;
+}
+
+// Display the logo and system information
+static void display_info(void) {
+    static SystemInfo info;
+    get_system_info(&info);
+    
+    // Print logo and information side by side
+    printf("\n%s", COLOR_BLUE);  // Set blue color for logo
+    
+    const char** logo_line = LOGO;
+    for (int i = 0; *logo_line || i < info.count; i++) {
+        printf("%-60s", *logo_line ? *logo_line : "");  // Print logo line
+        if (i < info.count) {
+            printf("%s%s", COLOR_BOLD, info.lines[i]);  // Print info line
+        }
+        printf("\n");
+        
+        if (*logo_line) {
+            logo_line++;
+        }
+    }
+    
+    printf(COLOR_RESET "\n");  // Reset colors
+}
+
+// Service lifecycle functions
+static bool neofetch_start(void) {
+    display_info();
+    return true;
+}
+
+static bool neofetch_stop(void) {
+    return true;
+}
+
+static void neofetch_status(char* buffer, size_t size) {
+    snprintf(buffer, size, "Neofetch service is ready");
+}
+
+// Initialize neofetch service
+bool init_neofetch_service(void) {
+    Service neofetch = {
+        .name = "neofetch",
+        .description = "System information display utility",
+        .type = SERVICE_TYPE_USER,
+        .state = SERVICE_STATE_INACTIVE,
+        .priority = 10,
+        .enabled = true,
+        .dependencies = {{ "metrics", false }},
+        .dependency_count = 1,
+        .start = neofetch_start,
+        .stop = neofetch_stop,
+        .reload = NULL,
+        .status = neofetch_status
+    };
+    
+    return service_register(&neofetch);
 }
\ No newline at end of file
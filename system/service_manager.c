@@ -1,178 +1,744 @@
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "libs/name_registry.h"
+#include "libs/boot_trace.h"
+#include "libs/arena.h"
+#include "libs/cgroup.h"
+#include "service_manager.h"
 
-// Service manager configuration
-#define MAX_SERVICE_NAME_LEN 64
-#define MAX_SERVICE_DESC_LEN 256
-#define MAX_SERVICES 128
-#define MAX_DEPENDENCIES 16
-
-// Service states
-typedef enum {
-    SERVICE_STATE_INACTIVE,
-    SERVICE_STATE_STARTING,
-    SERVICE_STATE_ACTIVE,
-    SERVICE_STATE_STOPPING,
-    SERVICE_STATE_FAILED
-} ServiceState;
-
-// Service type
-typedef enum {
-    SERVICE_TYPE_SYSTEM,    // Core system service
-    SERVICE_TYPE_NETWORK,   // Network-related service
-    SERVICE_TYPE_USER       // User-space service
-} ServiceType;
-
-// Service dependency
+// Dependency of a registered service, stored as an interned name id. The
+// id resolves to a table index once the dependency is registered.
 typedef struct {
-    char name[MAX_SERVICE_NAME_LEN];
-    bool required;  // If true, service won't start without this dependency
-} ServiceDependency;
+    int32_t id;
+    bool required;
+} ServiceDepRef;
 
-// Service definition
+// Registry entry for a registered service: what lookups, dependency
+// walks and scheduling touch. Entries live in a table that grows with
+// registrations, so keep table indices, not pointers, across
+// service_register calls.
 typedef struct {
-    char name[MAX_SERVICE_NAME_LEN];
-    char description[MAX_SERVICE_DESC_LEN];
-    ServiceType type;
+    const char* name;               // Interned in service_names
+    ServiceDepRef* dependencies;    // In service_arena
+    uint8_t dependency_count;
+    uint8_t type;                   // ServiceType
+    bool enabled;
     ServiceState state;
-    int priority;  // Lower number = higher priority
-    bool enabled;  // If service should start automatically
-    
-    // Dependencies
-    ServiceDependency dependencies[MAX_DEPENDENCIES];
-    int dependency_count;
-    
-    // Process information
+    int priority;
     int pid;
     int exit_code;
-    
-    // Service lifecycle handlers
+} ServiceEntry;
+
+// Rarely used fields, in a table parallel to the entries
+typedef struct {
+    const char* description;        // In service_arena
     bool (*start)(void);
     bool (*stop)(void);
     bool (*reload)(void);
     void (*status)(char* buffer, size_t size);
-} Service;
+} ServiceDetails;
+
+// Timing and critical path of the last service_start_enabled() run
+typedef struct {
+    uint64_t wall_ns;       // First dispatch to last completion
+    uint64_t serial_ns;     // Sum of every start() latency
+    uint64_t critical_ns;   // Length of the measured critical path
+    int started;
+    int failed;
+    int cyclic;             // Services in or behind a dependency cycle
+    int* critical_path;     // Service indices, root first
+    int critical_path_len;
+} ServiceStartReport;
+
+#define SERVICE_TABLE_INITIAL 64
 
-// Global service registry
-static Service services[MAX_SERVICES];
+// Global service registry; both tables grow on demand
+static ServiceEntry* services;
+static ServiceDetails* service_info;
 static int service_count = 0;
+static int service_capacity = 0;
+static NameRegistry service_names;
+static Arena service_arena;
+static ServiceStartReport start_report;
+
+static ServiceEntry* service_find(const char* name);
+
+// Table index of a dependency, or -1 while it is not registered
+static int service_dep_index(const ServiceDepRef* dep) {
+    return name_registry_value(&service_names, dep->id);
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
 
 // Initialize the service manager
 bool service_manager_init(void) {
-    memset(services, 0, sizeof(services));
+    free(services);
+    free(service_info);
+    free(start_report.critical_path);
+    services = NULL;
+    service_info = NULL;
+    service_count = 0;
+    service_capacity = 0;
+    memset(&start_report, 0, sizeof(start_report));
+    arena_free(&service_arena);
+    name_registry_free(&service_names);
+    return name_registry_init(&service_names, SERVICE_TABLE_INITIAL);
+}
+
+// Make room for one more service; entries move, indices stay valid
+static bool service_table_reserve(void) {
+    if (service_count < service_capacity) {
+        return true;
+    }
+    int capacity = service_capacity ? service_capacity * 2 : SERVICE_TABLE_INITIAL;
+    ServiceEntry* entries = realloc(services, (size_t)capacity * sizeof(*entries));
+    if (!entries) {
+        return false;
+    }
+    services = entries;
+    ServiceDetails* details = realloc(service_info, (size_t)capacity * sizeof(*details));
+    if (!details) {
+        return false;
+    }
+    service_info = details;
+    service_capacity = capacity;
     return true;
 }
 
-// Register a new service
+// Register a new service. Only the dependencies and description in use
+// are copied, into the arena.
 bool service_register(Service* service) {
-    if (service_count >= MAX_SERVICES) {
+    if (!service_table_reserve()) {
         return false;
     }
-    
+
     // Check for duplicate service
-    for (int i = 0; i < service_count; i++) {
-        if (strcmp(services[i].name, service->name) == 0) {
+    int32_t id = name_registry_intern(&service_names, service->name);
+    if (id < 0 || name_registry_value(&service_names, id) != NAME_REGISTRY_UNBOUND) {
+        return false;
+    }
+
+    // Intern dependency names; they may be registered later
+    ServiceEntry* entry = &services[service_count];
+    ServiceDetails* details = &service_info[service_count];
+    int dependency_count = service->dependency_count < MAX_DEPENDENCIES ?
+        service->dependency_count : MAX_DEPENDENCIES;
+    entry->dependencies = dependency_count > 0 ?
+        arena_alloc(&service_arena, (size_t)dependency_count * sizeof(ServiceDepRef)) : NULL;
+    details->description = arena_strdup(&service_arena, service->description);
+    if ((dependency_count > 0 && !entry->dependencies) || !details->description) {
+        return false;
+    }
+    for (int i = 0; i < dependency_count; i++) {
+        entry->dependencies[i].id = name_registry_intern(&service_names, service->dependencies[i].name);
+        entry->dependencies[i].required = service->dependencies[i].required;
+        if (entry->dependencies[i].id < 0) {
             return false;
         }
     }
-    
+    entry->dependency_count = (uint8_t)dependency_count;
+
     // Add service to registry
-    memcpy(&services[service_count], service, sizeof(Service));
+    entry->name = name_registry_name(&service_names, id);
+    entry->type = (uint8_t)service->type;
+    entry->state = service->state;
+    entry->priority = service->priority;
+    entry->enabled = service->enabled;
+    entry->pid = service->pid;
+    entry->exit_code = service->exit_code;
+    details->start = service->start;
+    details->stop = service->stop;
+    details->reload = service->reload;
+    details->status = service->status;
+    name_registry_bind(&service_names, id, service_count);
     service_count++;
     return true;
 }
 
 // Start a service and its dependencies
 bool service_start(const char* name) {
-    Service* service = service_find(name);
+    ServiceEntry* service = service_find(name);
     if (!service) {
         return false;
     }
-    
+
     // Check if service is already active
     if (service->state == SERVICE_STATE_ACTIVE) {
         return true;
     }
-    
+
     // Start dependencies first
     for (int i = 0; i < service->dependency_count; i++) {
-        Service* dep = service_find(service->dependencies[i].name);
-        if (!dep) {
+        int dep = service_dep_index(&service->dependencies[i]);
+        if (dep < 0) {
             if (service->dependencies[i].required) {
                 return false;
             }
             continue;
         }
-        
-        if (!service_start(dep->name)) {
+
+        if (!service_start(services[dep].name)) {
             if (service->dependencies[i].required) {
                 return false;
             }
         }
     }
-    
+
     // Start the service
     service->state = SERVICE_STATE_STARTING;
-    if (service->start && service->start()) {
+    BootSpanId span = BOOT_TRACE_BEGIN("service", service->name);
+    ServiceDetails* details = &service_info[service - services];
+    bool started = details->start && details->start();
+    BOOT_TRACE_END(span);
+    if (started) {
         service->state = SERVICE_STATE_ACTIVE;
         return true;
     }
-    
+
     service->state = SERVICE_STATE_FAILED;
     return false;
 }
 
 // Stop a service
 bool service_stop(const char* name) {
-    Service* service = service_find(name);
+    ServiceEntry* service = service_find(name);
     if (!service || service->state != SERVICE_STATE_ACTIVE) {
         return false;
     }
-    
+
     service->state = SERVICE_STATE_STOPPING;
-    if (service->stop && service->stop()) {
+    ServiceDetails* details = &service_info[service - services];
+    if (details->stop && details->stop()) {
         service->state = SERVICE_STATE_INACTIVE;
         return true;
     }
-    
+
     service->state = SERVICE_STATE_FAILED;
     return false;
 }
 
 // Find a service by name
-static Service* service_find(const char* name) {
-    for (int i = 0; i < service_count; i++) {
-        if (strcmp(services[i].name, name) == 0) {
-            return &services[i];
+static ServiceEntry* service_find(const char* name) {
+    int index = name_registry_find(&service_names, name);
+    return index >= 0 ? &services[index] : NULL;
+}
+
+// Dependency edge in the start graph: `from` must settle before `to` runs
+typedef struct {
+    int to;
+    bool required;
+} StartEdge;
+
+// Per-node scheduling state for one wavefront run
+typedef struct {
+    int edge_start;         // Outgoing edges in StartGraph.edges
+    int edge_count;
+    int pending;            // Dependencies that have not settled yet
+    bool dep_failed;        // A required dependency failed
+    int waited_on;          // Dependency that settled last (critical path)
+    BootSpanId span;        // Boot timeline span of the start hook
+    uint64_t begin_ns;
+    uint64_t end_ns;
+} StartNode;
+
+// Shared state of the start worker pool
+typedef struct {
+    StartNode* nodes;
+    StartEdge* edges;
+    int* ready;                 // Min-heap of runnable services by priority
+    int ready_count;
+    int remaining;              // Scheduled services that have not settled
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} StartGraph;
+
+static bool ready_before(int a, int b) {
+    if (services[a].priority != services[b].priority) {
+        return services[a].priority < services[b].priority;
+    }
+    return a < b;
+}
+
+static void ready_push(StartGraph* graph, int index) {
+    int pos = graph->ready_count++;
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (!ready_before(index, graph->ready[parent])) {
+            break;
         }
+        graph->ready[pos] = graph->ready[parent];
+        pos = parent;
     }
+    graph->ready[pos] = index;
+}
+
+static int ready_pop(StartGraph* graph) {
+    int top = graph->ready[0];
+    int last = graph->ready[--graph->ready_count];
+    int pos = 0;
+    for (;;) {
+        int child = pos * 2 + 1;
+        if (child >= graph->ready_count) {
+            break;
+        }
+        if (child + 1 < graph->ready_count &&
+            ready_before(graph->ready[child + 1], graph->ready[child])) {
+            child++;
+        }
+        if (!ready_before(graph->ready[child], last)) {
+            break;
+        }
+        graph->ready[pos] = graph->ready[child];
+        pos = child;
+    }
+    graph->ready[pos] = last;
+    return top;
+}
+
+// Record that `index` settled and release its dependents (lock held)
+static void start_settle(StartGraph* graph, int index, bool ok) {
+    StartNode* node = &graph->nodes[index];
+    graph->remaining--;
+
+    for (int e = node->edge_start; e < node->edge_start + node->edge_count; e++) {
+        StartNode* dependent = &graph->nodes[graph->edges[e].to];
+        if (!ok && graph->edges[e].required) {
+            dependent->dep_failed = true;
+        }
+        dependent->waited_on = index;
+        if (--dependent->pending == 0) {
+            ready_push(graph, graph->edges[e].to);
+        }
+    }
+
+    if (graph->remaining == 0 || graph->ready_count > 0) {
+        pthread_cond_broadcast(&graph->wake);
+    }
+}
+
+static void* start_worker(void* arg) {
+    StartGraph* graph = arg;
+
+    pthread_mutex_lock(&graph->lock);
+    for (;;) {
+        while (graph->ready_count == 0 && graph->remaining > 0) {
+            pthread_cond_wait(&graph->wake, &graph->lock);
+        }
+        if (graph->remaining == 0) {
+            break;
+        }
+
+        int index = ready_pop(graph);
+        StartNode* node = &graph->nodes[index];
+        ServiceEntry* service = &services[index];
+
+        // A failed required dependency settles the service without running it
+        if (node->dep_failed) {
+            service->state = SERVICE_STATE_FAILED;
+            node->begin_ns = node->end_ns = monotonic_ns();
+            start_report.failed++;
+            start_settle(graph, index, false);
+            continue;
+        }
+
+        service->state = SERVICE_STATE_STARTING;
+        pthread_mutex_unlock(&graph->lock);
+
+        BootSpanId after = node->waited_on >= 0 ? graph->nodes[node->waited_on].span : BOOT_SPAN_NONE;
+        node->span = BOOT_TRACE_BEGIN_AFTER("service", service->name, after);
+        node->begin_ns = monotonic_ns();
+        bool ok = service_info[index].start && service_info[index].start();
+        node->end_ns = monotonic_ns();
+        BOOT_TRACE_END(node->span);
+
+        pthread_mutex_lock(&graph->lock);
+        service->state = ok ? SERVICE_STATE_ACTIVE : SERVICE_STATE_FAILED;
+        start_report.serial_ns += node->end_ns - node->begin_ns;
+        if (ok) {
+            start_report.started++;
+        } else {
+            start_report.failed++;
+        }
+        start_settle(graph, index, ok);
+    }
+    pthread_mutex_unlock(&graph->lock);
+
     return NULL;
 }
 
-// Start all enabled services in priority order
+// Walk back from the last service to finish along the dependencies it waited on
+static void start_record_critical_path(const StartGraph* graph, const bool* scheduled) {
+    int last = -1;
+    for (int i = 0; i < service_count; i++) {
+        if (scheduled[i] && (last < 0 || graph->nodes[i].end_ns > graph->nodes[last].end_ns)) {
+            last = i;
+        }
+    }
+
+    int count = 0;
+    for (int i = last; i >= 0 && count < service_count; i = graph->nodes[i].waited_on) {
+        start_report.critical_path[count++] = i;
+        start_report.critical_ns += graph->nodes[i].end_ns - graph->nodes[i].begin_ns;
+    }
+
+    // Collected last service first; report root first
+    for (int i = 0; i < count / 2; i++) {
+        int swap = start_report.critical_path[i];
+        start_report.critical_path[i] = start_report.critical_path[count - 1 - i];
+        start_report.critical_path[count - 1 - i] = swap;
+    }
+    start_report.critical_path_len = count;
+}
+
+// Start all enabled services, running independent services concurrently.
+// Every service whose dependencies have settled is dispatched to a worker
+// pool; among runnable services, lower priority numbers go first.
 bool service_start_enabled(void) {
-    bool success = true;
-    
-    // Sort services by priority
-    for (int i = 0; i < service_count - 1; i++) {
-        for (int j = 0; j < service_count - i - 1; j++) {
-            if (services[j].priority > services[j + 1].priority) {
-                Service temp = services[j];
-                services[j] = services[j + 1];
-                services[j + 1] = temp;
+    static StartGraph graph;
+    size_t count = (size_t)(service_count > 0 ? service_count : 1);
+    int depth = 0;
+
+    // Per-run scratch sized to the current table
+    int* critical_path = realloc(start_report.critical_path, count * sizeof(int));
+    memset(&start_report, 0, sizeof(start_report));
+    start_report.critical_path = critical_path;
+    memset(&graph, 0, sizeof(graph));
+    graph.nodes = calloc(count, sizeof(StartNode));
+    graph.ready = malloc(count * sizeof(int));
+    bool* scheduled = calloc(count * 2, sizeof(bool));
+    int* stack = malloc(count * 3 * sizeof(int));
+    if (!critical_path || !graph.nodes || !graph.ready || !scheduled || !stack) {
+        free(graph.nodes);
+        free(graph.ready);
+        free(scheduled);
+        free(stack);
+        return false;
+    }
+
+    // Schedule enabled services and everything they depend on
+    for (int i = 0; i < service_count; i++) {
+        if (services[i].enabled && services[i].state != SERVICE_STATE_ACTIVE) {
+            scheduled[i] = true;
+            stack[depth++] = i;
+        }
+    }
+    while (depth > 0) {
+        ServiceEntry* service = &services[stack[--depth]];
+        for (int d = 0; d < service->dependency_count; d++) {
+            int dep = service_dep_index(&service->dependencies[d]);
+            if (dep >= 0 && services[dep].state != SERVICE_STATE_ACTIVE && !scheduled[dep]) {
+                scheduled[dep] = true;
+                stack[depth++] = dep;
             }
         }
     }
-    
-    // Start enabled services
+
+    // Build the reverse adjacency (dependency -> dependents) as a CSR array
+    int edge_total = 0;
     for (int i = 0; i < service_count; i++) {
-        if (services[i].enabled) {
-            if (!service_start(services[i].name)) {
-                success = false;
+        graph.nodes[i].waited_on = -1;
+        graph.nodes[i].span = BOOT_SPAN_NONE;
+        if (!scheduled[i]) {
+            continue;
+        }
+        for (int d = 0; d < services[i].dependency_count; d++) {
+            int dep = service_dep_index(&services[i].dependencies[d]);
+            if (dep < 0) {
+                if (services[i].dependencies[d].required) {
+                    graph.nodes[i].dep_failed = true;
+                }
+                continue;
             }
+            if (services[dep].state == SERVICE_STATE_ACTIVE) {
+                continue;
+            }
+            graph.nodes[dep].edge_count++;
+            graph.nodes[i].pending++;
+            edge_total++;
+        }
+    }
+
+    graph.edges = malloc((size_t)(edge_total > 0 ? edge_total : 1) * sizeof(StartEdge));
+    if (!graph.edges) {
+        free(graph.nodes);
+        free(graph.ready);
+        free(scheduled);
+        free(stack);
+        return false;
+    }
+
+    int offset = 0;
+    for (int i = 0; i < service_count; i++) {
+        graph.nodes[i].edge_start = offset;
+        offset += graph.nodes[i].edge_count;
+        graph.nodes[i].edge_count = 0;
+    }
+    for (int i = 0; i < service_count; i++) {
+        if (!scheduled[i]) {
+            continue;
+        }
+        for (int d = 0; d < services[i].dependency_count; d++) {
+            int dep = service_dep_index(&services[i].dependencies[d]);
+            if (dep < 0 || services[dep].state == SERVICE_STATE_ACTIVE) {
+                continue;
+            }
+            StartNode* from = &graph.nodes[dep];
+            StartEdge* edge = &graph.edges[from->edge_start + from->edge_count++];
+            edge->to = i;
+            edge->required = services[i].dependencies[d].required;
+        }
+    }
+
+    // Detect cycles up front: anything Kahn's algorithm cannot reach is in
+    // a cycle or depends on one, and is failed without being started
+    int* pending = stack + count;
+    int* queue = pending + count;
+    int head = 0, tail = 0;
+    for (int i = 0; i < service_count; i++) {
+        pending[i] = graph.nodes[i].pending;
+        if (scheduled[i] && pending[i] == 0) {
+            queue[tail++] = i;
+        }
+    }
+    while (head < tail) {
+        StartNode* node = &graph.nodes[queue[head++]];
+        for (int e = node->edge_start; e < node->edge_start + node->edge_count; e++) {
+            if (--pending[graph.edges[e].to] == 0) {
+                queue[tail++] = graph.edges[e].to;
+            }
+        }
+    }
+
+    bool* acyclic = scheduled + count;
+    for (int i = 0; i < tail; i++) {
+        acyclic[queue[i]] = true;
+    }
+    for (int i = 0; i < service_count; i++) {
+        if (scheduled[i] && !acyclic[i]) {
+            services[i].state = SERVICE_STATE_FAILED;
+            scheduled[i] = false;
+            start_report.cyclic++;
+        }
+    }
+
+    // Drop edges into cyclic services so they never become runnable
+    for (int i = 0; i < service_count; i++) {
+        StartNode* node = &graph.nodes[i];
+        int kept = node->edge_start;
+        for (int e = node->edge_start; e < node->edge_start + node->edge_count; e++) {
+            if (scheduled[graph.edges[e].to]) {
+                graph.edges[kept++] = graph.edges[e];
+            }
+        }
+        node->edge_count = kept - node->edge_start;
+        if (scheduled[i]) {
+            graph.remaining++;
+            if (node->pending == 0) {
+                ready_push(&graph, i);
+            }
+        }
+    }
+
+    // Run the wavefront
+    pthread_t workers[SERVICE_START_WORKERS];
+    int worker_count = 0;
+    pthread_mutex_init(&graph.lock, NULL);
+    pthread_cond_init(&graph.wake, NULL);
+
+    uint64_t begin = monotonic_ns();
+    int wanted = graph.remaining < SERVICE_START_WORKERS ? graph.remaining : SERVICE_START_WORKERS;
+    for (int i = 0; i < wanted; i++) {
+        if (pthread_create(&workers[worker_count], NULL, start_worker, &graph) == 0) {
+            worker_count++;
+        }
+    }
+    if (worker_count == 0 && graph.remaining > 0) {
+        start_worker(&graph);   // No threads available: run inline
+    }
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    start_report.wall_ns = monotonic_ns() - begin;
+
+    start_record_critical_path(&graph, scheduled);
+
+    pthread_cond_destroy(&graph.wake);
+    pthread_mutex_destroy(&graph.lock);
+    free(graph.edges);
+    free(graph.nodes);
+    free(graph.ready);
+    free(scheduled);
+    free(stack);
+
+    return start_report.failed == 0 && start_report.cyclic == 0;
+}
+
+// Shared state of the stop worker pool
+typedef struct {
+    int* dependents;            // Active services that still need each one
+    bool* scheduled;            // Active when the run began
+    bool* queued;
+    int* ready;
+    int ready_count;
+    int remaining;
+    int in_flight;
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} StopGraph;
+
+static void stop_queue(StopGraph* graph, int index) {
+    graph->queued[index] = true;
+    graph->ready[graph->ready_count++] = index;
+}
+
+static void* stop_worker(void* arg) {
+    StopGraph* graph = arg;
+
+    pthread_mutex_lock(&graph->lock);
+    for (;;) {
+        while (graph->ready_count == 0 && graph->remaining > 0) {
+            if (graph->in_flight == 0) {
+                // Only services that depend on each other in a cycle are
+                // left; nothing else will release them, so stop them all
+                for (int i = 0; i < service_count; i++) {
+                    if (graph->scheduled[i] && !graph->queued[i]) {
+                        stop_queue(graph, i);
+                    }
+                }
+                continue;
+            }
+            pthread_cond_wait(&graph->wake, &graph->lock);
+        }
+        if (graph->remaining == 0) {
+            break;
+        }
+
+        int index = graph->ready[--graph->ready_count];
+        ServiceEntry* service = &services[index];
+        service->state = SERVICE_STATE_STOPPING;
+        graph->in_flight++;
+        pthread_mutex_unlock(&graph->lock);
+
+        bool ok = service_info[index].stop && service_info[index].stop();
+
+        pthread_mutex_lock(&graph->lock);
+        service->state = ok ? SERVICE_STATE_INACTIVE : SERVICE_STATE_FAILED;
+        graph->failed += !ok;
+        graph->in_flight--;
+        graph->remaining--;
+        for (int d = 0; d < service->dependency_count; d++) {
+            int dep = service_dep_index(&service->dependencies[d]);
+            if (dep >= 0 && graph->scheduled[dep] && --graph->dependents[dep] == 0 &&
+                !graph->queued[dep]) {
+                stop_queue(graph, dep);
+            }
+        }
+        pthread_cond_broadcast(&graph->wake);
+    }
+    pthread_mutex_unlock(&graph->lock);
+
+    return NULL;
+}
+
+// Stop all active services in reverse dependency order. A service is
+// handed to the worker pool once no active service depends on it any
+// more, so independent services stop concurrently.
+bool service_stop_all(void) {
+    static StopGraph graph;
+    size_t count = (size_t)(service_count > 0 ? service_count : 1);
+
+    memset(&graph, 0, sizeof(graph));
+    graph.dependents = calloc(count, sizeof(int));
+    graph.ready = malloc(count * sizeof(int));
+    graph.scheduled = calloc(count * 2, sizeof(bool));
+    if (!graph.dependents || !graph.ready || !graph.scheduled) {
+        free(graph.dependents);
+        free(graph.ready);
+        free(graph.scheduled);
+        return false;
+    }
+    graph.queued = graph.scheduled + count;
+
+    for (int i = 0; i < service_count; i++) {
+        if (services[i].state == SERVICE_STATE_ACTIVE) {
+            graph.scheduled[i] = true;
+            graph.remaining++;
+        }
+    }
+    for (int i = 0; i < service_count; i++) {
+        if (!graph.scheduled[i]) {
+            continue;
+        }
+        for (int d = 0; d < services[i].dependency_count; d++) {
+            int dep = service_dep_index(&services[i].dependencies[d]);
+            if (dep >= 0 && graph.scheduled[dep]) {
+                graph.dependents[dep]++;
+            }
+        }
+    }
+    for (int i = 0; i < service_count; i++) {
+        if (graph.scheduled[i] && graph.dependents[i] == 0) {
+            stop_queue(&graph, i);
+        }
+    }
+
+    pthread_t workers[SERVICE_START_WORKERS];
+    int worker_count = 0;
+    pthread_mutex_init(&graph.lock, NULL);
+    pthread_cond_init(&graph.wake, NULL);
+    int wanted = graph.remaining < SERVICE_START_WORKERS ? graph.remaining : SERVICE_START_WORKERS;
+    for (int i = 0; i < wanted; i++) {
+        if (pthread_create(&workers[worker_count], NULL, stop_worker, &graph) == 0) {
+            worker_count++;
         }
     }
-    
-    return success;
-}
\ No newline at end of file
+    if (worker_count == 0 && graph.remaining > 0) {
+        stop_worker(&graph);    // No threads available: run inline
+    }
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&graph.wake);
+    pthread_mutex_destroy(&graph.lock);
+    free(graph.dependents);
+    free(graph.ready);
+    free(graph.scheduled);
+    return graph.failed == 0;
+}
+
+// Describe the last service_start_enabled() run and its critical path
+void service_start_report(char* buffer, size_t size) {
+    size_t used = (size_t)snprintf(buffer, size,
+        "started %d, failed %d, cyclic %d\n"
+        "wall %.3f ms, serial %.3f ms, critical path %.3f ms:",
+        start_report.started, start_report.failed, start_report.cyclic,
+        start_report.wall_ns / 1e6, start_report.serial_ns / 1e6,
+        start_report.critical_ns / 1e6);
+
+    for (int i = 0; i < start_report.critical_path_len && used < size; i++) {
+        used += (size_t)snprintf(buffer + used, size - used, "%s%s",
+            i == 0 ? " " : " -> ", services[start_report.critical_path[i]].name);
+    }
+}
+
+// Pressure stall figures of a running service's cgroup
+bool service_pressure(const char* name, CgroupPressure* pressure) {
+    ServiceEntry* service = service_find(name);
+    char path[CGROUP_MAX_PATH];
+    if (!service || service->pid <= 0 || !cgroup_path_of_pid(service->pid, path, sizeof(path))) {
+        return false;
+    }
+    return cgroup_read_pressure(path, pressure);
+}
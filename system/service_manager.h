@@ -0,0 +1,72 @@
+#ifndef PROMPTOS_SERVICE_MANAGER_H
+#define PROMPTOS_SERVICE_MANAGER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Service manager configuration
+#define MAX_SERVICE_NAME_LEN 64
+#define MAX_SERVICE_DESC_LEN 256
+#define MAX_DEPENDENCIES 16
+#define SERVICE_START_WORKERS 8
+
+// Service states
+typedef enum {
+    SERVICE_STATE_INACTIVE,
+    SERVICE_STATE_STARTING,
+    SERVICE_STATE_ACTIVE,
+    SERVICE_STATE_STOPPING,
+    SERVICE_STATE_FAILED
+} ServiceState;
+
+// Service type
+typedef enum {
+    SERVICE_TYPE_SYSTEM,    // Core system service
+    SERVICE_TYPE_NETWORK,   // Network-related service
+    SERVICE_TYPE_USER       // User-space service
+} ServiceType;
+
+// Service dependency
+typedef struct {
+    char name[MAX_SERVICE_NAME_LEN];
+    bool required;  // If true, service won't start without this dependency
+} ServiceDependency;
+
+// Service definition
+typedef struct {
+    char name[MAX_SERVICE_NAME_LEN];
+    char description[MAX_SERVICE_DESC_LEN];
+    ServiceType type;
+    ServiceState state;
+    int priority;  // Lower number = higher priority
+    bool enabled;  // If service should start automatically
+
+    // Dependencies
+    ServiceDependency dependencies[MAX_DEPENDENCIES];
+    int dependency_count;
+
+    // Process information
+    int pid;
+    int exit_code;
+
+    // Service lifecycle handlers
+    bool (*start)(void);
+    bool (*stop)(void);
+    bool (*reload)(void);
+    void (*status)(char* buffer, size_t size);
+} Service;
+
+struct CgroupPressure;  // libs/cgroup.h
+
+// Service manager API (service_manager.c)
+bool service_manager_init(void);
+bool service_register(Service* service);
+bool service_start(const char* name);
+bool service_stop(const char* name);
+bool service_start_enabled(void);
+bool service_stop_all(void);
+void service_start_report(char* buffer, size_t size);
+bool service_pressure(const char* name, struct CgroupPressure* pressure);
+
+#endif // PROMPTOS_SERVICE_MANAGER_H
@@ -0,0 +1,149 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "libs/klog.h"
+#include "service_manager.h"
+
+// Syslog service
+//
+// Drains the system log ring every SYSLOG_INTERVAL_MS, formats the
+// records and appends them to SYSLOG_PATH, one write per batch. Draining
+// never blocks producers; records they could not fit are reported as a
+// count.
+
+#define SYSLOG_PATH "/var/log/messages"
+#define SYSLOG_INTERVAL_MS 100
+#define SYSLOG_BATCH 512               // Records per drain
+#define SYSLOG_BUFFER_SIZE (64 * 1024)
+#define SYSLOG_LINE_MAX 256
+
+typedef struct {
+    char data[SYSLOG_BUFFER_SIZE];
+    size_t used;
+    int fd;
+} LogBuffer;
+
+static Klog system_log;
+static LogBuffer output;
+static pthread_t reader_thread;
+static bool reader_running = false;
+static uint64_t records_written = 0;
+static uint64_t dropped_reported = 0;
+
+static void buffer_flush(LogBuffer* buffer) {
+    size_t done = 0;
+    while (done < buffer->used) {
+        ssize_t written = write(buffer->fd, buffer->data + done, buffer->used - done);
+        if (written <= 0) {
+            break;      // Disk full or gone: the batch is lost, not the reader
+        }
+        done += (size_t)written;
+    }
+    buffer->used = 0;
+}
+
+static void buffer_line(const KlogRecord* record, void* context) {
+    LogBuffer* buffer = context;
+    if (SYSLOG_BUFFER_SIZE - buffer->used < SYSLOG_LINE_MAX) {
+        buffer_flush(buffer);
+    }
+    buffer->used += klog_format(record, buffer->data + buffer->used, SYSLOG_LINE_MAX - 1);
+    buffer->data[buffer->used++] = '\n';
+}
+
+// Drain everything committed so far, in batches
+static void drain_log(void) {
+    size_t drained;
+    do {
+        drained = klog_drain(&system_log, buffer_line, &output, SYSLOG_BATCH);
+        records_written += drained;
+    } while (drained == SYSLOG_BATCH);
+
+    uint64_t dropped = klog_dropped(&system_log);
+    if (dropped != dropped_reported) {
+        char line[SYSLOG_LINE_MAX];
+        int length = snprintf(line, sizeof(line), "syslog: %llu records dropped, ring full\n",
+                              (unsigned long long)(dropped - dropped_reported));
+        if (SYSLOG_BUFFER_SIZE - output.used < sizeof(line)) {
+            buffer_flush(&output);
+        }
+        memcpy(output.data + output.used, line, (size_t)length);
+        output.used += (size_t)length;
+        dropped_reported = dropped;
+    }
+    buffer_flush(&output);
+}
+
+static void* reader_loop(void* arg) {
+    (void)arg;
+    struct timespec interval = { 0, SYSLOG_INTERVAL_MS * 1000000L };
+    while (__atomic_load_n(&reader_running, __ATOMIC_ACQUIRE)) {
+        drain_log();
+        nanosleep(&interval, NULL);
+    }
+    drain_log();
+    return NULL;
+}
+
+// Service lifecycle functions
+static bool syslog_start(void) {
+    // Init creates the log at boot; outside of it the service creates its own
+    if (!klog_open(&system_log, KLOG_SHM_NAME) && !klog_create(&system_log, KLOG_SHM_NAME)) {
+        return false;
+    }
+    output.used = 0;
+    output.fd = open(SYSLOG_PATH, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+    if (output.fd < 0) {
+        klog_close(&system_log);
+        return false;
+    }
+    dropped_reported = klog_dropped(&system_log);
+
+    __atomic_store_n(&reader_running, true, __ATOMIC_RELEASE);
+    if (pthread_create(&reader_thread, NULL, reader_loop, NULL) != 0) {
+        __atomic_store_n(&reader_running, false, __ATOMIC_RELEASE);
+        close(output.fd);
+        klog_close(&system_log);
+        return false;
+    }
+    return true;
+}
+
+static bool syslog_stop(void) {
+    if (!__atomic_exchange_n(&reader_running, false, __ATOMIC_ACQ_REL)) {
+        return true;
+    }
+    pthread_join(reader_thread, NULL);   // Drains once more on the way out
+    close(output.fd);
+    klog_close(&system_log);
+    return true;
+}
+
+static void syslog_status(char* buffer, size_t size) {
+    snprintf(buffer, size, "Syslog: %llu records written to %s, %llu dropped",
+             (unsigned long long)records_written, SYSLOG_PATH,
+             (unsigned long long)klog_dropped(&system_log));
+}
+
+// Initialize syslog service
+bool init_syslog_service(void) {
+    Service syslog = {
+        .name = "syslog",
+        .description = "System log ring reader",
+        .type = SERVICE_TYPE_SYSTEM,
+        .state = SERVICE_STATE_INACTIVE,
+        .priority = 1,
+        .enabled = true,
+        .start = syslog_start,
+        .stop = syslog_stop,
+        .reload = NULL,
+        .status = syslog_status
+    };
+
+    return service_register(&syslog);
+}